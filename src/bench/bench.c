@@ -0,0 +1,589 @@
+/*
+ *  bench.c
+ *  neoaa
+ *
+ *  Headless benchmark for archive, list, unwrap and extract.
+ *  Generates synthetic trees, runs every operation in a forked
+ *  child so peak RSS and I/O counters belong to that operation
+ *  alone, and prints one JSON object per run on stdout. A short
+ *  table goes to stderr for humans.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "archive.h"
+#include "progress.h"
+#include "walk.h"
+
+#define OPTSTR "d:s:c:o:z:t:r:fkh"
+
+#define NEOAA_BENCH_FILL_SIZE (1024 * 1024)
+
+typedef struct {
+    const char *name;
+    char root[PATH_MAX];
+    char archive[PATH_MAX];
+    /* Entries as the walker will see them, and the file bytes in them */
+    uint64_t items;
+    uint64_t bytes;
+    /* Biggest file, the one unwrap pulls out */
+    char largest[PATH_MAX];
+    uint64_t largestSize;
+} NeoAABenchCorpus;
+
+typedef enum {
+    NEOAA_BENCH_ARCHIVE,
+    NEOAA_BENCH_LIST,
+    NEOAA_BENCH_UNWRAP,
+    NEOAA_BENCH_EXTRACT,
+    NEOAA_BENCH_OP_COUNT,
+} NeoAABenchOp;
+
+static const char *benchOpNames[NEOAA_BENCH_OP_COUNT] = {"archive", "list", "unwrap", "extract"};
+
+/* Filled in by the child and sent back over a pipe */
+typedef struct {
+    int result;
+    double seconds;
+    /* Deltas of /proc/self/io, syscr and syscw count read and write like syscalls */
+    uint64_t readSyscalls;
+    uint64_t writeSyscalls;
+    uint64_t readBytes;
+    uint64_t writeBytes;
+} NeoAABenchChild;
+
+typedef struct {
+    const char *workDir;
+    double scale;
+    NeoAAArchiveOptions options;
+    int repeats;
+    int keep;
+} NeoAABenchConfig;
+
+static uint64_t benchSeed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t bench_random(void) {
+    /* xorshift64, plenty for filler data */
+    benchSeed ^= benchSeed << 13;
+    benchSeed ^= benchSeed >> 7;
+    benchSeed ^= benchSeed << 17;
+    return benchSeed;
+}
+
+static uint64_t scaled(const NeoAABenchConfig *config, uint64_t value) {
+    uint64_t result = (uint64_t)(value * config->scale);
+    return result ? result : 1;
+}
+
+/* Compressible text, or noise nothing can shrink */
+static void fill_buffer(uint8_t *buffer, size_t size, int incompressible) {
+    if (incompressible) {
+        for (size_t i = 0; i + 8 <= size; i += 8) {
+            uint64_t value = bench_random();
+            memcpy(buffer + i, &value, 8);
+        }
+        return;
+    }
+    static const char words[] = "archive header blob field path mode owner block chunk table index ";
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = words[(i + (bench_random() & 3)) % (sizeof(words) - 1)];
+    }
+}
+
+static int write_file(NeoAABenchCorpus *corpus, const char *path, uint64_t size, int incompressible) {
+    static uint8_t *fill[2];
+    if (!fill[incompressible]) {
+        fill[incompressible] = (uint8_t *)malloc(NEOAA_BENCH_FILL_SIZE);
+        if (!fill[incompressible]) {
+            return -1;
+        }
+        fill_buffer(fill[incompressible], NEOAA_BENCH_FILL_SIZE, incompressible);
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    uint64_t left = size;
+    while (left) {
+        /* Start each file somewhere else in the buffer so files do not repeat each other */
+        size_t start = bench_random() % (NEOAA_BENCH_FILL_SIZE / 2);
+        size_t chunk = NEOAA_BENCH_FILL_SIZE - start;
+        if (chunk > left) {
+            chunk = left;
+        }
+        ssize_t written = write(fd, fill[incompressible] + start, chunk);
+        if (written <= 0) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        left -= written;
+    }
+    close(fd);
+    corpus->items++;
+    corpus->bytes += size;
+    if (size > corpus->largestSize) {
+        corpus->largestSize = size;
+        /* PAT is relative to the corpus root */
+        snprintf(corpus->largest, sizeof(corpus->largest), "%s", path + strlen(corpus->root) + 1);
+    }
+    return 0;
+}
+
+/* snprintf into a path buffer that fails instead of quietly cutting the path short */
+__attribute__((format(printf, 3, 4)))
+static int bench_path(char *path, size_t size, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(path, size, format, args);
+    va_end(args);
+    if (length < 0 || (size_t)length >= size) {
+        fprintf(stderr, "Path too long: %s...\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int make_dir(NeoAABenchCorpus *corpus, const char *path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    corpus->items++;
+    return 0;
+}
+
+/* Lots of small files spread over a few hundred directories */
+static int generate_tiny(NeoAABenchCorpus *corpus, const NeoAABenchConfig *config) {
+    uint64_t fileCount = scaled(config, 20000);
+    uint64_t dirCount = fileCount / 100 + 1;
+    char path[PATH_MAX];
+    for (uint64_t d = 0; d < dirCount; d++) {
+        if (bench_path(path, sizeof(path), "%s/dir%05llu", corpus->root, (unsigned long long)d) != 0
+            || make_dir(corpus, path) != 0) {
+            return -1;
+        }
+    }
+    for (uint64_t i = 0; i < fileCount; i++) {
+        if (bench_path(path, sizeof(path), "%s/dir%05llu/file%07llu.txt", corpus->root,
+                       (unsigned long long)(i % dirCount), (unsigned long long)i) != 0
+            || write_file(corpus, path, 64 + bench_random() % 4096, 0) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* A handful of files far bigger than any block or memory budget */
+static int generate_huge(NeoAABenchCorpus *corpus, const NeoAABenchConfig *config) {
+    char path[PATH_MAX];
+    for (int i = 0; i < 3; i++) {
+        if (bench_path(path, sizeof(path), "%s/huge%d.bin", corpus->root, i) != 0
+            || write_file(corpus, path, scaled(config, 96ULL * 1024 * 1024), i == 2) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* One long chain of directories with a couple of files on every level */
+static int generate_deep(NeoAABenchCorpus *corpus, const NeoAABenchConfig *config) {
+    uint64_t depth = scaled(config, 150);
+    /* Stay well inside PATH_MAX whatever the scale */
+    if (depth > 600) {
+        depth = 600;
+    }
+    char path[PATH_MAX];
+    char file[PATH_MAX];
+    size_t length = snprintf(path, sizeof(path), "%s", corpus->root);
+    for (uint64_t level = 0; level < depth && length + 16 < sizeof(path); level++) {
+        length += snprintf(path + length, sizeof(path) - length, "/l%03llu", (unsigned long long)(level % 1000));
+        if (make_dir(corpus, path) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (bench_path(file, sizeof(file), "%s/f%d", path, i) != 0
+                || write_file(corpus, file, 512 + bench_random() % 8192, 0) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Mostly symlinks, which are all header and no data */
+static int generate_symlinks(NeoAABenchCorpus *corpus, const NeoAABenchConfig *config) {
+    uint64_t targetCount = scaled(config, 200);
+    uint64_t linkCount = scaled(config, 10000);
+    char path[PATH_MAX];
+    char target[64];
+    if (bench_path(path, sizeof(path), "%s/targets", corpus->root) != 0 || make_dir(corpus, path) != 0) {
+        return -1;
+    }
+    if (bench_path(path, sizeof(path), "%s/links", corpus->root) != 0 || make_dir(corpus, path) != 0) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < targetCount; i++) {
+        if (bench_path(path, sizeof(path), "%s/targets/t%05llu", corpus->root, (unsigned long long)i) != 0
+            || write_file(corpus, path, 1024, 0) != 0) {
+            return -1;
+        }
+    }
+    for (uint64_t i = 0; i < linkCount; i++) {
+        if (bench_path(path, sizeof(path), "%s/links/l%07llu", corpus->root, (unsigned long long)i) != 0) {
+            return -1;
+        }
+        snprintf(target, sizeof(target), "../targets/t%05llu", (unsigned long long)(i % targetCount));
+        if (symlink(target, path) != 0) {
+            perror(path);
+            return -1;
+        }
+        corpus->items++;
+    }
+    return 0;
+}
+
+/* Medium sized files of pure noise, the compressors can only lose time here */
+static int generate_random(NeoAABenchCorpus *corpus, const NeoAABenchConfig *config) {
+    char path[PATH_MAX];
+    for (int i = 0; i < 8; i++) {
+        if (bench_path(path, sizeof(path), "%s/noise%d.bin", corpus->root, i) != 0
+            || write_file(corpus, path, scaled(config, 16ULL * 1024 * 1024), 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    int (*generate)(NeoAABenchCorpus *corpus, const NeoAABenchConfig *config);
+} NeoAABenchGenerator;
+
+static const NeoAABenchGenerator benchGenerators[] = {
+    {"tiny", generate_tiny},
+    {"huge", generate_huge},
+    {"deep", generate_deep},
+    {"symlinks", generate_symlinks},
+    {"random", generate_random},
+};
+
+#define NEOAA_BENCH_CORPUS_COUNT (sizeof(benchGenerators) / sizeof(benchGenerators[0]))
+
+static int remove_entry(const char *path, const struct stat *fileStat, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+static void remove_tree(const char *path) {
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static int read_proc_io(NeoAABenchChild *io) {
+    FILE *file = fopen("/proc/self/io", "r");
+    if (!file) {
+        return -1;
+    }
+    char key[32];
+    unsigned long long value;
+    while (fscanf(file, "%31[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0) {
+            io->readSyscalls = value;
+        } else if (strcmp(key, "syscw") == 0) {
+            io->writeSyscalls = value;
+        } else if (strcmp(key, "rchar") == 0) {
+            io->readBytes = value;
+        } else if (strcmp(key, "wchar") == 0) {
+            io->writeBytes = value;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static int bench_op_run(NeoAABenchOp op, NeoAABenchCorpus *corpus, const NeoAABenchConfig *config) {
+    char path[PATH_MAX];
+    switch (op) {
+        case NEOAA_BENCH_ARCHIVE:
+            return create_aar_from_directory(corpus->root, corpus->archive, &config->options, NULL);
+        case NEOAA_BENCH_LIST:
+            list_neo_aa_files(corpus->archive, NULL);
+            return 0;
+        case NEOAA_BENCH_UNWRAP:
+            if (bench_path(path, sizeof(path), "%s/unwrapped", config->workDir) != 0) {
+                return -1;
+            }
+            unwrap_file_out_of_neo_aa(corpus->archive, path, corpus->largest, NULL);
+            return access(path, F_OK);
+        case NEOAA_BENCH_EXTRACT:
+            if (bench_path(path, sizeof(path), "%s/extracted", config->workDir) != 0 || mkdir(path, 0755) != 0) {
+                return -1;
+            }
+            return extract_aar_to_directory(corpus->archive, path, &config->options, NULL);
+        default:
+            return -1;
+    }
+}
+
+/* The operation runs in a child so its peak RSS is not mixed up with earlier runs */
+static int bench_op(NeoAABenchOp op, NeoAABenchCorpus *corpus, const NeoAABenchConfig *config, int run) {
+    char path[PATH_MAX];
+    /* A cut short path would point the cleanup somewhere else entirely */
+    if (bench_path(path, sizeof(path), "%s/unwrapped", config->workDir) != 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bench_path(path, sizeof(path), "%s/extracted", config->workDir) != 0) {
+        return -1;
+    }
+    remove_tree(path);
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        /* Listing prints every path, keep that out of the results */
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+        NeoAABenchChild before;
+        NeoAABenchChild after;
+        memset(&before, 0, sizeof(before));
+        memset(&after, 0, sizeof(after));
+        read_proc_io(&before);
+        uint64_t start = neoaa_time_ns();
+        after.result = bench_op_run(op, corpus, config);
+        fflush(stdout);
+        after.seconds = (neoaa_time_ns() - start) / 1e9;
+        read_proc_io(&after);
+        after.readSyscalls -= before.readSyscalls;
+        after.writeSyscalls -= before.writeSyscalls;
+        after.readBytes -= before.readBytes;
+        after.writeBytes -= before.writeBytes;
+        ssize_t written = write(fds[1], &after, sizeof(after));
+        _exit(written == sizeof(after) ? 0 : 1);
+    }
+    close(fds[1]);
+    NeoAABenchChild child;
+    memset(&child, 0, sizeof(child));
+    ssize_t got = read(fds[0], &child, sizeof(child));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    if (wait4(pid, &status, 0, &usage) < 0 || got != sizeof(child) || !WIFEXITED(status)) {
+        child.result = -1;
+    }
+
+    /* What the operation moved: file data for archive and extract, the archive for list */
+    uint64_t bytes = corpus->bytes;
+    uint64_t items = corpus->items;
+    struct stat archiveStat;
+    if (op == NEOAA_BENCH_LIST) {
+        bytes = stat(corpus->archive, &archiveStat) == 0 ? archiveStat.st_size : 0;
+    } else if (op == NEOAA_BENCH_UNWRAP) {
+        bytes = corpus->largestSize;
+        items = 1;
+    }
+    double seconds = child.seconds > 0 ? child.seconds : 1e-9;
+    const char *compression = config->options.compression == NEOAA_COMPRESS_LZFSE ? "lzfse"
+        : config->options.compression == NEOAA_COMPRESS_ZLIB ? "zlib" : "none";
+    printf("{\"corpus\":\"%s\",\"op\":\"%s\",\"run\":%d,\"compression\":\"%s\",\"seekable\":%d,\"adaptive\":%d,\"threads\":%d,"
+           "\"result\":%d,\"seconds\":%.6f,\"bytes\":%llu,\"items\":%llu,\"bytesPerSecond\":%.0f,\"itemsPerSecond\":%.1f,"
+           "\"peakRssKb\":%ld,\"userSeconds\":%.6f,\"systemSeconds\":%.6f,\"readSyscalls\":%llu,\"writeSyscalls\":%llu,"
+           "\"readBytes\":%llu,\"writeBytes\":%llu,\"voluntarySwitches\":%ld,\"involuntarySwitches\":%ld,"
+           "\"minorFaults\":%ld,\"majorFaults\":%ld}\n",
+           corpus->name, benchOpNames[op], run, compression, config->options.seekable, config->options.adaptive,
+           config->options.threadCount,
+           child.result, child.seconds, (unsigned long long)bytes, (unsigned long long)items,
+           bytes / seconds, items / seconds, usage.ru_maxrss,
+           usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6, usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+           (unsigned long long)child.readSyscalls, (unsigned long long)child.writeSyscalls,
+           (unsigned long long)child.readBytes, (unsigned long long)child.writeBytes,
+           usage.ru_nvcsw, usage.ru_nivcsw, usage.ru_minflt, usage.ru_majflt);
+    fflush(stdout);
+    char rate[32];
+    neoaa_format_bytes(rate, sizeof(rate), bytes / seconds);
+    fprintf(stderr, "%-9s %-8s %9.3f s %12s/s %11.0f items/s %8ld KB RSS %9llu r/w calls%s\n",
+            corpus->name, benchOpNames[op], child.seconds, rate, items / seconds, usage.ru_maxrss,
+            (unsigned long long)(child.readSyscalls + child.writeSyscalls), child.result == 0 ? "" : "  FAILED");
+    return child.result;
+}
+
+/* Comma separated names, NULL selects everything */
+static int selected(const char *list, const char *name) {
+    if (!list) {
+        return 1;
+    }
+    size_t length = strlen(name);
+    for (const char *cursor = list; *cursor;) {
+        const char *end = strchr(cursor, ',');
+        size_t itemLength = end ? (size_t)(end - cursor) : strlen(cursor);
+        if (itemLength == length && strncmp(cursor, name, length) == 0) {
+            return 1;
+        }
+        if (!end) {
+            break;
+        }
+        cursor = end + 1;
+    }
+    return 0;
+}
+
+static void show_help(void) {
+    fprintf(stderr, "Usage: neoaa-bench [options]\n"
+                    "  -d dir     work directory (default /tmp/neoaa-bench)\n"
+                    "  -s scale   corpus size factor (default 1)\n"
+                    "  -c list    corpora: tiny,huge,deep,symlinks,random\n"
+                    "  -o list    operations: archive,list,unwrap,extract\n"
+                    "  -z comp    lzfse, zlib, none or seekable-lzfse, seekable-zlib (default lzfse)\n"
+                    "  -t n       worker threads (default one per CPU)\n"
+                    "  -r n       runs per operation (default 1)\n"
+                    "  -f         compress every block, no incompressibility sampling\n"
+                    "  -k         keep the corpora and archives\n");
+}
+
+int main(int argc, char **argv) {
+    NeoAABenchConfig config;
+    memset(&config, 0, sizeof(config));
+    config.workDir = "/tmp/neoaa-bench";
+    config.scale = 1.0;
+    config.repeats = 1;
+    neoaa_archive_options_init(&config.options);
+    const char *corpora = NULL;
+    const char *ops = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, OPTSTR)) != -1) {
+        switch (opt) {
+            case 'd':
+                config.workDir = optarg;
+                break;
+            case 's':
+                config.scale = atof(optarg);
+                break;
+            case 'c':
+                corpora = optarg;
+                break;
+            case 'o':
+                ops = optarg;
+                break;
+            case 'z': {
+                const char *name = optarg;
+                if (strncmp(name, "seekable-", 9) == 0) {
+                    config.options.seekable = 1;
+                    name += 9;
+                }
+                if (strcmp(name, "lzfse") == 0) {
+                    config.options.compression = NEOAA_COMPRESS_LZFSE;
+                } else if (strcmp(name, "zlib") == 0) {
+                    config.options.compression = NEOAA_COMPRESS_ZLIB;
+                } else if (strcmp(name, "none") == 0) {
+                    config.options.compression = NEOAA_COMPRESS_RAW;
+                } else {
+                    show_help();
+                    return 1;
+                }
+                break;
+            }
+            case 't':
+                config.options.threadCount = atoi(optarg);
+                break;
+            case 'r':
+                config.repeats = atoi(optarg);
+                break;
+            case 'f':
+                config.options.adaptive = 0;
+                break;
+            case 'k':
+                config.keep = 1;
+                break;
+            default:
+                show_help();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (config.scale <= 0 || config.repeats <= 0) {
+        show_help();
+        return 1;
+    }
+    if (!config.options.threadCount) {
+        config.options.threadCount = neoaa_default_thread_count();
+    }
+    if (mkdir(config.workDir, 0755) != 0 && errno != EEXIST) {
+        perror(config.workDir);
+        return 1;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < NEOAA_BENCH_CORPUS_COUNT; i++) {
+        const NeoAABenchGenerator *generator = &benchGenerators[i];
+        if (!selected(corpora, generator->name)) {
+            continue;
+        }
+        NeoAABenchCorpus corpus;
+        memset(&corpus, 0, sizeof(corpus));
+        corpus.name = generator->name;
+        if (bench_path(corpus.root, sizeof(corpus.root), "%s/%s", config.workDir, generator->name) != 0
+            || bench_path(corpus.archive, sizeof(corpus.archive), "%s/%s.%s", config.workDir, generator->name,
+                          config.options.compression == NEOAA_COMPRESS_RAW ? "aar" : "yaa") != 0) {
+            failures++;
+            continue;
+        }
+        remove_tree(corpus.root);
+        fprintf(stderr, "generating %s...\n", generator->name);
+        if (mkdir(corpus.root, 0755) != 0 || generator->generate(&corpus, &config) != 0) {
+            fprintf(stderr, "Failed to generate %s\n", generator->name);
+            failures++;
+            continue;
+        }
+        for (int op = 0; op < NEOAA_BENCH_OP_COUNT; op++) {
+            /* Everything else needs the archive, so it is always made */
+            if (op != NEOAA_BENCH_ARCHIVE && !selected(ops, benchOpNames[op])) {
+                continue;
+            }
+            int runs = selected(ops, benchOpNames[op]) ? config.repeats : 1;
+            for (int run = 0; run < runs; run++) {
+                if (bench_op((NeoAABenchOp)op, &corpus, &config, run) != 0) {
+                    failures++;
+                }
+            }
+        }
+        if (!config.keep) {
+            remove_tree(corpus.root);
+            unlink(corpus.archive);
+        }
+    }
+    char path[PATH_MAX];
+    if (bench_path(path, sizeof(path), "%s/unwrapped", config.workDir) == 0) {
+        unlink(path);
+    }
+    if (bench_path(path, sizeof(path), "%s/extracted", config.workDir) == 0) {
+        remove_tree(path);
+    }
+    return failures ? 1 : 0;
+}
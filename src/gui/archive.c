@@ -0,0 +1,852 @@
+/*
+ *  archive.c
+ *  neoaa
+ *
+ *  Archive operations shared by the GUI and worker threads.
+ *  Nothing in here may touch FLTK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "archive.h"
+#include "walk.h"
+#include "writer.h"
+#include "fileio.h"
+#include "scan.h"
+#include "reader.h"
+#include "patindex.h"
+#include "extract.h"
+#include "cache.h"
+#include "dedup.h"
+#include "arena.h"
+#include "stats.h"
+#include "checksum.h"
+#include "template.h"
+
+#if !(defined(_WIN32) || defined(WIN32))
+#include <sys/types.h>
+#endif
+
+/* Wrap and add headers, room for any file name a filesystem allows */
+#define NEOAA_SINGLE_HEADER_MAX 1024
+
+/*
+ * The item PAT strings, for formats the index reader does not
+ * handle. Decodes the whole archive through libNeoAppleArchive.
+ */
+static int list_neo_aa_files_generic(const char *inputPath, NeoAAProgress *progress) {
+    NeoAAStats *stats = neoaa_progress_stats(progress);
+    uint64_t start = neoaa_stats_start(stats);
+    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
+    if (!genericArchive) {
+        fprintf(stderr,"Not enough free memory to list files\n");
+        return -1;
+    }
+    NeoAAArchivePlain archive = genericArchive->raw;
+    neoaa_stats_phase(stats, NEOAA_PHASE_SCAN, start, 0, archive->itemCount);
+    neoaa_progress_set_total(progress, 0, archive->itemCount);
+    for (int i = 0; i < archive->itemCount; i++) {
+        /*
+         * We loop through all items to find the PAT field key.
+         * The PAT field key will be what path the item is in the
+         * archive. This also includes symlinks.
+         */
+        NeoAAArchiveItem item = archive->items[i];
+        NeoAAHeader header = item->header;
+        int index = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
+        if (index == -1) {
+            continue;
+        }
+        /* If index is not -1, then header has PAT field key */
+        char *patStr = neo_aa_header_get_field_key_string(header, index);
+        if (!patStr) {
+            printf("Could not get PAT entry in header\n");
+            continue;
+        }
+        printf("%s\n",patStr);
+        free(patStr);
+        neoaa_progress_add(progress, 0, 1);
+    }
+    return 0;
+}
+
+/* Paths as their headers go by, for archives that can only be read once */
+static int list_neo_aa_stream(NeoAAReader reader, NeoAAProgress *progress) {
+    NeoAAStats *stats = neoaa_progress_stats(progress);
+    reader->stats = stats;
+    uint8_t *header = (uint8_t *)malloc(NEOAA_MAX_HEADER_SIZE);
+    if (!header) {
+        fprintf(stderr,"Not enough free memory to list files\n");
+        return -1;
+    }
+    NeoAAScanEntry entry;
+    int status;
+    uint64_t start = neoaa_stats_start(stats);
+    while ((status = neoaa_scan_next(reader, header, &entry)) > 0) {
+        neoaa_stats_phase(stats, NEOAA_PHASE_SCAN, start, entry.headerSize, 1);
+        if (entry.path) {
+            printf("%s\n", entry.path);
+        }
+        uint64_t blobsSize = entry.blobsSize;
+        neoaa_scan_entry_clear(&entry);
+        if (neoaa_progress_cancelled(progress) || (blobsSize && neoaa_reader_skip(reader, blobsSize) != 0)) {
+            break;
+        }
+        neoaa_progress_add(progress, 0, 1);
+        start = neoaa_stats_start(stats);
+    }
+    free(header);
+    if (status < 0) {
+        fprintf(stderr,"Malformed archive stream\n");
+        return -1;
+    }
+    return neoaa_progress_cancelled(progress) ? NEOAA_ERR_CANCELLED : 0;
+}
+
+int list_neo_aa_files(const char *inputPath, NeoAAProgress *progress) {
+    if (strcmp(inputPath, NEOAA_STDIN_PATH) == 0) {
+        NeoAAReader reader = neoaa_reader_open_fd(STDIN_FILENO);
+        if (!reader) {
+            fprintf(stderr,"Failed to read archive from standard input\n");
+            return -1;
+        }
+        int result = list_neo_aa_stream(reader, progress);
+        neoaa_reader_close(reader);
+        return result;
+    }
+    NeoAAStats *stats = neoaa_progress_stats(progress);
+    uint64_t start = neoaa_stats_start(stats);
+    NeoAAIndex index = neoaa_index_open(inputPath, NEOAA_INDEX_SIDECAR_READ);
+    if (!index) {
+        return list_neo_aa_files_generic(inputPath, progress);
+    }
+    neoaa_stats_phase(stats, NEOAA_PHASE_SCAN, start, 0, index->count);
+    neoaa_progress_set_total(progress, 0, index->count);
+    start = neoaa_stats_start(stats);
+    for (size_t i = 0; i < index->count; i++) {
+        printf("%s\n", neoaa_index_path(index, &index->entries[i]));
+    }
+    neoaa_stats_phase(stats, NEOAA_PHASE_WRITE, start, 0, index->count);
+    neoaa_progress_add(progress, 0, index->count);
+    neoaa_index_destroy(index);
+    return 0;
+}
+
+int index_neo_aa_file(const char *inputPath) {
+    NeoAAIndex index = neoaa_index_build(inputPath);
+    if (!index) {
+        fprintf(stderr,"Failed to index %s\n", inputPath);
+        return -1;
+    }
+    int result = neoaa_index_save(index, inputPath);
+    if (result != 0) {
+        fprintf(stderr,"Failed to write index for %s\n", inputPath);
+    }
+    neoaa_index_destroy(index);
+    return result;
+}
+
+/* Header for a lone file entry as used by wrap and add, 0 if the name is too long */
+static size_t create_single_file_header(const char *path, uint64_t size, uint8_t *header, size_t headerMax) {
+    NeoAATemplateValues values;
+    memset(&values, 0, sizeof(values));
+    values.path = basename((char *)path);
+    values.pathLength = strlen(values.path);
+    values.size = size;
+    size_t headerSize = neoaa_template_encode(NEOAA_TEMPLATE_SINGLE_FILE, &values, header, headerMax);
+    if (!headerSize) {
+        fprintf(stderr,"Failed to create header\n");
+    }
+    return headerSize;
+}
+
+/* Byte for byte copy of an archive, the kernel moves the data */
+static int copy_archive(const char *inputPath, const char *outputPath) {
+    int inFd = open(inputPath, O_RDONLY);
+    if (inFd < 0) {
+        return -1;
+    }
+    struct stat fileStat;
+    int outFd = -1;
+    if (fstat(inFd, &fileStat) == 0) {
+        outFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    int result = outFd < 0 ? -1 : neoaa_copy_range(inFd, 0, outFd, fileStat.st_size);
+    if (outFd >= 0 && close(outFd) != 0) {
+        result = -1;
+    }
+    close(inFd);
+    if (result != 0 && outFd >= 0) {
+        unlink(outputPath);
+    }
+    /* The chunk table is tied to the mtime of the input, the copy needs its own to stay seekable */
+    NeoAAReader reader = result == 0 ? neoaa_reader_open_path(inputPath) : NULL;
+    if (reader && reader->chunks && neoaa_chunks_save(outputPath, reader->chunks, reader->chunkCount) != 0) {
+        fprintf(stderr, "Failed to copy the chunk table of %s\n", inputPath);
+    }
+    neoaa_reader_close(reader);
+    return result;
+}
+
+/*
+ * Appends one file entry to the end of the archive, existing
+ * items are never decoded or rewritten. A different outputPath
+ * gets a copy of the input first, made in kernel (or reflinked)
+ * where the filesystem allows, and the entry goes on the copy.
+ */
+int add_file_in_neo_aa(const char *inputPath, const char *outputPath, const char *addPath,
+                       const NeoAAArchiveOptions *options, NeoAAProgress *progress) {
+    NeoAAArchiveOptions defaults;
+    if (!options) {
+        neoaa_archive_options_init(&defaults);
+        options = &defaults;
+    }
+    if (!outputPath) {
+        outputPath = inputPath;
+    }
+    int addFd = open(addPath, O_RDONLY);
+    if (addFd < 0) {
+        fprintf(stderr,"Failed to open input path\n");
+        return -1;
+    }
+    struct stat fileStat;
+    if (fstat(addFd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode)) {
+        close(addFd);
+        fprintf(stderr,"Can only add regular files\n");
+        return -1;
+    }
+    neoaa_progress_set_total(progress, fileStat.st_size, 1);
+    uint8_t header[NEOAA_SINGLE_HEADER_MAX];
+    size_t headerSize = create_single_file_header(addPath, fileStat.st_size, header, sizeof(header));
+    if (!headerSize) {
+        close(addFd);
+        return -1;
+    }
+    /* A copy made here is ours to remove again if the add does not go through */
+    int fresh = strcmp(inputPath, outputPath) != 0;
+    if (fresh && copy_archive(inputPath, outputPath) != 0) {
+        close(addFd);
+        fprintf(stderr,"Failed to copy %s to %s\n", inputPath, outputPath);
+        return -1;
+    }
+    NeoAAWriter writer = neoaa_writer_open_append(outputPath, options->threadCount);
+    if (!writer) {
+        close(addFd);
+        if (fresh) {
+            unlink(outputPath);
+        }
+        return -1;
+    }
+    neoaa_writer_set_stats(writer, neoaa_progress_stats(progress));
+    neoaa_writer_set_adaptive(writer, options->adaptive);
+    int result = neoaa_writer_write_file(writer, header, headerSize, addFd, fileStat.st_size, options->checksums, progress);
+    close(addFd);
+    /* A file that shrank while we copied it is still added, padded, and the caller hears about it */
+    int incomplete = result == NEOAA_ERR_INCOMPLETE;
+    if (incomplete) {
+        result = 0;
+    }
+    if (result != 0 || neoaa_progress_cancelled(progress)) {
+        /* Abort only puts the old tail back, the copy itself would stay */
+        neoaa_writer_abort(writer);
+        if (fresh) {
+            unlink(outputPath);
+        }
+        if (result != 0 && result != NEOAA_ERR_CANCELLED) {
+            fprintf(stderr,"Failed to add %s to %s\n", addPath, outputPath);
+            return -1;
+        }
+        return NEOAA_ERR_CANCELLED;
+    }
+    if (neoaa_writer_close(writer) != 0) {
+        fprintf(stderr,"Failed to write %s\n", outputPath);
+        if (fresh) {
+            unlink(outputPath);
+        }
+        return -1;
+    }
+    neoaa_progress_add(progress, 0, 1);
+    return incomplete ? NEOAA_ERR_INCOMPLETE : 0;
+}
+
+/*
+ * A wrap is just one header followed by the file. Raw output lets
+ * the kernel move the data instead of pulling it through us, the
+ * compressed variants stream it through the parallel compressor
+ * so neither needs the whole file in memory. Checksums are taken
+ * on the same pass and patched into the header afterwards.
+ */
+int wrap_file_in_neo_aa(const char *inputPath, const char *outputPath,
+                        const NeoAAArchiveOptions *options, NeoAAProgress *progress) {
+    NeoAAArchiveOptions defaults;
+    if (!options) {
+        neoaa_archive_options_init(&defaults);
+        options = &defaults;
+    }
+    int inFd = open(inputPath, O_RDONLY);
+    if (inFd < 0) {
+        fprintf(stderr,"Failed to open input path\n");
+        return -1;
+    }
+    struct stat fileStat;
+    if (fstat(inFd, &fileStat) < 0) {
+        close(inFd);
+        fprintf(stderr,"Failed to stat input path\n");
+        return -1;
+    }
+    neoaa_progress_set_total(progress, fileStat.st_size, 1);
+    uint8_t header[NEOAA_SINGLE_HEADER_MAX];
+    size_t headerSize = create_single_file_header(inputPath, fileStat.st_size, header, sizeof(header));
+    if (!headerSize) {
+        close(inFd);
+        return -1;
+    }
+    NeoAAWriter writer = neoaa_writer_open_compressed(outputPath, options->compression, options->threadCount, options->seekable);
+    if (!writer) {
+        close(inFd);
+        return -1;
+    }
+    neoaa_writer_set_stats(writer, neoaa_progress_stats(progress));
+    neoaa_writer_set_adaptive(writer, options->adaptive);
+    int result = neoaa_writer_write_file(writer, header, headerSize, inFd, fileStat.st_size, options->checksums, progress);
+    close(inFd);
+    int incomplete = result == NEOAA_ERR_INCOMPLETE;
+    if (incomplete) {
+        result = 0;
+    }
+    if (result != 0 || neoaa_progress_cancelled(progress)) {
+        neoaa_writer_abort(writer);
+        return result != 0 && result != NEOAA_ERR_CANCELLED ? -1 : NEOAA_ERR_CANCELLED;
+    }
+    if (neoaa_writer_close(writer) != 0) {
+        fprintf(stderr,"Failed to write %s\n", outputPath);
+        unlink(outputPath);
+        return -1;
+    }
+    neoaa_progress_add(progress, 0, 1);
+    return incomplete ? NEOAA_ERR_INCOMPLETE : 0;
+}
+
+/* What unwrap says when the data it copied out is not what the header promised */
+static int unwrap_check(const NeoAAScanEntry *entry, const NeoAADigest *digest) {
+    if (neoaa_digest_compare(&entry->digest, entry->digestFields, digest) != 0) {
+        fprintf(stderr, "Checksum mismatch, %s is damaged in the archive\n", entry->path ? entry->path : "file");
+        return NEOAA_ERR_CHECKSUM;
+    }
+    return 0;
+}
+
+/*
+ * Stream one DAT blob out of a compressed archive, only the blocks
+ * holding it are decoded. The header is read first for its
+ * checksums, the data is hashed on its way out.
+ */
+static int unwrap_compressed_range(const char *inputPath, uint64_t headerOffset, uint64_t offset, uint64_t size, int outFd,
+                                   NeoAAProgress *progress) {
+    NeoAAStats *stats = neoaa_progress_stats(progress);
+    NeoAAReader reader = neoaa_reader_open_path(inputPath);
+    if (!reader) {
+        return -1;
+    }
+    reader->stats = stats;
+    /* Seekable archives jump straight to the chunk and decode the rest of the file in parallel */
+    int result = neoaa_reader_seek(reader, headerOffset);
+    if (result == 0) {
+        result = neoaa_reader_set_threads(reader, neoaa_default_thread_count());
+    }
+    uint8_t *buffer = (uint8_t *)malloc(NEOAA_READER_BUFFER_SIZE > NEOAA_MAX_HEADER_SIZE ? NEOAA_READER_BUFFER_SIZE : NEOAA_MAX_HEADER_SIZE);
+    NeoAAScanEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    if (!buffer) {
+        result = -1;
+    } else if (result == 0 && (neoaa_scan_next(reader, buffer, &entry) <= 0 || reader->offset > offset
+                               || neoaa_reader_skip(reader, offset - reader->offset) != 0)) {
+        result = -1;
+    }
+    NeoAAChecksum sum;
+    neoaa_checksum_init(&sum);
+    while (result == 0 && size) {
+        size_t chunk = size < NEOAA_READER_BUFFER_SIZE ? size : NEOAA_READER_BUFFER_SIZE;
+        if (neoaa_reader_read(reader, buffer, chunk) != (ssize_t)chunk) {
+            result = -1;
+            break;
+        }
+        const uint8_t *data = buffer;
+        size_t left = chunk;
+        uint64_t start = neoaa_stats_start(stats);
+        while (left) {
+            ssize_t written = write(outFd, data, left);
+            if (written <= 0) {
+                result = -1;
+                break;
+            }
+            data += written;
+            left -= written;
+        }
+        neoaa_stats_phase(stats, NEOAA_PHASE_WRITE, start, chunk, 0);
+        if (entry.digestFields) {
+            start = neoaa_stats_start(stats);
+            neoaa_checksum_update(&sum, buffer, chunk);
+            neoaa_stats_phase(stats, NEOAA_PHASE_CHECKSUM, start, chunk, 0);
+        }
+        size -= chunk;
+        neoaa_progress_add(progress, chunk, 0);
+        if (result == 0 && neoaa_progress_cancelled(progress)) {
+            result = NEOAA_ERR_CANCELLED;
+        }
+    }
+    if (result == 0 && entry.digestFields) {
+        NeoAADigest digest;
+        neoaa_checksum_final(&sum, &digest);
+        result = unwrap_check(&entry, &digest);
+    }
+    neoaa_scan_entry_clear(&entry);
+    free(buffer);
+    neoaa_reader_close(reader);
+    return result;
+}
+
+/* Plain archives are copied in kernel, the checksums then read the range back while it is still cached */
+static int unwrap_plain_range(const char *inputPath, uint64_t headerOffset, uint64_t offset, uint64_t size, int outFd,
+                              NeoAAProgress *progress) {
+    NeoAAStats *stats = neoaa_progress_stats(progress);
+    int inFd = open(inputPath, O_RDONLY);
+    if (inFd < 0) {
+        return -1;
+    }
+    int result = 0;
+    for (uint64_t copied = 0; copied < size && result == 0;) {
+        uint64_t window = size - copied < NEOAA_COPY_WINDOW ? size - copied : NEOAA_COPY_WINDOW;
+        uint64_t start = neoaa_stats_start(stats);
+        result = neoaa_copy_range_sparse(inFd, inFd, offset + copied, outFd, window);
+        neoaa_stats_phase(stats, NEOAA_PHASE_WRITE, start, window, 0);
+        copied += window;
+        neoaa_progress_add(progress, window, 0);
+        if (result == 0 && neoaa_progress_cancelled(progress)) {
+            result = NEOAA_ERR_CANCELLED;
+        }
+    }
+    NeoAAScanEntry entry;
+    if (result == 0 && neoaa_scan_read(inFd, headerOffset, &entry) > 0) {
+        if (entry.digestFields) {
+            NeoAADigest digest;
+            uint64_t start = neoaa_stats_start(stats);
+            result = neoaa_checksum_fd(inFd, offset, size, &digest);
+            neoaa_stats_phase(stats, NEOAA_PHASE_CHECKSUM, start, size, 1);
+            if (result == 0) {
+                result = unwrap_check(&entry, &digest);
+            }
+        }
+        neoaa_scan_entry_clear(&entry);
+    }
+    close(inFd);
+    return result;
+}
+
+/* Old full decode path, kept for formats the index reader does not handle */
+static int unwrap_file_generic(const char *inputPath, const char *outputPath, const char *pathString) {
+    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
+    if (!genericArchive) {
+        fprintf(stderr,"Not enough free memory to list files\n");
+        return -1;
+    }
+    NeoAAArchivePlain archive = genericArchive->raw;
+    for (int i = 0; i < archive->itemCount; i++) {
+        /*
+         * We loop through all items to find the PAT field key.
+         * The PAT field key will be what path the item is in the
+         * archive. This also includes symlinks.
+         */
+        NeoAAArchiveItem item = archive->items[i];
+        NeoAAHeader header = item->header;
+        int index = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
+        if (index == -1) {
+            continue;
+        }
+        /* If index is not -1, then header has PAT field key */
+        char *patStr = neo_aa_header_get_field_key_string(header, index);
+        if (!patStr) {
+            printf("Could not get PAT entry in header\n");
+            continue;
+        }
+        if (strcmp(pathString,patStr) == 0) {
+            free(patStr);
+            /* Unwrap file */
+            FILE *fp = fopen(outputPath, "w");
+            if (!fp) {
+                fprintf(stderr,"Failed to open outputPath.\n");
+                return -1;
+            }
+            fwrite(item->encodedBlobData, item->encodedBlobDataSize, 1, fp);
+            fclose(fp);
+            return 0;
+        }
+        free(patStr);
+    }
+    printf("Could not find file at the specified path in the project.\n");
+    return -1;
+}
+
+/*
+ * The index gives the DAT offset straight away. Plain archives
+ * are copied out in kernel, compressed ones skip every block
+ * before the file without decoding it.
+ */
+int unwrap_file_out_of_neo_aa(const char *inputPath, const char *outputPath, char *pathString, NeoAAProgress *progress) {
+    NeoAAStats *stats = neoaa_progress_stats(progress);
+    uint64_t start = neoaa_stats_start(stats);
+    NeoAAIndex index = neoaa_index_open(inputPath, NEOAA_INDEX_SIDECAR_READ);
+    if (!index) {
+        int result = unwrap_file_generic(inputPath, outputPath, pathString);
+        neoaa_stats_phase(stats, NEOAA_PHASE_SCAN, start, 0, 1);
+        return result;
+    }
+    neoaa_stats_phase(stats, NEOAA_PHASE_SCAN, start, 0, index->count);
+    const NeoAAIndexEntry *entry = neoaa_index_find(index, pathString);
+    if (!entry) {
+        neoaa_index_destroy(index);
+        printf("Could not find file at the specified path in the project.\n");
+        return -1;
+    }
+    if (entry->type != 'F') {
+        neoaa_index_destroy(index);
+        fprintf(stderr,"%s is not a regular file in the archive.\n", pathString);
+        return -1;
+    }
+    uint64_t headerOffset = entry->headerOffset;
+    uint64_t datOffset = entry->datOffset;
+    uint64_t datSize = entry->datSize;
+    int compressed = index->compressed;
+    neoaa_index_destroy(index);
+
+    int outFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0) {
+        fprintf(stderr,"Failed to open outputPath.\n");
+        return -1;
+    }
+    neoaa_progress_set_total(progress, datSize, 1);
+    start = neoaa_stats_start(stats);
+    int result;
+    if (compressed) {
+        result = unwrap_compressed_range(inputPath, headerOffset, datOffset, datSize, outFd, progress);
+    } else {
+        result = unwrap_plain_range(inputPath, headerOffset, datOffset, datSize, outFd, progress);
+    }
+    close(outFd);
+    neoaa_stats_file(stats, pathString, datSize, neoaa_stats_start(stats) - start);
+    /* A checksum mismatch is already reported, the copy is left for whoever wants to look at it */
+    if (result == NEOAA_ERR_CANCELLED) {
+        unlink(outputPath);
+    } else if (result != 0 && result != NEOAA_ERR_CHECKSUM) {
+        fprintf(stderr,"Failed to copy file out of archive.\n");
+    } else if (result == 0) {
+        neoaa_progress_add(progress, 0, 1);
+    }
+    return result;
+}
+
+void neoaa_archive_options_init(NeoAAArchiveOptions *options) {
+    memset(options, 0, sizeof(NeoAAArchiveOptions));
+    options->memoryLimit = NEOAA_DEFAULT_MEMORY_LIMIT;
+    options->compression = NEOAA_COMPRESS_RAW;
+    options->checksums = 1;
+    options->adaptive = 1;
+}
+
+/*
+ * The new archive is written next to the old one and renamed
+ * over it at the end, unchanged entries are copied out of the
+ * old one while it is still there.
+ */
+static int create_aar_incremental(const char *dirPath, const char *outputPath, const NeoAAArchiveOptions *options,
+                                  NeoAAArena arena, NeoAAWalkEntry *entries, size_t entryCount, NeoAAProgress *progress) {
+    size_t pathLength = strlen(outputPath);
+    char *tempPath = (char *)neoaa_arena_alloc(arena, pathLength + 8);
+    uint64_t *entryOffsets = (uint64_t *)neoaa_arena_alloc(arena, entryCount * 2 * sizeof(uint64_t));
+    int tempFd = -1;
+    if (tempPath) {
+        snprintf(tempPath, pathLength + 8, "%s.XXXXXX", outputPath);
+        tempFd = mkstemp(tempPath);
+    }
+    if (tempFd < 0 || !entryOffsets) {
+        fprintf(stderr, "Failed to open output %s\n", outputPath);
+        return -2;
+    }
+    fchmod(tempFd, 0644);
+    close(tempFd);
+    /* No usable cache just means everything is new this time */
+    NeoAACache previous = neoaa_cache_open(outputPath);
+    NeoAAWriter writer = neoaa_writer_open_compressed(tempPath, options->compression, options->threadCount, options->seekable);
+    int result = -2;
+    int incomplete = 0;
+    if (writer) {
+        neoaa_writer_set_cache(writer, previous, entryOffsets, entryOffsets + entryCount);
+        neoaa_writer_set_checksums(writer, options->checksums);
+        neoaa_writer_set_adaptive(writer, options->adaptive);
+        result = neoaa_writer_write_entries(writer, dirPath, entries, entryCount, options->threadCount, options->memoryLimit, progress);
+        /* Files that could not be read are left out, the rest still replaces the old archive */
+        incomplete = result == NEOAA_ERR_INCOMPLETE;
+        if (incomplete) {
+            result = 0;
+        }
+        if (result != 0) {
+            neoaa_writer_abort(writer);
+        } else if (neoaa_writer_close(writer) != 0) {
+            result = -2;
+        }
+    } else {
+        fprintf(stderr, "Failed to open output %s\n", outputPath);
+    }
+    /* Queued block copies read from the old archive, so it is only let go once the writer is done */
+    neoaa_cache_close(previous);
+    if (result == 0 && rename(tempPath, outputPath) != 0) {
+        perror("Failed to replace archive");
+        result = -2;
+    }
+    /* Renaming keeps the mtime, so the chunk table of the new archive just moves along */
+    char *tempChunks = neoaa_chunks_path(tempPath);
+    char *outputChunks = neoaa_chunks_path(outputPath);
+    if (tempChunks && outputChunks && (result != 0 || rename(tempChunks, outputChunks) != 0)) {
+        unlink(tempChunks);
+        if (result == 0) {
+            unlink(outputChunks);
+        }
+    }
+    free(tempChunks);
+    free(outputChunks);
+    if (result == 0 && neoaa_cache_save(outputPath, entries, entryCount, entryOffsets, entryOffsets + entryCount) != 0) {
+        fprintf(stderr, "Failed to write cache for %s\n", outputPath);
+    }
+    if (result != 0) {
+        unlink(tempPath);
+    }
+    return result == 0 && incomplete ? NEOAA_ERR_INCOMPLETE : result;
+}
+
+/* Everything the job allocates for its entries comes from arena */
+static int create_aar_in_arena(const char *dirPath, const char *outputPath, const NeoAAArchiveOptions *options,
+                               NeoAAArena arena, NeoAAProgress *progress) {
+    NeoAAWalkEntry *entries = NULL;
+    size_t entryCount = 0;
+    int result = neoaa_walk_directory(dirPath, options->threadCount, arena, &entries, &entryCount, progress);
+    if (result != 0) {
+        return result;
+    }
+    if (!entryCount) {
+        fprintf(stderr, "No items found to archive\n");
+        return -3;
+    }
+
+    if (options->dedup) {
+        uint64_t start = neoaa_stats_start(neoaa_progress_stats(progress));
+        result = neoaa_dedup_entries(dirPath, entries, entryCount, options->threadCount, progress, NULL);
+        neoaa_stats_phase(neoaa_progress_stats(progress), NEOAA_PHASE_DEDUP, start, 0, entryCount);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    uint64_t totalBytes = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        totalBytes += entries[i].size;
+    }
+    neoaa_progress_set_total(progress, totalBytes, entryCount);
+
+    if (options->incremental) {
+        return create_aar_incremental(dirPath, outputPath, options, arena, entries, entryCount, progress);
+    }
+    NeoAAWriter writer = neoaa_writer_open_compressed(outputPath, options->compression, options->threadCount, options->seekable);
+    if (!writer) {
+        fprintf(stderr, "Failed to open output %s\n", outputPath);
+        return -2;
+    }
+    neoaa_writer_set_checksums(writer, options->checksums);
+    neoaa_writer_set_adaptive(writer, options->adaptive);
+    result = neoaa_writer_write_entries(writer, dirPath, entries, entryCount, options->threadCount, options->memoryLimit, progress);
+    if (result != 0 && result != NEOAA_ERR_INCOMPLETE) {
+        /* Never leave a truncated archive behind */
+        neoaa_writer_abort(writer);
+        return result;
+    }
+    if (neoaa_writer_close(writer) != 0) {
+        unlink(outputPath);
+        return -2;
+    }
+    return result;
+}
+
+int create_aar_from_directory(const char *dirPath, const char *outputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress) {
+    NeoAAArchiveOptions defaults;
+    if (!options) {
+        neoaa_archive_options_init(&defaults);
+        options = &defaults;
+    }
+    NeoAAArena arena = neoaa_arena_create();
+    if (!arena) {
+        fprintf(stderr, "Failed to allocate archive job\n");
+        return -2;
+    }
+    int result = create_aar_in_arena(dirPath, outputPath, options, arena, progress);
+    /* Entries, paths and offsets of the whole job in one go */
+    neoaa_arena_destroy(arena);
+    return result;
+}
+
+int extract_aar_from_fd(int fd, const char *outputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress) {
+    NeoAAArchiveOptions defaults;
+    if (!options) {
+        neoaa_archive_options_init(&defaults);
+        options = &defaults;
+    }
+    NeoAAReader reader = neoaa_reader_open_fd(fd);
+    if (!reader) {
+        fprintf(stderr,"Failed to read archive stream\n");
+        return -1;
+    }
+    int result = neoaa_extract_stream(reader, NULL, outputPath, options->threadCount, options->memoryLimit,
+                                      options->checksums, progress);
+    neoaa_reader_close(reader);
+    return result;
+}
+
+int extract_aar_to_directory(const char *inputPath, const char *outputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress) {
+    if (strcmp(inputPath, NEOAA_STDIN_PATH) == 0) {
+        return extract_aar_from_fd(STDIN_FILENO, outputPath, options, progress);
+    }
+    NeoAAArchiveOptions defaults;
+    if (!options) {
+        neoaa_archive_options_init(&defaults);
+        options = &defaults;
+    }
+    NeoAAReader reader = neoaa_reader_open_path(inputPath);
+    if (reader) {
+        int result = neoaa_extract_stream(reader, inputPath, outputPath, options->threadCount, options->memoryLimit,
+                                          options->checksums, progress);
+        neoaa_reader_close(reader);
+        return result;
+    }
+    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
+    if (!genericArchive) {
+        fprintf(stderr,"Failed to open archive %s\n", inputPath);
+        return -1;
+    }
+    NeoAAArchivePlain archive = genericArchive->raw;
+    free(genericArchive);
+
+    uint64_t totalBytes = 0;
+    for (int i = 0; i < archive->itemCount; i++) {
+        totalBytes += archive->items[i]->encodedBlobDataSize;
+    }
+    neoaa_progress_set_total(progress, totalBytes, archive->itemCount);
+
+    NeoAACreatedPaths created;
+    memset(&created, 0, sizeof(created));
+    int result = 0;
+    for (int i = 0; i < archive->itemCount; i++) {
+        if (neoaa_progress_cancelled(progress)) {
+            result = NEOAA_ERR_CANCELLED;
+            break;
+        }
+        NeoAAArchiveItem item = archive->items[i];
+        NeoAAHeader header = item->header;
+        int patIndex = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
+        int typIndex = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("TYP"));
+        if (patIndex == -1 || typIndex == -1) {
+            continue;
+        }
+        char *patStr = neo_aa_header_get_field_key_string(header, patIndex);
+        if (!patStr) {
+            continue;
+        }
+        if (!neoaa_archive_path_is_safe(patStr)) {
+            fprintf(stderr, "Skipping unsafe path in archive: %s\n", patStr);
+            free(patStr);
+            continue;
+        }
+        char *fullPath = neoaa_join_path(outputPath, patStr);
+        free(patStr);
+        if (!fullPath) {
+            result = -2;
+            break;
+        }
+
+        int modIndex = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("MOD"));
+        char type = (char)neo_aa_header_get_field_key_uint(header, typIndex);
+        if (type == 'D') {
+            mode_t mode = modIndex == -1 ? 0755 : (mode_t)neo_aa_header_get_field_key_uint(header, modIndex);
+            /* Keep the directory writable by us so its children can still be extracted */
+            if (mkdir(fullPath, mode | S_IRWXU) == 0) {
+                neoaa_created_paths_add(&created, fullPath);
+            } else if (errno != EEXIST) {
+                perror("Failed to create directory");
+            }
+        } else if (type == 'F') {
+            mode_t mode = modIndex == -1 ? 0644 : (mode_t)neo_aa_header_get_field_key_uint(header, modIndex);
+            int fd = open(fullPath, O_WRONLY | O_CREAT | O_TRUNC, mode);
+            if (fd < 0) {
+                perror("Failed to create file");
+                free(fullPath);
+                continue;
+            }
+            neoaa_created_paths_add(&created, fullPath);
+            size_t written = 0;
+            while (written < item->encodedBlobDataSize) {
+                ssize_t w = write(fd, item->encodedBlobData + written, item->encodedBlobDataSize - written);
+                if (w <= 0) {
+                    perror("Failed to write file");
+                    break;
+                }
+                written += w;
+            }
+            close(fd);
+#if !(defined(_WIN32) || defined(WIN32))
+        } else if (type == 'L') {
+            int lnkIndex = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("LNK"));
+            char *lnkStr = lnkIndex == -1 ? NULL : neo_aa_header_get_field_key_string(header, lnkIndex);
+            if (!lnkStr) {
+                free(fullPath);
+                continue;
+            }
+            if (symlink(lnkStr, fullPath) == 0) {
+                neoaa_created_paths_add(&created, fullPath);
+            } else {
+                perror("Failed to create symlink");
+            }
+            free(lnkStr);
+#endif
+        }
+        free(fullPath);
+        neoaa_progress_add(progress, item->encodedBlobDataSize, 1);
+    }
+
+    if (result == NEOAA_ERR_CANCELLED) {
+        neoaa_created_paths_remove(&created);
+    }
+    neoaa_created_paths_free(&created);
+    neo_aa_archive_plain_destroy_nozero(archive);
+    return result;
+}
+
+int verify_neo_aa_file(const char *inputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress) {
+    NeoAAArchiveOptions defaults;
+    if (!options) {
+        neoaa_archive_options_init(&defaults);
+        options = &defaults;
+    }
+    int fromStdin = strcmp(inputPath, NEOAA_STDIN_PATH) == 0;
+    NeoAAReader reader = fromStdin ? neoaa_reader_open_fd(STDIN_FILENO) : neoaa_reader_open_path(inputPath);
+    if (!reader) {
+        fprintf(stderr,"Failed to open archive %s\n", inputPath);
+        return -1;
+    }
+    int result = neoaa_verify_stream(reader, fromStdin ? NULL : inputPath, options->threadCount, options->memoryLimit, progress);
+    neoaa_reader_close(reader);
+    return result;
+}
@@ -0,0 +1,62 @@
+/*
+ *  archive.h
+ *  neoaa
+ */
+
+#ifndef NEOAA_ARCHIVE_H
+#define NEOAA_ARCHIVE_H
+
+#include <libNeoAppleArchive.h>
+#include "progress.h"
+#include "compress.h"
+
+typedef enum {
+    NEOAA_CMD_ARCHIVE,
+    NEOAA_CMD_EXTRACT,
+    NEOAA_CMD_LIST,
+    NEOAA_CMD_ADD,
+    NEOAA_CMD_WRAP,
+    NEOAA_CMD_UNWRAP,
+    NEOAA_CMD_VERSION,
+    NEOAA_CMD_VERIFY,
+} NeoAACommand;
+
+/* Knobs for create, extract, add and wrap, NULL means all defaults */
+typedef struct {
+    int threadCount;     /* 0 picks one per CPU */
+    size_t memoryLimit;  /* file data in flight, 0 picks NEOAA_DEFAULT_MEMORY_LIMIT */
+    NeoAACompression compression;
+    int seekable;        /* compressed only, smaller blocks and a chunk table for random access. The stream
+                            stays a plain pbz* one any decoder reads, the table is saved as <archive>.nchk
+                            (see reader.h) and has to travel with the archive. Without it, or once the
+                            archive is modified by anything else, reads fall back to sequential. */
+    int incremental;     /* create only, reuse unchanged entries of the archive being replaced */
+    int dedup;           /* create only, store hard links and identical files once */
+    int checksums;       /* give files CKS and SH2 fields on create, add and wrap, check them on extract.
+                            Compressed output leaves out files bigger than one block, see neoaa_writer_write_file. */
+    int adaptive;        /* compressed only, store blocks that sample as incompressible raw without compressing them */
+} NeoAAArchiveOptions;
+
+/* Input path that has extract, list and verify read the archive from standard input */
+#define NEOAA_STDIN_PATH "-"
+
+void neoaa_archive_options_init(NeoAAArchiveOptions *options);
+/* progress, here and for unwrap, may be NULL. These three return 0 or a negative error. */
+int list_neo_aa_files(const char *inputPath, NeoAAProgress *progress);
+/* Writes <inputPath>.nidx so later list and unwrap calls skip the scan */
+int index_neo_aa_file(const char *inputPath);
+/* Appends addPath to inputPath in place, or to a copy of it when outputPath differs. NULL options use defaults. */
+int add_file_in_neo_aa(const char *inputPath, const char *outputPath, const char *addPath,
+                       const NeoAAArchiveOptions *options, NeoAAProgress *progress);
+/* Compression, threads, seekable, adaptive and checksums come from options, NULL uses defaults */
+int wrap_file_in_neo_aa(const char *inputPath, const char *outputPath,
+                        const NeoAAArchiveOptions *options, NeoAAProgress *progress);
+int unwrap_file_out_of_neo_aa(const char *inputPath, const char *outputPath, char *pathString, NeoAAProgress *progress);
+int create_aar_from_directory(const char *dirPath, const char *outputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress);
+int extract_aar_to_directory(const char *inputPath, const char *outputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress);
+/* Extract an archive as it is read from fd, which may be a pipe, without staging it anywhere */
+int extract_aar_from_fd(int fd, const char *outputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress);
+/* Check every file against its checksums without writing anything, NEOAA_ERR_CHECKSUM if any differ */
+int verify_neo_aa_file(const char *inputPath, const NeoAAArchiveOptions *options, NeoAAProgress *progress);
+
+#endif /* NEOAA_ARCHIVE_H */
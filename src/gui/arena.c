@@ -0,0 +1,253 @@
+/*
+ *  arena.c
+ *  neoaa
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "arena.h"
+
+#define NEOAA_ARENA_ALIGN 16
+/* Anything bigger than this gets a chunk of its own so the current one is not wasted */
+#define NEOAA_ARENA_LARGE (NEOAA_ARENA_CHUNK_SIZE / 4)
+
+typedef struct neoaa_arena_chunk NeoAAArenaChunk;
+
+struct neoaa_arena_chunk {
+    NeoAAArenaChunk *next;
+    size_t size;
+    /* Keeps the data after the header aligned */
+    uint8_t padding[NEOAA_ARENA_ALIGN - 2 * sizeof(void *) % NEOAA_ARENA_ALIGN];
+};
+
+struct neoaa_arena_impl {
+    NeoAAArenaChunk *chunks; /* the first one is the one being filled */
+    size_t used;
+};
+
+static NeoAAArenaChunk *arena_chunk_create(size_t size) {
+    NeoAAArenaChunk *chunk = (NeoAAArenaChunk *)malloc(sizeof(NeoAAArenaChunk) + size);
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+static uint8_t *arena_chunk_data(NeoAAArenaChunk *chunk) {
+    return (uint8_t *)(chunk + 1);
+}
+
+NeoAAArena neoaa_arena_create(void) {
+    return (NeoAAArena)calloc(1, sizeof(struct neoaa_arena_impl));
+}
+
+void *neoaa_arena_alloc(NeoAAArena arena, size_t size) {
+    size = (size + NEOAA_ARENA_ALIGN - 1) & ~(size_t)(NEOAA_ARENA_ALIGN - 1);
+    if (!size) {
+        size = NEOAA_ARENA_ALIGN;
+    }
+    NeoAAArenaChunk *current = arena->chunks;
+    if (current && current->size - arena->used >= size) {
+        void *data = arena_chunk_data(current) + arena->used;
+        arena->used += size;
+        return data;
+    }
+    if (size > NEOAA_ARENA_LARGE) {
+        NeoAAArenaChunk *chunk = arena_chunk_create(size);
+        if (!chunk) {
+            return NULL;
+        }
+        /* Behind the current chunk, which keeps filling up */
+        if (current) {
+            chunk->next = current->next;
+            current->next = chunk;
+        } else {
+            arena->chunks = chunk;
+            arena->used = size;
+        }
+        return arena_chunk_data(chunk);
+    }
+    NeoAAArenaChunk *chunk = arena_chunk_create(NEOAA_ARENA_CHUNK_SIZE);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = current;
+    arena->chunks = chunk;
+    arena->used = size;
+    return arena_chunk_data(chunk);
+}
+
+char *neoaa_arena_strdup(NeoAAArena arena, const char *string) {
+    size_t length = strlen(string) + 1;
+    char *copy = (char *)neoaa_arena_alloc(arena, length);
+    if (copy) {
+        memcpy(copy, string, length);
+    }
+    return copy;
+}
+
+char *neoaa_arena_join_path(NeoAAArena arena, const char *base, const char *name) {
+    size_t baseLen = strlen(base);
+    size_t nameLen = strlen(name);
+    char *path = (char *)neoaa_arena_alloc(arena, baseLen + nameLen + 2);
+    if (!path) {
+        return NULL;
+    }
+    if (baseLen) {
+        memcpy(path, base, baseLen);
+        path[baseLen] = '/';
+        baseLen++;
+    }
+    memcpy(path + baseLen, name, nameLen + 1);
+    return path;
+}
+
+void neoaa_arena_merge(NeoAAArena arena, NeoAAArena src) {
+    if (!src->chunks) {
+        return;
+    }
+    NeoAAArenaChunk *last = src->chunks;
+    while (last->next) {
+        last = last->next;
+    }
+    /* Spliced in behind our current chunk, their free space is given up */
+    if (arena->chunks) {
+        last->next = arena->chunks->next;
+        arena->chunks->next = src->chunks;
+    } else {
+        arena->chunks = src->chunks;
+        arena->used = src->used;
+    }
+    src->chunks = NULL;
+    src->used = 0;
+}
+
+void neoaa_arena_reset(NeoAAArena arena) {
+    NeoAAArenaChunk *keep = NULL;
+    NeoAAArenaChunk *chunk = arena->chunks;
+    while (chunk) {
+        NeoAAArenaChunk *next = chunk->next;
+        if (!keep && chunk->size == NEOAA_ARENA_CHUNK_SIZE) {
+            keep = chunk;
+            keep->next = NULL;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    arena->chunks = keep;
+    arena->used = 0;
+}
+
+void neoaa_arena_destroy(NeoAAArena arena) {
+    if (!arena) {
+        return;
+    }
+    NeoAAArenaChunk *chunk = arena->chunks;
+    while (chunk) {
+        NeoAAArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+/* Free buffers are chained through their own first bytes */
+typedef struct neoaa_buffer_free NeoAABufferFree;
+
+struct neoaa_buffer_free {
+    NeoAABufferFree *next;
+};
+
+#define NEOAA_BUFFER_CLASSES 15 /* 4 KiB to 64 MiB */
+
+struct neoaa_buffer_pool_impl {
+    pthread_mutex_t lock;
+    NeoAABufferFree *free[NEOAA_BUFFER_CLASSES];
+    size_t retained;
+    size_t retainLimit;
+};
+
+static int buffer_class(size_t size) {
+    int index = 0;
+    size_t classSize = NEOAA_BUFFER_MIN_SIZE;
+    while (classSize < size) {
+        classSize <<= 1;
+        index++;
+    }
+    return index;
+}
+
+NeoAABufferPool neoaa_buffer_pool_create(size_t retainLimit) {
+    NeoAABufferPool pool = (NeoAABufferPool)calloc(1, sizeof(struct neoaa_buffer_pool_impl));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->retainLimit = retainLimit;
+    return pool;
+}
+
+size_t neoaa_buffer_pool_round(size_t size) {
+    if (size > NEOAA_BUFFER_MAX_SIZE) {
+        return size;
+    }
+    return (size_t)NEOAA_BUFFER_MIN_SIZE << buffer_class(size);
+}
+
+void *neoaa_buffer_pool_get(NeoAABufferPool pool, size_t size) {
+    if (size > NEOAA_BUFFER_MAX_SIZE) {
+        return malloc(size);
+    }
+    int index = buffer_class(size);
+    size_t classSize = (size_t)NEOAA_BUFFER_MIN_SIZE << index;
+    pthread_mutex_lock(&pool->lock);
+    NeoAABufferFree *buffer = pool->free[index];
+    if (buffer) {
+        pool->free[index] = buffer->next;
+        pool->retained -= classSize;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return buffer ? (void *)buffer : malloc(classSize);
+}
+
+void neoaa_buffer_pool_put(NeoAABufferPool pool, void *buffer, size_t size) {
+    if (!buffer) {
+        return;
+    }
+    if (size > NEOAA_BUFFER_MAX_SIZE) {
+        free(buffer);
+        return;
+    }
+    int index = buffer_class(size);
+    size_t classSize = (size_t)NEOAA_BUFFER_MIN_SIZE << index;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->retained + classSize <= pool->retainLimit) {
+        NeoAABufferFree *node = (NeoAABufferFree *)buffer;
+        node->next = pool->free[index];
+        pool->free[index] = node;
+        pool->retained += classSize;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(buffer);
+}
+
+void neoaa_buffer_pool_destroy(NeoAABufferPool pool) {
+    if (!pool) {
+        return;
+    }
+    for (int i = 0; i < NEOAA_BUFFER_CLASSES; i++) {
+        NeoAABufferFree *buffer = pool->free[i];
+        while (buffer) {
+            NeoAABufferFree *next = buffer->next;
+            free(buffer);
+            buffer = next;
+        }
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,53 @@
+/*
+ *  arena.h
+ *  neoaa
+ *
+ *  Allocators for the lifetime of one archive job. An arena hands
+ *  out small blocks (walk entries, path strings) by bumping a
+ *  pointer through big chunks and frees them all at once. The
+ *  buffer pool recycles the file data buffers producers and
+ *  extract tasks fill, so a million small files do not mean a
+ *  million malloc and free pairs and fresh pages every time.
+ */
+
+#ifndef NEOAA_ARENA_H
+#define NEOAA_ARENA_H
+
+#include <stddef.h>
+
+/* Size of the chunks an arena carves its allocations out of */
+#define NEOAA_ARENA_CHUNK_SIZE (256 * 1024)
+
+typedef struct neoaa_arena_impl *NeoAAArena;
+
+/* Not thread safe, give every thread its own and merge them afterwards */
+NeoAAArena neoaa_arena_create(void);
+/* 16 byte aligned, NULL when out of memory. Lives until reset or destroy. */
+void *neoaa_arena_alloc(NeoAAArena arena, size_t size);
+char *neoaa_arena_strdup(NeoAAArena arena, const char *string);
+/* base + "/" + name like neoaa_join_path, just name if base is empty */
+char *neoaa_arena_join_path(NeoAAArena arena, const char *base, const char *name);
+/* Hand every allocation of src over to arena, src is left empty */
+void neoaa_arena_merge(NeoAAArena arena, NeoAAArena src);
+/* Frees everything allocated so far, keeps one chunk for reuse */
+void neoaa_arena_reset(NeoAAArena arena);
+void neoaa_arena_destroy(NeoAAArena arena);
+
+/* Buffers are handed out in power of two classes from this size up */
+#define NEOAA_BUFFER_MIN_SIZE 4096
+/* Bigger buffers go straight to malloc and free */
+#define NEOAA_BUFFER_MAX_SIZE (64ULL * 1024 * 1024)
+
+typedef struct neoaa_buffer_pool_impl *NeoAABufferPool;
+
+/* Thread safe. Keeps at most retainLimit bytes of free buffers around. */
+NeoAABufferPool neoaa_buffer_pool_create(size_t retainLimit);
+/* Bytes a buffer for size really takes, what to charge a memory budget */
+size_t neoaa_buffer_pool_round(size_t size);
+/* At least size bytes, NULL when out of memory */
+void *neoaa_buffer_pool_get(NeoAABufferPool pool, size_t size);
+/* size must be what the buffer was got with */
+void neoaa_buffer_pool_put(NeoAABufferPool pool, void *buffer, size_t size);
+void neoaa_buffer_pool_destroy(NeoAABufferPool pool);
+
+#endif /* NEOAA_ARENA_H */
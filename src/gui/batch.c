@@ -0,0 +1,405 @@
+/*
+ *  batch.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "walk.h"
+#include "writer.h"
+
+/* Every job gets at least this much of the memory budget */
+#define NEOAA_BATCH_MIN_MEMORY (16ULL * 1024 * 1024)
+
+typedef struct {
+    NeoAAJob job;
+    /* The disks its input and output live on, one if they share it */
+    dev_t devices[2];
+    int deviceCount;
+    int claimed;
+    int done; /* no worker touches it any more */
+} NeoAABatchEntry;
+
+typedef struct {
+    dev_t device;
+    int running;
+} NeoAABatchDevice;
+
+struct neoaa_batch_impl {
+    NeoAABatchEntry *entries;
+    size_t entryCount;
+    size_t entryMalloc;
+    /* Everything before it has been claimed */
+    size_t firstPending;
+    NeoAABatchDevice *devices;
+    size_t deviceCount;
+    size_t deviceMalloc;
+    int parallel;
+    int perDevice;
+    int threadCount;
+    size_t memoryLimit;
+    int running;
+    int stop;
+    NeoAAJobNotify notify;
+    void *userData;
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;
+    pthread_cond_t idleCond;
+    pthread_t threads[NEOAA_MAX_THREADS];
+    int started;
+};
+
+NeoAABatch neoaa_batch_create(int parallel, int perDevice, int threadCount, size_t memoryLimit) {
+    if (parallel <= 0) {
+        parallel = neoaa_default_thread_count();
+    }
+    if (parallel > NEOAA_MAX_THREADS) {
+        parallel = NEOAA_MAX_THREADS;
+    }
+    NeoAABatch batch = (NeoAABatch)calloc(1, sizeof(struct neoaa_batch_impl));
+    if (!batch) {
+        return NULL;
+    }
+    batch->parallel = parallel;
+    batch->perDevice = perDevice > 0 ? perDevice : 0;
+    batch->threadCount = threadCount > 0 ? threadCount : neoaa_default_thread_count();
+    batch->memoryLimit = memoryLimit ? memoryLimit : NEOAA_DEFAULT_MEMORY_LIMIT;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->workCond, NULL);
+    pthread_cond_init(&batch->idleCond, NULL);
+    return batch;
+}
+
+/* The disk a path is on, or its parent directory when it does not exist yet */
+static int batch_path_device(const char *path, dev_t *device) {
+    if (!path[0] || strcmp(path, NEOAA_STDIN_PATH) == 0) {
+        return -1;
+    }
+    struct stat pathStat;
+    if (stat(path, &pathStat) == 0) {
+        *device = pathStat.st_dev;
+        return 0;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        return -1;
+    }
+    int result = stat(dirname(copy), &pathStat);
+    free(copy);
+    if (result != 0) {
+        return -1;
+    }
+    *device = pathStat.st_dev;
+    return 0;
+}
+
+int neoaa_batch_add(NeoAABatch batch, NeoAAJob job) {
+    NeoAABatchEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.job = job;
+    /* Looked up before taking the lock, stat may block on a slow disk */
+    const char *paths[2] = { job->inputPath, job->outputPath };
+    for (int i = 0; i < 2; i++) {
+        dev_t device;
+        if (batch_path_device(paths[i], &device) == 0 && (!entry.deviceCount || entry.devices[0] != device)) {
+            entry.devices[entry.deviceCount++] = device;
+        }
+    }
+    pthread_mutex_lock(&batch->lock);
+    if (batch->entryCount == batch->entryMalloc) {
+        size_t newMalloc = batch->entryMalloc ? batch->entryMalloc * 2 : 64;
+        NeoAABatchEntry *newEntries = (NeoAABatchEntry *)realloc(batch->entries, sizeof(NeoAABatchEntry) * newMalloc);
+        if (!newEntries) {
+            pthread_mutex_unlock(&batch->lock);
+            return -1;
+        }
+        batch->entries = newEntries;
+        batch->entryMalloc = newMalloc;
+    }
+    batch->entries[batch->entryCount++] = entry;
+    pthread_cond_signal(&batch->workCond);
+    pthread_mutex_unlock(&batch->lock);
+    return 0;
+}
+
+/* NULL when out of memory */
+static NeoAABatchDevice *batch_device(NeoAABatch batch, dev_t device) {
+    for (size_t i = 0; i < batch->deviceCount; i++) {
+        if (batch->devices[i].device == device) {
+            return &batch->devices[i];
+        }
+    }
+    if (batch->deviceCount == batch->deviceMalloc) {
+        size_t newMalloc = batch->deviceMalloc ? batch->deviceMalloc * 2 : 8;
+        NeoAABatchDevice *newDevices = (NeoAABatchDevice *)realloc(batch->devices, sizeof(NeoAABatchDevice) * newMalloc);
+        if (!newDevices) {
+            return NULL;
+        }
+        batch->devices = newDevices;
+        batch->deviceMalloc = newMalloc;
+    }
+    NeoAABatchDevice *entry = &batch->devices[batch->deviceCount++];
+    entry->device = device;
+    entry->running = 0;
+    return entry;
+}
+
+static int batch_device_busy(NeoAABatch batch, const NeoAABatchEntry *entry) {
+    if (!batch->perDevice) {
+        return 0;
+    }
+    for (int i = 0; i < entry->deviceCount; i++) {
+        NeoAABatchDevice *device = batch_device(batch, entry->devices[i]);
+        if (device && device->running >= batch->perDevice) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Called with the lock held, like the two below */
+static int batch_has_pending(NeoAABatch batch) {
+    while (batch->firstPending < batch->entryCount && batch->entries[batch->firstPending].claimed) {
+        batch->firstPending++;
+    }
+    return batch->firstPending < batch->entryCount;
+}
+
+/* The first pending entry whose disks have room, or -1 */
+static long batch_next(NeoAABatch batch) {
+    if (batch->running >= batch->parallel || !batch_has_pending(batch)) {
+        return -1;
+    }
+    for (size_t i = batch->firstPending; i < batch->entryCount; i++) {
+        if (!batch->entries[i].claimed && !batch_device_busy(batch, &batch->entries[i])) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static void batch_device_add(NeoAABatch batch, const dev_t *devices, int deviceCount, int delta) {
+    for (int i = 0; i < deviceCount; i++) {
+        NeoAABatchDevice *device = batch_device(batch, devices[i]);
+        if (device) {
+            device->running += delta;
+        }
+    }
+}
+
+static long batch_find(NeoAABatch batch, NeoAAJob job) {
+    for (size_t i = 0; i < batch->entryCount; i++) {
+        if (batch->entries[i].job == job) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static void *batch_thread(void *context) {
+    NeoAABatch batch = (NeoAABatch)context;
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        long index = -1;
+        while (!batch->stop && (index = batch_next(batch)) < 0) {
+            pthread_cond_wait(&batch->workCond, &batch->lock);
+        }
+        if (batch->stop) {
+            break;
+        }
+        NeoAABatchEntry *entry = &batch->entries[index];
+        entry->claimed = 1;
+        NeoAAJob job = entry->job;
+        dev_t devices[2] = { entry->devices[0], entry->devices[1] };
+        int deviceCount = entry->deviceCount;
+        batch_device_add(batch, devices, deviceCount, 1);
+        batch->running++;
+        /* Every running job gets the same share whether the others are busy or not */
+        int jobThreads = batch->threadCount / batch->parallel;
+        size_t jobMemory = batch->memoryLimit / batch->parallel;
+        pthread_mutex_unlock(&batch->lock);
+
+        job->options.threadCount = jobThreads < 1 ? 1 : jobThreads;
+        job->options.memoryLimit = jobMemory < NEOAA_BATCH_MIN_MEMORY ? NEOAA_BATCH_MIN_MEMORY : jobMemory;
+        neoaa_job_run(job, batch->notify, batch->userData);
+
+        pthread_mutex_lock(&batch->lock);
+        /* Entries may have moved while it ran */
+        index = batch_find(batch, job);
+        if (index >= 0) {
+            batch->entries[index].done = 1;
+        }
+        batch_device_add(batch, devices, deviceCount, -1);
+        batch->running--;
+        /* A disk freed up, whoever waits for it can go */
+        pthread_cond_broadcast(&batch->workCond);
+        pthread_cond_broadcast(&batch->idleCond);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+/* Called with the lock held, starts workers until there is one per parallel job */
+static void batch_spawn(NeoAABatch batch) {
+    while (batch->started < batch->parallel) {
+        if (pthread_create(&batch->threads[batch->started], NULL, batch_thread, batch) != 0) {
+            break;
+        }
+        batch->started++;
+    }
+}
+
+int neoaa_batch_start(NeoAABatch batch, NeoAAJobNotify notify, void *userData) {
+    pthread_mutex_lock(&batch->lock);
+    batch->notify = notify;
+    batch->userData = userData;
+    batch_spawn(batch);
+    int started = batch->started;
+    pthread_mutex_unlock(&batch->lock);
+    if (!started) {
+        fprintf(stderr, "Failed to start batch threads\n");
+        return -1;
+    }
+    return 0;
+}
+
+void neoaa_batch_set_limits(NeoAABatch batch, int parallel, int perDevice) {
+    if (parallel <= 0) {
+        parallel = neoaa_default_thread_count();
+    }
+    if (parallel > NEOAA_MAX_THREADS) {
+        parallel = NEOAA_MAX_THREADS;
+    }
+    pthread_mutex_lock(&batch->lock);
+    batch->parallel = parallel;
+    batch->perDevice = perDevice > 0 ? perDevice : 0;
+    /* Workers beyond the new count just stay idle, jobs already running finish */
+    if (batch->started) {
+        batch_spawn(batch);
+    }
+    pthread_cond_broadcast(&batch->workCond);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+int neoaa_batch_move(NeoAABatch batch, NeoAAJob job, int delta) {
+    pthread_mutex_lock(&batch->lock);
+    long index = batch_find(batch, job);
+    long target = index + delta;
+    int result = -1;
+    if (index >= 0 && target >= 0 && target < (long)batch->entryCount && !batch->entries[index].claimed
+        && !batch->entries[target].claimed) {
+        NeoAABatchEntry entry = batch->entries[index];
+        batch->entries[index] = batch->entries[target];
+        batch->entries[target] = entry;
+        result = 0;
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return result;
+}
+
+void neoaa_batch_cancel(NeoAABatch batch, NeoAAJob job) {
+    pthread_mutex_lock(&batch->lock);
+    long index = batch_find(batch, job);
+    if (index >= 0 && !batch->entries[index].claimed) {
+        /* Never started, it finishes right here and listeners hear it like any other job */
+        batch->entries[index].claimed = 1;
+        job->notify = batch->notify;
+        job->userData = batch->userData;
+        job->result = NEOAA_ERR_CANCELLED;
+        job->finishTime = neoaa_time_ns();
+        __atomic_store_n(&job->state, NEOAA_JOB_CANCELLED, __ATOMIC_RELEASE);
+        /* Counts as running until the listener has heard, so wait does not return under it */
+        batch->running++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (job->notify) {
+            job->notify(job, 1);
+        }
+
+        /* Only done after the notify, so reap can not free it under the listener */
+        pthread_mutex_lock(&batch->lock);
+        index = batch_find(batch, job);
+        if (index >= 0) {
+            batch->entries[index].done = 1;
+        }
+        batch->running--;
+        pthread_cond_broadcast(&batch->workCond);
+        pthread_cond_broadcast(&batch->idleCond);
+    } else if (index >= 0) {
+        neoaa_job_cancel(job);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+size_t neoaa_batch_reap(NeoAABatch batch) {
+    pthread_mutex_lock(&batch->lock);
+    size_t kept = 0;
+    size_t reaped = 0;
+    for (size_t i = 0; i < batch->entryCount; i++) {
+        if (batch->entries[i].done) {
+            /* Nobody looks at a done job any more, not even the worker that ran it */
+            neoaa_job_destroy(batch->entries[i].job);
+            reaped++;
+        } else {
+            batch->entries[kept++] = batch->entries[i];
+        }
+    }
+    batch->entryCount = kept;
+    batch->firstPending = 0;
+    pthread_mutex_unlock(&batch->lock);
+    return reaped;
+}
+
+void neoaa_batch_wait(NeoAABatch batch) {
+    pthread_mutex_lock(&batch->lock);
+    while (batch->started && (batch->running || batch_has_pending(batch))) {
+        pthread_cond_wait(&batch->idleCond, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+size_t neoaa_batch_count(NeoAABatch batch) {
+    pthread_mutex_lock(&batch->lock);
+    size_t count = batch->entryCount;
+    pthread_mutex_unlock(&batch->lock);
+    return count;
+}
+
+NeoAAJob neoaa_batch_job(NeoAABatch batch, size_t index) {
+    pthread_mutex_lock(&batch->lock);
+    NeoAAJob job = index < batch->entryCount ? batch->entries[index].job : NULL;
+    pthread_mutex_unlock(&batch->lock);
+    return job;
+}
+
+void neoaa_batch_destroy(NeoAABatch batch) {
+    if (!batch) {
+        return;
+    }
+    pthread_mutex_lock(&batch->lock);
+    batch->stop = 1;
+    for (size_t i = 0; i < batch->entryCount; i++) {
+        if (batch->entries[i].claimed) {
+            neoaa_job_cancel(batch->entries[i].job);
+        }
+    }
+    pthread_cond_broadcast(&batch->workCond);
+    pthread_mutex_unlock(&batch->lock);
+    for (int i = 0; i < batch->started; i++) {
+        pthread_join(batch->threads[i], NULL);
+    }
+    for (size_t i = 0; i < batch->entryCount; i++) {
+        neoaa_job_destroy(batch->entries[i].job);
+    }
+    free(batch->entries);
+    free(batch->devices);
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->workCond);
+    pthread_cond_destroy(&batch->idleCond);
+    free(batch);
+}
@@ -0,0 +1,55 @@
+/*
+ *  batch.h
+ *  neoaa
+ *
+ *  Runs many jobs in one process on a fixed set of batch workers.
+ *  A free worker takes the first pending job in queue order whose
+ *  disks are not already busy with as many jobs as the per device
+ *  limit allows, so jobs on different disks overlap while those
+ *  sharing one take turns instead of seeking against each other.
+ *  The thread and memory budgets are split evenly between the jobs
+ *  that can run at once.
+ */
+
+#ifndef NEOAA_BATCH_H
+#define NEOAA_BATCH_H
+
+#include <stddef.h>
+#include "job.h"
+
+/* Jobs run at once on the same disk unless told otherwise */
+#define NEOAA_BATCH_DEFAULT_PER_DEVICE 2
+
+typedef struct neoaa_batch_impl *NeoAABatch;
+
+/*
+ * parallel jobs at once, 0 picks one per CPU. perDevice caps the
+ * jobs touching one disk, 0 lifts the cap. threadCount and
+ * memoryLimit are shared by all running jobs, 0 picks the defaults.
+ */
+NeoAABatch neoaa_batch_create(int parallel, int perDevice, int threadCount, size_t memoryLimit);
+/*
+ * Queue a job that has not been started, the batch owns it from
+ * now on. May be called while the batch runs. Non zero if it could
+ * not be queued, the caller still owns it then.
+ */
+int neoaa_batch_add(NeoAABatch batch, NeoAAJob job);
+/* Start the workers. notify is passed to every job as with neoaa_job_start. */
+int neoaa_batch_start(NeoAABatch batch, NeoAAJobNotify notify, void *userData);
+/* Change how many jobs run at once, overall and per disk, at any time */
+void neoaa_batch_set_limits(NeoAABatch batch, int parallel, int perDevice);
+/* Swap a pending job with the one delta places away if that is pending too, non zero if it was not */
+int neoaa_batch_move(NeoAABatch batch, NeoAAJob job, int delta);
+/* A pending job is dropped straight away as cancelled, a running one is asked to stop */
+void neoaa_batch_cancel(NeoAABatch batch, NeoAAJob job);
+/* Destroy and drop every finished job, returns how many. The indexes of the rest change. */
+size_t neoaa_batch_reap(NeoAABatch batch);
+/* Block until every job queued so far is done */
+void neoaa_batch_wait(NeoAABatch batch);
+size_t neoaa_batch_count(NeoAABatch batch);
+/* Jobs in queue order, neoaa_batch_move and neoaa_batch_reap change it */
+NeoAAJob neoaa_batch_job(NeoAABatch batch, size_t index);
+/* Cancels running jobs and waits for them, pending ones never start */
+void neoaa_batch_destroy(NeoAABatch batch);
+
+#endif /* NEOAA_BATCH_H */
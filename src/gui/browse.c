@@ -0,0 +1,364 @@
+/*
+ *  browse.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "browse.h"
+#include "progress.h"
+#include "reader.h"
+#include "scan.h"
+
+static uint64_t hash_name(uint32_t parent, const char *name, size_t length) {
+    /* FNV-1a over the parent index and the name */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 4; i++) {
+        hash ^= (parent >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int node_matches(NeoAABrowse browse, uint32_t index, uint32_t parent, const char *name, size_t length) {
+    const NeoAABrowseNode *node = &browse->nodes[index];
+    const char *nodeName = browse->pool + node->nameOffset;
+    return node->parent == parent && strncmp(nodeName, name, length) == 0 && nodeName[length] == '\0';
+}
+
+static void bucket_insert(NeoAABrowse browse, uint32_t index) {
+    const NeoAABrowseNode *node = &browse->nodes[index];
+    const char *name = browse->pool + node->nameOffset;
+    size_t slot = hash_name(node->parent, name, strlen(name)) & (browse->bucketCount - 1);
+    while (browse->buckets[slot]) {
+        slot = (slot + 1) & (browse->bucketCount - 1);
+    }
+    browse->buckets[slot] = index;
+}
+
+/* Kept at most half full, grown by rehashing every node */
+static int buckets_reserve(NeoAABrowse browse, size_t nodeCount) {
+    if (nodeCount * 2 <= browse->bucketCount) {
+        return 0;
+    }
+    size_t bucketCount = browse->bucketCount ? browse->bucketCount * 2 : 4096;
+    while (nodeCount * 2 > bucketCount) {
+        bucketCount *= 2;
+    }
+    uint32_t *buckets = (uint32_t *)calloc(bucketCount, sizeof(uint32_t));
+    if (!buckets) {
+        return -1;
+    }
+    free(browse->buckets);
+    browse->buckets = buckets;
+    browse->bucketCount = bucketCount;
+    for (size_t i = 1; i < browse->nodeCount; i++) {
+        bucket_insert(browse, (uint32_t)i);
+    }
+    return 0;
+}
+
+static uint32_t node_find(NeoAABrowse browse, uint32_t parent, const char *name, size_t length) {
+    if (!browse->bucketCount) {
+        return 0;
+    }
+    size_t slot = hash_name(parent, name, length) & (browse->bucketCount - 1);
+    while (browse->buckets[slot]) {
+        if (node_matches(browse, browse->buckets[slot], parent, name, length)) {
+            return browse->buckets[slot];
+        }
+        slot = (slot + 1) & (browse->bucketCount - 1);
+    }
+    return 0;
+}
+
+/* Caller holds the lock, the UI may be reading nodes and names */
+static uint32_t node_add(NeoAABrowse browse, uint32_t parent, const char *name, size_t length, char type) {
+    if (browse->nodeCount >= UINT32_MAX || browse->nodes[parent].depth == UINT16_MAX) {
+        return 0;
+    }
+    if (browse->poolSize + length + 1 > browse->poolCapacity) {
+        size_t capacity = browse->poolCapacity * 2;
+        while (capacity < browse->poolSize + length + 1) {
+            capacity *= 2;
+        }
+        char *pool = (char *)realloc(browse->pool, capacity);
+        if (!pool) {
+            return 0;
+        }
+        browse->pool = pool;
+        browse->poolCapacity = capacity;
+    }
+    if (browse->nodeCount == browse->nodeCapacity) {
+        size_t capacity = browse->nodeCapacity * 2;
+        NeoAABrowseNode *nodes = (NeoAABrowseNode *)realloc(browse->nodes, capacity * sizeof(NeoAABrowseNode));
+        if (!nodes) {
+            return 0;
+        }
+        browse->nodes = nodes;
+        browse->nodeCapacity = capacity;
+    }
+    if (buckets_reserve(browse, browse->nodeCount + 1) != 0) {
+        return 0;
+    }
+    uint32_t index = (uint32_t)browse->nodeCount++;
+    NeoAABrowseNode *node = &browse->nodes[index];
+    memset(node, 0, sizeof(NeoAABrowseNode));
+    node->nameOffset = browse->poolSize;
+    node->parent = parent;
+    node->depth = browse->nodes[parent].depth + 1;
+    node->type = type;
+    memcpy(browse->pool + browse->poolSize, name, length);
+    browse->pool[browse->poolSize + length] = '\0';
+    browse->poolSize += length + 1;
+    bucket_insert(browse, index);
+
+    NeoAABrowseNode *parentNode = &browse->nodes[parent];
+    if (parentNode->lastChild) {
+        browse->nodes[parentNode->lastChild].nextSibling = index;
+    } else {
+        parentNode->firstChild = index;
+    }
+    parentNode->lastChild = index;
+    parentNode->childCount++;
+    /* Only rows under an expanded directory change what is on screen */
+    if (parent == 0 || parentNode->expanded) {
+        browse->visibleDirty = 1;
+    }
+    return index;
+}
+
+/*
+ * Directories may show up after their contents or not at all,
+ * missing ones are made up so every entry has a parent row.
+ */
+static int browse_insert(NeoAABrowse browse, const NeoAAScanEntry *entry) {
+    const char *path = entry->path;
+    uint32_t parent = 0;
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+        if (!*path) {
+            return 0;
+        }
+        const char *end = strchr(path, '/');
+        size_t length = end ? (size_t)(end - path) : strlen(path);
+        const char *rest = path + length;
+        while (*rest == '/') {
+            rest++;
+        }
+        int last = *rest == '\0';
+        if (length == 1 && path[0] == '.') {
+            if (last) {
+                return 0;
+            }
+            path = rest;
+            continue;
+        }
+        uint32_t index = node_find(browse, parent, path, length);
+        if (!index) {
+            index = node_add(browse, parent, path, length, last ? entry->type : 'D');
+            if (!index) {
+                return -1;
+            }
+        }
+        if (last) {
+            NeoAABrowseNode *node = &browse->nodes[index];
+            if (entry->type) {
+                node->type = entry->type;
+            }
+            node->size = entry->datSize;
+            return 0;
+        }
+        parent = index;
+        path = rest;
+    }
+}
+
+static void browse_notify(NeoAABrowse browse, int done) {
+    if (!browse->notify) {
+        return;
+    }
+    uint64_t now = neoaa_time_ns();
+    if (!done) {
+        /* The first screen goes out early, after that at most every interval */
+        if (browse->lastNotifyTime) {
+            if (now - browse->lastNotifyTime < NEOAA_PROGRESS_NOTIFY_INTERVAL_NS) {
+                return;
+            }
+        } else if (browse->entryCount < NEOAA_BROWSE_FIRST_NOTIFY) {
+            return;
+        }
+    }
+    browse->lastNotifyTime = now;
+    browse->notify(browse, done);
+}
+
+static void *browse_thread(void *context) {
+    NeoAABrowse browse = (NeoAABrowse)context;
+    int error = 0;
+    NeoAAReader reader = neoaa_reader_open_path(browse->archivePath);
+    uint8_t *header = (uint8_t *)malloc(NEOAA_MAX_HEADER_SIZE);
+    if (!reader || !header) {
+        error = -1;
+    }
+    NeoAAScanEntry entry;
+    while (!error && !neoaa_browse_cancelled(browse)) {
+        int status = neoaa_scan_next(reader, header, &entry);
+        if (status <= 0) {
+            error = status;
+            break;
+        }
+        if (entry.path) {
+            neoaa_browse_lock(browse);
+            error = browse_insert(browse, &entry);
+            browse->entryCount++;
+            neoaa_browse_unlock(browse);
+        }
+        /* Blob data is skipped, whole blocks at a time when compressed */
+        if (!error && entry.blobsSize && neoaa_reader_skip(reader, entry.blobsSize) != 0) {
+            error = -1;
+        }
+        neoaa_scan_entry_clear(&entry);
+        browse_notify(browse, 0);
+    }
+    free(header);
+    neoaa_reader_close(reader);
+    if (error) {
+        fprintf(stderr, "Failed to read archive %s\n", browse->archivePath);
+    }
+    neoaa_browse_lock(browse);
+    browse->error = error;
+    browse->done = 1;
+    neoaa_browse_unlock(browse);
+    browse_notify(browse, 1);
+    return NULL;
+}
+
+NeoAABrowse neoaa_browse_open(const char *archivePath, NeoAABrowseNotify notify, void *userData) {
+    NeoAABrowse browse = (NeoAABrowse)calloc(1, sizeof(struct neoaa_browse_impl));
+    if (!browse) {
+        return NULL;
+    }
+    pthread_mutex_init(&browse->lock, NULL);
+    browse->archivePath = strdup(archivePath);
+    browse->nodeCapacity = 1024;
+    browse->nodes = (NeoAABrowseNode *)calloc(browse->nodeCapacity, sizeof(NeoAABrowseNode));
+    browse->poolCapacity = 65536;
+    browse->pool = (char *)malloc(browse->poolCapacity);
+    if (!browse->archivePath || !browse->nodes || !browse->pool) {
+        neoaa_browse_close(browse);
+        return NULL;
+    }
+    /* The root, never shown itself but always expanded */
+    browse->nodes[0].type = 'D';
+    browse->nodes[0].expanded = 1;
+    browse->pool[0] = '\0';
+    browse->poolSize = 1;
+    browse->nodeCount = 1;
+    browse->notify = notify;
+    browse->userData = userData;
+    if (pthread_create(&browse->thread, NULL, browse_thread, browse) != 0) {
+        neoaa_browse_close(browse);
+        return NULL;
+    }
+    browse->threadStarted = 1;
+    return browse;
+}
+
+void neoaa_browse_close(NeoAABrowse browse) {
+    if (!browse) {
+        return;
+    }
+    if (browse->threadStarted) {
+        __atomic_store_n(&browse->cancelled, 1, __ATOMIC_RELAXED);
+        pthread_join(browse->thread, NULL);
+    }
+    pthread_mutex_destroy(&browse->lock);
+    free(browse->archivePath);
+    free(browse->nodes);
+    free(browse->pool);
+    free(browse->buckets);
+    free(browse->visible);
+    free(browse);
+}
+
+void neoaa_browse_lock(NeoAABrowse browse) {
+    pthread_mutex_lock(&browse->lock);
+}
+
+void neoaa_browse_unlock(NeoAABrowse browse) {
+    pthread_mutex_unlock(&browse->lock);
+}
+
+static int visible_append(NeoAABrowse browse, uint32_t index) {
+    if (browse->visibleCount == browse->visibleCapacity) {
+        size_t capacity = browse->visibleCapacity ? browse->visibleCapacity * 2 : 1024;
+        uint32_t *visible = (uint32_t *)realloc(browse->visible, capacity * sizeof(uint32_t));
+        if (!visible) {
+            return -1;
+        }
+        browse->visible = visible;
+        browse->visibleCapacity = capacity;
+    }
+    browse->visible[browse->visibleCount++] = index;
+    return 0;
+}
+
+/* Depth first over expanded directories, collapsed ones cost nothing */
+static void visible_rebuild(NeoAABrowse browse) {
+    const NeoAABrowseNode *nodes = browse->nodes;
+    browse->visibleCount = 0;
+    browse->visibleDirty = 0;
+    uint32_t index = nodes[0].firstChild;
+    while (index) {
+        if (visible_append(browse, index) != 0) {
+            return;
+        }
+        if (nodes[index].expanded && nodes[index].firstChild) {
+            index = nodes[index].firstChild;
+            continue;
+        }
+        while (index && !nodes[index].nextSibling) {
+            index = nodes[index].parent;
+        }
+        if (index) {
+            index = nodes[index].nextSibling;
+        }
+    }
+}
+
+size_t neoaa_browse_row_count(NeoAABrowse browse) {
+    if (browse->visibleDirty) {
+        visible_rebuild(browse);
+    }
+    return browse->visibleCount;
+}
+
+const NeoAABrowseNode *neoaa_browse_row(NeoAABrowse browse, size_t row) {
+    if (row >= neoaa_browse_row_count(browse)) {
+        return NULL;
+    }
+    return &browse->nodes[browse->visible[row]];
+}
+
+int neoaa_browse_toggle(NeoAABrowse browse, size_t row) {
+    if (row >= neoaa_browse_row_count(browse)) {
+        return 0;
+    }
+    NeoAABrowseNode *node = &browse->nodes[browse->visible[row]];
+    if (node->type != 'D') {
+        return 0;
+    }
+    node->expanded = !node->expanded;
+    if (node->firstChild) {
+        browse->visibleDirty = 1;
+    }
+    return 1;
+}
@@ -0,0 +1,98 @@
+/*
+ *  browse.h
+ *  neoaa
+ *
+ *  Tree model behind the archive browser. A background thread
+ *  scans headers only, skipping blob data, and files every
+ *  entry under its parent as it is parsed, so the UI can show
+ *  the first rows long before the scan is done.
+ */
+
+#ifndef NEOAA_BROWSE_H
+#define NEOAA_BROWSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* First notify once this many entries are in, so the first screen fills quickly */
+#define NEOAA_BROWSE_FIRST_NOTIFY 256
+
+/*
+ * Kept small on purpose, a million entries cost about 40 MB
+ * plus their names. Children hang off their parent as a list,
+ * index 0 is the root and doubles as "none".
+ */
+typedef struct {
+    uint64_t nameOffset;
+    uint64_t size;
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t lastChild;
+    uint32_t nextSibling;
+    uint32_t childCount;
+    uint16_t depth;
+    char type;
+    uint8_t expanded;
+} NeoAABrowseNode;
+
+typedef struct neoaa_browse_impl *NeoAABrowse;
+
+/* Called on the scan thread, done is set on the last call */
+typedef void (*NeoAABrowseNotify)(NeoAABrowse browse, int done);
+
+struct neoaa_browse_impl {
+    char *archivePath;
+    pthread_mutex_t lock;
+    NeoAABrowseNode *nodes;
+    size_t nodeCount;
+    size_t nodeCapacity;
+    char *pool;
+    size_t poolSize;
+    size_t poolCapacity;
+    /* (parent, name) lookup, only touched by the scan thread */
+    uint32_t *buckets;
+    size_t bucketCount;
+    /* Rows currently on screen, rebuilt lazily when visibleDirty is set */
+    uint32_t *visible;
+    size_t visibleCount;
+    size_t visibleCapacity;
+    int visibleDirty;
+    uint64_t entryCount;
+    int done;
+    int error;
+    int cancelled;
+    NeoAABrowseNotify notify;
+    void *userData;
+    uint64_t lastNotifyTime;
+    pthread_t thread;
+    int threadStarted;
+};
+
+/* Starts the scan thread, NULL if it could not be started */
+NeoAABrowse neoaa_browse_open(const char *archivePath, NeoAABrowseNotify notify, void *userData);
+/* Stops the scan if it is still running and frees everything */
+void neoaa_browse_close(NeoAABrowse browse);
+
+/*
+ * Everything below reads or changes nodes the scan thread is
+ * still adding to, so it has to run between lock and unlock.
+ */
+void neoaa_browse_lock(NeoAABrowse browse);
+void neoaa_browse_unlock(NeoAABrowse browse);
+size_t neoaa_browse_row_count(NeoAABrowse browse);
+/* NULL for rows past the end */
+const NeoAABrowseNode *neoaa_browse_row(NeoAABrowse browse, size_t row);
+/* Expands or collapses a directory row, returns 0 if the row is not one */
+int neoaa_browse_toggle(NeoAABrowse browse, size_t row);
+
+/* Safe without the lock, lets a notify callback stop waiting on a closing browser */
+static inline int neoaa_browse_cancelled(NeoAABrowse browse) {
+    return __atomic_load_n(&browse->cancelled, __ATOMIC_RELAXED);
+}
+
+static inline const char *neoaa_browse_name(NeoAABrowse browse, const NeoAABrowseNode *node) {
+    return browse->pool + node->nameOffset;
+}
+
+#endif /* NEOAA_BROWSE_H */
@@ -0,0 +1,225 @@
+/*
+ *  browser.c
+ *  neoaa
+ */
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Table_Row.H>
+#include <FL/Fl_Box.H>
+#include <FL/fl_draw.H>
+#include <FL/fl_ask.H>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "browser.h"
+#include "browse.h"
+#include "progress.h"
+
+#define NEOAA_BROWSER_INDENT 16
+
+static const char *browserColumns[] = {"Name", "Type", "Size"};
+
+/*
+ * Fl_Table only asks for the cells it is about to draw, so a
+ * million rows cost no more to show than a screenful.
+ */
+class NeoAAArchiveTable : public Fl_Table_Row {
+public:
+    NeoAABrowse browse;
+
+    NeoAAArchiveTable(int x, int y, int w, int h) : Fl_Table_Row(x, y, w, h), browse(NULL) {}
+
+protected:
+    void draw_cell(TableContext context, int row, int col, int x, int y, int w, int h);
+};
+
+static struct {
+    Fl_Double_Window *window;
+    NeoAAArchiveTable *table;
+    Fl_Box *statusBox;
+    char statusText[256];
+    char title[512];
+    NeoAABrowse browse;
+} browser;
+
+static const char *type_name(char type) {
+    switch (type) {
+        case 'D':
+            return "Directory";
+        case 'F':
+            return "File";
+        case 'L':
+            return "Symlink";
+        default:
+            return "Other";
+    }
+}
+
+void NeoAAArchiveTable::draw_cell(TableContext context, int row, int col, int x, int y, int w, int h) {
+    if (context == CONTEXT_STARTPAGE) {
+        fl_font(FL_HELVETICA, 12);
+        return;
+    }
+    if (context == CONTEXT_COL_HEADER) {
+        fl_push_clip(x, y, w, h);
+        fl_draw_box(FL_THIN_UP_BOX, x, y, w, h, col_header_color());
+        fl_color(FL_BLACK);
+        fl_draw(browserColumns[col], x + 4, y, w - 4, h, FL_ALIGN_LEFT);
+        fl_pop_clip();
+        return;
+    }
+    if (context != CONTEXT_CELL || !browse) {
+        return;
+    }
+    /* Copy what we need out under the lock, the scan may grow the arrays */
+    char text[256];
+    int indent = 0;
+    text[0] = '\0';
+    neoaa_browse_lock(browse);
+    const NeoAABrowseNode *node = neoaa_browse_row(browse, row);
+    if (node) {
+        if (col == 0) {
+            const char *marker = "  ";
+            if (node->type == 'D' && node->childCount) {
+                marker = node->expanded ? "- " : "+ ";
+            }
+            indent = (node->depth - 1) * NEOAA_BROWSER_INDENT;
+            snprintf(text, sizeof(text), "%s%s", marker, neoaa_browse_name(browse, node));
+        } else if (col == 1) {
+            snprintf(text, sizeof(text), "%s", type_name(node->type));
+        } else if (node->type == 'F') {
+            neoaa_format_bytes(text, sizeof(text), (double)node->size);
+        } else if (node->type == 'D') {
+            snprintf(text, sizeof(text), "%u items", node->childCount);
+        }
+    }
+    neoaa_browse_unlock(browse);
+
+    fl_push_clip(x, y, w, h);
+    fl_color(row_selected(row) ? FL_SELECTION_COLOR : FL_WHITE);
+    fl_rectf(x, y, w, h);
+    fl_color(FL_BLACK);
+    fl_draw(text, x + 4 + indent, y, w - 4 - indent, h, col == 2 ? FL_ALIGN_RIGHT : FL_ALIGN_LEFT);
+    fl_pop_clip();
+}
+
+static void browser_update(void) {
+    neoaa_browse_lock(browser.browse);
+    size_t rows = neoaa_browse_row_count(browser.browse);
+    uint64_t entries = browser.browse->entryCount;
+    int done = browser.browse->done;
+    int error = browser.browse->error;
+    neoaa_browse_unlock(browser.browse);
+    if ((size_t)browser.table->rows() != rows) {
+        browser.table->rows((int)rows);
+    }
+    browser.table->redraw();
+    if (!done) {
+        snprintf(browser.statusText, sizeof(browser.statusText), "Reading... %llu entries", (unsigned long long)entries);
+    } else if (error) {
+        snprintf(browser.statusText, sizeof(browser.statusText), "Failed after %llu entries", (unsigned long long)entries);
+    } else {
+        snprintf(browser.statusText, sizeof(browser.statusText), "%llu entries", (unsigned long long)entries);
+    }
+    browser.statusBox->label(browser.statusText);
+}
+
+/* Runs on the UI thread, scheduled by Fl::awake from the scan */
+static void browser_awake_cb(void *data) {
+    if ((NeoAABrowse)data != browser.browse) {
+        return;
+    }
+    browser_update();
+}
+
+/* Runs on the scan thread, never touch widgets here */
+static void browser_notify(NeoAABrowse browse, int done) {
+    if (!done) {
+        Fl::awake(browser_awake_cb, browse);
+        return;
+    }
+    /* The last update carries the final count, but give up if the window is closing */
+    while (Fl::awake(browser_awake_cb, browse) != 0 && !neoaa_browse_cancelled(browse)) {
+        usleep(1000);
+    }
+}
+
+static void browser_table_cb(Fl_Widget *w, void *data) {
+    NeoAAArchiveTable *table = (NeoAAArchiveTable *)w;
+    if (!browser.browse || table->callback_context() != Fl_Table::CONTEXT_CELL || Fl::event() != FL_PUSH) {
+        return;
+    }
+    /* A click on the name of a directory opens or closes it */
+    if (table->callback_col() != 0) {
+        return;
+    }
+    neoaa_browse_lock(browser.browse);
+    int toggled = neoaa_browse_toggle(browser.browse, table->callback_row());
+    neoaa_browse_unlock(browser.browse);
+    if (toggled) {
+        browser_update();
+    }
+}
+
+static void browser_close(void) {
+    if (!browser.browse) {
+        return;
+    }
+    browser.table->browse = NULL;
+    neoaa_browse_close(browser.browse);
+    browser.browse = NULL;
+}
+
+static void browser_window_cb(Fl_Widget *w, void *data) {
+    browser_close();
+    browser.table->rows(0);
+    browser.window->hide();
+}
+
+static void browser_create(void) {
+    Fl_Double_Window *window = new Fl_Double_Window(600, 500, "Archive Contents");
+    NeoAAArchiveTable *table = new NeoAAArchiveTable(10, 10, 580, 450);
+    table->type(Fl_Table_Row::SELECT_SINGLE);
+    table->rows(0);
+    table->cols(3);
+    table->col_header(1);
+    table->col_resize(1);
+    table->row_height_all(20);
+    table->col_width(0, 360);
+    table->col_width(1, 90);
+    table->col_width(2, 110);
+    table->callback(browser_table_cb);
+    table->end();
+
+    Fl_Box *statusBox = new Fl_Box(FL_NO_BOX, 10, 465, 580, 25, "");
+    statusBox->labelsize(11);
+    statusBox->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
+
+    window->resizable(table);
+    window->callback(browser_window_cb);
+    window->end();
+
+    browser.window = window;
+    browser.table = table;
+    browser.statusBox = statusBox;
+}
+
+void neoaa_browser_show(const char *archivePath) {
+    if (!browser.window) {
+        browser_create();
+    }
+    browser_close();
+    browser.table->rows(0);
+    NeoAABrowse browse = neoaa_browse_open(archivePath, browser_notify, NULL);
+    if (!browse) {
+        fl_alert("Failed to open %s", archivePath);
+        return;
+    }
+    browser.browse = browse;
+    browser.table->browse = browse;
+    snprintf(browser.title, sizeof(browser.title), "Archive Contents - %s", archivePath);
+    browser.window->label(browser.title);
+    browser.statusBox->label("Reading...");
+    browser.window->show();
+}
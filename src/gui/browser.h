@@ -0,0 +1,16 @@
+/*
+ *  browser.h
+ *  neoaa
+ *
+ *  Archive browser window. Rows come from a NeoAABrowse scan
+ *  and appear while it is still running, only the rows that
+ *  fit on screen are ever drawn.
+ */
+
+#ifndef NEOAA_BROWSER_H
+#define NEOAA_BROWSER_H
+
+/* Shows the browser window, replacing whatever archive it had open */
+void neoaa_browser_show(const char *archivePath);
+
+#endif /* NEOAA_BROWSER_H */
@@ -0,0 +1,278 @@
+/*
+ *  cache.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+/*
+ * Sidecar layout, host byte order like the .nidx: magic,
+ * version, the archive stat it belongs to, counts, then the
+ * record array and the string pool.
+ */
+#define NEOAA_CACHE_MAGIC "NCAC"
+/* Reused entries copy their old header, bumped whenever the header layout changes */
+#define NEOAA_CACHE_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t archiveSize;
+    int64_t archiveMtimeSec;
+    int64_t archiveMtimeNsec;
+    uint64_t count;
+    uint64_t poolSize;
+} NeoAACacheFileHeader;
+
+static uint64_t hash_path(const char *path) {
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static char *sidecar_path(const char *archivePath) {
+    size_t length = strlen(archivePath);
+    char *path = (char *)malloc(length + sizeof(NEOAA_CACHE_SUFFIX));
+    if (path) {
+        memcpy(path, archivePath, length);
+        memcpy(path + length, NEOAA_CACHE_SUFFIX, sizeof(NEOAA_CACHE_SUFFIX));
+    }
+    return path;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    uint8_t *bytes = (uint8_t *)data;
+    while (size) {
+        ssize_t got = read(fd, bytes, size);
+        if (got <= 0) {
+            return -1;
+        }
+        bytes += got;
+        size -= got;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0) {
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int cache_hash(NeoAACache cache) {
+    if (cache->count >= UINT32_MAX) {
+        return -1;
+    }
+    size_t bucketCount = 16;
+    while (bucketCount < cache->count * 2) {
+        bucketCount *= 2;
+    }
+    cache->buckets = (uint32_t *)calloc(bucketCount, sizeof(uint32_t));
+    if (!cache->buckets) {
+        return -1;
+    }
+    cache->bucketCount = bucketCount;
+    for (size_t i = 0; i < cache->count; i++) {
+        const char *path = cache->pool + cache->records[i].pathOffset;
+        size_t slot = hash_path(path) & (bucketCount - 1);
+        while (cache->buckets[slot]) {
+            if (strcmp(cache->pool + cache->records[cache->buckets[slot] - 1].pathOffset, path) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (bucketCount - 1);
+        }
+        cache->buckets[slot] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+NeoAACache neoaa_cache_open(const char *archivePath) {
+    char *path = sidecar_path(archivePath);
+    if (!path) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    NeoAACache cache = (NeoAACache)calloc(1, sizeof(struct neoaa_cache_impl));
+    if (!cache) {
+        close(fd);
+        return NULL;
+    }
+    /* Stat the archive through the descriptor we keep, so both are the same file */
+    cache->source = neoaa_reader_open_path(archivePath);
+    struct stat archiveStat;
+    NeoAACacheFileHeader fileHeader;
+    if (!cache->source || fstat(cache->source->fd, &archiveStat) != 0
+        || read_all(fd, &fileHeader, sizeof(fileHeader)) != 0
+        || memcmp(fileHeader.magic, NEOAA_CACHE_MAGIC, 4) != 0
+        || fileHeader.version != NEOAA_CACHE_VERSION
+        || fileHeader.archiveSize != (uint64_t)archiveStat.st_size
+        || fileHeader.archiveMtimeSec != archiveStat.st_mtim.tv_sec
+        || fileHeader.archiveMtimeNsec != archiveStat.st_mtim.tv_nsec
+        || fileHeader.count > fileHeader.archiveSize
+        || fileHeader.poolSize > fileHeader.archiveSize) {
+        /* Stale or foreign, everything gets archived from scratch */
+        close(fd);
+        neoaa_cache_close(cache);
+        return NULL;
+    }
+    cache->count = fileHeader.count;
+    cache->poolSize = fileHeader.poolSize;
+    cache->records = (NeoAACacheRecord *)malloc(cache->count * sizeof(NeoAACacheRecord) + 1);
+    cache->pool = (char *)malloc(cache->poolSize + 1);
+    int failed = !cache->records || !cache->pool
+        || read_all(fd, cache->records, cache->count * sizeof(NeoAACacheRecord)) != 0
+        || read_all(fd, cache->pool, cache->poolSize) != 0;
+    close(fd);
+    for (size_t i = 0; !failed && i < cache->count; i++) {
+        const NeoAACacheRecord *record = &cache->records[i];
+        if (record->pathOffset >= cache->poolSize
+            || !memchr(cache->pool + record->pathOffset, '\0', cache->poolSize - record->pathOffset)
+            || record->offset + record->length < record->offset) {
+            failed = 1;
+        }
+    }
+    /* Block copies need to know where the blocks start */
+    if (!failed && cache->source->compressed && neoaa_reader_scan_chunks(cache->source) != 0) {
+        failed = 1;
+    }
+    if (failed || cache_hash(cache) != 0) {
+        neoaa_cache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+const NeoAACacheRecord *neoaa_cache_find(NeoAACache cache, const NeoAAWalkEntry *entry) {
+    if (!cache->bucketCount) {
+        return NULL;
+    }
+    size_t slot = hash_path(entry->path) & (cache->bucketCount - 1);
+    while (cache->buckets[slot]) {
+        const NeoAACacheRecord *record = &cache->records[cache->buckets[slot] - 1];
+        if (strcmp(cache->pool + record->pathOffset, entry->path) == 0) {
+            int unchanged = record->dev == (uint64_t)entry->dev && record->ino == (uint64_t)entry->ino
+                && record->size == (uint64_t)entry->size && record->mtimeSec == entry->mtime.tv_sec
+                && record->mtimeNsec == entry->mtime.tv_nsec && record->mode == (uint32_t)entry->mode
+                && record->uid == (uint32_t)entry->uid && record->gid == (uint32_t)entry->gid;
+            return unchanged ? record : NULL;
+        }
+        slot = (slot + 1) & (cache->bucketCount - 1);
+    }
+    return NULL;
+}
+
+void neoaa_cache_close(NeoAACache cache) {
+    if (!cache) {
+        return;
+    }
+    neoaa_reader_close(cache->source);
+    free(cache->records);
+    free(cache->pool);
+    free(cache->buckets);
+    free(cache);
+}
+
+int neoaa_cache_save(const char *archivePath, const NeoAAWalkEntry *entries, size_t entryCount,
+                     const uint64_t *offsets, const uint64_t *lengths) {
+    struct stat archiveStat;
+    if (stat(archivePath, &archiveStat) != 0) {
+        return -1;
+    }
+    NeoAACacheFileHeader fileHeader;
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    memcpy(fileHeader.magic, NEOAA_CACHE_MAGIC, 4);
+    fileHeader.version = NEOAA_CACHE_VERSION;
+    fileHeader.archiveSize = archiveStat.st_size;
+    fileHeader.archiveMtimeSec = archiveStat.st_mtim.tv_sec;
+    fileHeader.archiveMtimeNsec = archiveStat.st_mtim.tv_nsec;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (lengths[i]) {
+            fileHeader.count++;
+            fileHeader.poolSize += strlen(entries[i].path) + 1;
+        }
+    }
+    NeoAACacheRecord *records = (NeoAACacheRecord *)calloc(fileHeader.count ? fileHeader.count : 1, sizeof(NeoAACacheRecord));
+    char *pool = (char *)malloc(fileHeader.poolSize ? fileHeader.poolSize : 1);
+    char *path = sidecar_path(archivePath);
+    size_t pathLength = path ? strlen(path) : 0;
+    char *tempPath = path ? (char *)malloc(pathLength + 8) : NULL;
+    if (!records || !pool || !tempPath) {
+        free(records);
+        free(pool);
+        free(path);
+        free(tempPath);
+        return -1;
+    }
+    size_t count = 0;
+    size_t poolSize = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (!lengths[i]) {
+            continue;
+        }
+        const NeoAAWalkEntry *entry = &entries[i];
+        NeoAACacheRecord *record = &records[count++];
+        size_t length = strlen(entry->path) + 1;
+        record->pathOffset = poolSize;
+        record->dev = entry->dev;
+        record->ino = entry->ino;
+        record->size = entry->size;
+        record->mtimeSec = entry->mtime.tv_sec;
+        record->mtimeNsec = entry->mtime.tv_nsec;
+        record->mode = entry->mode;
+        record->uid = entry->uid;
+        record->gid = entry->gid;
+        record->offset = offsets[i];
+        record->length = lengths[i];
+        memcpy(pool + poolSize, entry->path, length);
+        poolSize += length;
+    }
+
+    snprintf(tempPath, pathLength + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(tempPath);
+    int result = fd < 0 ? -1 : write_all(fd, &fileHeader, sizeof(fileHeader));
+    if (result == 0 && count) {
+        result = write_all(fd, records, count * sizeof(NeoAACacheRecord));
+    }
+    if (result == 0 && poolSize) {
+        result = write_all(fd, pool, poolSize);
+    }
+    if (fd >= 0) {
+        fchmod(fd, 0644);
+        if (close(fd) != 0) {
+            result = -1;
+        }
+        /* Rename so a later run never sees half a cache */
+        if (result == 0 && rename(tempPath, path) != 0) {
+            result = -1;
+        }
+        if (result != 0) {
+            unlink(tempPath);
+        }
+    }
+    free(records);
+    free(pool);
+    free(tempPath);
+    free(path);
+    return result;
+}
@@ -0,0 +1,68 @@
+/*
+ *  cache.h
+ *  neoaa
+ *
+ *  Item cache for incremental archiving. Saved next to the
+ *  archive as <archive>.ncache, it remembers for every entry
+ *  the lstat it was built from and where its encoded header and
+ *  blobs sit in the uncompressed stream. An entry whose path,
+ *  device, inode, size, mtime, mode and owner still match is
+ *  copied from the previous archive instead of being read and
+ *  encoded again. Like the .nidx index it is only trusted while
+ *  the archive size and mtime match what it was written for.
+ */
+
+#ifndef NEOAA_CACHE_H
+#define NEOAA_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "reader.h"
+#include "walk.h"
+
+#define NEOAA_CACHE_SUFFIX ".ncache"
+
+typedef struct {
+    uint64_t pathOffset; /* into the string pool, NUL terminated */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t reserved;
+    uint64_t offset; /* header of the entry in the uncompressed stream */
+    uint64_t length; /* header and blobs */
+} NeoAACacheRecord;
+
+typedef struct neoaa_cache_impl *NeoAACache;
+
+struct neoaa_cache_impl {
+    NeoAACacheRecord *records;
+    size_t count;
+    char *pool;
+    size_t poolSize;
+    /* Open addressing, record index + 1 with 0 as empty */
+    uint32_t *buckets;
+    size_t bucketCount;
+    /* The archive the offsets point into, kept open so it can be replaced under us */
+    NeoAAReader source;
+};
+
+/* NULL if there is no sidecar, it is stale, or the archive cannot be read */
+NeoAACache neoaa_cache_open(const char *archivePath);
+/* The record for an unchanged entry, NULL if it has to be archived again */
+const NeoAACacheRecord *neoaa_cache_find(NeoAACache cache, const NeoAAWalkEntry *entry);
+void neoaa_cache_close(NeoAACache cache);
+
+/*
+ * Write the sidecar for a freshly written archive. offsets and
+ * lengths say where each of the entries ended up, entries with
+ * a length of 0 were not archived and are left out.
+ */
+int neoaa_cache_save(const char *archivePath, const NeoAAWalkEntry *entries, size_t entryCount,
+                     const uint64_t *offsets, const uint64_t *lengths);
+
+#endif /* NEOAA_CACHE_H */
@@ -0,0 +1,321 @@
+/*
+ *  checksum.c
+ *  neoaa
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define NEOAA_SHA256_X86 1
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#define NEOAA_SHA256_ARM 1
+#endif
+
+/* Data is hashed in slices this big so the CRC pass finds it still in L1 */
+#define NEOAA_CHECKSUM_SLICE (16 * 1024)
+/* Buffer for checksumming straight from a file */
+#define NEOAA_CHECKSUM_READ_SIZE (1024 * 1024)
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256_blocks_c(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    while (blocks--) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16)
+                | ((uint32_t)data[i * 4 + 2] << 8) | data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef NEOAA_SHA256_X86
+
+/* Four rounds, then the next four message words from the previous sixteen */
+#define SHA_NI_ROUNDS(k, msg)                                                            \
+    tmp = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i *)&sha256K[k]));            \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);                                 \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(tmp, 0x0E))
+#define SHA_NI_SCHEDULE(w0, w1, w2, w3) \
+    w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_x86(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    /* The instructions want the state as ABEF and CDGH */
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    while (blocks--) {
+        __m128i saved0 = state0;
+        __m128i saved1 = state1;
+        __m128i msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), byteSwap);
+        __m128i msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), byteSwap);
+        __m128i msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), byteSwap);
+        __m128i msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), byteSwap);
+        SHA_NI_ROUNDS(0, msg0);
+        SHA_NI_ROUNDS(4, msg1);
+        SHA_NI_ROUNDS(8, msg2);
+        SHA_NI_ROUNDS(12, msg3);
+        for (int k = 16; k < 64; k += 16) {
+            SHA_NI_SCHEDULE(msg0, msg1, msg2, msg3);
+            SHA_NI_ROUNDS(k, msg0);
+            SHA_NI_SCHEDULE(msg1, msg2, msg3, msg0);
+            SHA_NI_ROUNDS(k + 4, msg1);
+            SHA_NI_SCHEDULE(msg2, msg3, msg0, msg1);
+            SHA_NI_ROUNDS(k + 8, msg2);
+            SHA_NI_SCHEDULE(msg3, msg0, msg1, msg2);
+            SHA_NI_ROUNDS(k + 12, msg3);
+        }
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+        data += 64;
+    }
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static int sha256_x86_supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ebx & (1u << 29)) != 0;
+}
+
+#endif /* NEOAA_SHA256_X86 */
+
+#ifdef NEOAA_SHA256_ARM
+
+static void sha256_blocks_arm(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+    while (blocks--) {
+        uint32x4_t saved0 = state0;
+        uint32x4_t saved1 = state1;
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+        }
+        for (int k = 0; k < 64; k += 4) {
+            int i = (k / 4) & 3;
+            if (k >= 16) {
+                msg[i] = vsha256su1q_u32(vsha256su0q_u32(msg[i], msg[(i + 1) & 3]), msg[(i + 2) & 3], msg[(i + 3) & 3]);
+            }
+            uint32x4_t words = vaddq_u32(msg[i], vld1q_u32(&sha256K[k]));
+            uint32x4_t previous = state0;
+            state0 = vsha256hq_u32(state0, state1, words);
+            state1 = vsha256h2q_u32(state1, previous, words);
+        }
+        state0 = vaddq_u32(state0, saved0);
+        state1 = vaddq_u32(state1, saved1);
+        data += 64;
+    }
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+
+#endif /* NEOAA_SHA256_ARM */
+
+typedef void (*NeoAASha256Blocks)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static NeoAASha256Blocks sha256_blocks_impl(void) {
+    static NeoAASha256Blocks chosen;
+    NeoAASha256Blocks blocks = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+    if (!blocks) {
+        blocks = sha256_blocks_c;
+#if defined(NEOAA_SHA256_X86)
+        if (sha256_x86_supported()) {
+            blocks = sha256_blocks_x86;
+        }
+#elif defined(NEOAA_SHA256_ARM)
+        blocks = sha256_blocks_arm;
+#endif
+        /* Every thread picks the same one, losing the race is harmless */
+        __atomic_store_n(&chosen, blocks, __ATOMIC_RELAXED);
+    }
+    return blocks;
+}
+
+void neoaa_checksum_init(NeoAAChecksum *sum) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sum->state, initial, sizeof(initial));
+    sum->length = 0;
+    sum->blockUsed = 0;
+    sum->crc32 = (uint32_t)crc32(0, Z_NULL, 0);
+}
+
+static void sha256_update(NeoAAChecksum *sum, NeoAASha256Blocks blocks, const uint8_t *data, size_t size) {
+    if (sum->blockUsed) {
+        size_t take = 64 - sum->blockUsed < size ? 64 - sum->blockUsed : size;
+        memcpy(sum->block + sum->blockUsed, data, take);
+        sum->blockUsed += take;
+        data += take;
+        size -= take;
+        if (sum->blockUsed < 64) {
+            return;
+        }
+        blocks(sum->state, sum->block, 1);
+        sum->blockUsed = 0;
+    }
+    if (size >= 64) {
+        blocks(sum->state, data, size / 64);
+        data += size & ~(size_t)63;
+        size &= 63;
+    }
+    memcpy(sum->block, data, size);
+    sum->blockUsed = size;
+}
+
+void neoaa_checksum_update(NeoAAChecksum *sum, const void *data, size_t size) {
+    NeoAASha256Blocks blocks = sha256_blocks_impl();
+    const uint8_t *bytes = (const uint8_t *)data;
+    sum->length += size;
+    while (size) {
+        size_t slice = size < NEOAA_CHECKSUM_SLICE ? size : NEOAA_CHECKSUM_SLICE;
+        sha256_update(sum, blocks, bytes, slice);
+        sum->crc32 = (uint32_t)crc32(sum->crc32, bytes, (uInt)slice);
+        bytes += slice;
+        size -= slice;
+    }
+}
+
+void neoaa_checksum_final(NeoAAChecksum *sum, NeoAADigest *digest) {
+    NeoAASha256Blocks blocks = sha256_blocks_impl();
+    uint64_t bits = sum->length * 8;
+    uint8_t padding[72];
+    size_t padSize = (sum->blockUsed < 56 ? 56 : 120) - sum->blockUsed;
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        padding[padSize + i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+    sha256_update(sum, blocks, padding, padSize + 8);
+    for (int i = 0; i < 8; i++) {
+        digest->sha256[i * 4] = (uint8_t)(sum->state[i] >> 24);
+        digest->sha256[i * 4 + 1] = (uint8_t)(sum->state[i] >> 16);
+        digest->sha256[i * 4 + 2] = (uint8_t)(sum->state[i] >> 8);
+        digest->sha256[i * 4 + 3] = (uint8_t)sum->state[i];
+    }
+    digest->crc32 = sum->crc32;
+}
+
+void neoaa_checksum_buffer(const void *data, size_t size, NeoAADigest *digest) {
+    NeoAAChecksum sum;
+    neoaa_checksum_init(&sum);
+    neoaa_checksum_update(&sum, data, size);
+    neoaa_checksum_final(&sum, digest);
+}
+
+void neoaa_checksum_update_zeros(NeoAAChecksum *sum, uint64_t size) {
+    static const uint8_t zeros[4096] = {0};
+    while (size) {
+        size_t chunk = size < sizeof(zeros) ? (size_t)size : sizeof(zeros);
+        neoaa_checksum_update(sum, zeros, chunk);
+        size -= chunk;
+    }
+}
+
+int neoaa_checksum_fd(int fd, uint64_t offset, uint64_t size, NeoAADigest *digest) {
+    size_t bufferSize = size < NEOAA_CHECKSUM_READ_SIZE ? (size_t)size : NEOAA_CHECKSUM_READ_SIZE;
+    uint8_t *buffer = (uint8_t *)malloc(bufferSize ? bufferSize : 1);
+    if (!buffer) {
+        return -2;
+    }
+    NeoAAChecksum sum;
+    neoaa_checksum_init(&sum);
+    uint64_t end = offset + size;
+    int result = 0;
+    while (offset < end) {
+        size_t chunk = end - offset < bufferSize ? (size_t)(end - offset) : bufferSize;
+        ssize_t got = pread(fd, buffer, chunk, (off_t)offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            result = -1;
+            break;
+        }
+        neoaa_checksum_update(&sum, buffer, got);
+        offset += got;
+    }
+    free(buffer);
+    neoaa_checksum_final(&sum, digest);
+    return result;
+}
+
+void neoaa_digest_encode(const NeoAADigest *digest, uint8_t *fields) {
+    memcpy(fields, "CKSF", 4);
+    for (int i = 0; i < 4; i++) {
+        fields[4 + i] = (uint8_t)(digest->crc32 >> (i * 8));
+    }
+    memcpy(fields + 8, "SH2H", 4);
+    memcpy(fields + 12, digest->sha256, NEOAA_SHA256_SIZE);
+}
+
+int neoaa_digest_compare(const NeoAADigest *expected, int fields, const NeoAADigest *actual) {
+    if ((fields & NEOAA_DIGEST_CRC32) && expected->crc32 != actual->crc32) {
+        return -1;
+    }
+    if ((fields & NEOAA_DIGEST_SHA256) && memcmp(expected->sha256, actual->sha256, NEOAA_SHA256_SIZE) != 0) {
+        return -1;
+    }
+    return 0;
+}
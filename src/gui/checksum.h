@@ -0,0 +1,54 @@
+/*
+ *  checksum.h
+ *  neoaa
+ *
+ *  Content checksums of file entries, stored in the CKS (CRC32)
+ *  and SH2 (SHA-256) header fields. Both come out of one pass over
+ *  data that is already in memory. SHA-256 runs on the SHA
+ *  instructions of x86 and ARMv8 when the CPU has them and on
+ *  plain C otherwise, CRC32 is zlib's.
+ */
+
+#ifndef NEOAA_CHECKSUM_H
+#define NEOAA_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NEOAA_SHA256_SIZE 32
+
+/* Which fields a digest carries */
+#define NEOAA_DIGEST_CRC32 1
+#define NEOAA_DIGEST_SHA256 2
+
+/* What the CKS and SH2 fields add to an encoded header */
+#define NEOAA_DIGEST_FIELDS_SIZE (4 + 4 + 4 + NEOAA_SHA256_SIZE)
+
+typedef struct {
+    uint32_t crc32;
+    uint8_t sha256[NEOAA_SHA256_SIZE];
+} NeoAADigest;
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t blockUsed;
+    uint32_t crc32;
+} NeoAAChecksum;
+
+void neoaa_checksum_init(NeoAAChecksum *sum);
+void neoaa_checksum_update(NeoAAChecksum *sum, const void *data, size_t size);
+/* Same as size zero bytes, for holes that are never read */
+void neoaa_checksum_update_zeros(NeoAAChecksum *sum, uint64_t size);
+void neoaa_checksum_final(NeoAAChecksum *sum, NeoAADigest *digest);
+void neoaa_checksum_buffer(const void *data, size_t size, NeoAADigest *digest);
+/* size bytes of fd from offset with pread, non zero if they could not all be read */
+int neoaa_checksum_fd(int fd, uint64_t offset, uint64_t size, NeoAADigest *digest);
+
+/* Append the CKS and SH2 fields, NEOAA_DIGEST_FIELDS_SIZE bytes */
+void neoaa_digest_encode(const NeoAADigest *digest, uint8_t *fields);
+/* 0 if every field in fields (NEOAA_DIGEST_*) matches, nothing to check counts as a match */
+int neoaa_digest_compare(const NeoAADigest *expected, int fields, const NeoAADigest *actual);
+
+#endif /* NEOAA_CHECKSUM_H */
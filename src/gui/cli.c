@@ -0,0 +1,334 @@
+/*
+ *  cli.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cli.h"
+#include "archive.h"
+#include "batch.h"
+#include "job.h"
+
+#define OPTSTR "i:o:a:p:f:m:j:d:t:shv"
+
+/* Most words a manifest line may have */
+#define NEOAA_CLI_MAX_WORDS 32
+
+typedef struct {
+    const char *inputPath;
+    const char *outputPath;
+    const char *memberPath;
+    const char *addPath;
+    const char *manifestPath;
+    NeoAACompression compression;
+    int seekable;
+    int threadCount;
+    int parallel;
+    int perDevice;
+    int help;
+    int version;
+} NeoAACliArgs;
+
+void show_help(void) {
+    printf("Usage: neoaa command <options>\n\n");
+    printf("Commands:\n\n");
+    printf(" archive: archive the contents of a directory.\n");
+    printf(" extract: extract files from an archive.\n");
+    printf(" list: list the contents of an archive.\n");
+    printf(" add: append a file to an archive.\n");
+    printf(" wrap: archive a singular file.\n");
+    printf(" unwrap: extract a singular file from an archive.\n");
+    printf(" verify: check the files in an archive against their checksums.\n");
+    printf(" batch: run every job in a manifest, several at once.\n");
+    printf(" version: display version of aa\n");
+    printf("\n");
+    printf("Options:\n\n");
+    printf(" -i: path to the input file or directory, - reads the archive from stdin for extract and list.\n");
+    printf(" -o: path to the output file or directory.\n");
+    printf(" -a: algorithm for compression, lzfse (default), zlib, raw (no compression).\n");
+    printf(" -s: make a compressed archive seekable, its chunk table is kept in <archive>.nchk.\n");
+    printf(" -p: specify path of file in project to unwrap.\n");
+    printf(" -f: path of file to add to the .aar specified in -i.\n");
+    printf(" -t: worker threads, one per CPU by default. For batch, shared by all running jobs.\n");
+    printf(" -m: batch manifest, - for stdin. One job per line written like a command line\n");
+    printf("     without the program name, e.g. archive -i dir -o dir.aar -a zlib. # starts a comment.\n");
+    printf(" -j: batch jobs to run at once, one per CPU by default.\n");
+    printf(" -d: batch jobs to run at once on the same disk, %d by default, 0 for no limit.\n", NEOAA_BATCH_DEFAULT_PER_DEVICE);
+    printf(" -h: this ;-)\n");
+    printf("\n");
+    printf("batch prints a line per finished job to stdout: state, command, input, output,\n");
+    printf("result code and seconds, separated by tabs.\n");
+    printf("\n");
+}
+
+static void cli_version(void) {
+    printf("neoaa, built %s\n", __DATE__);
+}
+
+static int cli_compression(const char *name, NeoAACompression *compression) {
+    if (strcmp(name, "lzfse") == 0) {
+        *compression = NEOAA_COMPRESS_LZFSE;
+    } else if (strcmp(name, "zlib") == 0) {
+        *compression = NEOAA_COMPRESS_ZLIB;
+    } else if (strcmp(name, "raw") == 0) {
+        *compression = NEOAA_COMPRESS_RAW;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* argv[0] is the command, the options follow it as OPTSTR describes them */
+static int cli_parse(int argc, char **argv, NeoAACliArgs *args) {
+    memset(args, 0, sizeof(NeoAACliArgs));
+    args->compression = NEOAA_COMPRESS_LZFSE;
+    args->perDevice = NEOAA_BATCH_DEFAULT_PER_DEVICE;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *spec = arg[0] == '-' && arg[1] && arg[1] != ':' && !arg[2] ? strchr(OPTSTR, arg[1]) : NULL;
+        if (!spec) {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            return -1;
+        }
+        const char *value = NULL;
+        if (spec[1] == ':') {
+            if (++i == argc) {
+                fprintf(stderr, "Option %s needs a value\n", arg);
+                return -1;
+            }
+            value = argv[i];
+        }
+        switch (arg[1]) {
+            case 'i': args->inputPath = value; break;
+            case 'o': args->outputPath = value; break;
+            case 'p': args->memberPath = value; break;
+            case 'f': args->addPath = value; break;
+            case 'm': args->manifestPath = value; break;
+            case 't': args->threadCount = atoi(value); break;
+            case 'j': args->parallel = atoi(value); break;
+            case 'd': args->perDevice = atoi(value); break;
+            case 's': args->seekable = 1; break;
+            case 'h': args->help = 1; break;
+            case 'v': args->version = 1; break;
+            case 'a':
+                if (cli_compression(value, &args->compression) != 0) {
+                    fprintf(stderr, "Unknown compression %s\n", value);
+                    return -1;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+static int cli_command(const char *name, NeoAACommand *command) {
+    for (int i = NEOAA_CMD_ARCHIVE; i <= NEOAA_CMD_VERIFY; i++) {
+        if (strcmp(name, neoaa_command_name((NeoAACommand)i)) == 0) {
+            *command = (NeoAACommand)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* The job a command line describes, NULL after saying what is missing */
+static NeoAAJob cli_job(NeoAACommand command, const NeoAACliArgs *args) {
+    const char *missing = NULL;
+    if (!args->inputPath) {
+        missing = "-i";
+    } else if ((command == NEOAA_CMD_ARCHIVE || command == NEOAA_CMD_EXTRACT || command == NEOAA_CMD_WRAP
+                || command == NEOAA_CMD_UNWRAP) && !args->outputPath) {
+        missing = "-o";
+    } else if (command == NEOAA_CMD_UNWRAP && !args->memberPath) {
+        missing = "-p";
+    } else if (command == NEOAA_CMD_ADD && !args->addPath) {
+        missing = "-f";
+    }
+    if (missing) {
+        fprintf(stderr, "%s needs %s\n", neoaa_command_name(command), missing);
+        return NULL;
+    }
+    NeoAAJob job;
+    if (command == NEOAA_CMD_ADD) {
+        /* Jobs take the file to add as input and the archive as output */
+        job = neoaa_job_create(command, args->addPath, args->inputPath);
+    } else {
+        job = neoaa_job_create(command, args->inputPath, args->outputPath ? args->outputPath : "");
+    }
+    if (!job || (args->memberPath && neoaa_job_set_member_path(job, args->memberPath) != 0)) {
+        fprintf(stderr, "Not enough memory to create job\n");
+        neoaa_job_destroy(job);
+        return NULL;
+    }
+    job->options.compression = args->compression;
+    job->options.seekable = args->seekable;
+    job->options.threadCount = args->threadCount;
+    return job;
+}
+
+/* Split line into words in place, double quotes keep spaces inside one. -1 if there are too many. */
+static int cli_split(char *line, char **words, int maxWords) {
+    int count = 0;
+    char *p = line;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+        }
+        if (!*p || *p == '#') {
+            return count;
+        }
+        if (count == maxWords) {
+            return -1;
+        }
+        char *out = p;
+        words[count++] = out;
+        int quoted = 0;
+        while (*p && (quoted || (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'))) {
+            if (*p == '"') {
+                quoted = !quoted;
+            } else {
+                *out++ = *p;
+            }
+            p++;
+        }
+        if (*p) {
+            p++;
+        }
+        *out = '\0';
+    }
+}
+
+typedef struct {
+    size_t total;
+    size_t failed;
+} NeoAACliReport;
+
+static void cli_batch_notify(NeoAAJob job, int finished) {
+    if (!finished) {
+        return;
+    }
+    NeoAACliReport *report = (NeoAACliReport *)job->userData;
+    NeoAAProgressSnapshot snapshot;
+    neoaa_progress_snapshot(&job->progress, &snapshot);
+    NeoAAJobState state = neoaa_job_state(job);
+    if (state != NEOAA_JOB_SUCCEEDED) {
+        __atomic_add_fetch(&report->failed, 1, __ATOMIC_RELAXED);
+    }
+    const char *stateName = state == NEOAA_JOB_SUCCEEDED ? "ok" : state == NEOAA_JOB_CANCELLED ? "cancelled" : "failed";
+    printf("%s\t%s\t%s\t%s\t%d\t%.3f\n", stateName, neoaa_command_name(job->command), job->inputPath, job->outputPath,
+           job->result, snapshot.elapsedSeconds);
+    fflush(stdout);
+}
+
+/* Queue every job of the manifest, nothing runs unless all of them parse */
+static int cli_batch_load(NeoAABatch batch, const char *manifestPath) {
+    FILE *fp = strcmp(manifestPath, "-") == 0 ? stdin : fopen(manifestPath, "r");
+    if (!fp) {
+        fprintf(stderr, "Failed to open manifest %s\n", manifestPath);
+        return -1;
+    }
+    char *line = NULL;
+    size_t lineSize = 0;
+    size_t lineNumber = 0;
+    int errors = 0;
+    while (getline(&line, &lineSize, fp) >= 0) {
+        lineNumber++;
+        char *words[NEOAA_CLI_MAX_WORDS];
+        int wordCount = cli_split(line, words, NEOAA_CLI_MAX_WORDS);
+        if (!wordCount) {
+            continue;
+        }
+        NeoAACliArgs args;
+        NeoAACommand command;
+        NeoAAJob job = NULL;
+        if (wordCount < 0) {
+            fprintf(stderr, "Too many words\n");
+        } else if (cli_command(words[0], &command) != 0 || command == NEOAA_CMD_VERSION) {
+            fprintf(stderr, "Unknown command %s\n", words[0]);
+        } else if (cli_parse(wordCount, words, &args) == 0) {
+            /* The batch hands out threads, -s and -a stay per job */
+            args.threadCount = 0;
+            job = cli_job(command, &args);
+        }
+        if (!job || neoaa_batch_add(batch, job) != 0) {
+            fprintf(stderr, "%s: line %zu is not a valid job\n", manifestPath, lineNumber);
+            neoaa_job_destroy(job);
+            errors++;
+        }
+    }
+    free(line);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return errors ? -1 : 0;
+}
+
+static int cli_batch(const NeoAACliArgs *args) {
+    if (!args->manifestPath) {
+        fprintf(stderr, "batch needs -m\n");
+        return 1;
+    }
+    NeoAABatch batch = neoaa_batch_create(args->parallel, args->perDevice, args->threadCount, 0);
+    if (!batch) {
+        fprintf(stderr, "Not enough memory to create batch\n");
+        return 1;
+    }
+    if (cli_batch_load(batch, args->manifestPath) != 0) {
+        neoaa_batch_destroy(batch);
+        return 1;
+    }
+    NeoAACliReport report;
+    report.total = neoaa_batch_count(batch);
+    report.failed = 0;
+    uint64_t start = neoaa_time_ns();
+    if (neoaa_batch_start(batch, cli_batch_notify, &report) != 0) {
+        neoaa_batch_destroy(batch);
+        return 1;
+    }
+    neoaa_batch_wait(batch);
+    neoaa_batch_destroy(batch);
+    fprintf(stderr, "%zu jobs, %zu failed, %.2f s\n", report.total, report.failed, (double)(neoaa_time_ns() - start) / 1e9);
+    return report.failed ? 1 : 0;
+}
+
+int neoaa_cli_main(int argc, char **argv) {
+    if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        show_help();
+        return 0;
+    }
+    if (strcmp(argv[1], "-v") == 0) {
+        cli_version();
+        return 0;
+    }
+    NeoAACliArgs args;
+    if (cli_parse(argc - 1, argv + 1, &args) != 0) {
+        show_help();
+        return 1;
+    }
+    if (args.help) {
+        show_help();
+        return 0;
+    }
+    if (strcmp(argv[1], "batch") == 0) {
+        return cli_batch(&args);
+    }
+    NeoAACommand command;
+    if (cli_command(argv[1], &command) != 0) {
+        fprintf(stderr, "Unknown command %s\n", argv[1]);
+        show_help();
+        return 1;
+    }
+    if (command == NEOAA_CMD_VERSION || args.version) {
+        cli_version();
+        return 0;
+    }
+    NeoAAJob job = cli_job(command, &args);
+    if (!job) {
+        return 1;
+    }
+    int result = neoaa_job_run(job, NULL, NULL);
+    neoaa_job_destroy(job);
+    return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+/*
+ *  cli.h
+ *  neoaa
+ *
+ *  Headless command line front end. main hands over to it when
+ *  there are arguments, before FLTK is touched at all, so scripts
+ *  pay no GUI startup. The batch command reads a manifest with one
+ *  command line per job and runs them all through a NeoAABatch.
+ */
+
+#ifndef NEOAA_CLI_H
+#define NEOAA_CLI_H
+
+void show_help(void);
+/* argv[1] is the command, returns the process exit status */
+int neoaa_cli_main(int argc, char **argv);
+
+#endif /* NEOAA_CLI_H */
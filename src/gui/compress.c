@@ -0,0 +1,608 @@
+/*
+ *  compress.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <lzfse.h>
+#include <zlib.h>
+#include "compress.h"
+#include "walk.h"
+#include "fileio.h"
+
+/* Adaptive blocks are judged in segments of at least this size, at most NEOAA_ADAPTIVE_MAX_SEGMENTS of them */
+#define NEOAA_ADAPTIVE_SEGMENT (64 * 1024)
+#define NEOAA_ADAPTIVE_MAX_SEGMENTS 64
+/* Bytes looked at in each of the two sample windows of a segment */
+#define NEOAA_ADAPTIVE_WINDOW 4096
+/* Sampled bits per byte from which a segment counts as incompressible */
+#define NEOAA_ADAPTIVE_ENTROPY 7.5
+/* Raw stretches shorter than this are compressed with their neighbours instead of getting their own block */
+#define NEOAA_ADAPTIVE_MIN_RAW (2 * NEOAA_ADAPTIVE_SEGMENT)
+
+/* A stretch of a slot that goes out as one block */
+typedef struct {
+    size_t rawSize;
+    size_t payloadSize;  /* rawSize means stored raw */
+    size_t outputOffset; /* where a compressed payload starts in output */
+    int compress;
+} NeoAACompressRun;
+
+typedef struct {
+    uint8_t *input;
+    size_t inputSize;
+    uint8_t *output;
+    /* Blocks the input turns into, one unless the compressor is adaptive */
+    NeoAACompressRun runs[NEOAA_ADAPTIVE_MAX_SEGMENTS];
+    int runCount;
+    /* Already compressed elsewhere, the payload is copied from copyFd as is */
+    int copy;
+    int copyFd;
+    uint64_t copyOffset;
+    int done;
+} NeoAACompressSlot;
+
+struct neoaa_compressor_impl {
+    int fd;
+    NeoAACompression compression;
+    size_t blockSize;
+    int slotCount;
+    NeoAACompressSlot *slots;
+    /* Sequence numbers, slot = sequence % slotCount */
+    uint64_t nextSubmit;
+    uint64_t nextWork;
+    uint64_t nextWrite;
+    int shutdown;
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+    pthread_t threads[NEOAA_MAX_THREADS];
+    int threadCount;
+    /* Seekable streams only, every block as it is written */
+    int chunkTable;
+    NeoAAChunk *chunks;
+    size_t chunkCount;
+    size_t chunkCapacity;
+    uint64_t rawOffset;
+    uint64_t fileOffset;
+    NeoAAStats *stats;
+    int adaptive;
+    /* What a whole block of zeros compresses to, 0 until the first one came by */
+    uint8_t *zeroPayload;
+    size_t zeroPayloadSize;
+};
+
+static void store_be64(uint8_t *dst, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        dst[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0) {
+            perror("Failed to write output");
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+size_t neoaa_compress_block(NeoAACompression compression, const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize, void *scratch) {
+    if (compression == NEOAA_COMPRESS_LZFSE) {
+        /* 0 when it does not fit, which is exactly "not worth it" */
+        return lzfse_encode_buffer(dst, dstSize, src, srcSize, scratch);
+    }
+    if (compression == NEOAA_COMPRESS_ZLIB) {
+        /* Apple's zlib is raw DEFLATE, no zlib header or adler trailer */
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return 0;
+        }
+        stream.next_in = (Bytef *)src;
+        stream.avail_in = (uInt)srcSize;
+        stream.next_out = dst;
+        stream.avail_out = (uInt)dstSize;
+        int status = deflate(&stream, Z_FINISH);
+        size_t compressedSize = stream.total_out;
+        deflateEnd(&stream);
+        return status == Z_STREAM_END ? compressedSize : 0;
+    }
+    return 0;
+}
+
+size_t neoaa_decompress_block(NeoAACompression compression, const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize, void *scratch) {
+    if (compression == NEOAA_COMPRESS_LZFSE) {
+        return lzfse_decode_buffer(dst, dstSize, src, srcSize, scratch);
+    }
+    if (compression == NEOAA_COMPRESS_ZLIB) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -15) != Z_OK) {
+            return 0;
+        }
+        stream.next_in = (Bytef *)src;
+        stream.avail_in = (uInt)srcSize;
+        stream.next_out = dst;
+        stream.avail_out = (uInt)dstSize;
+        int status = inflate(&stream, Z_FINISH);
+        size_t decodedSize = stream.total_out;
+        inflateEnd(&stream);
+        return status == Z_STREAM_END ? decodedSize : 0;
+    }
+    return 0;
+}
+
+size_t neoaa_compress_scratch_size(NeoAACompression compression, int decode) {
+    if (compression != NEOAA_COMPRESS_LZFSE) {
+        return 0;
+    }
+    return decode ? lzfse_decode_scratch_size() : lzfse_encode_scratch_size();
+}
+
+/* Order 0 entropy of a window in bits per byte, plus how many of its 4 byte words repeat an earlier one */
+static double sample_window(const uint8_t *data, size_t size, uint32_t *seen, size_t *repeats) {
+    /* Four histograms so consecutive equal bytes do not wait on each other's increments */
+    uint32_t counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        counts[0][data[i]]++;
+        counts[1][data[i + 1]]++;
+        counts[2][data[i + 2]]++;
+        counts[3][data[i + 3]]++;
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        uint32_t *slot = &seen[(word * 2654435761u) >> 20];
+        *repeats += *slot == word;
+        *slot = word;
+    }
+    for (; i < size; i++) {
+        counts[0][data[i]]++;
+    }
+    double entropy = 0;
+    for (int value = 0; value < 256; value++) {
+        uint32_t count = counts[0][value] + counts[1][value] + counts[2][value] + counts[3][value];
+        if (count) {
+            double p = (double)count / size;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+/*
+ * Guess from two windows whether a segment is worth compressing.
+ * Already compressed data (JPEG, video, archives) has close to 8
+ * bits per byte and no repeats, text and most binaries are far
+ * below. A repeat check catches data that only looks random byte
+ * by byte but is made of copies LZ would still find.
+ */
+static int segment_incompressible(const uint8_t *data, size_t size) {
+    uint32_t seen[4096];
+    memset(seen, 0, sizeof(seen));
+    size_t repeats = 0;
+    size_t window = size < 2 * NEOAA_ADAPTIVE_WINDOW ? size : NEOAA_ADAPTIVE_WINDOW;
+    double entropy = sample_window(data, window, seen, &repeats);
+    size_t sampled = window;
+    if (size >= 2 * NEOAA_ADAPTIVE_WINDOW) {
+        entropy = (entropy + sample_window(data + size / 2, window, seen, &repeats)) / 2;
+        sampled += window;
+    }
+    return entropy >= NEOAA_ADAPTIVE_ENTROPY && repeats * 64 < sampled / 4;
+}
+
+/* Split input into compressed and raw runs, returns how many */
+static int plan_runs(const uint8_t *input, size_t inputSize, NeoAACompressRun *runs) {
+    size_t segmentSize = NEOAA_ADAPTIVE_SEGMENT;
+    if (inputSize > segmentSize * NEOAA_ADAPTIVE_MAX_SEGMENTS) {
+        segmentSize = (inputSize + NEOAA_ADAPTIVE_MAX_SEGMENTS - 1) / NEOAA_ADAPTIVE_MAX_SEGMENTS;
+    }
+    int count = 0;
+    for (size_t offset = 0; offset < inputSize; offset += segmentSize) {
+        size_t size = inputSize - offset < segmentSize ? inputSize - offset : segmentSize;
+        int compress = !segment_incompressible(input + offset, size);
+        if (count && runs[count - 1].compress == compress) {
+            runs[count - 1].rawSize += size;
+        } else {
+            runs[count].rawSize = size;
+            runs[count].compress = compress;
+            count++;
+        }
+    }
+    if (count == 1) {
+        return count;
+    }
+    /* A short raw run saves little and costs a block, fold it into its neighbours */
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        int compress = runs[i].compress || runs[i].rawSize < NEOAA_ADAPTIVE_MIN_RAW;
+        if (merged && runs[merged - 1].compress == compress) {
+            runs[merged - 1].rawSize += runs[i].rawSize;
+        } else {
+            runs[merged].rawSize = runs[i].rawSize;
+            runs[merged].compress = compress;
+            merged++;
+        }
+    }
+    return merged;
+}
+
+/* Split the slot into runs when adaptive and compress those that are worth it */
+static void compress_runs(NeoAACompressor compressor, NeoAACompressSlot *slot, void *scratch) {
+    if (compressor->adaptive) {
+        slot->runCount = plan_runs(slot->input, slot->inputSize, slot->runs);
+    } else {
+        slot->runs[0].rawSize = slot->inputSize;
+        slot->runs[0].compress = 1;
+        slot->runCount = 1;
+    }
+    /* Anything that does not shrink is stored raw, so the payloads always fit in output */
+    size_t inputOffset = 0;
+    size_t outputUsed = 0;
+    for (int i = 0; i < slot->runCount; i++) {
+        NeoAACompressRun *run = &slot->runs[i];
+        run->payloadSize = run->rawSize;
+        if (run->compress) {
+            size_t compressedSize = neoaa_compress_block(compressor->compression, slot->input + inputOffset, run->rawSize,
+                                                         slot->output + outputUsed, run->rawSize, scratch);
+            if (compressedSize && compressedSize < run->rawSize) {
+                run->payloadSize = compressedSize;
+                run->outputOffset = outputUsed;
+                outputUsed += compressedSize;
+            }
+        }
+        inputOffset += run->rawSize;
+    }
+}
+
+static int is_zero(const uint8_t *data, size_t size) {
+    return !size || (!data[0] && memcmp(data, data + 1, size - 1) == 0);
+}
+
+/* Holes of sparse files arrive as whole blocks of zeros, they all compress the same so that is done once */
+static void compress_zero_block(NeoAACompressor compressor, NeoAACompressSlot *slot, void *scratch) {
+    NeoAACompressRun *run = &slot->runs[0];
+    slot->runCount = 1;
+    run->rawSize = slot->inputSize;
+    run->payloadSize = slot->inputSize;
+    run->outputOffset = 0;
+    run->compress = 1;
+    pthread_mutex_lock(&compressor->lock);
+    size_t cached = compressor->zeroPayloadSize;
+    if (cached) {
+        memcpy(slot->output, compressor->zeroPayload, cached);
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    if (cached) {
+        run->payloadSize = cached;
+        return;
+    }
+    size_t compressedSize = neoaa_compress_block(compressor->compression, slot->input, slot->inputSize,
+                                                 slot->output, slot->inputSize, scratch);
+    if (!compressedSize || compressedSize >= slot->inputSize) {
+        return;
+    }
+    run->payloadSize = compressedSize;
+    uint8_t *copy = (uint8_t *)malloc(compressedSize);
+    if (copy) {
+        memcpy(copy, slot->output, compressedSize);
+        pthread_mutex_lock(&compressor->lock);
+        if (!compressor->zeroPayloadSize) {
+            compressor->zeroPayload = copy;
+            compressor->zeroPayloadSize = compressedSize;
+            copy = NULL;
+        }
+        pthread_mutex_unlock(&compressor->lock);
+        free(copy);
+    }
+}
+
+static void *compressor_thread(void *context) {
+    NeoAACompressor compressor = (NeoAACompressor)context;
+    void *scratch = NULL;
+    size_t scratchSize = neoaa_compress_scratch_size(compressor->compression, 0);
+    if (scratchSize) {
+        scratch = malloc(scratchSize);
+    }
+    pthread_mutex_lock(&compressor->lock);
+    for (;;) {
+        while (!compressor->shutdown && compressor->nextWork == compressor->nextSubmit) {
+            pthread_cond_wait(&compressor->workCond, &compressor->lock);
+        }
+        if (compressor->nextWork == compressor->nextSubmit) {
+            break;
+        }
+        NeoAACompressSlot *slot = &compressor->slots[compressor->nextWork++ % compressor->slotCount];
+        if (slot->copy) {
+            /* Nothing to do, just keep the order */
+            slot->done = 1;
+            pthread_cond_broadcast(&compressor->doneCond);
+            continue;
+        }
+        pthread_mutex_unlock(&compressor->lock);
+
+        uint64_t start = neoaa_stats_start(compressor->stats);
+        if (slot->inputSize == compressor->blockSize && is_zero(slot->input, slot->inputSize)) {
+            compress_zero_block(compressor, slot, scratch);
+        } else {
+            compress_runs(compressor, slot, scratch);
+        }
+        neoaa_stats_phase(compressor->stats, NEOAA_PHASE_COMPRESS, start, slot->inputSize, 0);
+
+        pthread_mutex_lock(&compressor->lock);
+        slot->done = 1;
+        pthread_cond_broadcast(&compressor->doneCond);
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    free(scratch);
+    return NULL;
+}
+
+static NeoAACompressor compressor_start(int fd, NeoAACompression compression, size_t blockSize, int threadCount,
+                                        int writeStreamHeader, uint64_t fileOffset) {
+    if (compression != NEOAA_COMPRESS_LZFSE && compression != NEOAA_COMPRESS_ZLIB) {
+        return NULL;
+    }
+    if (!blockSize) {
+        blockSize = NEOAA_DEFAULT_BLOCK_SIZE;
+    }
+    if (threadCount <= 0) {
+        threadCount = neoaa_default_thread_count();
+    }
+    if (threadCount > NEOAA_MAX_THREADS) {
+        threadCount = NEOAA_MAX_THREADS;
+    }
+    NeoAACompressor compressor = (NeoAACompressor)calloc(1, sizeof(struct neoaa_compressor_impl));
+    if (!compressor) {
+        return NULL;
+    }
+    compressor->fd = fd;
+    compressor->compression = compression;
+    compressor->blockSize = blockSize;
+    /* Two blocks per worker so the workers never wait on the writer */
+    compressor->slotCount = threadCount * 2;
+    compressor->slots = (NeoAACompressSlot *)calloc(compressor->slotCount, sizeof(NeoAACompressSlot));
+    if (!compressor->slots) {
+        free(compressor);
+        return NULL;
+    }
+    for (int i = 0; i < compressor->slotCount; i++) {
+        compressor->slots[i].input = (uint8_t *)malloc(blockSize);
+        compressor->slots[i].output = (uint8_t *)malloc(blockSize);
+        if (!compressor->slots[i].input || !compressor->slots[i].output) {
+            compressor->error = -2;
+        }
+    }
+
+    if (writeStreamHeader) {
+        uint8_t streamHeader[NEOAA_STREAM_HEADER_SIZE];
+        memcpy(streamHeader, compression == NEOAA_COMPRESS_LZFSE ? "pbze" : "pbzz", 4);
+        store_be64(streamHeader + 4, blockSize);
+        if (!compressor->error && write_all(fd, streamHeader, sizeof(streamHeader)) != 0) {
+            compressor->error = -1;
+        }
+        fileOffset = sizeof(streamHeader);
+    }
+    compressor->fileOffset = fileOffset;
+
+    pthread_mutex_init(&compressor->lock, NULL);
+    pthread_cond_init(&compressor->workCond, NULL);
+    pthread_cond_init(&compressor->doneCond, NULL);
+    for (int i = 0; i < threadCount && !compressor->error; i++) {
+        if (pthread_create(&compressor->threads[i], NULL, compressor_thread, compressor) != 0) {
+            break;
+        }
+        compressor->threadCount++;
+    }
+    if (!compressor->threadCount) {
+        compressor->error = -2;
+    }
+    if (compressor->error) {
+        neoaa_compressor_finish(compressor, NULL, NULL);
+        return NULL;
+    }
+    return compressor;
+}
+
+NeoAACompressor neoaa_compressor_create(int fd, NeoAACompression compression, size_t blockSize, int threadCount) {
+    return compressor_start(fd, compression, blockSize, threadCount, 1, 0);
+}
+
+NeoAACompressor neoaa_compressor_resume(int fd, NeoAACompression compression, size_t blockSize, int threadCount,
+                                        const NeoAAChunk *chunks, size_t chunkCount, uint64_t rawOffset, uint64_t fileOffset) {
+    NeoAAChunk *copy = NULL;
+    if (chunks) {
+        copy = (NeoAAChunk *)malloc((chunkCount ? chunkCount : 1) * sizeof(NeoAAChunk));
+        if (!copy) {
+            return NULL;
+        }
+        memcpy(copy, chunks, chunkCount * sizeof(NeoAAChunk));
+    }
+    NeoAACompressor compressor = compressor_start(fd, compression, blockSize, threadCount, 0, fileOffset);
+    if (!compressor) {
+        free(copy);
+        return NULL;
+    }
+    if (copy) {
+        compressor->chunkTable = 1;
+        compressor->chunks = copy;
+        compressor->chunkCount = chunkCount;
+        compressor->chunkCapacity = chunkCount ? chunkCount : 1;
+        compressor->rawOffset = rawOffset;
+    }
+    return compressor;
+}
+
+void neoaa_compressor_enable_chunk_table(NeoAACompressor compressor) {
+    compressor->chunkTable = 1;
+}
+
+static int compressor_record_chunk(NeoAACompressor compressor, size_t rawSize, size_t payloadSize) {
+    if (compressor->chunkCount == compressor->chunkCapacity) {
+        size_t capacity = compressor->chunkCapacity ? compressor->chunkCapacity * 2 : 256;
+        NeoAAChunk *chunks = (NeoAAChunk *)realloc(compressor->chunks, capacity * sizeof(NeoAAChunk));
+        if (!chunks) {
+            return -1;
+        }
+        compressor->chunks = chunks;
+        compressor->chunkCapacity = capacity;
+    }
+    compressor->chunks[compressor->chunkCount].rawOffset = compressor->rawOffset;
+    compressor->chunks[compressor->chunkCount].fileOffset = compressor->fileOffset;
+    compressor->chunkCount++;
+    compressor->rawOffset += rawSize;
+    compressor->fileOffset += NEOAA_BLOCK_HEADER_SIZE + payloadSize;
+    return 0;
+}
+
+/* Write out the oldest block, waiting for its worker if needed. Called with the lock held. */
+static void compressor_write_oldest(NeoAACompressor compressor) {
+    NeoAACompressSlot *slot = &compressor->slots[compressor->nextWrite % compressor->slotCount];
+    while (!slot->done) {
+        pthread_cond_wait(&compressor->doneCond, &compressor->lock);
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    uint64_t start = neoaa_stats_start(compressor->stats);
+    size_t inputOffset = 0;
+    for (int i = 0; i < slot->runCount && !compressor->error; i++) {
+        const NeoAACompressRun *run = &slot->runs[i];
+        uint8_t blockHeader[16];
+        store_be64(blockHeader, run->rawSize);
+        store_be64(blockHeader + 8, run->payloadSize);
+        if ((compressor->chunkTable && compressor_record_chunk(compressor, run->rawSize, run->payloadSize) != 0)
+            || write_all(compressor->fd, blockHeader, sizeof(blockHeader)) != 0) {
+            compressor->error = -1;
+        } else if (slot->copy) {
+            if (neoaa_copy_range(slot->copyFd, slot->copyOffset, compressor->fd, run->payloadSize) != 0) {
+                compressor->error = -1;
+            }
+        } else if (write_all(compressor->fd,
+                             run->payloadSize < run->rawSize ? slot->output + run->outputOffset : slot->input + inputOffset,
+                             run->payloadSize) != 0) {
+            compressor->error = -1;
+        }
+        inputOffset += run->rawSize;
+        neoaa_stats_phase(compressor->stats, NEOAA_PHASE_WRITE, start, sizeof(blockHeader) + run->payloadSize, 0);
+        start = neoaa_stats_start(compressor->stats);
+    }
+    pthread_mutex_lock(&compressor->lock);
+    slot->done = 0;
+    compressor->nextWrite++;
+}
+
+/* Flush whatever already finished in order, then make room. Called with the lock held, NULL once writing failed. */
+static NeoAACompressSlot *compressor_next_slot(NeoAACompressor compressor) {
+    while (compressor->nextWrite < compressor->nextSubmit
+           && (compressor->slots[compressor->nextWrite % compressor->slotCount].done
+               || compressor->nextSubmit - compressor->nextWrite == (uint64_t)compressor->slotCount)) {
+        compressor_write_oldest(compressor);
+    }
+    if (compressor->error) {
+        return NULL;
+    }
+    return &compressor->slots[compressor->nextSubmit % compressor->slotCount];
+}
+
+uint8_t *neoaa_compressor_submit(NeoAACompressor compressor, uint8_t *block, size_t size) {
+    pthread_mutex_lock(&compressor->lock);
+    NeoAACompressSlot *slot = compressor_next_slot(compressor);
+    if (!slot) {
+        pthread_mutex_unlock(&compressor->lock);
+        return NULL;
+    }
+    uint8_t *freeBuffer = slot->input;
+    slot->input = block;
+    slot->inputSize = size;
+    slot->runCount = 0;
+    slot->copy = 0;
+    slot->done = 0;
+    compressor->nextSubmit++;
+    pthread_cond_signal(&compressor->workCond);
+    pthread_mutex_unlock(&compressor->lock);
+    return freeBuffer;
+}
+
+int neoaa_compressor_submit_copy(NeoAACompressor compressor, int fd, uint64_t offset, size_t rawSize, size_t payloadSize) {
+    if (!rawSize || rawSize > compressor->blockSize || payloadSize > rawSize) {
+        return -1;
+    }
+    pthread_mutex_lock(&compressor->lock);
+    NeoAACompressSlot *slot = compressor_next_slot(compressor);
+    if (!slot) {
+        pthread_mutex_unlock(&compressor->lock);
+        return -1;
+    }
+    slot->inputSize = rawSize;
+    slot->runs[0].rawSize = rawSize;
+    slot->runs[0].payloadSize = payloadSize;
+    slot->runCount = 1;
+    slot->copy = 1;
+    slot->copyFd = fd;
+    slot->copyOffset = offset;
+    slot->done = 0;
+    compressor->nextSubmit++;
+    pthread_cond_signal(&compressor->workCond);
+    pthread_mutex_unlock(&compressor->lock);
+    return 0;
+}
+
+void neoaa_compressor_set_stats(NeoAACompressor compressor, NeoAAStats *stats) {
+    pthread_mutex_lock(&compressor->lock);
+    compressor->stats = stats;
+    pthread_mutex_unlock(&compressor->lock);
+}
+
+void neoaa_compressor_set_adaptive(NeoAACompressor compressor, int enabled) {
+    pthread_mutex_lock(&compressor->lock);
+    compressor->adaptive = enabled;
+    pthread_mutex_unlock(&compressor->lock);
+}
+
+NeoAACompression neoaa_compressor_compression(NeoAACompressor compressor) {
+    return compressor->compression;
+}
+
+int neoaa_compressor_finish(NeoAACompressor compressor, NeoAAChunk **chunks, size_t *chunkCount) {
+    pthread_mutex_lock(&compressor->lock);
+    while (compressor->threadCount && compressor->nextWrite < compressor->nextSubmit) {
+        compressor_write_oldest(compressor);
+    }
+    compressor->shutdown = 1;
+    pthread_cond_broadcast(&compressor->workCond);
+    pthread_mutex_unlock(&compressor->lock);
+    for (int i = 0; i < compressor->threadCount; i++) {
+        pthread_join(compressor->threads[i], NULL);
+    }
+    int error = compressor->error;
+    if (chunks) {
+        /* Only a table that covers every block is any use */
+        *chunks = compressor->chunkTable && !error ? compressor->chunks : NULL;
+        *chunkCount = *chunks ? compressor->chunkCount : 0;
+    }
+    if (!chunks || !*chunks) {
+        free(compressor->chunks);
+    }
+    free(compressor->zeroPayload);
+    for (int i = 0; i < compressor->slotCount; i++) {
+        free(compressor->slots[i].input);
+        free(compressor->slots[i].output);
+    }
+    free(compressor->slots);
+    pthread_mutex_destroy(&compressor->lock);
+    pthread_cond_destroy(&compressor->workCond);
+    pthread_cond_destroy(&compressor->doneCond);
+    free(compressor);
+    return error;
+}
@@ -0,0 +1,109 @@
+/*
+ *  compress.h
+ *  neoaa
+ *
+ *  Parallel block compressor producing the pbz* stream used by
+ *  compressed Apple Archives: a 4 byte magic, the big endian
+ *  64 bit block size, then per block the big endian uncompressed
+ *  and compressed sizes followed by the payload. A payload whose
+ *  two sizes match is stored raw.
+ *
+ *  Seekable streams are the same stream with smaller blocks. The
+ *  compressor records the (uncompressed offset, file offset of
+ *  the block header) of every block and finish hands that chunk
+ *  table over, the writer keeps it beside the archive (see
+ *  reader.h) so nothing but blocks is ever in the stream.
+ *
+ *  Adaptive compressors sample every block first and split it
+ *  into runs, those that look incompressible are stored raw as
+ *  their own blocks without trying. Blocks may therefore be
+ *  shorter than the block size anywhere in the stream. The stream
+ *  keeps the one algorithm its magic names, standard readers
+ *  know no other way.
+ */
+
+#ifndef NEOAA_COMPRESS_H
+#define NEOAA_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stats.h"
+
+typedef enum {
+    NEOAA_COMPRESS_LZFSE,
+    NEOAA_COMPRESS_RAW,
+    NEOAA_COMPRESS_ZLIB,
+} NeoAACompression;
+
+#define NEOAA_DEFAULT_BLOCK_SIZE (4 * 1024 * 1024)
+/* Smaller blocks for seekable streams so a random read decodes less */
+#define NEOAA_SEEKABLE_BLOCK_SIZE (1024 * 1024)
+
+/* Opens the chunk table file saved beside a seekable archive */
+#define NEOAA_CHUNK_TABLE_MAGIC "NAACHUNK"
+#define NEOAA_STREAM_HEADER_SIZE 12
+#define NEOAA_BLOCK_HEADER_SIZE 16
+
+typedef struct {
+    uint64_t rawOffset;  /* first uncompressed byte of the chunk */
+    uint64_t fileOffset; /* its block header in the file */
+} NeoAAChunk;
+
+typedef struct neoaa_compressor_impl *NeoAACompressor;
+
+/* Writes the stream header to fd straight away. RAW is not a valid compression here. */
+NeoAACompressor neoaa_compressor_create(int fd, NeoAACompression compression, size_t blockSize, int threadCount);
+
+/*
+ * Continue a stream that already has blocks, appending at the
+ * current position of fd. fileOffset is that position relative
+ * to the stream header, rawOffset the uncompressed size so far.
+ * When chunks is given the chunk table is enabled and the one
+ * finish hands over covers the old blocks as well.
+ */
+NeoAACompressor neoaa_compressor_resume(int fd, NeoAACompression compression, size_t blockSize, int threadCount,
+                                        const NeoAAChunk *chunks, size_t chunkCount, uint64_t rawOffset, uint64_t fileOffset);
+
+/* Record every block for the chunk table finish hands over. Call before the first submit. */
+void neoaa_compressor_enable_chunk_table(NeoAACompressor compressor);
+
+/*
+ * Queue one block of at most blockSize bytes. The compressor takes
+ * ownership of block and hands back an empty blockSize buffer for
+ * the caller to fill next, blocking while all workers are busy.
+ * Returns NULL once a write to fd has failed.
+ */
+uint8_t *neoaa_compressor_submit(NeoAACompressor compressor, uint8_t *block, size_t size);
+
+/*
+ * Queue a block that is already compressed with the same
+ * algorithm, payloadSize bytes at offset in fd, so it goes out
+ * without being decoded or compressed again. fd has to stay
+ * open until the block is written. Non zero once a write failed.
+ */
+int neoaa_compressor_submit_copy(NeoAACompressor compressor, int fd, uint64_t offset, size_t rawSize, size_t payloadSize);
+
+NeoAACompression neoaa_compressor_compression(NeoAACompressor compressor);
+/* Sample blocks submitted from now on and store what will not shrink raw, see above */
+void neoaa_compressor_set_adaptive(NeoAACompressor compressor, int enabled);
+/* Time the blocks from now on, call before submitting */
+void neoaa_compressor_set_stats(NeoAACompressor compressor, NeoAAStats *stats);
+
+/*
+ * Wait for every queued block, write it and free the compressor.
+ * Non zero if anything failed. With chunks given, the chunk table
+ * of a compressor that has one and did not fail is handed over
+ * for the caller to free, NULL otherwise.
+ */
+int neoaa_compressor_finish(NeoAACompressor compressor, NeoAAChunk **chunks, size_t *chunkCount);
+
+/* One block, used by the workers and anyone else who needs a single chunk */
+size_t neoaa_compress_block(NeoAACompression compression, const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize, void *scratch);
+
+/* Inverse of neoaa_compress_block, returns the decoded size or 0 on failure */
+size_t neoaa_decompress_block(NeoAACompression compression, const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize, void *scratch);
+
+/* Scratch needed by either direction for an algorithm, may be 0 */
+size_t neoaa_compress_scratch_size(NeoAACompression compression, int decode);
+
+#endif /* NEOAA_COMPRESS_H */
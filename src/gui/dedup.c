@@ -0,0 +1,339 @@
+/*
+ *  dedup.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "dedup.h"
+#include "fileio.h"
+#include "pool.h"
+
+/* Candidates hashed or compared by one task */
+#define NEOAA_DEDUP_BATCH 64
+
+#define NEOAA_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define NEOAA_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define NEOAA_HASH_PRIME3 0x165667B19E3779F9ULL
+
+typedef struct {
+    uint64_t size;
+    size_t index; /* into the walk entries */
+    uint64_t hash[2];
+    int hashed;
+    size_t origin; /* candidate it has to be compared with, or itself */
+    int same;
+} NeoAADedupCandidate;
+
+typedef struct {
+    const char *root;
+    NeoAAWalkEntry *entries;
+    NeoAADedupCandidate *candidates;
+    NeoAAProgress *progress;
+} NeoAADedupContext;
+
+typedef struct {
+    NeoAADedupContext *context;
+    size_t *work; /* candidate numbers */
+    size_t count;
+} NeoAADedupBatch;
+
+static inline uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t load64(const uint8_t *src) {
+    /* Host order, hashes are only ever compared within one run */
+    uint64_t value;
+    memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+static inline uint64_t avalanche(uint64_t value) {
+    value ^= value >> 33;
+    value *= NEOAA_HASH_PRIME2;
+    value ^= value >> 29;
+    value *= NEOAA_HASH_PRIME3;
+    value ^= value >> 32;
+    return value;
+}
+
+void neoaa_content_hash(const void *data, size_t size, uint64_t hash[2]) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t lanes[4] = {
+        NEOAA_HASH_PRIME1 + NEOAA_HASH_PRIME2, NEOAA_HASH_PRIME2, 0, (uint64_t)0 - NEOAA_HASH_PRIME1,
+    };
+    /* 32 byte stripes, the lanes do not depend on each other */
+    size_t stripes = size / 32;
+    for (size_t i = 0; i < stripes; i++) {
+        const uint8_t *stripe = bytes + i * 32;
+        for (int lane = 0; lane < 4; lane++) {
+            lanes[lane] = rotl64(lanes[lane] + load64(stripe + lane * 8) * NEOAA_HASH_PRIME2, 31) * NEOAA_HASH_PRIME1;
+        }
+    }
+    uint8_t tail[32];
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, bytes + stripes * 32, size % 32);
+    for (int lane = 0; lane < 4; lane++) {
+        lanes[lane] = rotl64(lanes[lane] + load64(tail + lane * 8) * NEOAA_HASH_PRIME2, 31) * NEOAA_HASH_PRIME1;
+    }
+    uint64_t first = (uint64_t)size * NEOAA_HASH_PRIME3;
+    uint64_t second = ~(uint64_t)size;
+    for (int lane = 0; lane < 4; lane++) {
+        first = rotl64(first ^ lanes[lane], 27) * NEOAA_HASH_PRIME1 + NEOAA_HASH_PRIME3;
+        second = rotl64(second + lanes[3 - lane] * NEOAA_HASH_PRIME3, 29) * NEOAA_HASH_PRIME2;
+    }
+    hash[0] = avalanche(first);
+    hash[1] = avalanche(second ^ first);
+}
+
+static uint64_t hash_identity(uint64_t dev, uint64_t ino) {
+    return avalanche(dev * NEOAA_HASH_PRIME1 ^ ino);
+}
+
+/* Every later link to an inode points at the first one in archive order, each inode gets its own HLC id */
+static size_t dedup_hardlinks(NeoAAWalkEntry *entries, size_t entryCount) {
+    size_t linked = 0;
+    size_t clusters = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (S_ISREG(entries[i].mode) && entries[i].nlink > 1) {
+            linked++;
+        }
+    }
+    if (linked < 2) {
+        return 0;
+    }
+    size_t bucketCount = 16;
+    while (bucketCount < linked * 2) {
+        bucketCount *= 2;
+    }
+    /* Entry index + 1, 0 as empty */
+    size_t *buckets = (size_t *)calloc(bucketCount, sizeof(size_t));
+    if (!buckets) {
+        return 0;
+    }
+    size_t found = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        NeoAAWalkEntry *entry = &entries[i];
+        if (!S_ISREG(entry->mode) || entry->nlink < 2) {
+            continue;
+        }
+        size_t slot = hash_identity(entry->dev, entry->ino) & (bucketCount - 1);
+        while (buckets[slot]) {
+            const NeoAAWalkEntry *first = &entries[buckets[slot] - 1];
+            if (first->dev == entry->dev && first->ino == entry->ino) {
+                break;
+            }
+            slot = (slot + 1) & (bucketCount - 1);
+        }
+        if (buckets[slot]) {
+            NeoAAWalkEntry *origin = &entries[buckets[slot] - 1];
+            if (!origin->hardlinkCluster) {
+                origin->hardlinkCluster = (uint32_t)++clusters;
+            }
+            entry->duplicateOf = origin->path;
+            entry->hardlinkCluster = origin->hardlinkCluster;
+            found++;
+        } else {
+            buckets[slot] = i + 1;
+        }
+    }
+    free(buckets);
+    return found;
+}
+
+static int compare_by_size(const void *a, const void *b) {
+    const NeoAADedupCandidate *left = (const NeoAADedupCandidate *)a;
+    const NeoAADedupCandidate *right = (const NeoAADedupCandidate *)b;
+    if (left->size != right->size) {
+        return left->size < right->size ? -1 : 1;
+    }
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+/* Unhashed ones last, then by hash and archive order so the first of a run is the origin */
+static int compare_by_hash(const void *a, const void *b) {
+    const NeoAADedupCandidate *left = (const NeoAADedupCandidate *)a;
+    const NeoAADedupCandidate *right = (const NeoAADedupCandidate *)b;
+    if (left->hashed != right->hashed) {
+        return left->hashed ? -1 : 1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (left->hash[i] != right->hash[i]) {
+            return left->hash[i] < right->hash[i] ? -1 : 1;
+        }
+    }
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+static void *map_entry(NeoAADedupContext *context, size_t index, size_t *size) {
+    char *fullPath = neoaa_join_path(context->root, context->entries[index].path);
+    if (!fullPath) {
+        return NULL;
+    }
+    void *data = neoaa_map_file(fullPath, size);
+    free(fullPath);
+    return data;
+}
+
+static void hash_batch_run(void *batchContext) {
+    NeoAADedupBatch *batch = (NeoAADedupBatch *)batchContext;
+    NeoAADedupContext *context = batch->context;
+    for (size_t i = 0; i < batch->count && !neoaa_progress_cancelled(context->progress); i++) {
+        NeoAADedupCandidate *candidate = &context->candidates[batch->work[i]];
+        size_t size;
+        void *data = map_entry(context, candidate->index, &size);
+        if (!data) {
+            continue;
+        }
+        /* A file that changed size since the walk is archived on its own */
+        if (size == candidate->size) {
+            neoaa_content_hash(data, size, candidate->hash);
+            candidate->hashed = 1;
+        }
+        neoaa_unmap_file(data, size);
+    }
+    free(batch);
+}
+
+static void compare_batch_run(void *batchContext) {
+    NeoAADedupBatch *batch = (NeoAADedupBatch *)batchContext;
+    NeoAADedupContext *context = batch->context;
+    for (size_t i = 0; i < batch->count && !neoaa_progress_cancelled(context->progress); i++) {
+        NeoAADedupCandidate *candidate = &context->candidates[batch->work[i]];
+        const NeoAADedupCandidate *origin = &context->candidates[candidate->origin];
+        size_t size;
+        size_t originSize;
+        void *data = map_entry(context, candidate->index, &size);
+        void *originData = map_entry(context, origin->index, &originSize);
+        candidate->same = data && originData && size == candidate->size && originSize == size
+            && memcmp(data, originData, size) == 0;
+        neoaa_unmap_file(data, size);
+        neoaa_unmap_file(originData, originSize);
+    }
+    free(batch);
+}
+
+/* Runs fn over the listed candidates in batches on the pool and waits for all of them */
+static void run_batches(NeoAAPool pool, NeoAADedupContext *context, size_t *work, size_t count, NeoAATaskFunction function) {
+    for (size_t start = 0; start < count; start += NEOAA_DEDUP_BATCH) {
+        NeoAADedupBatch *batch = (NeoAADedupBatch *)malloc(sizeof(NeoAADedupBatch));
+        if (!batch) {
+            break;
+        }
+        batch->context = context;
+        batch->work = work + start;
+        batch->count = count - start < NEOAA_DEDUP_BATCH ? count - start : NEOAA_DEDUP_BATCH;
+        if (neoaa_pool_submit(pool, function, batch) != 0) {
+            function(batch);
+        }
+    }
+    neoaa_pool_wait(pool);
+}
+
+int neoaa_dedup_entries(const char *dirPath, NeoAAWalkEntry *entries, size_t entryCount, int threadCount,
+                        NeoAAProgress *progress, NeoAADedupStats *stats) {
+    NeoAADedupStats local;
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(NeoAADedupStats));
+    stats->hardlinks = dedup_hardlinks(entries, entryCount);
+    for (size_t i = 0; i < entryCount; i++) {
+        if (entries[i].duplicateOf) {
+            stats->bytesSaved += entries[i].size;
+        }
+    }
+
+    size_t candidateCount = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (S_ISREG(entries[i].mode) && !entries[i].duplicateOf && entries[i].size >= NEOAA_DEDUP_MIN_SIZE) {
+            candidateCount++;
+        }
+    }
+    if (candidateCount < 2) {
+        return 0;
+    }
+    NeoAADedupCandidate *candidates = (NeoAADedupCandidate *)calloc(candidateCount, sizeof(NeoAADedupCandidate));
+    size_t *work = (size_t *)malloc(candidateCount * sizeof(size_t));
+    NeoAAPool pool = neoaa_pool_create(threadCount);
+    if (!candidates || !work || !pool) {
+        /* Not being able to dedup is not an error, the archive is just bigger */
+        free(candidates);
+        free(work);
+        neoaa_pool_destroy(pool);
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (S_ISREG(entries[i].mode) && !entries[i].duplicateOf && entries[i].size >= NEOAA_DEDUP_MIN_SIZE) {
+            candidates[count].size = entries[i].size;
+            candidates[count].index = i;
+            count++;
+        }
+    }
+    qsort(candidates, candidateCount, sizeof(NeoAADedupCandidate), compare_by_size);
+
+    NeoAADedupContext context;
+    context.root = dirPath;
+    context.entries = entries;
+    context.candidates = candidates;
+    context.progress = progress;
+
+    /* Only files sharing their size with another one are worth reading */
+    size_t workCount = 0;
+    for (size_t start = 0, end; start < candidateCount; start = end) {
+        for (end = start + 1; end < candidateCount && candidates[end].size == candidates[start].size; end++) {
+        }
+        for (size_t i = start; end - start > 1 && i < end; i++) {
+            work[workCount++] = i;
+        }
+    }
+    run_batches(pool, &context, work, workCount, hash_batch_run);
+
+    /* Within a size, equal hashes are compared byte for byte with the first of their run */
+    workCount = 0;
+    for (size_t start = 0, end; start < candidateCount; start = end) {
+        for (end = start + 1; end < candidateCount && candidates[end].size == candidates[start].size; end++) {
+        }
+        if (end - start < 2) {
+            continue;
+        }
+        qsort(candidates + start, end - start, sizeof(NeoAADedupCandidate), compare_by_hash);
+        size_t origin = start;
+        for (size_t i = start + 1; i < end && candidates[i].hashed; i++) {
+            if (memcmp(candidates[i].hash, candidates[origin].hash, sizeof(candidates[i].hash)) != 0) {
+                origin = i;
+                continue;
+            }
+            candidates[i].origin = origin;
+            work[workCount++] = i;
+        }
+    }
+    run_batches(pool, &context, work, workCount, compare_batch_run);
+    neoaa_pool_destroy(pool);
+
+    int result = neoaa_progress_cancelled(progress) ? NEOAA_ERR_CANCELLED : 0;
+    /* One CLC id per origin, kept apart from the HLC ids */
+    size_t clusters = 0;
+    for (size_t i = 0; !result && i < workCount; i++) {
+        const NeoAADedupCandidate *candidate = &candidates[work[i]];
+        if (!candidate->same) {
+            continue;
+        }
+        NeoAAWalkEntry *entry = &entries[candidate->index];
+        NeoAAWalkEntry *origin = &entries[candidates[candidate->origin].index];
+        if (!origin->cloneCluster) {
+            origin->cloneCluster = (uint32_t)++clusters;
+        }
+        entry->duplicateOf = origin->path;
+        entry->cloneCluster = origin->cloneCluster;
+        stats->copies++;
+        stats->bytesSaved += entry->size;
+    }
+    free(candidates);
+    free(work);
+    return result;
+}
@@ -0,0 +1,43 @@
+/*
+ *  dedup.h
+ *  neoaa
+ *
+ *  Duplicate detection run over the walk entries before they are
+ *  archived. Hard links are found by device and inode without
+ *  reading anything. Files of equal size are then hashed in
+ *  parallel and byte compared against the first file with the
+ *  same hash, so a hash collision can never merge two files.
+ *  Every later copy is marked with the first one's path and gets
+ *  written as a header without data (see neoaa_walk_build_header),
+ *  sharing an HLC or CLC cluster id with the first one.
+ */
+
+#ifndef NEOAA_DEDUP_H
+#define NEOAA_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "progress.h"
+#include "walk.h"
+
+/* Smaller files are left alone, saving them is hardly worth the extra work on extract */
+#define NEOAA_DEDUP_MIN_SIZE 1024
+
+typedef struct {
+    size_t hardlinks;
+    size_t copies;
+    uint64_t bytesSaved;
+} NeoAADedupStats;
+
+/*
+ * Sets duplicateOf and the cluster ids on the sorted entries.
+ * Returns 0, or NEOAA_ERR_CANCELLED. Files that cannot be read
+ * are simply not deduplicated. stats may be NULL.
+ */
+int neoaa_dedup_entries(const char *dirPath, NeoAAWalkEntry *entries, size_t entryCount, int threadCount,
+                        NeoAAProgress *progress, NeoAADedupStats *stats);
+
+/* 128 bit content hash, four independent lanes so the loop vectorizes */
+void neoaa_content_hash(const void *data, size_t size, uint64_t hash[2]);
+
+#endif /* NEOAA_DEDUP_H */
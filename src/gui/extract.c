@@ -0,0 +1,1069 @@
+/*
+ *  extract.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "extract.h"
+#include "fileio.h"
+#include "patindex.h"
+#include "pool.h"
+#include "arena.h"
+#include "scan.h"
+#include "walk.h"
+#include "writer.h"
+#include "checksum.h"
+
+/* Charged against the memory budget per task so tiny files cannot queue without bound */
+#define NEOAA_EXTRACT_TASK_OVERHEAD 4096
+/* Metadata records handed to a worker at once in the final pass */
+#define NEOAA_EXTRACT_META_BATCH 512
+
+/* What the final pass has to apply to one entry */
+typedef struct {
+    char *path;
+    char *link;
+    char type;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    int hasUid;
+    int hasGid;
+    int hasMode;
+} NeoAAExtractMeta;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t limit;
+    size_t inFlight;
+    /* File data of the tasks, recycled instead of a malloc per file */
+    NeoAABufferPool buffers;
+    NeoAAStats *stats;
+    int error;
+    NeoAAProgress *progress;
+    /* Plain archives on disk are copied from here by the workers, -1 otherwise */
+    int archiveFd;
+    /* Second descriptor of that archive to find its holes with, -1 if there is none */
+    int holeFd;
+    mode_t mask;
+    int applyOwners;
+    /* Check CKS and SH2 where the header has them, verifyOnly writes nothing at all */
+    int verify;
+    int verifyOnly;
+    size_t checked;
+    size_t mismatched;
+} NeoAAExtractContext;
+
+/* A large file shared by the tasks writing its pieces, closed by the last one */
+typedef struct {
+    int fd;
+    int references;
+} NeoAAExtractFile;
+
+typedef struct {
+    NeoAAExtractContext *context;
+    char *path;              /* whole file, opened by the worker */
+    NeoAAExtractFile *file;  /* or one piece of an already open file */
+    uint8_t *data;           /* NULL copies from archiveFd instead */
+    uint64_t archiveOffset;
+    uint64_t fileOffset;
+    uint64_t size;
+    size_t cost;
+    /* Checksums the data has to match, fields 0 if there is nothing to check */
+    NeoAADigest expected;
+    int digestFields;
+} NeoAAExtractTask;
+
+typedef struct {
+    NeoAAExtractContext *context;
+    NeoAAExtractMeta *meta;
+    size_t count;
+} NeoAAExtractMetaBatch;
+
+/* A file stored as a reference to another entry, made once every file is written */
+typedef struct {
+    NeoAAExtractContext *context;
+    char *path;
+    char *origin;
+    char kind; /* 'H' hard link, 'C' copy */
+} NeoAAExtractDuplicate;
+
+typedef struct {
+    NeoAAExtractDuplicate *items;
+    size_t count;
+    size_t malloc;
+} NeoAAExtractDuplicateList;
+
+/* First file seen of an HLC or CLC cluster, the one later members are made from */
+typedef struct {
+    uint64_t id;
+    char kind;    /* 'H' or 'C', the two kinds number their clusters apart */
+    char *origin; /* NULL for an empty slot */
+} NeoAAExtractCluster;
+
+typedef struct {
+    /* Open addressing, slotCount is a power of two */
+    NeoAAExtractCluster *slots;
+    size_t slotCount;
+    size_t count;
+} NeoAAExtractClusterMap;
+
+void neoaa_created_paths_add(NeoAACreatedPaths *created, const char *path) {
+    if (created->count == created->malloc) {
+        size_t newMalloc = created->malloc ? created->malloc * 2 : 64;
+        char **newPaths = (char **)realloc(created->paths, sizeof(char *) * newMalloc);
+        if (!newPaths) {
+            return;
+        }
+        created->paths = newPaths;
+        created->malloc = newMalloc;
+    }
+    char *copy = strdup(path);
+    if (copy) {
+        created->paths[created->count++] = copy;
+    }
+}
+
+void neoaa_created_paths_remove(NeoAACreatedPaths *created) {
+    for (size_t i = created->count; i > 0; i--) {
+        if (remove(created->paths[i - 1]) != 0 && errno != ENOENT) {
+            fprintf(stderr, "Failed to clean up %s\n", created->paths[i - 1]);
+        }
+    }
+}
+
+void neoaa_created_paths_free(NeoAACreatedPaths *created) {
+    for (size_t i = 0; i < created->count; i++) {
+        free(created->paths[i]);
+    }
+    free(created->paths);
+}
+
+int neoaa_archive_path_is_safe(const char *path) {
+    if (!path[0] || path[0] == '/') {
+        return 0;
+    }
+    const char *component = path;
+    while (*component) {
+        const char *end = strchr(component, '/');
+        size_t len = end ? (size_t)(end - component) : strlen(component);
+        if (len == 2 && component[0] == '.' && component[1] == '.') {
+            return 0;
+        }
+        if (!end) {
+            break;
+        }
+        component = end + 1;
+    }
+    return 1;
+}
+
+static void context_fail(NeoAAExtractContext *context, int error) {
+    pthread_mutex_lock(&context->lock);
+    if (!context->error) {
+        __atomic_store_n(&context->error, error, __ATOMIC_RELAXED);
+    }
+    pthread_cond_broadcast(&context->cond);
+    pthread_mutex_unlock(&context->lock);
+}
+
+static int context_failed(NeoAAExtractContext *context) {
+    return __atomic_load_n(&context->error, __ATOMIC_RELAXED);
+}
+
+/* Wait until cost fits in the budget, anything fits when nothing else is in flight */
+static int budget_reserve(NeoAAExtractContext *context, size_t cost) {
+    pthread_mutex_lock(&context->lock);
+    while (!context->error && context->inFlight && context->inFlight + cost > context->limit) {
+        pthread_cond_wait(&context->cond, &context->lock);
+    }
+    int error = context->error;
+    if (!error) {
+        context->inFlight += cost;
+    }
+    pthread_mutex_unlock(&context->lock);
+    return error;
+}
+
+static void budget_release(NeoAAExtractContext *context, size_t cost) {
+    pthread_mutex_lock(&context->lock);
+    context->inFlight -= cost;
+    pthread_cond_broadcast(&context->cond);
+    pthread_mutex_unlock(&context->lock);
+}
+
+/* Only for archives that list a file before its directory, ours never do */
+static void make_parents(const char *path) {
+    char *copy = strdup(path);
+    if (!copy) {
+        return;
+    }
+    for (char *slash = strchr(copy + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(copy, S_IRWXU);
+        *slash = '/';
+    }
+    free(copy);
+}
+
+/* Big files are only sized, not laid out, so the holes they are written with stay holes */
+static int open_output(const char *path, uint64_t size) {
+    /* Owner only until the final pass sets the real mode */
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0 && errno == ENOENT) {
+        make_parents(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    }
+    if (fd < 0) {
+        perror("Failed to create file");
+        return -1;
+    }
+    if (size > NEOAA_EXTRACT_PIECE_SIZE) {
+        if (ftruncate(fd, (off_t)size) != 0) {
+            perror("Failed to size file");
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+#ifdef __linux__
+    /* Best effort, lets the filesystem lay the file out in one go */
+    if (size) {
+        fallocate(fd, 0, 0, (off_t)size);
+    }
+#endif
+    return fd;
+}
+
+static int pwrite_all(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+    while (size) {
+        ssize_t written = pwrite(fd, data, size, (off_t)offset);
+        if (written <= 0) {
+            perror("Failed to write file");
+            return -1;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static void file_release(NeoAAExtractFile *file) {
+    if (__atomic_sub_fetch(&file->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+/* A mismatch is counted and reported, the rest of the archive is still looked at */
+static void context_check(NeoAAExtractContext *context, const char *path, const NeoAADigest *expected, int fields,
+                          const NeoAADigest *actual) {
+    if (neoaa_digest_compare(expected, fields, actual) != 0) {
+        fprintf(stderr, "Checksum mismatch: %s\n", path ? path : "(unknown)");
+        __atomic_fetch_add(&context->mismatched, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&context->checked, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Hash what the task holds, or the archive range it copied while that is still cached */
+static int task_check(NeoAAExtractContext *context, NeoAAExtractTask *task) {
+    uint64_t start = neoaa_stats_start(context->stats);
+    NeoAADigest digest;
+    int result = 0;
+    if (task->data || context->archiveFd < 0) {
+        neoaa_checksum_buffer(task->data, task->size, &digest);
+    } else {
+        result = neoaa_checksum_fd(context->archiveFd, task->archiveOffset, task->size, &digest);
+    }
+    neoaa_stats_phase(context->stats, NEOAA_PHASE_CHECKSUM, start, task->size, 1);
+    if (result == 0) {
+        context_check(context, task->path, &task->expected, task->digestFields, &digest);
+    }
+    return result;
+}
+
+/* Plain archive data is copied in kernel a window at a time, so a big file moves the progress and can be cancelled */
+static int task_copy(NeoAAExtractContext *context, const NeoAAExtractTask *task, int fd) {
+    for (uint64_t copied = 0; copied < task->size;) {
+        uint64_t window = task->size - copied < NEOAA_COPY_WINDOW ? task->size - copied : NEOAA_COPY_WINDOW;
+        uint64_t offset = task->archiveOffset + copied;
+        int result = context->holeFd >= 0
+            ? neoaa_copy_range_sparse(context->archiveFd, context->holeFd, offset, fd, window)
+            : neoaa_copy_range(context->archiveFd, offset, fd, window);
+        if (result != 0) {
+            return -1;
+        }
+        copied += window;
+        neoaa_progress_add(context->progress, window, 0);
+        if (neoaa_progress_cancelled(context->progress)) {
+            return NEOAA_ERR_CANCELLED;
+        }
+    }
+    return 0;
+}
+
+static void extract_task_run(void *taskContext) {
+    NeoAAExtractTask *task = (NeoAAExtractTask *)taskContext;
+    NeoAAExtractContext *context = task->context;
+    if (!context_failed(context)) {
+        uint64_t start = neoaa_stats_start(context->stats);
+        int result = 0;
+        uint64_t unreported = task->size;
+        if (task->file) {
+            result = neoaa_pwrite_sparse(task->file->fd, task->data, task->size, task->fileOffset);
+        } else if (!context->verifyOnly) {
+            int fd = open_output(task->path, task->size);
+            if (fd < 0) {
+                result = -1;
+            } else {
+                if (task->data) {
+                    result = pwrite_all(fd, task->data, task->size, 0);
+                } else if (task->size) {
+                    result = task_copy(context, task, fd);
+                    unreported = 0;
+                }
+                if (close(fd) != 0) {
+                    result = -1;
+                }
+            }
+        }
+        if (!context->verifyOnly) {
+            neoaa_stats_phase(context->stats, NEOAA_PHASE_WRITE, start, task->size, task->file ? 0 : 1);
+        }
+        if (result == 0 && task->digestFields) {
+            result = task_check(context, task);
+        }
+        if (!task->file && task->path) {
+            neoaa_stats_file(context->stats, task->path, task->size, neoaa_stats_start(context->stats) - start);
+        }
+        if (result != 0) {
+            context_fail(context, result == NEOAA_ERR_CANCELLED ? result : -1);
+        } else {
+            neoaa_progress_add(context->progress, unreported, 0);
+        }
+    }
+    if (task->file) {
+        file_release(task->file);
+    }
+    budget_release(context, task->cost);
+    free(task->path);
+    neoaa_buffer_pool_put(context->buffers, task->data, task->size);
+    free(task);
+}
+
+static int submit_task(NeoAAPool pool, NeoAAExtractTask *task) {
+    /* The task may be freed by a worker as soon as it is queued */
+    NeoAAExtractContext *context = task->context;
+    if (neoaa_pool_submit(pool, extract_task_run, task) != 0) {
+        /* Run it here, it still has to drop its references */
+        extract_task_run(task);
+    }
+    return context_failed(context);
+}
+
+/* Read size bytes of file data from the reader into a new task buffer */
+static NeoAAExtractTask *task_with_data(NeoAAExtractContext *context, NeoAAReader reader, uint64_t size) {
+    size_t cost = neoaa_buffer_pool_round(size) + NEOAA_EXTRACT_TASK_OVERHEAD;
+    if (budget_reserve(context, cost) != 0) {
+        return NULL;
+    }
+    NeoAAExtractTask *task = (NeoAAExtractTask *)calloc(1, sizeof(NeoAAExtractTask));
+    uint8_t *data = (uint8_t *)neoaa_buffer_pool_get(context->buffers, size);
+    if (!task || !data || neoaa_reader_read(reader, data, size) != (ssize_t)size) {
+        if (task && data) {
+            fprintf(stderr, "Archive ended in the middle of a file\n");
+        }
+        free(task);
+        neoaa_buffer_pool_put(context->buffers, data, size);
+        budget_release(context, cost);
+        context_fail(context, -1);
+        return NULL;
+    }
+    task->context = context;
+    task->data = data;
+    task->size = size;
+    task->cost = cost;
+    return task;
+}
+
+static void task_expect(NeoAAExtractContext *context, NeoAAExtractTask *task, const NeoAAScanEntry *entry) {
+    if (context->verify) {
+        task->expected = entry->digest;
+        task->digestFields = entry->digestFields;
+    }
+}
+
+/*
+ * Data is in the reader's stream, the reader is left right after
+ * it. When verifying only, path is just what mismatches are
+ * reported as and nothing is written.
+ */
+static int extract_file(NeoAAExtractContext *context, NeoAAPool pool, NeoAAReader reader,
+                        const char *path, const NeoAAScanEntry *entry) {
+    uint64_t size = entry->datSize;
+    if (context->archiveFd >= 0) {
+        /* Plain archive on disk, the worker copies it in kernel and we just seek past */
+        if (budget_reserve(context, NEOAA_EXTRACT_TASK_OVERHEAD) != 0) {
+            return -1;
+        }
+        NeoAAExtractTask *task = (NeoAAExtractTask *)calloc(1, sizeof(NeoAAExtractTask));
+        char *taskPath = strdup(path);
+        if (!task || !taskPath) {
+            free(task);
+            free(taskPath);
+            budget_release(context, NEOAA_EXTRACT_TASK_OVERHEAD);
+            return -2;
+        }
+        task->context = context;
+        task->path = taskPath;
+        task->archiveOffset = reader->streamStart + entry->datOffset;
+        task->size = size;
+        task->cost = NEOAA_EXTRACT_TASK_OVERHEAD;
+        task_expect(context, task, entry);
+        if (submit_task(pool, task) != 0) {
+            return -1;
+        }
+        return neoaa_reader_skip(reader, size);
+    }
+    if (size <= NEOAA_EXTRACT_PIECE_SIZE) {
+        NeoAAExtractTask *task = task_with_data(context, reader, size);
+        if (!task) {
+            return -1;
+        }
+        task->path = strdup(path);
+        if (!task->path) {
+            task->size = 0;
+            context_fail(context, -2);
+        }
+        task_expect(context, task, entry);
+        return submit_task(pool, task);
+    }
+
+    /*
+     * Big file, opened once here and written piece by piece by
+     * whoever is free. The pieces have to be hashed in order, so
+     * that happens here as each one comes out of the reader.
+     */
+    NeoAAExtractFile *file = NULL;
+    if (!context->verifyOnly) {
+        file = (NeoAAExtractFile *)calloc(1, sizeof(NeoAAExtractFile));
+        if (!file) {
+            return -2;
+        }
+        file->fd = open_output(path, size);
+        if (file->fd < 0) {
+            free(file);
+            return -1;
+        }
+        file->references = 1;
+    }
+    int check = context->verify && entry->digestFields;
+    NeoAAChecksum sum;
+    neoaa_checksum_init(&sum);
+    uint64_t offset = 0;
+    int result = 0;
+    while (offset < size && result == 0) {
+        if (neoaa_progress_cancelled(context->progress)) {
+            result = NEOAA_ERR_CANCELLED;
+            break;
+        }
+        uint64_t pieceSize = size - offset < NEOAA_EXTRACT_PIECE_SIZE ? size - offset : NEOAA_EXTRACT_PIECE_SIZE;
+        NeoAAExtractTask *task = task_with_data(context, reader, pieceSize);
+        if (!task) {
+            result = -1;
+            break;
+        }
+        if (check) {
+            uint64_t start = neoaa_stats_start(context->stats);
+            neoaa_checksum_update(&sum, task->data, pieceSize);
+            neoaa_stats_phase(context->stats, NEOAA_PHASE_CHECKSUM, start, pieceSize, 0);
+        }
+        offset += pieceSize;
+        if (!file) {
+            /* Only releases it, there is nothing to write */
+            extract_task_run(task);
+            continue;
+        }
+        __atomic_add_fetch(&file->references, 1, __ATOMIC_RELAXED);
+        task->file = file;
+        task->fileOffset = offset - pieceSize;
+        result = submit_task(pool, task);
+    }
+    if (file) {
+        file_release(file);
+    }
+    if (check && result == 0) {
+        NeoAADigest digest;
+        neoaa_checksum_final(&sum, &digest);
+        context_check(context, path, &entry->digest, entry->digestFields, &digest);
+    }
+    return result;
+}
+
+static size_t cluster_slot(const NeoAAExtractClusterMap *map, char kind, uint64_t id) {
+    size_t slot = (size_t)((id * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)kind) & (map->slotCount - 1);
+    while (map->slots[slot].origin && (map->slots[slot].kind != kind || map->slots[slot].id != id)) {
+        slot = (slot + 1) & (map->slotCount - 1);
+    }
+    return slot;
+}
+
+static const char *cluster_find(const NeoAAExtractClusterMap *map, char kind, uint64_t id) {
+    return map->count ? map->slots[cluster_slot(map, kind, id)].origin : NULL;
+}
+
+/* Remember path as the origin of the cluster unless it already has one */
+static int cluster_add(NeoAAExtractClusterMap *map, char kind, uint64_t id, const char *path) {
+    if ((map->count + 1) * 2 > map->slotCount) {
+        size_t slotCount = map->slotCount ? map->slotCount * 2 : 64;
+        NeoAAExtractCluster *slots = (NeoAAExtractCluster *)calloc(slotCount, sizeof(NeoAAExtractCluster));
+        if (!slots) {
+            return -2;
+        }
+        NeoAAExtractClusterMap grown = { slots, slotCount, map->count };
+        for (size_t i = 0; i < map->slotCount; i++) {
+            if (map->slots[i].origin) {
+                slots[cluster_slot(&grown, map->slots[i].kind, map->slots[i].id)] = map->slots[i];
+            }
+        }
+        free(map->slots);
+        *map = grown;
+    }
+    NeoAAExtractCluster *cluster = &map->slots[cluster_slot(map, kind, id)];
+    if (cluster->origin) {
+        return 0;
+    }
+    cluster->origin = strdup(path);
+    if (!cluster->origin) {
+        return -2;
+    }
+    cluster->id = id;
+    cluster->kind = kind;
+    map->count++;
+    return 0;
+}
+
+/* The clusters of a file that were new so far start with it */
+static int cluster_remember(NeoAAExtractClusterMap *map, const NeoAAScanEntry *entry, const char *path) {
+    if (entry->hasHardlinkCluster && cluster_add(map, 'H', entry->hardlinkCluster, path) != 0) {
+        return -2;
+    }
+    if (entry->hasCloneCluster && cluster_add(map, 'C', entry->cloneCluster, path) != 0) {
+        return -2;
+    }
+    return 0;
+}
+
+/*
+ * What a file that shares its data is made from, NULL if none of
+ * its clusters has been seen yet. A hard link wins over a copy, so
+ * the first link of an inode that is itself a copy is copied once
+ * and the rest are linked to it.
+ */
+static const char *cluster_origin(const NeoAAExtractClusterMap *map, const NeoAAScanEntry *entry, char *kind) {
+    const char *origin = entry->hasHardlinkCluster ? cluster_find(map, 'H', entry->hardlinkCluster) : NULL;
+    *kind = 'H';
+    if (!origin && entry->hasCloneCluster) {
+        origin = cluster_find(map, 'C', entry->cloneCluster);
+        *kind = 'C';
+    }
+    return origin;
+}
+
+static void cluster_map_free(NeoAAExtractClusterMap *map) {
+    for (size_t i = 0; i < map->slotCount; i++) {
+        free(map->slots[i].origin);
+    }
+    free(map->slots);
+}
+
+static int duplicate_add(NeoAAExtractDuplicateList *list, NeoAAExtractContext *context, const char *path,
+                         const char *origin, char kind) {
+    if (list->count == list->malloc) {
+        size_t newMalloc = list->malloc ? list->malloc * 2 : 64;
+        NeoAAExtractDuplicate *items = (NeoAAExtractDuplicate *)realloc(list->items, newMalloc * sizeof(NeoAAExtractDuplicate));
+        if (!items) {
+            return -2;
+        }
+        list->items = items;
+        list->malloc = newMalloc;
+    }
+    NeoAAExtractDuplicate *duplicate = &list->items[list->count];
+    duplicate->context = context;
+    duplicate->path = strdup(path);
+    duplicate->origin = strdup(origin);
+    duplicate->kind = kind;
+    if (!duplicate->path || !duplicate->origin) {
+        free(duplicate->path);
+        free(duplicate->origin);
+        return -2;
+    }
+    list->count++;
+    return 0;
+}
+
+static void duplicate_list_free(NeoAAExtractDuplicateList *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i].path);
+        free(list->items[i].origin);
+    }
+    free(list->items);
+}
+
+static int duplicate_copy(const NeoAAExtractDuplicate *duplicate) {
+    /* Never follow a link, the origin has to be a file this extraction wrote */
+    int inFd = open(duplicate->origin, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat fileStat;
+    if (inFd < 0 || fstat(inFd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+        fprintf(stderr, "Failed to copy %s from %s\n", duplicate->path, duplicate->origin);
+        if (inFd >= 0) {
+            close(inFd);
+        }
+        return -1;
+    }
+    int outFd = open_output(duplicate->path, fileStat.st_size);
+    int result = outFd < 0 ? -1 : neoaa_copy_range_sparse(inFd, inFd, 0, outFd, fileStat.st_size);
+    if (outFd >= 0 && close(outFd) != 0) {
+        result = -1;
+    }
+    close(inFd);
+    return result;
+}
+
+static void duplicate_copy_run(void *duplicateContext) {
+    NeoAAExtractDuplicate *duplicate = (NeoAAExtractDuplicate *)duplicateContext;
+    if (!context_failed(duplicate->context) && duplicate_copy(duplicate) != 0) {
+        context_fail(duplicate->context, -1);
+    }
+}
+
+/*
+ * Copies first, in kernel on the pool and as reflinks where the
+ * filesystem can. Hard links after, one by one, since a copy may
+ * be what they link to. A filesystem without hard links gets a
+ * copy instead.
+ */
+static int duplicates_apply(NeoAAExtractContext *context, NeoAAPool pool, NeoAAExtractDuplicateList *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->items[i].kind == 'C' && neoaa_pool_submit(pool, duplicate_copy_run, &list->items[i]) != 0) {
+            duplicate_copy_run(&list->items[i]);
+        }
+    }
+    neoaa_pool_wait(pool);
+    for (size_t i = 0; i < list->count && !context_failed(context); i++) {
+        const NeoAAExtractDuplicate *duplicate = &list->items[i];
+        if (duplicate->kind == 'C') {
+            continue;
+        }
+        if (unlink(duplicate->path) != 0 && errno != ENOENT) {
+            perror("Failed to replace file");
+        }
+        if (link(duplicate->origin, duplicate->path) != 0 && duplicate_copy(duplicate) != 0) {
+            context_fail(context, -1);
+        }
+    }
+    return context_failed(context);
+}
+
+static void meta_apply(NeoAAExtractContext *context, const NeoAAExtractMeta *meta) {
+    if (meta->type == 'L') {
+#if !(defined(_WIN32) || defined(WIN32))
+        if (symlink(meta->link, meta->path) != 0) {
+            perror("Failed to create symlink");
+            return;
+        }
+#endif
+    }
+    /* Ownership first, chown clears setuid and setgid */
+    if (context->applyOwners && (meta->hasUid || meta->hasGid)) {
+        if (lchown(meta->path, meta->hasUid ? meta->uid : (uid_t)-1, meta->hasGid ? meta->gid : (gid_t)-1) != 0) {
+            perror("Failed to set owner");
+        }
+    }
+    if (meta->type != 'L' && meta->hasMode && chmod(meta->path, meta->mode & ~context->mask) != 0) {
+        perror("Failed to set mode");
+    }
+}
+
+static void meta_batch_run(void *batchContext) {
+    NeoAAExtractMetaBatch *batch = (NeoAAExtractMetaBatch *)batchContext;
+    for (size_t i = 0; i < batch->count; i++) {
+        if (batch->meta[i].type != 'D') {
+            meta_apply(batch->context, &batch->meta[i]);
+        }
+    }
+    free(batch);
+}
+
+/*
+ * Files and symlinks in batches on the pool, then directories
+ * one by one in reverse archive order so a directory losing its
+ * write or search bit never gets in the way of its children.
+ */
+static void meta_apply_all(NeoAAExtractContext *context, NeoAAPool pool, NeoAAExtractMeta *meta, size_t count) {
+    for (size_t start = 0; start < count; start += NEOAA_EXTRACT_META_BATCH) {
+        NeoAAExtractMetaBatch *batch = (NeoAAExtractMetaBatch *)malloc(sizeof(NeoAAExtractMetaBatch));
+        size_t batchCount = count - start < NEOAA_EXTRACT_META_BATCH ? count - start : NEOAA_EXTRACT_META_BATCH;
+        if (!batch) {
+            for (size_t i = start; i < start + batchCount; i++) {
+                if (meta[i].type != 'D') {
+                    meta_apply(context, &meta[i]);
+                }
+            }
+            continue;
+        }
+        batch->context = context;
+        batch->meta = meta + start;
+        batch->count = batchCount;
+        if (neoaa_pool_submit(pool, meta_batch_run, batch) != 0) {
+            meta_batch_run(batch);
+        }
+    }
+    neoaa_pool_wait(pool);
+    for (size_t i = count; i > 0; i--) {
+        if (meta[i - 1].type == 'D') {
+            meta_apply(context, &meta[i - 1]);
+        }
+    }
+}
+
+typedef struct {
+    NeoAAExtractMeta *items;
+    size_t count;
+    size_t malloc;
+} NeoAAExtractMetaList;
+
+/* Takes ownership of path on success */
+static int meta_add(NeoAAExtractMetaList *list, char *path, const NeoAAScanEntry *entry) {
+    if (list->count == list->malloc) {
+        size_t newMalloc = list->malloc ? list->malloc * 2 : 256;
+        NeoAAExtractMeta *items = (NeoAAExtractMeta *)realloc(list->items, newMalloc * sizeof(NeoAAExtractMeta));
+        if (!items) {
+            return -2;
+        }
+        list->items = items;
+        list->malloc = newMalloc;
+    }
+    NeoAAExtractMeta *meta = &list->items[list->count];
+    memset(meta, 0, sizeof(NeoAAExtractMeta));
+    meta->type = entry->type;
+    if (entry->type == 'L') {
+        meta->link = strdup(entry->link);
+        if (!meta->link) {
+            return -2;
+        }
+    }
+    meta->path = path;
+    /* Without MOD nothing says what the mode should be, the owner only one it was created with stays */
+    meta->mode = (mode_t)entry->mode & 07777;
+    meta->hasMode = entry->hasMode;
+    meta->uid = (uid_t)entry->uid;
+    meta->gid = (gid_t)entry->gid;
+    /* Older neoaa archives cut ids down to 2 and 1 bytes, a narrower field may not hold the real one */
+    meta->hasUid = entry->hasUid && entry->uidSize >= sizeof(uid_t);
+    meta->hasGid = entry->hasGid && entry->gidSize >= sizeof(gid_t);
+    list->count++;
+    return 0;
+}
+
+static void meta_list_free(NeoAAExtractMetaList *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i].path);
+        free(list->items[i].link);
+    }
+    free(list->items);
+}
+
+/* Every directory before any file data, progress totals come for free with it */
+static int extract_skeleton(const char *inputPath, const char *outputPath, NeoAAProgress *progress, NeoAACreatedPaths *created) {
+    NeoAAIndex index = neoaa_index_open(inputPath, NEOAA_INDEX_SIDECAR_READ);
+    if (!index) {
+        return 0;
+    }
+    uint64_t totalBytes = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        const NeoAAIndexEntry *entry = &index->entries[i];
+        totalBytes += entry->datSize;
+        const char *path = neoaa_index_path(index, entry);
+        if (entry->type != 'D' || !neoaa_archive_path_is_safe(path)) {
+            continue;
+        }
+        char *fullPath = neoaa_join_path(outputPath, path);
+        if (!fullPath) {
+            continue;
+        }
+        if (mkdir(fullPath, S_IRWXU) == 0) {
+            neoaa_created_paths_add(created, fullPath);
+        } else if (errno != EEXIST) {
+            perror("Failed to create directory");
+        }
+        free(fullPath);
+    }
+    neoaa_progress_set_total(progress, totalBytes, index->count);
+    neoaa_index_destroy(index);
+    return 1;
+}
+
+/* Say how many files did not match, NEOAA_ERR_CHECKSUM if any */
+static int context_check_result(NeoAAExtractContext *context, int result) {
+    if (context->mismatched) {
+        fprintf(stderr, "%zu file%s did not match %s checksums\n", context->mismatched,
+                context->mismatched == 1 ? "" : "s", context->mismatched == 1 ? "its" : "their");
+        if (result == 0) {
+            result = NEOAA_ERR_CHECKSUM;
+        }
+    }
+    return result;
+}
+
+int neoaa_extract_stream(NeoAAReader reader, const char *inputPath, const char *outputPath,
+                         int threadCount, size_t memoryLimit, int verify, NeoAAProgress *progress) {
+    NeoAAExtractContext context;
+    memset(&context, 0, sizeof(context));
+    context.verify = verify;
+    context.limit = memoryLimit ? memoryLimit : NEOAA_DEFAULT_MEMORY_LIMIT;
+    context.progress = progress;
+    context.stats = neoaa_progress_stats(progress);
+    reader->stats = context.stats;
+    context.archiveFd = (!reader->compressed && reader->seekable) ? reader->fd : -1;
+    /* Looking for holes moves the position, which the reader's descriptor must keep */
+    context.holeFd = context.archiveFd >= 0 && inputPath ? open(inputPath, O_RDONLY | O_CLOEXEC) : -1;
+    context.mask = umask(0);
+    umask(context.mask);
+    context.applyOwners = geteuid() == 0;
+
+    NeoAACreatedPaths created;
+    memset(&created, 0, sizeof(created));
+    NeoAAExtractMetaList metaList;
+    memset(&metaList, 0, sizeof(metaList));
+    NeoAAExtractDuplicateList duplicates;
+    memset(&duplicates, 0, sizeof(duplicates));
+    NeoAAExtractClusterMap clusters;
+    memset(&clusters, 0, sizeof(clusters));
+
+    int haveSkeleton = 0;
+    if (inputPath && reader->seekable && (!reader->compressed || reader->chunks)) {
+        haveSkeleton = extract_skeleton(inputPath, outputPath, progress, &created);
+    }
+    NeoAAPool pool = neoaa_pool_create(threadCount);
+    uint8_t *header = (uint8_t *)malloc(NEOAA_MAX_HEADER_SIZE);
+    context.buffers = neoaa_buffer_pool_create(context.limit);
+    if (!pool || !header || !context.buffers) {
+        neoaa_pool_destroy(pool);
+        neoaa_buffer_pool_destroy(context.buffers);
+        free(header);
+        neoaa_created_paths_free(&created);
+        if (context.holeFd >= 0) {
+            close(context.holeFd);
+        }
+        return -2;
+    }
+    pthread_mutex_init(&context.lock, NULL);
+    pthread_cond_init(&context.cond, NULL);
+    /* Blocks are decompressed on workers while we parse */
+    neoaa_reader_set_threads(reader, neoaa_pool_thread_count(pool));
+
+    int result = 0;
+    NeoAAScanEntry entry;
+    int status;
+    uint64_t scanStart = neoaa_stats_start(context.stats);
+    while ((status = neoaa_scan_next(reader, header, &entry)) > 0) {
+        neoaa_stats_phase(context.stats, NEOAA_PHASE_SCAN, scanStart, entry.headerSize, 1);
+        if (neoaa_progress_cancelled(progress)) {
+            neoaa_scan_entry_clear(&entry);
+            result = NEOAA_ERR_CANCELLED;
+            break;
+        }
+        uint64_t remaining = entry.blobsSize;
+        char *fullPath = NULL;
+        if (entry.path && entry.type) {
+            if (neoaa_archive_path_is_safe(entry.path)) {
+                fullPath = neoaa_join_path(outputPath, entry.path);
+            } else {
+                fprintf(stderr, "Skipping unsafe path in archive: %s\n", entry.path);
+            }
+        }
+        const char *origin = NULL;
+        char originKind = 0;
+        if (fullPath && neoaa_scan_entry_shares_data(&entry)) {
+            origin = cluster_origin(&clusters, &entry, &originKind);
+        }
+        if (fullPath && (entry.type == 'D' || entry.type == 'F' || (entry.type == 'L' && entry.link))) {
+            if (entry.type == 'D' && !haveSkeleton) {
+                if (mkdir(fullPath, S_IRWXU) == 0) {
+                    neoaa_created_paths_add(&created, fullPath);
+                } else if (errno != EEXIST) {
+                    perror("Failed to create directory");
+                }
+            } else if (origin) {
+                neoaa_created_paths_add(&created, fullPath);
+                if (duplicate_add(&duplicates, &context, fullPath, origin, originKind) != 0) {
+                    result = -2;
+                }
+            } else if (entry.type == 'F') {
+                neoaa_created_paths_add(&created, fullPath);
+                /* Skip blobs in front of DAT, the rest is skipped below */
+                uint64_t before = entry.datOffset - (entry.headerOffset + entry.headerSize);
+                result = neoaa_reader_skip(reader, before) != 0 ? -1 : extract_file(&context, pool, reader, fullPath, &entry);
+                remaining -= before + entry.datSize;
+            }
+            if (result == 0 && entry.type == 'F' && cluster_remember(&clusters, &entry, fullPath) != 0) {
+                result = -2;
+            }
+            if (result == 0) {
+                if (meta_add(&metaList, fullPath, &entry) == 0) {
+                    fullPath = NULL;
+                } else {
+                    result = -2;
+                }
+            }
+        }
+        free(fullPath);
+        neoaa_scan_entry_clear(&entry);
+        if (result == 0 && remaining && neoaa_reader_skip(reader, remaining) != 0) {
+            result = -1;
+        }
+        if (result != 0 || context_failed(&context)) {
+            break;
+        }
+        neoaa_progress_add(progress, 0, 1);
+        scanStart = neoaa_stats_start(context.stats);
+    }
+    if (status < 0 && result == 0) {
+        fprintf(stderr, "Malformed archive %s\n", inputPath ? inputPath : "stream");
+        result = -1;
+    }
+    neoaa_pool_wait(pool);
+    if (result == 0) {
+        result = context.error;
+    }
+    uint64_t metaStart = neoaa_stats_start(context.stats);
+    if (result == 0 && duplicates.count) {
+        result = duplicates_apply(&context, pool, &duplicates);
+    }
+    if (result == 0) {
+        meta_apply_all(&context, pool, metaList.items, metaList.count);
+    }
+    neoaa_stats_phase(context.stats, NEOAA_PHASE_METADATA, metaStart, 0, metaList.count + duplicates.count);
+    result = context_check_result(&context, result);
+    if (result == NEOAA_ERR_CANCELLED) {
+        neoaa_created_paths_remove(&created);
+    }
+    neoaa_pool_destroy(pool);
+    neoaa_buffer_pool_destroy(context.buffers);
+    pthread_mutex_destroy(&context.lock);
+    pthread_cond_destroy(&context.cond);
+    meta_list_free(&metaList);
+    duplicate_list_free(&duplicates);
+    cluster_map_free(&clusters);
+    neoaa_created_paths_free(&created);
+    free(header);
+    if (context.holeFd >= 0) {
+        close(context.holeFd);
+    }
+    return result;
+}
+
+int neoaa_verify_stream(NeoAAReader reader, const char *inputPath, int threadCount, size_t memoryLimit,
+                        NeoAAProgress *progress) {
+    NeoAAExtractContext context;
+    memset(&context, 0, sizeof(context));
+    context.verify = 1;
+    context.verifyOnly = 1;
+    context.limit = memoryLimit ? memoryLimit : NEOAA_DEFAULT_MEMORY_LIMIT;
+    context.progress = progress;
+    context.stats = neoaa_progress_stats(progress);
+    reader->stats = context.stats;
+    /* Plain archives are hashed straight from the file by the workers, in parallel */
+    context.archiveFd = (!reader->compressed && reader->seekable) ? reader->fd : -1;
+    context.holeFd = -1;
+
+    if (inputPath && reader->seekable && (!reader->compressed || reader->chunks)) {
+        NeoAAIndex index = neoaa_index_open(inputPath, NEOAA_INDEX_SIDECAR_READ);
+        if (index) {
+            uint64_t totalBytes = 0;
+            for (size_t i = 0; i < index->count; i++) {
+                totalBytes += index->entries[i].datSize;
+            }
+            neoaa_progress_set_total(progress, totalBytes, index->count);
+            neoaa_index_destroy(index);
+        }
+    }
+    NeoAAPool pool = neoaa_pool_create(threadCount);
+    uint8_t *header = (uint8_t *)malloc(NEOAA_MAX_HEADER_SIZE);
+    context.buffers = neoaa_buffer_pool_create(context.limit);
+    if (!pool || !header || !context.buffers) {
+        neoaa_pool_destroy(pool);
+        neoaa_buffer_pool_destroy(context.buffers);
+        free(header);
+        return -2;
+    }
+    pthread_mutex_init(&context.lock, NULL);
+    pthread_cond_init(&context.cond, NULL);
+    neoaa_reader_set_threads(reader, neoaa_pool_thread_count(pool));
+
+    int result = 0;
+    size_t unchecked = 0;
+    NeoAAScanEntry entry;
+    int status;
+    uint64_t scanStart = neoaa_stats_start(context.stats);
+    while ((status = neoaa_scan_next(reader, header, &entry)) > 0) {
+        neoaa_stats_phase(context.stats, NEOAA_PHASE_SCAN, scanStart, entry.headerSize, 1);
+        if (neoaa_progress_cancelled(progress)) {
+            neoaa_scan_entry_clear(&entry);
+            result = NEOAA_ERR_CANCELLED;
+            break;
+        }
+        uint64_t remaining = entry.blobsSize;
+        /* Duplicates without data have nothing to check, their origin is checked instead */
+        if (entry.type == 'F' && !neoaa_scan_entry_shares_data(&entry)) {
+            if (entry.digestFields) {
+                uint64_t before = entry.datOffset - (entry.headerOffset + entry.headerSize);
+                result = neoaa_reader_skip(reader, before) != 0
+                    ? -1 : extract_file(&context, pool, reader, entry.path ? entry.path : "", &entry);
+                remaining -= before + entry.datSize;
+            } else {
+                unchecked++;
+            }
+        }
+        neoaa_scan_entry_clear(&entry);
+        if (result == 0 && remaining && neoaa_reader_skip(reader, remaining) != 0) {
+            result = -1;
+        }
+        if (result != 0 || context_failed(&context)) {
+            break;
+        }
+        neoaa_progress_add(progress, 0, 1);
+        scanStart = neoaa_stats_start(context.stats);
+    }
+    if (status < 0 && result == 0) {
+        fprintf(stderr, "Malformed archive %s\n", inputPath ? inputPath : "stream");
+        result = -1;
+    }
+    neoaa_pool_wait(pool);
+    if (result == 0) {
+        result = context.error;
+    }
+    if (result == 0 || context.mismatched) {
+        printf("Checked %zu file%s, %zu without checksums\n", context.checked + context.mismatched,
+               context.checked + context.mismatched == 1 ? "" : "s", unchecked);
+    }
+    result = context_check_result(&context, result);
+    neoaa_pool_destroy(pool);
+    neoaa_buffer_pool_destroy(context.buffers);
+    pthread_mutex_destroy(&context.lock);
+    pthread_cond_destroy(&context.cond);
+    free(header);
+    return result;
+}
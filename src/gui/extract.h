@@ -0,0 +1,59 @@
+/*
+ *  extract.h
+ *  neoaa
+ *
+ *  Parallel extraction. Directories are created up front, file
+ *  contents are written by a pool of workers and modes, owners
+ *  and symlinks are applied in one pass once every file is in
+ *  place.
+ */
+
+#ifndef NEOAA_EXTRACT_H
+#define NEOAA_EXTRACT_H
+
+#include <stddef.h>
+#include "progress.h"
+#include "reader.h"
+
+/* Files bigger than this are written in pieces of this size by several workers */
+#define NEOAA_EXTRACT_PIECE_SIZE (4 * 1024 * 1024)
+
+/* Paths created by an extraction, removed again if it is cancelled */
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t malloc;
+} NeoAACreatedPaths;
+
+void neoaa_created_paths_add(NeoAACreatedPaths *created, const char *path);
+/* Newest first so directories are empty by the time we reach them */
+void neoaa_created_paths_remove(NeoAACreatedPaths *created);
+void neoaa_created_paths_free(NeoAACreatedPaths *created);
+
+/* Reject absolute paths and anything with a ".." component */
+int neoaa_archive_path_is_safe(const char *path);
+
+/*
+ * Extract everything the reader yields below outputPath. When
+ * the archive is plain or seekable, inputPath is used for a
+ * header-only pass that builds the directory skeleton before
+ * any data is read. It may be NULL, and is ignored for pipes,
+ * then every entry is written as its bytes arrive and memory
+ * stays bounded by memoryLimit for file data in flight.
+ * With verify set, files are checked against their CKS and SH2
+ * fields as they are written and any mismatch ends up as
+ * NEOAA_ERR_CHECKSUM once everything is extracted.
+ */
+int neoaa_extract_stream(NeoAAReader reader, const char *inputPath, const char *outputPath,
+                         int threadCount, size_t memoryLimit, int verify, NeoAAProgress *progress);
+
+/*
+ * Same pass without writing anything, every file with checksums
+ * is hashed and compared. inputPath may be NULL here too. Plain archives are hashed by the
+ * workers straight from the file, compressed ones as they are
+ * decoded. NEOAA_ERR_CHECKSUM if anything did not match.
+ */
+int neoaa_verify_stream(NeoAAReader reader, const char *inputPath, int threadCount, size_t memoryLimit,
+                        NeoAAProgress *progress);
+
+#endif /* NEOAA_EXTRACT_H */
@@ -0,0 +1,242 @@
+/*
+ *  fileio.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fileio.h"
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/* How much of the input we map at once on the fallback path */
+#define NEOAA_MAP_WINDOW (64ULL * 1024 * 1024)
+
+static char emptyMapping;
+
+static int copy_range_mmap(int inFd, uint64_t inOffset, int outFd, uint64_t length) {
+    /* Touching a mapping past EOF is SIGBUS, refuse if the file is shorter than promised */
+    struct stat fileStat;
+    if (fstat(inFd, &fileStat) < 0 || (uint64_t)fileStat.st_size < inOffset + length) {
+        return -1;
+    }
+    long pageSize = sysconf(_SC_PAGESIZE);
+    while (length) {
+        /* mmap offsets must be page aligned */
+        uint64_t alignedOffset = inOffset - (inOffset % pageSize);
+        uint64_t skip = inOffset - alignedOffset;
+        uint64_t window = length + skip < NEOAA_MAP_WINDOW ? length + skip : NEOAA_MAP_WINDOW;
+        uint8_t *map = (uint8_t *)mmap(NULL, window, PROT_READ, MAP_PRIVATE, inFd, alignedOffset);
+        if (map == MAP_FAILED) {
+            perror("mmap failed");
+            return -1;
+        }
+        madvise(map, window, MADV_SEQUENTIAL);
+        uint64_t chunk = window - skip;
+        uint8_t *data = map + skip;
+        uint64_t left = chunk;
+        while (left) {
+            ssize_t written = write(outFd, data, left);
+            if (written <= 0) {
+                perror("Failed to write output");
+                munmap(map, window);
+                return -1;
+            }
+            data += written;
+            left -= written;
+        }
+        munmap(map, window);
+        inOffset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+int neoaa_copy_range(int inFd, uint64_t inOffset, int outFd, uint64_t length) {
+#ifdef __linux__
+    /* In-kernel copy, reflinks on filesystems that support it */
+    loff_t offset = (loff_t)inOffset;
+    while (length) {
+        ssize_t copied = copy_file_range(inFd, &offset, outFd, NULL, length, 0);
+        if (copied == 0) {
+            /* Input ended early */
+            return -1;
+        }
+        if (copied < 0) {
+            break;
+        }
+        length -= copied;
+    }
+    if (!length) {
+        return 0;
+    }
+    /* Cross filesystem on older kernels, special files, etc. */
+    off_t sendOffset = (off_t)offset;
+    while (length) {
+        ssize_t sent = sendfile(outFd, inFd, &sendOffset, length);
+        if (sent == 0) {
+            return -1;
+        }
+        if (sent < 0) {
+            break;
+        }
+        length -= sent;
+    }
+    if (!length) {
+        return 0;
+    }
+    inOffset = (uint64_t)sendOffset;
+#endif
+    return copy_range_mmap(inFd, inOffset, outFd, length);
+}
+
+void neoaa_next_data(int fd, uint64_t offset, uint64_t end, uint64_t *dataStart, uint64_t *dataEnd) {
+    *dataStart = offset;
+    *dataEnd = end;
+#ifdef SEEK_DATA
+    off_t data = lseek(fd, (off_t)offset, SEEK_DATA);
+    if (data < 0) {
+        /* ENXIO means nothing but hole up to the end of the file */
+        if (errno == ENXIO) {
+            *dataStart = end;
+        }
+        return;
+    }
+    if ((uint64_t)data >= end) {
+        *dataStart = end;
+        return;
+    }
+    *dataStart = (uint64_t)data;
+    off_t hole = lseek(fd, data, SEEK_HOLE);
+    if (hole >= 0 && (uint64_t)hole < end) {
+        *dataEnd = (uint64_t)hole;
+    }
+#endif
+}
+
+int neoaa_write_hole(int outFd, uint64_t length) {
+    struct stat fileStat;
+    off_t position = lseek(outFd, 0, SEEK_CUR);
+    if (position < 0 || fstat(outFd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+        return -1;
+    }
+    uint64_t end = (uint64_t)position + length;
+    if (position < fileStat.st_size) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+        uint64_t punchEnd = end < (uint64_t)fileStat.st_size ? end : (uint64_t)fileStat.st_size;
+        if (fallocate(outFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, (off_t)(punchEnd - position)) != 0) {
+            return -1;
+        }
+#else
+        return -1;
+#endif
+    }
+    if (end > (uint64_t)fileStat.st_size && ftruncate(outFd, (off_t)end) != 0) {
+        return -1;
+    }
+    return lseek(outFd, (off_t)end, SEEK_SET) < 0 ? -1 : 0;
+}
+
+int neoaa_copy_range_sparse(int inFd, int extentFd, uint64_t inOffset, int outFd, uint64_t length) {
+    uint64_t offset = inOffset;
+    uint64_t end = inOffset + length;
+    while (offset < end) {
+        uint64_t dataStart;
+        uint64_t dataEnd;
+        neoaa_next_data(extentFd, offset, end, &dataStart, &dataEnd);
+        uint64_t hole = dataStart - offset;
+        if (hole && (hole < NEOAA_SPARSE_MIN_HOLE || neoaa_write_hole(outFd, hole) != 0)
+            && neoaa_copy_range(inFd, offset, outFd, hole) != 0) {
+            return -1;
+        }
+        if (dataEnd > dataStart && neoaa_copy_range(inFd, dataStart, outFd, dataEnd - dataStart) != 0) {
+            return -1;
+        }
+        offset = dataEnd > dataStart ? dataEnd : end;
+    }
+    return 0;
+}
+
+static int is_zero(const uint8_t *data, size_t size) {
+    return !size || (!data[0] && memcmp(data, data + 1, size - 1) == 0);
+}
+
+static int pwrite_all(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+    while (size) {
+        ssize_t written = pwrite(fd, data, size, (off_t)offset);
+        if (written <= 0) {
+            perror("Failed to write file");
+            return -1;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+int neoaa_pwrite_sparse(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+    /* Zero runs are looked for in whole pages of the file */
+    const size_t page = 4096;
+    size_t position = 0;
+    size_t pending = 0;
+    while (position < size) {
+        size_t next = (size_t)(((offset + position) / page + 1) * page - offset);
+        if (next > size) {
+            next = size;
+        }
+        size_t zeroEnd = position;
+        while (zeroEnd < size && next - zeroEnd == page && is_zero(data + zeroEnd, page)) {
+            zeroEnd = next;
+            next = next + page < size ? next + page : size;
+        }
+        if (zeroEnd - position >= NEOAA_SPARSE_MIN_HOLE) {
+            if (pwrite_all(fd, data + pending, position - pending, offset + pending) != 0) {
+                return -1;
+            }
+            pending = zeroEnd;
+            position = zeroEnd;
+        } else {
+            position = zeroEnd > position ? zeroEnd : next;
+        }
+    }
+    return pwrite_all(fd, data + pending, size - pending, offset + pending);
+}
+
+void *neoaa_map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0) {
+        close(fd);
+        return NULL;
+    }
+    *size = fileStat.st_size;
+    if (!*size) {
+        close(fd);
+        return &emptyMapping;
+    }
+    void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, *size, MADV_SEQUENTIAL);
+    return data;
+}
+
+void neoaa_unmap_file(void *data, size_t size) {
+    if (data && data != &emptyMapping) {
+        munmap(data, size);
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ *  fileio.h
+ *  neoaa
+ *
+ *  Bulk file copies that avoid staging data in our own buffers,
+ *  and the hole handling that keeps sparse files sparse.
+ */
+
+#ifndef NEOAA_FILEIO_H
+#define NEOAA_FILEIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Copy length bytes of inFd starting at inOffset to the current
+ * position of outFd. Uses copy_file_range or sendfile where the
+ * kernel has them and falls back to windowed mmap + write, so no
+ * heap buffer the size of the file is ever allocated.
+ */
+int neoaa_copy_range(int inFd, uint64_t inOffset, int outFd, uint64_t length);
+
+/* Long copies are made in pieces this big so progress moves and cancel is noticed in between */
+#define NEOAA_COPY_WINDOW (16 * 1024 * 1024)
+
+/* Holes shorter than this are copied as zeros, not worth a seek or a hole of their own */
+#define NEOAA_SPARSE_MIN_HOLE (64 * 1024)
+
+/*
+ * Next data extent of fd at or after offset, clipped to end,
+ * found with SEEK_DATA and SEEK_HOLE. Both come back as end when
+ * only holes are left. Where holes can not be told apart all of
+ * it is data. Moves the position of fd, so never use it on a
+ * descriptor that is also read sequentially.
+ */
+void neoaa_next_data(int fd, uint64_t offset, uint64_t end, uint64_t *dataStart, uint64_t *dataEnd);
+
+/*
+ * Advance the position of outFd by length, leaving a hole there
+ * instead of writing zeros. Anything already in that range is
+ * punched out. Non zero, with nothing moved, if outFd can not
+ * have holes.
+ */
+int neoaa_write_hole(int outFd, uint64_t length);
+
+/*
+ * neoaa_copy_range for sparse input, only the data extents of
+ * inFd are copied and its holes become holes in outFd where it
+ * can have them. extentFd, often inFd itself, is what the extents
+ * are looked up on since that moves its position.
+ */
+int neoaa_copy_range_sparse(int inFd, int extentFd, uint64_t inOffset, int outFd, uint64_t length);
+
+/*
+ * pwrite that skips zero runs of at least NEOAA_SPARSE_MIN_HOLE,
+ * aligned to the file, so they stay holes. The file has to read
+ * as zeros there already, as after ftruncate.
+ */
+int neoaa_pwrite_sparse(int fd, const uint8_t *data, size_t size, uint64_t offset);
+
+/* Map a whole file read-only, NULL on failure. Empty files map to a dummy non NULL pointer. */
+void *neoaa_map_file(const char *path, size_t *size);
+void neoaa_unmap_file(void *data, size_t size);
+
+#endif /* NEOAA_FILEIO_H */
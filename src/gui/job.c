@@ -0,0 +1,179 @@
+/*
+ *  job.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "job.h"
+
+static void job_progress_notify(void *context) {
+    NeoAAJob job = (NeoAAJob)context;
+    if (job->notify) {
+        job->notify(job, 0);
+    }
+}
+
+NeoAAJob neoaa_job_create(NeoAACommand command, const char *inputPath, const char *outputPath) {
+    NeoAAJob job = (NeoAAJob)calloc(1, sizeof(struct neoaa_job_impl));
+    if (!job) {
+        return NULL;
+    }
+    job->command = command;
+    /* Copy, FLTK choosers hand us static buffers that get reused */
+    job->inputPath = strdup(inputPath);
+    job->outputPath = strdup(outputPath);
+    if (!job->inputPath || !job->outputPath) {
+        neoaa_job_destroy(job);
+        return NULL;
+    }
+    neoaa_archive_options_init(&job->options);
+    /* Set up here so a cancel that comes before the start still counts */
+    neoaa_progress_init(&job->progress, job_progress_notify, job);
+    job->state = NEOAA_JOB_PENDING;
+    return job;
+}
+
+static const char *commandNames[] = {"archive", "extract", "list", "add", "wrap", "unwrap", "version", "verify"};
+
+const char *neoaa_command_name(NeoAACommand command) {
+    if ((size_t)command >= sizeof(commandNames) / sizeof(commandNames[0])) {
+        return "unknown";
+    }
+    return commandNames[command];
+}
+
+static void job_execute(NeoAAJob job) {
+    int result;
+    switch (job->command) {
+        case NEOAA_CMD_ARCHIVE:
+            result = create_aar_from_directory(job->inputPath, job->outputPath, &job->options, &job->progress);
+            break;
+        case NEOAA_CMD_EXTRACT:
+            result = extract_aar_to_directory(job->inputPath, job->outputPath, &job->options, &job->progress);
+            break;
+        case NEOAA_CMD_ADD:
+            /* inputPath is the file, outputPath the archive it is appended to in place */
+            result = add_file_in_neo_aa(job->outputPath, NULL, job->inputPath, &job->options, &job->progress);
+            break;
+        case NEOAA_CMD_VERIFY:
+            result = verify_neo_aa_file(job->inputPath, &job->options, &job->progress);
+            break;
+        case NEOAA_CMD_LIST:
+            result = list_neo_aa_files(job->inputPath, &job->progress);
+            break;
+        case NEOAA_CMD_WRAP:
+            result = wrap_file_in_neo_aa(job->inputPath, job->outputPath, &job->options, &job->progress);
+            break;
+        case NEOAA_CMD_UNWRAP:
+            if (!job->memberPath) {
+                fprintf(stderr, "No file given to unwrap from %s\n", job->inputPath);
+                result = -1;
+                break;
+            }
+            result = unwrap_file_out_of_neo_aa(job->inputPath, job->outputPath, job->memberPath, &job->progress);
+            break;
+        default:
+            fprintf(stderr, "Unsupported job command %d\n", job->command);
+            result = -1;
+            break;
+    }
+    job->result = result;
+    NeoAAJobState state;
+    if (result == NEOAA_ERR_CANCELLED) {
+        state = NEOAA_JOB_CANCELLED;
+    } else if (result != 0) {
+        state = NEOAA_JOB_FAILED;
+    } else {
+        state = NEOAA_JOB_SUCCEEDED;
+    }
+    neoaa_stats_finish(job->stats);
+    if (job->stats && job->reportPath) {
+        neoaa_stats_write_json(job->stats, job->reportPath, neoaa_command_name(job->command),
+                               job->inputPath, job->outputPath, result);
+    }
+    job->finishTime = neoaa_time_ns();
+    __atomic_store_n(&job->state, state, __ATOMIC_RELEASE);
+    if (job->notify) {
+        job->notify(job, 1);
+    }
+}
+
+static void *job_thread(void *context) {
+    job_execute((NeoAAJob)context);
+    return NULL;
+}
+
+int neoaa_job_enable_stats(NeoAAJob job, const char *reportPath) {
+    if (!job->stats) {
+        job->stats = neoaa_stats_create();
+    }
+    free(job->reportPath);
+    job->reportPath = reportPath ? strdup(reportPath) : NULL;
+    if (!job->stats || (reportPath && !job->reportPath)) {
+        return -1;
+    }
+    return 0;
+}
+
+int neoaa_job_set_member_path(NeoAAJob job, const char *memberPath) {
+    free(job->memberPath);
+    job->memberPath = strdup(memberPath);
+    return job->memberPath ? 0 : -1;
+}
+
+static void job_prepare(NeoAAJob job, NeoAAJobNotify notify, void *userData) {
+    job->notify = notify;
+    job->userData = userData;
+    job->progress.startTime = neoaa_time_ns();
+    job->progress.stats = job->stats;
+    if (job->stats) {
+        /* Wall clock starts with the job, not when it was set up */
+        job->stats->startTime = neoaa_time_ns();
+    }
+    /* Release, so whoever sees it running also sees the start time */
+    __atomic_store_n(&job->state, NEOAA_JOB_RUNNING, __ATOMIC_RELEASE);
+}
+
+int neoaa_job_run(NeoAAJob job, NeoAAJobNotify notify, void *userData) {
+    job_prepare(job, notify, userData);
+    job_execute(job);
+    return job->result;
+}
+
+int neoaa_job_start(NeoAAJob job, NeoAAJobNotify notify, void *userData) {
+    job_prepare(job, notify, userData);
+    if (pthread_create(&job->thread, NULL, job_thread, job) != 0) {
+        fprintf(stderr, "Failed to start worker thread\n");
+        job->state = NEOAA_JOB_FAILED;
+        return -1;
+    }
+    job->threadStarted = 1;
+    return 0;
+}
+
+void neoaa_job_cancel(NeoAAJob job) {
+    neoaa_progress_cancel(&job->progress);
+}
+
+NeoAAJobState neoaa_job_state(NeoAAJob job) {
+    return (NeoAAJobState)__atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+}
+
+void neoaa_job_destroy(NeoAAJob job) {
+    if (!job) {
+        return;
+    }
+    if (job->threadStarted) {
+        /* Never leave a worker running with a freed job */
+        neoaa_job_cancel(job);
+        pthread_join(job->thread, NULL);
+    }
+    free(job->inputPath);
+    free(job->outputPath);
+    free(job->memberPath);
+    free(job->reportPath);
+    neoaa_stats_destroy(job->stats);
+    free(job);
+}
@@ -0,0 +1,70 @@
+/*
+ *  job.h
+ *  neoaa
+ *
+ *  Runs archive operations on a worker thread so the UI
+ *  thread never blocks on I/O or compression.
+ */
+
+#ifndef NEOAA_JOB_H
+#define NEOAA_JOB_H
+
+#include <pthread.h>
+#include "archive.h"
+#include "progress.h"
+#include "stats.h"
+
+typedef enum {
+    NEOAA_JOB_PENDING,
+    NEOAA_JOB_RUNNING,
+    NEOAA_JOB_SUCCEEDED,
+    NEOAA_JOB_FAILED,
+    NEOAA_JOB_CANCELLED,
+} NeoAAJobState;
+
+typedef struct neoaa_job_impl *NeoAAJob;
+
+/*
+ * Called from the worker thread, throttled while the job runs
+ * and exactly once with finished set when it is done. GUI users
+ * should forward it to the UI thread with Fl::awake.
+ */
+typedef void (*NeoAAJobNotify)(NeoAAJob job, int finished);
+
+struct neoaa_job_impl {
+    NeoAACommand command;
+    char *inputPath;
+    char *outputPath;
+    char *memberPath; /* unwrap only, the file to pull out of inputPath */
+    NeoAAArchiveOptions options;
+    NeoAAProgress progress;
+    NeoAAJobState state;
+    int result;
+    uint64_t finishTime; /* neoaa_time_ns once it is done, 0 before */
+    pthread_t thread;
+    int threadStarted;
+    NeoAAJobNotify notify;
+    void *userData;
+    /* Phase timings when enabled, and where the JSON report goes at the end */
+    NeoAAStats *stats;
+    char *reportPath;
+};
+
+NeoAAJob neoaa_job_create(NeoAACommand command, const char *inputPath, const char *outputPath);
+/*
+ * Time the job's phases, before starting it. reportPath may be
+ * NULL, otherwise a JSON report is written there once the job is
+ * done, right before the final notify.
+ */
+int neoaa_job_enable_stats(NeoAAJob job, const char *reportPath);
+/* Which file unwrap copies out, before starting it */
+int neoaa_job_set_member_path(NeoAAJob job, const char *memberPath);
+int neoaa_job_start(NeoAAJob job, NeoAAJobNotify notify, void *userData);
+/* Like neoaa_job_start but on the calling thread, returns once the job is done with its result */
+int neoaa_job_run(NeoAAJob job, NeoAAJobNotify notify, void *userData);
+const char *neoaa_command_name(NeoAACommand command);
+void neoaa_job_cancel(NeoAAJob job);
+NeoAAJobState neoaa_job_state(NeoAAJob job);
+void neoaa_job_destroy(NeoAAJob job);
+
+#endif /* NEOAA_JOB_H */
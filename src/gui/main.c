@@ -8,7 +8,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <getopt.h>
 #include <libgen.h>
 #include <libNeoAppleArchive.h>
 #include <dirent.h>
@@ -24,473 +23,212 @@
 #include <FL/Fl_Multiline_Output.H>
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Help_View.H>
+#include <FL/Fl_Progress.H>
+#include <FL/Fl_Choice.H>
+#include <FL/Fl_Spinner.H>
+#include <FL/Fl_Check_Button.H>
+#include "archive.h"
+#include "browser.h"
+#include "cli.h"
+#include "job.h"
+#include "queue.h"
+#include "walk.h"
 
 #if !(defined(_WIN32) || defined(WIN32))
 #include <sys/types.h>
 #endif
 
-#define OPTSTR "i:o:a:p:f:hv"
-
-typedef enum {
-    NEOAA_CMD_ARCHIVE,
-    NEOAA_CMD_EXTRACT,
-    NEOAA_CMD_LIST,
-    NEOAA_CMD_ADD,
-    NEOAA_CMD_WRAP,
-    NEOAA_CMD_UNWRAP,
-    NEOAA_CMD_VERSION,
-} NeoAACommand;
-
-typedef enum {
-    NEOAA_COMPRESS_LZFSE,
-    NEOAA_COMPRESS_RAW,
-    NEOAA_COMPRESS_ZLIB,
-} NeoAACompression;
-
-extern char *optarg;
-
-void show_help(void) {
-    printf("Usage: neoaa command <options>\n\n");
-    printf("Commands:\n\n");
-    printf(" archive: archive the contents of a directory.\n");
-    printf(" extract: extract files from an archive.\n");
-    printf(" list: list the contents of an archive.\n");
-    printf(" wrap: archive a singular file.\n");
-    printf(" unwrap: extract a singular file from an archive.\n");
-    printf(" version: display version of aa\n");
-    printf("\n");
-    printf("Options:\n\n");
-    printf(" -i: path to the input file or directory.\n");
-    printf(" -o: path to the output file or directory.\n");
-    printf(" -a: algorithm for compression, lzfse (default), zlib, raw (no compression).\n");
-    printf(" -p: specify path of file in project to unwrap.\n");
-    /* printf(" -f: path of file to add to the .aar specified in -i.\n"); */
-    printf(" -h: this ;-)\n");
-    printf("\n");
-}
-
-void list_neo_aa_files(const char *inputPath) {
-    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
-    if (!genericArchive) {
-        fprintf(stderr,"Not enough free memory to list files\n");
-        return;
+/* Widgets showing the state of the job running in the background */
+typedef struct {
+    Fl_Progress *progressBar;
+    Fl_Box *statusBox;
+    Fl_Button *cancelButton;
+    Fl_Button *archiveButton;
+    Fl_Button *extractButton;
+    Fl_Button *verifyButton;
+    Fl_Button *addButton;
+    Fl_Choice *compressionChoice;
+    Fl_Spinner *threadSpinner;
+    Fl_Check_Button *seekableCheck;
+    Fl_Check_Button *incrementalCheck;
+    Fl_Check_Button *dedupCheck;
+    Fl_Check_Button *statsCheck;
+    Fl_Box *statsBox;
+    NeoAAJob job;
+    char statusText[256];
+    char statsText[1024];
+} NeoAAJobPanel;
+
+static NeoAAJobPanel jobPanel;
+
+static void job_panel_update(void) {
+    NeoAAProgressSnapshot snapshot;
+    neoaa_progress_snapshot(&jobPanel.job->progress, &snapshot);
+    char done[32];
+    char total[32];
+    char rate[32];
+    neoaa_format_bytes(done, sizeof(done), (double)snapshot.bytesDone);
+    neoaa_format_bytes(total, sizeof(total), (double)snapshot.bytesTotal);
+    neoaa_format_bytes(rate, sizeof(rate), snapshot.bytesPerSecond);
+    if (snapshot.etaSeconds >= 0) {
+        unsigned long eta = (unsigned long)snapshot.etaSeconds;
+        snprintf(jobPanel.statusText, sizeof(jobPanel.statusText), "%s / %s, %llu / %llu items, %s/s, ETA %lu:%02lu",
+                 done, total, (unsigned long long)snapshot.itemsDone, (unsigned long long)snapshot.itemsTotal,
+                 rate, eta / 60, eta % 60);
+    } else {
+        snprintf(jobPanel.statusText, sizeof(jobPanel.statusText), "%s, %llu items, %s/s",
+                 done, (unsigned long long)snapshot.itemsDone, rate);
     }
-    NeoAAArchivePlain archive = genericArchive->raw;
-    for (int i = 0; i < archive->itemCount; i++) {
-        /*
-         * We loop through all items to find the PAT field key.
-         * The PAT field key will be what path the item is in the
-         * archive. This also includes symlinks.
-         */
-        NeoAAArchiveItem item = archive->items[i];
-        NeoAAHeader header = item->header;
-        int index = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
-        if (index == -1) {
-            continue;
-        }
-        /* If index is not -1, then header has PAT field key */
-        char *patStr = neo_aa_header_get_field_key_string(header, index);
-        if (!patStr) {
-            printf("Could not get PAT entry in header\n");
-            continue;
-        }
-        printf("%s\n",patStr);
-        free(patStr);
+    if (snapshot.bytesTotal) {
+        jobPanel.progressBar->value((float)((double)snapshot.bytesDone / (double)snapshot.bytesTotal));
+    } else if (snapshot.itemsTotal) {
+        jobPanel.progressBar->value((float)((double)snapshot.itemsDone / (double)snapshot.itemsTotal));
+    }
+    jobPanel.statusBox->label(jobPanel.statusText);
+    if (jobPanel.job->stats) {
+        neoaa_stats_format(jobPanel.job->stats, jobPanel.statsText, sizeof(jobPanel.statsText));
+        jobPanel.statsBox->label(jobPanel.statsText);
     }
 }
 
-void add_file_in_neo_aa(const char *inputPath, const char *outputPath, const char *addPath, NeoAACompression compress) {
-    NeoAAHeader header = neo_aa_header_create();
-    if (!header) {
-        fprintf(stderr,"Failed to create header\n");
-        return;
-    }
-    char *fileName = basename((char *)addPath);
-    /* Declare our file as, well, a file */
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("TYP"), 1, 'F');
-    /* Declare our PAT to be our file name */
-    neo_aa_header_set_field_string(header, NEO_AA_FIELD_C("PAT"), strlen(fileName), fileName);
-    /* Set other field keys */
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("UID"), 2, 0x1F5);
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("GID"), 1, 0x14);
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("MOD"), 2, 0x1ED);
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("FLG"), 1, 0);
-    /* Crete the NeoAAArchiveItem item */
-    NeoAAArchiveItem item = neo_aa_archive_item_create_with_header(header);
-    if (!item) {
-        neo_aa_header_destroy_nozero(header);
-        fprintf(stderr,"Failed to create item\n");
-        return;
-    }
-    FILE *fp = fopen(addPath, "rb");
-    if (!fp) {
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Failed to open input path\n");
-        return;
-    }
-    fseek(fp, 0, SEEK_END);
-    size_t binarySize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    /* allocate our uncompressed data */
-    uint8_t *data = (uint8_t *)malloc(binarySize);
-    if (!data) {
-        fclose(fp);
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Not enough memory to allocate file into memory\n");
-        return;
-    }
-    ssize_t bytesRead = fread(data, binarySize, 1, fp);
-    fclose(fp);
-    if (bytesRead < binarySize) {
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Failed to read the entire file\n");
-        return;
-    }
-    
-    /* Handle other than RAW later */
-    neo_aa_header_set_field_blob(header, NEO_AA_FIELD_C("DAT"), 0, binarySize);
-    neo_aa_archive_item_add_blob_data(item, (char *)data, binarySize);
-    free(data);
-    
-    /* Make NeoAAArchivePlain from inputPath */
-    NeoAAArchiveGeneric plainInputArchive = neo_aa_archive_generic_from_path(inputPath);
-    if (!plainInputArchive) {
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Not enough memory to make NeoAAArchiveGeneric\n");
-        return;
-    }
-    NeoAAArchivePlain rawInput = plainInputArchive->raw;
-    /* VLAs are ugly but eh */
-    NeoAAArchiveItem itemList[rawInput->itemCount + 1];
-    memcpy(itemList, rawInput->items, rawInput->itemCount);
-    itemList[rawInput->itemCount] = item;
-    free(plainInputArchive);
-    NeoAAArchivePlain archive = neo_aa_archive_plain_create_with_items_nocopy(itemList, rawInput->itemCount + 1);
-    neo_aa_archive_plain_destroy_nozero(rawInput);
-    if (!archive) {
-        fprintf(stderr,"Failed to create NeoAAArchivePlain\n");
-        return;
-    }
-    if (NEOAA_COMPRESS_LZFSE == compress) {
-        neo_aa_archive_plain_compress_write_path(archive, NEOAA_COMPRESS_LZFSE, outputPath);
-        return;
+static void job_panel_set_running(int running) {
+    if (running) {
+        jobPanel.archiveButton->deactivate();
+        jobPanel.extractButton->deactivate();
+        jobPanel.verifyButton->deactivate();
+        jobPanel.addButton->deactivate();
+        jobPanel.cancelButton->activate();
+    } else {
+        jobPanel.archiveButton->activate();
+        jobPanel.extractButton->activate();
+        jobPanel.verifyButton->activate();
+        jobPanel.addButton->activate();
+        jobPanel.cancelButton->deactivate();
     }
-    neo_aa_archive_plain_write_path(archive, outputPath);
-    neo_aa_archive_plain_destroy_nozero(archive);
 }
 
-void wrap_file_in_neo_aa(const char *inputPath, const char *outputPath, NeoAACompression compress) {
-    NeoAAHeader header = neo_aa_header_create();
-    if (!header) {
-        fprintf(stderr,"Failed to create header\n");
-        return;
-    }
-    char *fileName = basename((char *)inputPath);
-    /* Declare our file as, well, a file */
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("TYP"), 1, 'F');
-    /* Declare our PAT to be our file name */
-    neo_aa_header_set_field_string(header, NEO_AA_FIELD_C("PAT"), strlen(fileName), fileName);
-    /* Set other field keys */
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("UID"), 2, 0x1F5);
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("GID"), 1, 0x14);
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("MOD"), 2, 0x1ED);
-    neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("FLG"), 1, 0);
-    /* Crete the NeoAAArchiveItem item */
-    NeoAAArchiveItem item = neo_aa_archive_item_create_with_header(header);
-    if (!item) {
-        neo_aa_header_destroy_nozero(header);
-        fprintf(stderr,"Failed to create item\n");
-        return;
-    }
-    FILE *fp = fopen(inputPath, "r");
-    if (!fp) {
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Failed to open input path\n");
-        return;
-    }
-    fseek(fp, 0, SEEK_END);
-    size_t binarySize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    /* allocate our uncompressed data */
-    uint8_t *data = (uint8_t *)malloc(binarySize);
-    if (!data) {
-        fclose(fp);
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Not enough memory to allocate file into memory\n");
-        return;
-    }
-    ssize_t bytesRead = fread(data, 1, binarySize, fp);
-    fclose(fp);
-    if (bytesRead < binarySize) {
-        neo_aa_archive_item_destroy_nozero(item);
-        fprintf(stderr,"Failed to read the entire file\n");
-        return;
-    }
-    
-    /* Handle other than RAW later */
-    neo_aa_header_set_field_blob(header, NEO_AA_FIELD_C("DAT"), 0, binarySize);
-    neo_aa_archive_item_add_blob_data(item, (char *)data, binarySize);
-    free(data);
-    NeoAAArchiveItemList itemList = &item;
-    NeoAAArchivePlain archive = neo_aa_archive_plain_create_with_items_nocopy(itemList, 1);
-    if (!archive) {
-        fprintf(stderr,"Failed to create NeoAAArchivePlain\n");
-        return;
-    }
-    if (NEOAA_COMPRESS_LZFSE == compress) {
-        neo_aa_archive_plain_compress_write_path(archive, NEOAA_COMPRESS_LZFSE, outputPath);
+/* Runs on the UI thread, scheduled by Fl::awake from the worker */
+static void job_progress_awake_cb(void *data) {
+    NeoAAJob job = (NeoAAJob)data;
+    if (job != jobPanel.job) {
         return;
     }
-    neo_aa_archive_plain_write_path(archive, outputPath);
+    job_panel_update();
 }
 
-void unwrap_file_out_of_neo_aa(const char *inputPath, const char *outputPath, char *pathString) {
-    NeoAAArchiveGeneric genericArchive = neo_aa_archive_generic_from_path(inputPath);
-    if (!genericArchive) {
-        fprintf(stderr,"Not enough free memory to list files\n");
+static void job_finished_awake_cb(void *data) {
+    NeoAAJob job = (NeoAAJob)data;
+    if (job != jobPanel.job) {
         return;
     }
-    NeoAAArchivePlain archive = genericArchive->raw;
-    for (int i = 0; i < archive->itemCount; i++) {
-        /*
-         * We loop through all items to find the PAT field key.
-         * The PAT field key will be what path the item is in the
-         * archive. This also includes symlinks.
-         */
-        NeoAAArchiveItem item = archive->items[i];
-        NeoAAHeader header = item->header;
-        int index = neo_aa_header_get_field_key_index(header, NEO_AA_FIELD_C("PAT"));
-        if (index == -1) {
-            continue;
-        }
-        /* If index is not -1, then header has PAT field key */
-        char *patStr = neo_aa_header_get_field_key_string(header, index);
-        if (!patStr) {
-            printf("Could not get PAT entry in header\n");
-            continue;
+    job_panel_update();
+    NeoAAJobState state = neoaa_job_state(job);
+    if (state == NEOAA_JOB_SUCCEEDED) {
+        jobPanel.progressBar->value(1.0f);
+    } else {
+        jobPanel.progressBar->value(0.0f);
+        jobPanel.statusBox->label(state == NEOAA_JOB_CANCELLED ? "Cancelled" : "Failed");
+    }
+    job_panel_set_running(0);
+    if (state == NEOAA_JOB_SUCCEEDED) {
+        if (job->reportPath) {
+            printf("Timings written to %s\n", job->reportPath);
         }
-        if (strncmp(pathString,patStr,strlen(pathString)) == 0) {
-            free(patStr);
-            /* Unwrap file */
-            FILE *fp = fopen(outputPath, "w");
-            if (!fp) {
-                fprintf(stderr,"Failed to open outputPath.\n");
-                return;
-            }
-            fwrite(item->encodedBlobData, item->encodedBlobDataSize, 1, fp);
-            fclose(fp);
-            return;
+        if (job->command == NEOAA_CMD_ARCHIVE) {
+            fl_message("Archive created successfully at:\n%s", job->outputPath);
+        } else if (job->command == NEOAA_CMD_ADD) {
+            fl_message("File added successfully to:\n%s", job->outputPath);
+        } else if (job->command == NEOAA_CMD_VERIFY) {
+            fl_message("Every checksum matched in:\n%s", job->inputPath);
+        } else {
+            fl_message("Extraction completed successfully to:\n%s", job->outputPath);
         }
-        free(patStr);
+    } else if (state == NEOAA_JOB_FAILED && job->result == NEOAA_ERR_CHECKSUM) {
+        fl_alert("Some files do not match their checksums, the terminal lists them");
+    } else if (state == NEOAA_JOB_FAILED && job->result == NEOAA_ERR_INCOMPLETE) {
+        fl_alert("Some files could not be read whole, the terminal lists them. The archive is still at:\n%s", job->outputPath);
+    } else if (state == NEOAA_JOB_FAILED) {
+        fl_alert("Operation failed (error %d)", job->result);
     }
-    printf("Could not find file at the specified path in the project.\n");
+    jobPanel.job = NULL;
+    /* The panel keeps showing the last timings, they live in our own buffer */
+    neoaa_job_destroy(job);
 }
 
-/* TODO: Experimental */
-/* Recursively archive directory contents */
-static int add_directory_contents_to_archive(const char *dirPath, NeoAAArchiveItem *items, 
-                                          size_t *itemsCount, size_t *itemsMalloc,
-                                          const char *basePath) {
-    DIR *dir = opendir(dirPath);
-    if (!dir) {
-        fprintf(stderr, "Failed to open directory: %s\n", dirPath);
-        return -1;
+/* Runs on the worker thread, never touch widgets here */
+static void job_notify(NeoAAJob job, int finished) {
+    if (!finished) {
+        /* Dropping an update when the awake queue is full is harmless */
+        Fl::awake(job_progress_awake_cb, job);
+        return;
     }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;  /* Skip "." and ".." */
-        }
-
-        char fullPath[1024];
-        snprintf(fullPath, sizeof(fullPath), "%s/%s", dirPath, entry->d_name);
-
-        /* Build relative path for PAT field */
-        char relativePath[2048];
-        if (basePath && basePath[0] != '\0') {
-            snprintf(relativePath, sizeof(relativePath), "%s/%s", basePath, entry->d_name);
-        } else {
-            strncpy(relativePath, entry->d_name, sizeof(relativePath));
-        }
-
-        /* Check if we need to grow our items array */
-        if (*itemsCount == *itemsMalloc) {
-            *itemsMalloc *= 2;
-            NeoAAArchiveItem *newItems = (NeoAAArchiveItem *)realloc(items, sizeof(NeoAAArchiveItem) * (*itemsMalloc));
-            if (!newItems) {
-                fprintf(stderr, "Failed to realloc items array\n");
-                closedir(dir);
-                return -2;
-            }
-            items = newItems;
-        }
-
-        struct stat fileStat;
-        if (lstat(fullPath, &fileStat) < 0) {
-            perror("Failed to get file info");
-            continue;
-        }
-
-        NeoAAHeader header = neo_aa_header_create();
-        if (!header) {
-            fprintf(stderr, "Failed to create header for %s\n", fullPath);
-            continue;
-        }
-
-#if !(defined(_WIN32) || defined(WIN32))
-        /* Set UID/GID on Unix-like systems */
-        if (fileStat.st_uid != (uid_t)-1) {
-            neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("UID"), 2, (unsigned short)fileStat.st_uid);
-        }
-        if (fileStat.st_gid != (gid_t)-1) {
-            neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("GID"), 1, (unsigned char)fileStat.st_gid);
-        }
-#endif
-
-        if (S_ISDIR(fileStat.st_mode)) {
-            /* Handle directory */
-            neo_aa_header_set_field_string(header, NEO_AA_FIELD_C("PAT"), strlen(relativePath), relativePath);
-            neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("TYP"), 1, 'D');
-            
-            NeoAAArchiveItem item = neo_aa_archive_item_create_with_header(header);
-            if (!item) {
-                fprintf(stderr, "Failed to create item for directory: %s\n", fullPath);
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            
-            items[(*itemsCount)++] = item;
-            
-            /* Recursively process subdirectory */
-            int result = add_directory_contents_to_archive(fullPath, items, itemsCount, itemsMalloc, relativePath);
-            if (result != 0) {
-                closedir(dir);
-                return result;
-            }
-        } else if (S_ISLNK(fileStat.st_mode)) {
-#if !(defined(_WIN32) || defined(WIN32))
-            /* Handle symlink */
-            char symlinkTarget[1024];
-            ssize_t len = readlink(fullPath, symlinkTarget, sizeof(symlinkTarget) - 1);
-            if (len < 0) {
-                perror("readlink failed");
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            symlinkTarget[len] = '\0';
-            
-            neo_aa_header_set_field_string(header, NEO_AA_FIELD_C("PAT"), strlen(relativePath), relativePath);
-            neo_aa_header_set_field_string(header, NEO_AA_FIELD_C("LNK"), len, symlinkTarget);
-            neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("TYP"), 1, 'L');
-            
-            NeoAAArchiveItem item = neo_aa_archive_item_create_with_header(header);
-            if (!item) {
-                fprintf(stderr, "Failed to create item for symlink: %s\n", fullPath);
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            
-            items[(*itemsCount)++] = item;
-#endif
-        } else if (S_ISREG(fileStat.st_mode)) {
-            /* Handle regular file */
-            int fd = open(fullPath, O_RDONLY);
-            if (fd < 0) {
-                perror("Failed to open file");
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            
-            size_t fileSize = fileStat.st_size;
-            unsigned char *fileData = (unsigned char *)malloc(fileSize);
-            if (!fileData) {
-                fprintf(stderr, "Memory allocation failed for file: %s\n", fullPath);
-                close(fd);
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            
-            ssize_t bytesRead = read(fd, fileData, fileSize);
-            close(fd);
-            
-            if (bytesRead < (ssize_t)fileSize) {
-                fprintf(stderr, "Failed to read entire file: %s\n", fullPath);
-                free(fileData);
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            
-            neo_aa_header_set_field_string(header, NEO_AA_FIELD_C("PAT"), strlen(relativePath), relativePath);
-            neo_aa_header_set_field_uint(header, NEO_AA_FIELD_C("TYP"), 1, 'F');
-            neo_aa_header_set_field_blob(header, NEO_AA_FIELD_C("DAT"), 0, fileSize);
-            
-            NeoAAArchiveItem item = neo_aa_archive_item_create_with_header(header);
-            if (!item) {
-                fprintf(stderr, "Failed to create item for file: %s\n", fullPath);
-                free(fileData);
-                neo_aa_header_destroy_nozero(header);
-                continue;
-            }
-            
-            neo_aa_archive_item_add_blob_data(item, (char *)fileData, fileSize);
-            items[(*itemsCount)++] = item;
-            free(fileData);
-        }
+    /* The final notification must arrive, otherwise the job is never reaped */
+    while (Fl::awake(job_finished_awake_cb, job) != 0) {
+        usleep(1000);
     }
-    
-    closedir(dir);
-    return 0;
 }
 
-int create_aar_from_directory(const char *dirPath, const char *outputPath) {
-    size_t itemsCount = 0;
-    size_t itemsMalloc = 100;
-    NeoAAArchiveItemList items = (NeoAAArchiveItemList)malloc(sizeof(NeoAAArchiveItem) * itemsMalloc);
-    if (!items) {
-        fprintf(stderr, "Failed to allocate initial items array\n");
-        return -1;
+/* Order of the entries in the compression choice */
+static const NeoAACompression compressionChoices[] = {
+    NEOAA_COMPRESS_LZFSE,
+    NEOAA_COMPRESS_ZLIB,
+    NEOAA_COMPRESS_RAW,
+};
+
+static void start_job(NeoAACommand command, const char *inputPath, const char *outputPath) {
+    if (jobPanel.job) {
+        return;
     }
-    
-    /* Process directory recursively */
-    int result = add_directory_contents_to_archive(dirPath, items, &itemsCount, &itemsMalloc, "");
-    if (result != 0) {
-        neo_aa_archive_item_list_destroy_nozero(items, itemsCount);
-        return result;
+    NeoAAJob job = neoaa_job_create(command, inputPath, outputPath);
+    if (!job) {
+        fl_alert("Not enough memory to start job");
+        return;
     }
-    
-    /* Create archive if we found any items */
-    if (itemsCount > 0) {
-        NeoAAArchivePlain archive = neo_aa_archive_plain_create_with_items_nocopy(items, itemsCount);
-        if (!archive) {
-            fprintf(stderr, "Failed to create archive from items\n");
-            neo_aa_archive_item_list_destroy_nozero(items, itemsCount);
-            return -2;
+    int choice = jobPanel.compressionChoice->value();
+    if (choice >= 0 && choice < (int)(sizeof(compressionChoices) / sizeof(compressionChoices[0]))) {
+        job->options.compression = compressionChoices[choice];
+    }
+    job->options.threadCount = (int)jobPanel.threadSpinner->value();
+    job->options.seekable = jobPanel.seekableCheck->value();
+    job->options.incremental = jobPanel.incrementalCheck->value();
+    job->options.dedup = jobPanel.dedupCheck->value();
+    if (jobPanel.statsCheck->value()) {
+        /* The report goes next to the archive the job works on */
+        const char *archivePath = (command == NEOAA_CMD_EXTRACT || command == NEOAA_CMD_VERIFY) ? inputPath : outputPath;
+        const char *commandName = neoaa_command_name(command);
+        size_t reportSize = strlen(archivePath) + strlen(commandName) + 7;
+        char *reportPath = (char *)malloc(reportSize);
+        if (reportPath) {
+            snprintf(reportPath, reportSize, "%s.%s.json", archivePath, commandName);
         }
-        
-        /* Write the archive */
-        neo_aa_archive_plain_write_path(archive, outputPath);
-        neo_aa_archive_plain_destroy_nozero(archive);
-    } else {
-        free(items);
-        fprintf(stderr, "No items found to archive\n");
-        return -3;
+        if (!reportPath || neoaa_job_enable_stats(job, reportPath) != 0) {
+            fprintf(stderr, "Failed to enable timings, running without\n");
+        }
+        free(reportPath);
+    }
+    jobPanel.statsText[0] = '\0';
+    jobPanel.statsBox->label(jobPanel.statsText);
+    jobPanel.job = job;
+    jobPanel.progressBar->value(0.0f);
+    jobPanel.statusBox->label(command == NEOAA_CMD_ARCHIVE ? "Scanning..." : "Loading archive...");
+    job_panel_set_running(1);
+    if (neoaa_job_start(job, job_notify, NULL) != 0) {
+        jobPanel.job = NULL;
+        neoaa_job_destroy(job);
+        job_panel_set_running(0);
+        fl_alert("Failed to start job");
     }
-    
-    return 0;
 }
 
-
 static void archive_button_cb(Fl_Widget* w, void* data) {
     Fl_Input* inputPathInput = (Fl_Input*)data;
     const char* inputPath = inputPathInput->value();
 
     if (inputPath && inputPath[0] != '\0') {
-        const char* outputPath = fl_file_chooser("Select Output AAR Location", "*.aar", "output.aar", 1);
+        const char* outputPath = fl_file_chooser("Select Output AAR Location", "*.{aar,yaa}", "output.aar", 1);
         if (outputPath) {
             printf("Archiving: %s -> %s\n", inputPath, outputPath);
-            create_aar_from_directory(inputPath, outputPath);
-            fl_message("Archive created successfully at:\n%s", outputPath);
+            start_job(NEOAA_CMD_ARCHIVE, inputPath, outputPath);
         }
     }
 }
@@ -503,12 +241,54 @@ static void extract_button_cb(Fl_Widget* w, void* data) {
         const char* outputPath = fl_dir_chooser("Select Extraction Destination", "");
         if (outputPath) {
             printf("Extracting: %s -> %s\n", inputPath, outputPath);
-            neo_aa_extract_aar_to_path(inputPath, outputPath);
-            fl_message("Extraction completed successfully to:\n%s", outputPath);
+            start_job(NEOAA_CMD_EXTRACT, inputPath, outputPath);
         }
     }
 }
 
+static void verify_button_cb(Fl_Widget* w, void* data) {
+    Fl_Input* inputPathInput = (Fl_Input*)data;
+    const char* inputPath = inputPathInput->value();
+
+    if (inputPath && inputPath[0] != '\0') {
+        printf("Verifying: %s\n", inputPath);
+        start_job(NEOAA_CMD_VERIFY, inputPath, "");
+    }
+}
+
+static void add_button_cb(Fl_Widget* w, void* data) {
+    Fl_Input* archivePathInput = (Fl_Input*)data;
+    const char* archivePath = archivePathInput->value();
+
+    if (archivePath && archivePath[0] != '\0') {
+        const char* addPath = fl_file_chooser("Select File to Add", "*", "");
+        if (addPath) {
+            printf("Adding: %s -> %s\n", addPath, archivePath);
+            start_job(NEOAA_CMD_ADD, addPath, archivePath);
+        }
+    }
+}
+
+static void contents_button_cb(Fl_Widget* w, void* data) {
+    Fl_Input* inputPathInput = (Fl_Input*)data;
+    const char* inputPath = inputPathInput->value();
+
+    if (inputPath && inputPath[0] != '\0') {
+        neoaa_browser_show(inputPath);
+    }
+}
+
+static void cancel_button_cb(Fl_Widget* w, void* data) {
+    if (jobPanel.job) {
+        neoaa_job_cancel(jobPanel.job);
+        jobPanel.statusBox->label("Cancelling...");
+    }
+}
+
+static void queue_button_cb(Fl_Widget* w, void* data) {
+    neoaa_queue_show();
+}
+
 static void browse_input_cb(Fl_Widget* w, void* data) {
     Fl_Input* inputPathInput = (Fl_Input*)data;
     /* 
@@ -532,9 +312,14 @@ static void browse_output_cb(Fl_Widget* w, void* data) {
 }
 
 int main(int argc, char** argv) {
-    Fl_Window* window = new Fl_Window(400, 300, "NeoAppleArchive");
+    /* Anything on the command line is a headless job, except the process serial number Finder passes */
+    if (argc > 1 && strncmp(argv[1], "-psn_", 5) != 0) {
+        return neoaa_cli_main(argc, argv);
+    }
 
-    Fl_Group* group = new Fl_Group(10, 10, 380, 280);
+    Fl_Window* window = new Fl_Window(400, 480, "NeoAppleArchive");
+
+    Fl_Group* group = new Fl_Group(10, 10, 380, 460);
     
     Fl_Box* title = new Fl_Box(FL_FLAT_BOX, 0, 10, 400, 30, "NeoAppleArchive");
     title->labelsize(16);
@@ -545,6 +330,11 @@ int main(int argc, char** argv) {
     credit->labelsize(10);
     credit->align(FL_ALIGN_CENTER);
 
+    Fl_Button* queueButton = new Fl_Button(320, 12, 70, 22, "Queue");
+    queueButton->labelsize(12);
+    queueButton->callback(queue_button_cb);
+    queueButton->tooltip("Archive and extract many folders and archives at once, dropped on the queue or picked together.");
+
     Fl_Box* archiveLabel = new Fl_Box(FL_FLAT_BOX, 10, 50, 380, 20, "Select Directory to Archive:");
     archiveLabel->labelsize(12);
     archiveLabel->labelfont(FL_BOLD);
@@ -556,26 +346,106 @@ int main(int argc, char** argv) {
     Fl_Button* browseInputButton = new Fl_Button(300, 80, 80, 30, "Browse");
     browseInputButton->callback(browse_input_cb, (void*)inputPathInput);
     
-    Fl_Button* archiveButton = new Fl_Button(10, 120, 360, 40, "Create Archive");
+    Fl_Choice* compressionChoice = new Fl_Choice(100, 120, 90, 25, "Compression:");
+    compressionChoice->labelsize(12);
+    compressionChoice->add("LZFSE");
+    compressionChoice->add("zlib");
+    compressionChoice->add("None");
+    compressionChoice->value(0);
+    compressionChoice->tooltip("Compress the archive in parallel blocks, data that will not shrink is stored as is. None writes a plain .aar.");
+
+    Fl_Check_Button* seekableCheck = new Fl_Check_Button(195, 120, 70, 25, "Seekable");
+    seekableCheck->labelsize(12);
+    seekableCheck->tooltip("Add a chunk table so single files can be pulled out without decompressing everything.");
+
+    Fl_Spinner* threadSpinner = new Fl_Spinner(320, 120, 50, 25, "Threads:");
+    threadSpinner->labelsize(12);
+    threadSpinner->minimum(1);
+    threadSpinner->maximum(NEOAA_MAX_THREADS);
+    threadSpinner->step(1);
+    threadSpinner->value(neoaa_default_thread_count());
+    threadSpinner->tooltip("Worker threads used for reading and compressing.");
+
+    Fl_Button* archiveButton = new Fl_Button(10, 150, 180, 40, "Create Archive");
     archiveButton->callback(archive_button_cb, (void*)inputPathInput);
+
+    Fl_Check_Button* dedupCheck = new Fl_Check_Button(195, 157, 85, 25, "Dedup");
+    dedupCheck->labelsize(12);
+    dedupCheck->tooltip("Store hard links and identical files once, extraction links or copies them back.");
+
+    Fl_Check_Button* incrementalCheck = new Fl_Check_Button(285, 157, 95, 25, "Incremental");
+    incrementalCheck->labelsize(12);
+    incrementalCheck->tooltip("Replace an existing archive, copying files that have not changed since it was made instead of reading them again.");
     
-    Fl_Box* extractLabel = new Fl_Box(FL_FLAT_BOX, 10, 170, 380, 20, "Select AAR to Extract:");
+    Fl_Box* extractLabel = new Fl_Box(FL_FLAT_BOX, 10, 200, 380, 20, "Select AAR to Extract:");
     extractLabel->labelsize(12);
     extractLabel->labelfont(FL_BOLD);
 
-    Fl_Input* outputPathInput = new Fl_Input(10, 200, 280, 30, "AAR File:");
+    Fl_Input* outputPathInput = new Fl_Input(10, 230, 280, 30, "AAR File:");
     outputPathInput->align(FL_ALIGN_LEFT);
     outputPathInput->tooltip("Choose the .aar or .yaa file to extract.");
 
-    Fl_Button* browseOutputButton = new Fl_Button(300, 200, 80, 30, "Browse");
+    Fl_Button* browseOutputButton = new Fl_Button(300, 230, 80, 30, "Browse");
     browseOutputButton->callback(browse_output_cb, (void*)outputPathInput);
 
-    Fl_Button* extractButton = new Fl_Button(10, 240, 360, 40, "Extract AAR");
+    Fl_Button* extractButton = new Fl_Button(10, 270, 90, 40, "Extract");
     extractButton->callback(extract_button_cb, (void*)outputPathInput);
 
+    Fl_Button* verifyButton = new Fl_Button(105, 270, 85, 40, "Verify");
+    verifyButton->callback(verify_button_cb, (void*)outputPathInput);
+    verifyButton->tooltip("Check every file against the checksums stored in the archive without extracting anything.");
+
+    Fl_Button* addButton = new Fl_Button(195, 270, 90, 40, "Add File");
+    addButton->callback(add_button_cb, (void*)outputPathInput);
+    addButton->tooltip("Append a file to the end of the archive without rewriting it.");
+
+    Fl_Button* contentsButton = new Fl_Button(290, 270, 90, 40, "Contents");
+    contentsButton->callback(contents_button_cb, (void*)outputPathInput);
+    contentsButton->tooltip("List what is in the archive without extracting it.");
+
+    Fl_Progress* progressBar = new Fl_Progress(10, 320, 280, 25);
+    progressBar->minimum(0.0f);
+    progressBar->maximum(1.0f);
+    progressBar->value(0.0f);
+
+    Fl_Button* cancelButton = new Fl_Button(300, 320, 80, 25, "Cancel");
+    cancelButton->callback(cancel_button_cb);
+    cancelButton->deactivate();
+
+    Fl_Box* statusBox = new Fl_Box(FL_NO_BOX, 10, 350, 285, 50, "Idle");
+    statusBox->labelsize(11);
+    statusBox->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE | FL_ALIGN_WRAP);
+
+    Fl_Check_Button* statsCheck = new Fl_Check_Button(300, 350, 85, 25, "Timings");
+    statsCheck->labelsize(12);
+    statsCheck->tooltip("Time each phase of the job, show it below and write a JSON report next to the archive.");
+
+    Fl_Box* statsBox = new Fl_Box(FL_DOWN_BOX, 10, 405, 380, 60, "");
+    statsBox->labelsize(10);
+    statsBox->align(FL_ALIGN_LEFT | FL_ALIGN_TOP | FL_ALIGN_INSIDE | FL_ALIGN_CLIP);
+
+    jobPanel.progressBar = progressBar;
+    jobPanel.statusBox = statusBox;
+    jobPanel.cancelButton = cancelButton;
+    jobPanel.archiveButton = archiveButton;
+    jobPanel.extractButton = extractButton;
+    jobPanel.verifyButton = verifyButton;
+    jobPanel.addButton = addButton;
+    jobPanel.compressionChoice = compressionChoice;
+    jobPanel.threadSpinner = threadSpinner;
+    jobPanel.seekableCheck = seekableCheck;
+    jobPanel.incrementalCheck = incrementalCheck;
+    jobPanel.dedupCheck = dedupCheck;
+    jobPanel.statsCheck = statsCheck;
+    jobPanel.statsBox = statsBox;
+
     group->end();
     window->end();
     window->show(argc, argv);
 
-    return Fl::run();
+    /* Enable FLTK's thread support so workers can use Fl::awake */
+    Fl::lock();
+    int result = Fl::run();
+    neoaa_queue_shutdown();
+    return result;
 }
@@ -0,0 +1,343 @@
+/*
+ *  patindex.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "patindex.h"
+#include "reader.h"
+#include "scan.h"
+
+/*
+ * Sidecar layout, host byte order since it is only a cache:
+ * magic, version, the archive stat it was built from, counts,
+ * then the entry array and the string pool.
+ */
+#define NEOAA_INDEX_MAGIC "NIDX"
+#define NEOAA_INDEX_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t archiveSize;
+    int64_t archiveMtimeSec;
+    int64_t archiveMtimeNsec;
+    uint64_t count;
+    uint64_t poolSize;
+    uint32_t compressed;
+    uint32_t reserved;
+} NeoAAIndexFileHeader;
+
+static uint64_t hash_path(const char *path) {
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static NeoAAIndex index_create(void) {
+    return (NeoAAIndex)calloc(1, sizeof(struct neoaa_index_impl));
+}
+
+static int index_stat(NeoAAIndex index, const char *archivePath) {
+    struct stat fileStat;
+    if (stat(archivePath, &fileStat) != 0) {
+        return -1;
+    }
+    index->archiveSize = fileStat.st_size;
+    index->archiveMtimeSec = fileStat.st_mtim.tv_sec;
+    index->archiveMtimeNsec = fileStat.st_mtim.tv_nsec;
+    return 0;
+}
+
+static int index_append(NeoAAIndex index, const NeoAAScanEntry *scan) {
+    size_t pathLength = strlen(scan->path) + 1;
+    if (index->poolSize + pathLength > index->poolCapacity) {
+        size_t capacity = index->poolCapacity ? index->poolCapacity * 2 : 65536;
+        while (capacity < index->poolSize + pathLength) {
+            capacity *= 2;
+        }
+        char *pool = (char *)realloc(index->pool, capacity);
+        if (!pool) {
+            return -1;
+        }
+        index->pool = pool;
+        index->poolCapacity = capacity;
+    }
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 1024;
+        NeoAAIndexEntry *entries = (NeoAAIndexEntry *)realloc(index->entries, capacity * sizeof(NeoAAIndexEntry));
+        if (!entries) {
+            return -1;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    NeoAAIndexEntry *entry = &index->entries[index->count++];
+    memset(entry, 0, sizeof(NeoAAIndexEntry));
+    entry->pathOffset = index->poolSize;
+    entry->headerOffset = scan->headerOffset;
+    entry->datOffset = scan->datOffset;
+    entry->datSize = scan->datSize;
+    entry->type = scan->type;
+    memcpy(index->pool + index->poolSize, scan->path, pathLength);
+    index->poolSize += pathLength;
+    return 0;
+}
+
+/* Built once all entries are in, so the table is sized right the first time */
+static int index_hash(NeoAAIndex index) {
+    if (index->count >= UINT32_MAX) {
+        return -1;
+    }
+    size_t bucketCount = 16;
+    while (bucketCount < index->count * 2) {
+        bucketCount *= 2;
+    }
+    uint32_t *buckets = (uint32_t *)calloc(bucketCount, sizeof(uint32_t));
+    if (!buckets) {
+        return -1;
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucketCount = bucketCount;
+    for (size_t i = 0; i < index->count; i++) {
+        const char *path = neoaa_index_path(index, &index->entries[i]);
+        size_t slot = hash_path(path) & (bucketCount - 1);
+        while (buckets[slot]) {
+            /* A later entry for the same path replaces it, an add appends a newer version */
+            if (strcmp(neoaa_index_path(index, &index->entries[buckets[slot] - 1]), path) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (bucketCount - 1);
+        }
+        buckets[slot] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+NeoAAIndex neoaa_index_build(const char *archivePath) {
+    NeoAAReader reader = neoaa_reader_open_path(archivePath);
+    if (!reader) {
+        return NULL;
+    }
+    NeoAAIndex index = index_create();
+    uint8_t *header = (uint8_t *)malloc(NEOAA_MAX_HEADER_SIZE);
+    if (!index || !header || index_stat(index, archivePath) != 0) {
+        free(header);
+        neoaa_index_destroy(index);
+        neoaa_reader_close(reader);
+        return NULL;
+    }
+    index->compressed = reader->compressed;
+
+    int failed = 0;
+    NeoAAScanEntry scan;
+    int status;
+    while ((status = neoaa_scan_next(reader, header, &scan)) > 0) {
+        /* Only the header is decoded, blob data is skipped in place */
+        int appended = scan.path ? index_append(index, &scan) : 0;
+        uint64_t blobsSize = scan.blobsSize;
+        neoaa_scan_entry_clear(&scan);
+        if (appended != 0 || (blobsSize && neoaa_reader_skip(reader, blobsSize) != 0)) {
+            failed = 1;
+            break;
+        }
+    }
+    if (status < 0) {
+        failed = 1;
+    }
+    free(header);
+    neoaa_reader_close(reader);
+    if (failed) {
+        fprintf(stderr, "Malformed archive %s\n", archivePath);
+    }
+    if (failed || index_hash(index) != 0) {
+        neoaa_index_destroy(index);
+        return NULL;
+    }
+    return index;
+}
+
+static char *sidecar_path(const char *archivePath) {
+    size_t length = strlen(archivePath);
+    char *path = (char *)malloc(length + sizeof(NEOAA_INDEX_SUFFIX));
+    if (path) {
+        memcpy(path, archivePath, length);
+        memcpy(path + length, NEOAA_INDEX_SUFFIX, sizeof(NEOAA_INDEX_SUFFIX));
+    }
+    return path;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    uint8_t *bytes = (uint8_t *)data;
+    while (size) {
+        ssize_t got = read(fd, bytes, size);
+        if (got <= 0) {
+            return -1;
+        }
+        bytes += got;
+        size -= got;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0) {
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+NeoAAIndex neoaa_index_load(const char *archivePath) {
+    char *path = sidecar_path(archivePath);
+    if (!path) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    NeoAAIndex index = index_create();
+    NeoAAIndexFileHeader fileHeader;
+    if (!index || index_stat(index, archivePath) != 0
+        || read_all(fd, &fileHeader, sizeof(fileHeader)) != 0
+        || memcmp(fileHeader.magic, NEOAA_INDEX_MAGIC, 4) != 0
+        || fileHeader.version != NEOAA_INDEX_VERSION
+        || fileHeader.archiveSize != index->archiveSize
+        || fileHeader.archiveMtimeSec != index->archiveMtimeSec
+        || fileHeader.archiveMtimeNsec != index->archiveMtimeNsec
+        || fileHeader.count > fileHeader.archiveSize
+        || fileHeader.poolSize > fileHeader.archiveSize) {
+        /* Stale or foreign, the caller falls back to a scan */
+        neoaa_index_destroy(index);
+        close(fd);
+        return NULL;
+    }
+    index->compressed = fileHeader.compressed;
+    index->count = index->capacity = fileHeader.count;
+    index->poolSize = index->poolCapacity = fileHeader.poolSize;
+    index->entries = (NeoAAIndexEntry *)malloc(index->count * sizeof(NeoAAIndexEntry) + 1);
+    index->pool = (char *)malloc(index->poolSize + 1);
+    int failed = !index->entries || !index->pool
+        || read_all(fd, index->entries, index->count * sizeof(NeoAAIndexEntry)) != 0
+        || read_all(fd, index->pool, index->poolSize) != 0;
+    close(fd);
+    for (size_t i = 0; !failed && i < index->count; i++) {
+        /* Every path has to end inside the pool */
+        uint64_t pathOffset = index->entries[i].pathOffset;
+        if (pathOffset >= index->poolSize || !memchr(index->pool + pathOffset, '\0', index->poolSize - pathOffset)) {
+            failed = 1;
+        }
+    }
+    if (failed || index_hash(index) != 0) {
+        neoaa_index_destroy(index);
+        return NULL;
+    }
+    return index;
+}
+
+int neoaa_index_save(NeoAAIndex index, const char *archivePath) {
+    char *path = sidecar_path(archivePath);
+    if (!path) {
+        return -1;
+    }
+    size_t pathLength = strlen(path);
+    char *tempPath = (char *)malloc(pathLength + 8);
+    if (!tempPath) {
+        free(path);
+        return -1;
+    }
+    snprintf(tempPath, pathLength + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(tempPath);
+    if (fd < 0) {
+        free(tempPath);
+        free(path);
+        return -1;
+    }
+    NeoAAIndexFileHeader fileHeader;
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    memcpy(fileHeader.magic, NEOAA_INDEX_MAGIC, 4);
+    fileHeader.version = NEOAA_INDEX_VERSION;
+    fileHeader.archiveSize = index->archiveSize;
+    fileHeader.archiveMtimeSec = index->archiveMtimeSec;
+    fileHeader.archiveMtimeNsec = index->archiveMtimeNsec;
+    fileHeader.count = index->count;
+    fileHeader.poolSize = index->poolSize;
+    fileHeader.compressed = index->compressed;
+    int result = write_all(fd, &fileHeader, sizeof(fileHeader));
+    if (result == 0 && index->count) {
+        result = write_all(fd, index->entries, index->count * sizeof(NeoAAIndexEntry));
+    }
+    if (result == 0 && index->poolSize) {
+        result = write_all(fd, index->pool, index->poolSize);
+    }
+    fchmod(fd, 0644);
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    /* Rename so a reader never sees half an index */
+    if (result == 0 && rename(tempPath, path) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        unlink(tempPath);
+    }
+    free(tempPath);
+    free(path);
+    return result;
+}
+
+NeoAAIndex neoaa_index_open(const char *archivePath, NeoAAIndexSidecar sidecar) {
+    if (sidecar != NEOAA_INDEX_SIDECAR_NONE) {
+        NeoAAIndex index = neoaa_index_load(archivePath);
+        if (index) {
+            return index;
+        }
+    }
+    NeoAAIndex index = neoaa_index_build(archivePath);
+    if (index && sidecar == NEOAA_INDEX_SIDECAR_UPDATE && neoaa_index_save(index, archivePath) != 0) {
+        fprintf(stderr, "Failed to write index for %s\n", archivePath);
+    }
+    return index;
+}
+
+const NeoAAIndexEntry *neoaa_index_find(NeoAAIndex index, const char *path) {
+    if (!index->bucketCount) {
+        return NULL;
+    }
+    size_t slot = hash_path(path) & (index->bucketCount - 1);
+    while (index->buckets[slot]) {
+        const NeoAAIndexEntry *entry = &index->entries[index->buckets[slot] - 1];
+        if (strcmp(neoaa_index_path(index, entry), path) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & (index->bucketCount - 1);
+    }
+    return NULL;
+}
+
+void neoaa_index_destroy(NeoAAIndex index) {
+    if (!index) {
+        return;
+    }
+    free(index->entries);
+    free(index->pool);
+    free(index->buckets);
+    free(index);
+}
@@ -0,0 +1,66 @@
+/*
+ *  patindex.h
+ *  neoaa
+ *
+ *  PAT -> entry index built from headers alone, so looking up
+ *  one path in a huge archive does not decode every item. Can
+ *  be saved next to the archive as <archive>.nidx and is only
+ *  trusted while the archive size and mtime still match.
+ */
+
+#ifndef NEOAA_PATINDEX_H
+#define NEOAA_PATINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NEOAA_INDEX_SUFFIX ".nidx"
+
+typedef struct {
+    uint64_t pathOffset;   /* into the string pool, NUL terminated */
+    uint64_t headerOffset; /* offsets are in the uncompressed stream */
+    uint64_t datOffset;
+    uint64_t datSize;
+    char type;             /* TYP, 0 if missing */
+} NeoAAIndexEntry;
+
+typedef struct neoaa_index_impl *NeoAAIndex;
+
+struct neoaa_index_impl {
+    NeoAAIndexEntry *entries; /* archive order */
+    size_t count;
+    size_t capacity;
+    char *pool;
+    size_t poolSize;
+    size_t poolCapacity;
+    /* Open addressing, entry index + 1 with 0 as empty */
+    uint32_t *buckets;
+    size_t bucketCount;
+    int compressed;
+    uint64_t archiveSize;
+    int64_t archiveMtimeSec;
+    int64_t archiveMtimeNsec;
+};
+
+typedef enum {
+    NEOAA_INDEX_SIDECAR_NONE,   /* always scan the archive */
+    NEOAA_INDEX_SIDECAR_READ,   /* use a fresh sidecar if there is one */
+    NEOAA_INDEX_SIDECAR_UPDATE, /* as READ, and write one after a scan */
+} NeoAAIndexSidecar;
+
+/* NULL if the archive is unreadable or in a format the reader does not know */
+NeoAAIndex neoaa_index_open(const char *archivePath, NeoAAIndexSidecar sidecar);
+NeoAAIndex neoaa_index_build(const char *archivePath);
+NeoAAIndex neoaa_index_load(const char *archivePath);
+int neoaa_index_save(NeoAAIndex index, const char *archivePath);
+
+/* Exact match on PAT, the last entry wins if a path repeats like it does on extract */
+const NeoAAIndexEntry *neoaa_index_find(NeoAAIndex index, const char *path);
+
+static inline const char *neoaa_index_path(NeoAAIndex index, const NeoAAIndexEntry *entry) {
+    return index->pool + entry->pathOffset;
+}
+
+void neoaa_index_destroy(NeoAAIndex index);
+
+#endif /* NEOAA_PATINDEX_H */
@@ -0,0 +1,135 @@
+/*
+ *  pool.c
+ *  neoaa
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+#include "walk.h"
+
+typedef struct neoaa_pool_task {
+    NeoAATaskFunction function;
+    void *context;
+    struct neoaa_pool_task *next;
+} NeoAAPoolTask;
+
+struct neoaa_pool_impl {
+    NeoAAPoolTask *head;
+    NeoAAPoolTask *tail;
+    /* Queued plus running */
+    size_t outstanding;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;
+    pthread_cond_t idleCond;
+    pthread_t threads[NEOAA_MAX_THREADS];
+    int threadCount;
+};
+
+static void *pool_thread(void *context) {
+    NeoAAPool pool = (NeoAAPool)context;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->shutdown) {
+            pthread_cond_wait(&pool->workCond, &pool->lock);
+        }
+        if (!pool->head) {
+            break;
+        }
+        NeoAAPoolTask *task = pool->head;
+        pool->head = task->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task->function(task->context);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->outstanding == 0) {
+            pthread_cond_broadcast(&pool->idleCond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+NeoAAPool neoaa_pool_create(int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = neoaa_default_thread_count();
+    }
+    if (threadCount > NEOAA_MAX_THREADS) {
+        threadCount = NEOAA_MAX_THREADS;
+    }
+    NeoAAPool pool = (NeoAAPool)calloc(1, sizeof(struct neoaa_pool_impl));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workCond, NULL);
+    pthread_cond_init(&pool->idleCond, NULL);
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, pool) != 0) {
+            break;
+        }
+        pool->threadCount++;
+    }
+    if (!pool->threadCount) {
+        neoaa_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int neoaa_pool_thread_count(NeoAAPool pool) {
+    return pool->threadCount;
+}
+
+int neoaa_pool_submit(NeoAAPool pool, NeoAATaskFunction function, void *context) {
+    NeoAAPoolTask *task = (NeoAAPoolTask *)malloc(sizeof(NeoAAPoolTask));
+    if (!task) {
+        return -1;
+    }
+    task->function = function;
+    task->context = context;
+    task->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pool->outstanding++;
+    pthread_cond_signal(&pool->workCond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void neoaa_pool_wait(NeoAAPool pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->outstanding) {
+        pthread_cond_wait(&pool->idleCond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void neoaa_pool_destroy(NeoAAPool pool) {
+    if (!pool) {
+        return;
+    }
+    neoaa_pool_wait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->workCond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workCond);
+    pthread_cond_destroy(&pool->idleCond);
+    free(pool);
+}
@@ -0,0 +1,27 @@
+/*
+ *  pool.h
+ *  neoaa
+ *
+ *  Fixed set of worker threads running queued tasks in FIFO
+ *  order. Callers bound the queue themselves, usually with a
+ *  memory budget, the pool never blocks a submit.
+ */
+
+#ifndef NEOAA_POOL_H
+#define NEOAA_POOL_H
+
+typedef void (*NeoAATaskFunction)(void *context);
+
+typedef struct neoaa_pool_impl *NeoAAPool;
+
+/* 0 picks one thread per CPU */
+NeoAAPool neoaa_pool_create(int threadCount);
+int neoaa_pool_thread_count(NeoAAPool pool);
+/* Non zero if the task could not be queued, it is then not run */
+int neoaa_pool_submit(NeoAAPool pool, NeoAATaskFunction function, void *context);
+/* Block until every task submitted so far has finished */
+void neoaa_pool_wait(NeoAAPool pool);
+/* Waits for outstanding tasks, then stops the threads */
+void neoaa_pool_destroy(NeoAAPool pool);
+
+#endif /* NEOAA_POOL_H */
@@ -0,0 +1,111 @@
+/*
+ *  progress.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "progress.h"
+
+uint64_t neoaa_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void neoaa_progress_init(NeoAAProgress *progress, NeoAAProgressNotify notify, void *context) {
+    if (!progress) {
+        return;
+    }
+    memset(progress, 0, sizeof(NeoAAProgress));
+    progress->notify = notify;
+    progress->notifyContext = context;
+    progress->startTime = neoaa_time_ns();
+}
+
+void neoaa_progress_set_total(NeoAAProgress *progress, uint64_t bytes, uint64_t items) {
+    if (!progress) {
+        return;
+    }
+    __atomic_store_n(&progress->bytesTotal, bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&progress->itemsTotal, items, __ATOMIC_RELAXED);
+}
+
+void neoaa_progress_add(NeoAAProgress *progress, uint64_t bytes, uint64_t items) {
+    if (!progress) {
+        return;
+    }
+    __atomic_fetch_add(&progress->bytesDone, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&progress->itemsDone, items, __ATOMIC_RELAXED);
+    if (!progress->notify) {
+        return;
+    }
+    /*
+     * Throttle notifications so we do not flood the UI event
+     * queue when processing millions of tiny files. Only the
+     * thread that wins the exchange sends the notification.
+     */
+    uint64_t now = neoaa_time_ns();
+    uint64_t last = __atomic_load_n(&progress->lastNotifyTime, __ATOMIC_RELAXED);
+    if (now - last < NEOAA_PROGRESS_NOTIFY_INTERVAL_NS) {
+        return;
+    }
+    if (__atomic_compare_exchange_n(&progress->lastNotifyTime, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        progress->notify(progress->notifyContext);
+    }
+}
+
+void neoaa_progress_cancel(NeoAAProgress *progress) {
+    if (!progress) {
+        return;
+    }
+    __atomic_store_n(&progress->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+int neoaa_progress_cancelled(NeoAAProgress *progress) {
+    if (!progress) {
+        return 0;
+    }
+    return __atomic_load_n(&progress->cancelled, __ATOMIC_ACQUIRE);
+}
+
+struct neoaa_stats_impl *neoaa_progress_stats(NeoAAProgress *progress) {
+    return progress ? progress->stats : NULL;
+}
+
+void neoaa_progress_snapshot(NeoAAProgress *progress, NeoAAProgressSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(NeoAAProgressSnapshot));
+    snapshot->etaSeconds = -1;
+    if (!progress) {
+        return;
+    }
+    snapshot->bytesTotal = __atomic_load_n(&progress->bytesTotal, __ATOMIC_RELAXED);
+    snapshot->itemsTotal = __atomic_load_n(&progress->itemsTotal, __ATOMIC_RELAXED);
+    snapshot->bytesDone = __atomic_load_n(&progress->bytesDone, __ATOMIC_RELAXED);
+    snapshot->itemsDone = __atomic_load_n(&progress->itemsDone, __ATOMIC_RELAXED);
+    snapshot->elapsedSeconds = (double)(neoaa_time_ns() - progress->startTime) / 1e9;
+    if (snapshot->elapsedSeconds <= 0) {
+        return;
+    }
+    snapshot->bytesPerSecond = (double)snapshot->bytesDone / snapshot->elapsedSeconds;
+    snapshot->itemsPerSecond = (double)snapshot->itemsDone / snapshot->elapsedSeconds;
+    /* Prefer bytes for the ETA, fall back to items for trees of empty files */
+    if (snapshot->bytesTotal && snapshot->bytesPerSecond > 0) {
+        uint64_t left = snapshot->bytesTotal > snapshot->bytesDone ? snapshot->bytesTotal - snapshot->bytesDone : 0;
+        snapshot->etaSeconds = (double)left / snapshot->bytesPerSecond;
+    } else if (snapshot->itemsTotal && snapshot->itemsPerSecond > 0) {
+        uint64_t left = snapshot->itemsTotal > snapshot->itemsDone ? snapshot->itemsTotal - snapshot->itemsDone : 0;
+        snapshot->etaSeconds = (double)left / snapshot->itemsPerSecond;
+    }
+}
+
+void neoaa_format_bytes(char *buf, size_t bufSize, double bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(buf, bufSize, "%.1f %s", bytes, units[unit]);
+}
@@ -0,0 +1,73 @@
+/*
+ *  progress.h
+ *  neoaa
+ *
+ *  Progress counters and cooperative cancel shared between
+ *  a worker thread running an archive operation and the UI.
+ */
+
+#ifndef NEOAA_PROGRESS_H
+#define NEOAA_PROGRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by operations that stopped because their NeoAAProgress was cancelled */
+#define NEOAA_ERR_CANCELLED -4
+/* Returned when file contents do not match the checksums in their header */
+#define NEOAA_ERR_CHECKSUM -5
+/* Returned when the archive was written but files that could not be read are missing or cut short in it */
+#define NEOAA_ERR_INCOMPLETE -6
+
+/* Minimum time between two notify calls from the worker side */
+#define NEOAA_PROGRESS_NOTIFY_INTERVAL_NS 100000000ULL
+
+typedef void (*NeoAAProgressNotify)(void *context);
+
+struct neoaa_stats_impl;
+
+/*
+ * All counters are updated with atomics so any number of
+ * worker threads may report into the same NeoAAProgress.
+ * Every function accepts NULL so operations can be run
+ * without progress reporting.
+ */
+typedef struct neoaa_progress_impl {
+    uint64_t bytesTotal;
+    uint64_t itemsTotal;
+    uint64_t bytesDone;
+    uint64_t itemsDone;
+    uint64_t startTime;
+    uint64_t lastNotifyTime;
+    int cancelled;
+    NeoAAProgressNotify notify;
+    void *notifyContext;
+    /* Phase timings, see stats.h. NULL leaves them off. */
+    struct neoaa_stats_impl *stats;
+} NeoAAProgress;
+
+typedef struct {
+    uint64_t bytesTotal;
+    uint64_t itemsTotal;
+    uint64_t bytesDone;
+    uint64_t itemsDone;
+    double elapsedSeconds;
+    double bytesPerSecond;
+    double itemsPerSecond;
+    /* -1 if the totals are not known (yet) */
+    double etaSeconds;
+} NeoAAProgressSnapshot;
+
+uint64_t neoaa_time_ns(void);
+void neoaa_progress_init(NeoAAProgress *progress, NeoAAProgressNotify notify, void *context);
+void neoaa_progress_set_total(NeoAAProgress *progress, uint64_t bytes, uint64_t items);
+void neoaa_progress_add(NeoAAProgress *progress, uint64_t bytes, uint64_t items);
+void neoaa_progress_cancel(NeoAAProgress *progress);
+int neoaa_progress_cancelled(NeoAAProgress *progress);
+/* The stats to report into, NULL if there are none */
+struct neoaa_stats_impl *neoaa_progress_stats(NeoAAProgress *progress);
+void neoaa_progress_snapshot(NeoAAProgress *progress, NeoAAProgressSnapshot *snapshot);
+/* Human readable size like "1.5 MB" for status lines */
+void neoaa_format_bytes(char *buf, size_t bufSize, double bytes);
+
+#endif /* NEOAA_PROGRESS_H */
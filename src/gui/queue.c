@@ -0,0 +1,592 @@
+/*
+ *  queue.c
+ *  neoaa
+ */
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Table_Row.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Input.H>
+#include <FL/Fl_Choice.H>
+#include <FL/Fl_Spinner.H>
+#include <FL/Fl_File_Chooser.H>
+#include <FL/Fl_Native_File_Chooser.H>
+#include <FL/fl_draw.H>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "queue.h"
+#include "batch.h"
+#include "job.h"
+#include "walk.h"
+
+/* Seconds between two refreshes while the window is open */
+#define NEOAA_QUEUE_REFRESH_INTERVAL 0.25
+
+static const char *queueColumns[] = {"Job", "State", "Progress", "Speed"};
+
+/* Order of the entries in the compression choice, same as the main window */
+static const NeoAACompression queueCompressions[] = {
+    NEOAA_COMPRESS_LZFSE,
+    NEOAA_COMPRESS_ZLIB,
+    NEOAA_COMPRESS_RAW,
+};
+
+/* Also the drop target, whatever lands on it is queued */
+class NeoAAQueueTable : public Fl_Table_Row {
+public:
+    NeoAAQueueTable(int x, int y, int w, int h) : Fl_Table_Row(x, y, w, h) {}
+    int handle(int event);
+
+protected:
+    void draw_cell(TableContext context, int row, int col, int x, int y, int w, int h);
+};
+
+static struct {
+    Fl_Double_Window *window;
+    NeoAAQueueTable *table;
+    Fl_Input *outputInput;
+    Fl_Choice *compressionChoice;
+    Fl_Spinner *parallelSpinner;
+    Fl_Spinner *perDeviceSpinner;
+    Fl_Box *statusBox;
+    char statusText[512];
+    /* What the last add left out, shown until the next one */
+    char addText[256];
+    NeoAABatch batch;
+} queue;
+
+typedef struct {
+    NeoAAJobState state;
+    double fraction; /* -1 while the totals are not known */
+    double bytesPerSecond;
+} NeoAAQueueRow;
+
+typedef struct {
+    int added;
+    int skipped;
+} NeoAAQueueAdd;
+
+static void queue_row(NeoAAJob job, NeoAAQueueRow *row) {
+    row->state = neoaa_job_state(job);
+    row->fraction = -1;
+    row->bytesPerSecond = 0;
+    if (row->state == NEOAA_JOB_PENDING) {
+        return;
+    }
+    NeoAAProgressSnapshot snapshot;
+    neoaa_progress_snapshot(&job->progress, &snapshot);
+    if (row->state == NEOAA_JOB_SUCCEEDED) {
+        row->fraction = 1;
+    } else if (snapshot.bytesTotal) {
+        row->fraction = (double)snapshot.bytesDone / (double)snapshot.bytesTotal;
+    } else if (snapshot.itemsTotal) {
+        row->fraction = (double)snapshot.itemsDone / (double)snapshot.itemsTotal;
+    }
+    if (row->fraction > 1) {
+        row->fraction = 1;
+    }
+    if (row->state == NEOAA_JOB_RUNNING) {
+        row->bytesPerSecond = snapshot.bytesPerSecond;
+    } else if (job->finishTime > job->progress.startTime) {
+        /* The snapshot keeps the clock running after the end, which would wear the rate down */
+        row->bytesPerSecond = (double)snapshot.bytesDone / ((double)(job->finishTime - job->progress.startTime) / 1e9);
+    }
+}
+
+static const char *queue_state_name(NeoAAJobState state) {
+    switch (state) {
+        case NEOAA_JOB_PENDING:
+            return "Queued";
+        case NEOAA_JOB_RUNNING:
+            return "Running";
+        case NEOAA_JOB_SUCCEEDED:
+            return "Done";
+        case NEOAA_JOB_CANCELLED:
+            return "Cancelled";
+        default:
+            return "Failed";
+    }
+}
+
+static const char *queue_base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash && slash[1] ? slash + 1 : path;
+}
+
+void NeoAAQueueTable::draw_cell(TableContext context, int row, int col, int x, int y, int w, int h) {
+    if (context == CONTEXT_STARTPAGE) {
+        fl_font(FL_HELVETICA, 12);
+        return;
+    }
+    if (context == CONTEXT_COL_HEADER) {
+        fl_push_clip(x, y, w, h);
+        fl_draw_box(FL_THIN_UP_BOX, x, y, w, h, col_header_color());
+        fl_color(FL_BLACK);
+        fl_draw(queueColumns[col], x + 4, y, w - 4, h, FL_ALIGN_LEFT);
+        fl_pop_clip();
+        return;
+    }
+    if (context != CONTEXT_CELL || !queue.batch) {
+        return;
+    }
+    /* Only reaping destroys jobs and that happens on this thread too */
+    NeoAAJob job = neoaa_batch_job(queue.batch, row);
+    if (!job) {
+        return;
+    }
+    NeoAAQueueRow info;
+    queue_row(job, &info);
+    char text[512];
+    text[0] = '\0';
+    if (col == 0) {
+        snprintf(text, sizeof(text), "%s %s -> %s", neoaa_command_name(job->command),
+                 queue_base_name(job->inputPath), queue_base_name(job->outputPath));
+    } else if (col == 1) {
+        if (info.state == NEOAA_JOB_FAILED) {
+            snprintf(text, sizeof(text), "Failed (%d)", job->result);
+        } else {
+            snprintf(text, sizeof(text), "%s", queue_state_name(info.state));
+        }
+    } else if (col == 2 && info.fraction >= 0) {
+        snprintf(text, sizeof(text), "%d%%", (int)(info.fraction * 100));
+    } else if (col == 3 && info.bytesPerSecond > 0) {
+        neoaa_format_bytes(text, sizeof(text) - 2, info.bytesPerSecond);
+        strcat(text, "/s");
+    }
+
+    fl_push_clip(x, y, w, h);
+    fl_color(row_selected(row) ? FL_SELECTION_COLOR : FL_WHITE);
+    fl_rectf(x, y, w, h);
+    if (col == 2 && info.fraction >= 0) {
+        fl_draw_box(FL_THIN_DOWN_BOX, x + 2, y + 2, w - 4, h - 4, FL_WHITE);
+        fl_color(info.state == NEOAA_JOB_RUNNING || info.state == NEOAA_JOB_SUCCEEDED ? FL_GREEN : FL_GRAY);
+        fl_rectf(x + 3, y + 3, (int)((w - 6) * info.fraction), h - 6);
+    }
+    fl_color(FL_BLACK);
+    fl_draw(text, x + 4, y, w - 8, h, col == 2 ? FL_ALIGN_CENTER : col == 3 ? FL_ALIGN_RIGHT : FL_ALIGN_LEFT);
+    fl_pop_clip();
+}
+
+static void queue_update(void) {
+    size_t count = queue.batch ? neoaa_batch_count(queue.batch) : 0;
+    if ((size_t)queue.table->rows() != count) {
+        queue.table->rows((int)count);
+    }
+    queue.table->redraw();
+    size_t running = 0;
+    size_t pending = 0;
+    double bytesPerSecond = 0;
+    for (size_t i = 0; i < count; i++) {
+        NeoAAJob job = neoaa_batch_job(queue.batch, i);
+        if (!job) {
+            break;
+        }
+        NeoAAQueueRow info;
+        queue_row(job, &info);
+        if (info.state == NEOAA_JOB_RUNNING) {
+            running++;
+            bytesPerSecond += info.bytesPerSecond;
+        } else if (info.state == NEOAA_JOB_PENDING) {
+            pending++;
+        }
+    }
+    char rate[32];
+    neoaa_format_bytes(rate, sizeof(rate), bytesPerSecond);
+    snprintf(queue.statusText, sizeof(queue.statusText), "%zu running, %zu queued, %zu finished, %s/s%s%s",
+             running, pending, count - running - pending, rate, queue.addText[0] ? "\n" : "", queue.addText);
+    queue.statusBox->label(queue.statusText);
+}
+
+/* Workers never call back into the UI, it just looks again every so often */
+static void queue_timer_cb(void *data) {
+    if (!queue.window->visible()) {
+        return;
+    }
+    queue_update();
+    Fl::repeat_timeout(NEOAA_QUEUE_REFRESH_INTERVAL, queue_timer_cb);
+}
+
+/* Made and started on the first add, the workers wait for jobs until shutdown */
+static NeoAABatch queue_batch(void) {
+    if (queue.batch) {
+        return queue.batch;
+    }
+    NeoAABatch batch = neoaa_batch_create((int)queue.parallelSpinner->value(), (int)queue.perDeviceSpinner->value(), 0, 0);
+    if (!batch) {
+        return NULL;
+    }
+    if (neoaa_batch_start(batch, NULL, NULL) != 0) {
+        neoaa_batch_destroy(batch);
+        return NULL;
+    }
+    queue.batch = batch;
+    return batch;
+}
+
+/*
+ * Folders are archived and .aar/.yaa files extracted, into the
+ * output folder or next to them when none is set.
+ */
+static int queue_add_path(const char *addPath) {
+    char path[PATH_MAX];
+    size_t length = strlen(addPath);
+    /* A trailing slash would leave the name empty */
+    while (length > 1 && addPath[length - 1] == '/') {
+        length--;
+    }
+    if (!length || length >= sizeof(path)) {
+        return -1;
+    }
+    memcpy(path, addPath, length);
+    path[length] = '\0';
+    struct stat pathStat;
+    if (stat(path, &pathStat) != 0) {
+        return -1;
+    }
+
+    char parent[PATH_MAX];
+    const char *outputDir = queue.outputInput->value();
+    if (outputDir && outputDir[0]) {
+        snprintf(parent, sizeof(parent), "%s", outputDir);
+    } else {
+        char copy[PATH_MAX];
+        memcpy(copy, path, length + 1);
+        snprintf(parent, sizeof(parent), "%s", dirname(copy));
+    }
+    const char *name = queue_base_name(path);
+    const char *extension = strrchr(name, '.');
+    NeoAACommand command;
+    char outputPath[PATH_MAX];
+    int written;
+    if (S_ISDIR(pathStat.st_mode)) {
+        command = NEOAA_CMD_ARCHIVE;
+        written = snprintf(outputPath, sizeof(outputPath), "%s/%s.aar", parent, name);
+    } else if (S_ISREG(pathStat.st_mode) && extension && extension != name
+               && (strcasecmp(extension, ".aar") == 0 || strcasecmp(extension, ".yaa") == 0)) {
+        command = NEOAA_CMD_EXTRACT;
+        written = snprintf(outputPath, sizeof(outputPath), "%s/%.*s", parent, (int)(extension - name), name);
+    } else {
+        return -1;
+    }
+    if (written < 0 || (size_t)written >= sizeof(outputPath)) {
+        return -1;
+    }
+    /* Extraction wants its folder to exist, the one next to the archive usually does not yet */
+    int madeOutput = 0;
+    if (command == NEOAA_CMD_EXTRACT) {
+        if (mkdir(outputPath, S_IRWXU | S_IRWXG | S_IRWXO) == 0) {
+            madeOutput = 1;
+        } else if (errno != EEXIST) {
+            fprintf(stderr, "Failed to create %s: %s\n", outputPath, strerror(errno));
+            return -1;
+        }
+    }
+
+    NeoAAJob job = neoaa_job_create(command, path, outputPath);
+    if (!job) {
+        if (madeOutput) {
+            rmdir(outputPath);
+        }
+        return -1;
+    }
+    int choice = queue.compressionChoice->value();
+    if (choice >= 0 && choice < (int)(sizeof(queueCompressions) / sizeof(queueCompressions[0]))) {
+        job->options.compression = queueCompressions[choice];
+    }
+    NeoAABatch batch = queue_batch();
+    if (!batch || neoaa_batch_add(batch, job) != 0) {
+        neoaa_job_destroy(job);
+        if (madeOutput) {
+            rmdir(outputPath);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static void queue_count_add(NeoAAQueueAdd *add, const char *path) {
+    if (queue_add_path(path) == 0) {
+        add->added++;
+    } else {
+        fprintf(stderr, "Not queued: %s\n", path);
+        add->skipped++;
+    }
+}
+
+static void queue_finish_add(const NeoAAQueueAdd *add) {
+    if (add->skipped) {
+        snprintf(queue.addText, sizeof(queue.addText),
+                 "%d added, %d skipped. Only folders and .aar/.yaa files can be queued.", add->added, add->skipped);
+    } else {
+        queue.addText[0] = '\0';
+    }
+    queue_update();
+}
+
+/* file:// URIs as X11 drops them lose the scheme, the host and their %XX escapes, in place */
+static void queue_decode_uri(char *line) {
+    if (strncmp(line, "file://", 7) != 0) {
+        return;
+    }
+    const char *in = strchr(line + 7, '/');
+    if (!in) {
+        line[0] = '\0';
+        return;
+    }
+    char *out = line;
+    while (*in) {
+        if (in[0] == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2])) {
+            char hex[3] = { in[1], in[2], '\0' };
+            *out++ = (char)strtol(hex, NULL, 16);
+            in += 3;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+}
+
+/* A drop is one path or URI per line */
+static void queue_add_dropped(const char *text, int length) {
+    char *copy = (char *)malloc((size_t)length + 1);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, text, (size_t)length);
+    copy[length] = '\0';
+    NeoAAQueueAdd add = { 0, 0 };
+    char *save = NULL;
+    for (char *line = strtok_r(copy, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        queue_decode_uri(line);
+        if (line[0]) {
+            queue_count_add(&add, line);
+        }
+    }
+    free(copy);
+    queue_finish_add(&add);
+}
+
+int NeoAAQueueTable::handle(int event) {
+    switch (event) {
+        /* Taking the drag is what makes FLTK deliver the drop as FL_PASTE */
+        case FL_DND_ENTER:
+        case FL_DND_DRAG:
+        case FL_DND_RELEASE:
+            return 1;
+        case FL_PASTE:
+            queue_add_dropped(Fl::event_text(), Fl::event_length());
+            return 1;
+        default:
+            return Fl_Table_Row::handle(event);
+    }
+}
+
+static void queue_choose(int type, const char *title, const char *filter) {
+    Fl_Native_File_Chooser chooser;
+    chooser.type(type);
+    chooser.title(title);
+    if (filter) {
+        chooser.filter(filter);
+    }
+    if (chooser.show() != 0) {
+        return;
+    }
+    NeoAAQueueAdd add = { 0, 0 };
+    for (int i = 0; i < chooser.count(); i++) {
+        queue_count_add(&add, chooser.filename(i));
+    }
+    queue_finish_add(&add);
+}
+
+static void queue_add_folders_cb(Fl_Widget *w, void *data) {
+    queue_choose(Fl_Native_File_Chooser::BROWSE_MULTI_DIRECTORY, "Select Folders to Archive", NULL);
+}
+
+static void queue_add_archives_cb(Fl_Widget *w, void *data) {
+    queue_choose(Fl_Native_File_Chooser::BROWSE_MULTI_FILE, "Select Archives to Extract", "Archives\t*.{aar,yaa}");
+}
+
+static void queue_browse_output_cb(Fl_Widget *w, void *data) {
+    const char *outputDir = fl_dir_chooser("Select Output Folder", queue.outputInput->value());
+    if (outputDir) {
+        queue.outputInput->value(outputDir);
+    }
+}
+
+/* The job in the selected row, NULL when no row is */
+static NeoAAJob queue_selected(int *row) {
+    if (!queue.batch) {
+        return NULL;
+    }
+    for (int i = 0; i < queue.table->rows(); i++) {
+        if (queue.table->row_selected(i)) {
+            *row = i;
+            return neoaa_batch_job(queue.batch, i);
+        }
+    }
+    return NULL;
+}
+
+/* data is how many rows to move by, only jobs that have not started move */
+static void queue_move_cb(Fl_Widget *w, void *data) {
+    int delta = (int)(intptr_t)data;
+    int row = 0;
+    NeoAAJob job = queue_selected(&row);
+    if (!job || neoaa_batch_move(queue.batch, job, delta) != 0) {
+        return;
+    }
+    queue.table->select_row(row, 0);
+    queue.table->select_row(row + delta, 1);
+    queue_update();
+}
+
+static void queue_cancel_cb(Fl_Widget *w, void *data) {
+    int row = 0;
+    NeoAAJob job = queue_selected(&row);
+    if (job) {
+        neoaa_batch_cancel(queue.batch, job);
+        queue_update();
+    }
+}
+
+static void queue_clear_cb(Fl_Widget *w, void *data) {
+    if (!queue.batch) {
+        return;
+    }
+    /* Rows shift, a selection would land on some other job */
+    queue.table->select_all_rows(0);
+    neoaa_batch_reap(queue.batch);
+    queue.addText[0] = '\0';
+    queue_update();
+}
+
+static void queue_limits_cb(Fl_Widget *w, void *data) {
+    if (queue.batch) {
+        neoaa_batch_set_limits(queue.batch, (int)queue.parallelSpinner->value(), (int)queue.perDeviceSpinner->value());
+    }
+}
+
+static void queue_create(void) {
+    Fl_Double_Window *window = new Fl_Double_Window(640, 450, "Job Queue");
+
+    Fl_Button *addFoldersButton = new Fl_Button(10, 10, 110, 25, "Add Folders...");
+    addFoldersButton->labelsize(12);
+    addFoldersButton->callback(queue_add_folders_cb);
+    addFoldersButton->tooltip("Queue folders to archive, or drop them on the list.");
+
+    Fl_Button *addArchivesButton = new Fl_Button(125, 10, 110, 25, "Add Archives...");
+    addArchivesButton->labelsize(12);
+    addArchivesButton->callback(queue_add_archives_cb);
+    addArchivesButton->tooltip("Queue .aar and .yaa files to extract, or drop them on the list.");
+
+    Fl_Input *outputInput = new Fl_Input(300, 10, 245, 25, "Output:");
+    outputInput->labelsize(12);
+    outputInput->align(FL_ALIGN_LEFT);
+    outputInput->tooltip("Where new archives and extracted folders go. Empty puts each next to what it came from.");
+
+    Fl_Button *browseOutputButton = new Fl_Button(550, 10, 80, 25, "Browse");
+    browseOutputButton->labelsize(12);
+    browseOutputButton->callback(queue_browse_output_cb);
+
+    Fl_Choice *compressionChoice = new Fl_Choice(95, 45, 90, 25, "Compression:");
+    compressionChoice->labelsize(12);
+    compressionChoice->add("LZFSE");
+    compressionChoice->add("zlib");
+    compressionChoice->add("None");
+    compressionChoice->value(0);
+    compressionChoice->tooltip("Used by archive jobs queued from now on.");
+
+    Fl_Spinner *parallelSpinner = new Fl_Spinner(260, 45, 50, 25, "Parallel:");
+    parallelSpinner->labelsize(12);
+    parallelSpinner->minimum(1);
+    parallelSpinner->maximum(NEOAA_MAX_THREADS);
+    parallelSpinner->step(1);
+    parallelSpinner->value(neoaa_default_thread_count());
+    parallelSpinner->callback(queue_limits_cb);
+    parallelSpinner->tooltip("Jobs that run at once. They share the worker threads between them.");
+
+    Fl_Spinner *perDeviceSpinner = new Fl_Spinner(385, 45, 50, 25, "Per disk:");
+    perDeviceSpinner->labelsize(12);
+    perDeviceSpinner->minimum(0);
+    perDeviceSpinner->maximum(NEOAA_MAX_THREADS);
+    perDeviceSpinner->step(1);
+    perDeviceSpinner->value(NEOAA_BATCH_DEFAULT_PER_DEVICE);
+    perDeviceSpinner->callback(queue_limits_cb);
+    perDeviceSpinner->tooltip("Jobs that run at once on the same disk, so they do not seek against each other. 0 for no limit.");
+
+    NeoAAQueueTable *table = new NeoAAQueueTable(10, 80, 620, 280);
+    table->type(Fl_Table_Row::SELECT_SINGLE);
+    table->rows(0);
+    table->cols(4);
+    table->col_header(1);
+    table->col_resize(1);
+    table->row_height_all(20);
+    table->col_width(0, 300);
+    table->col_width(1, 90);
+    table->col_width(2, 120);
+    table->col_width(3, 90);
+    table->tooltip("Drop folders and .aar/.yaa files here.");
+    table->end();
+
+    Fl_Button *upButton = new Fl_Button(10, 370, 60, 25, "Up");
+    upButton->labelsize(12);
+    upButton->callback(queue_move_cb, (void *)(intptr_t)-1);
+    upButton->tooltip("Run the selected job sooner, only queued jobs move.");
+
+    Fl_Button *downButton = new Fl_Button(75, 370, 60, 25, "Down");
+    downButton->labelsize(12);
+    downButton->callback(queue_move_cb, (void *)(intptr_t)1);
+    downButton->tooltip("Run the selected job later, only queued jobs move.");
+
+    Fl_Button *cancelButton = new Fl_Button(140, 370, 70, 25, "Cancel");
+    cancelButton->labelsize(12);
+    cancelButton->callback(queue_cancel_cb);
+    cancelButton->tooltip("Stop the selected job, or drop it if it has not started.");
+
+    Fl_Button *clearButton = new Fl_Button(215, 370, 110, 25, "Clear Finished");
+    clearButton->labelsize(12);
+    clearButton->callback(queue_clear_cb);
+
+    Fl_Box *statusBox = new Fl_Box(FL_NO_BOX, 10, 405, 620, 40, "");
+    statusBox->labelsize(11);
+    statusBox->align(FL_ALIGN_LEFT | FL_ALIGN_TOP | FL_ALIGN_INSIDE | FL_ALIGN_WRAP);
+
+    window->resizable(table);
+    window->end();
+
+    queue.window = window;
+    queue.table = table;
+    queue.outputInput = outputInput;
+    queue.compressionChoice = compressionChoice;
+    queue.parallelSpinner = parallelSpinner;
+    queue.perDeviceSpinner = perDeviceSpinner;
+    queue.statusBox = statusBox;
+}
+
+void neoaa_queue_show(void) {
+    if (!queue.window) {
+        queue_create();
+    }
+    queue_update();
+    queue.window->show();
+    /* Closing the window leaves the jobs running, the timer stops until it is shown again */
+    Fl::remove_timeout(queue_timer_cb);
+    Fl::add_timeout(NEOAA_QUEUE_REFRESH_INTERVAL, queue_timer_cb);
+}
+
+void neoaa_queue_shutdown(void) {
+    Fl::remove_timeout(queue_timer_cb);
+    neoaa_batch_destroy(queue.batch);
+    queue.batch = NULL;
+}
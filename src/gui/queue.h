@@ -0,0 +1,19 @@
+/*
+ *  queue.h
+ *  neoaa
+ *
+ *  Job queue window. Folders dropped on it or picked in bulk are
+ *  archived and .aar/.yaa files are extracted, all through one
+ *  NeoAABatch so jobs on different disks overlap while those on
+ *  the same one take turns. Pending jobs can be moved up and down
+ *  and any job can be cancelled.
+ */
+
+#ifndef NEOAA_QUEUE_H
+#define NEOAA_QUEUE_H
+
+void neoaa_queue_show(void);
+/* Cancels whatever still runs and waits for it, call once the UI is gone */
+void neoaa_queue_shutdown(void);
+
+#endif /* NEOAA_QUEUE_H */
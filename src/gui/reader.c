@@ -0,0 +1,855 @@
+/*
+ *  reader.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "reader.h"
+#include "walk.h"
+
+/* Refuse block sizes from corrupt streams that would make us allocate silly amounts */
+#define NEOAA_READER_MAX_BLOCK (256ULL * 1024 * 1024)
+
+typedef enum {
+    NEOAA_SLOT_FREE,
+    NEOAA_SLOT_BUSY,
+    NEOAA_SLOT_DONE,
+    NEOAA_SLOT_FAILED,
+} NeoAAPrefetchSlotState;
+
+typedef struct {
+    uint8_t *data;
+    size_t capacity;
+    size_t length;
+    NeoAAPrefetchSlotState state;
+} NeoAAPrefetchSlot;
+
+/* Chunk n is decoded into slot n % slotCount, at most slotCount ahead of the reader */
+struct neoaa_reader_prefetch {
+    NeoAAReader reader;
+    NeoAAPrefetchSlot *slots;
+    int slotCount;
+    size_t nextClaim;
+    size_t nextConsume;
+    int busy;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t workCond;
+    pthread_cond_t doneCond;
+    pthread_t threads[NEOAA_MAX_THREADS];
+    int threadCount;
+};
+
+static uint64_t load_be64(const uint8_t *src) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+static int pread_all(int fd, void *data, size_t size, uint64_t offset) {
+    uint8_t *bytes = (uint8_t *)data;
+    while (size) {
+        ssize_t got = pread(fd, bytes, size, (off_t)offset);
+        if (got <= 0) {
+            return -1;
+        }
+        bytes += got;
+        size -= got;
+        offset += got;
+    }
+    return 0;
+}
+
+/* Read exactly size bytes unless the input ends, returns what was read or -1 */
+static ssize_t read_raw(NeoAAReader reader, void *data, size_t size) {
+    uint8_t *bytes = (uint8_t *)data;
+    size_t done = 0;
+    if (reader->peekLength) {
+        size_t take = reader->peekLength < size ? reader->peekLength : size;
+        memcpy(bytes, reader->peek, take);
+        memmove(reader->peek, reader->peek + take, reader->peekLength - take);
+        reader->peekLength -= take;
+        done = take;
+    }
+    while (done < size) {
+        ssize_t got = read(reader->fd, bytes + done, size - done);
+        if (got < 0) {
+            perror("Failed to read archive");
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += got;
+        reader->fileOffset += got;
+    }
+    return (ssize_t)done;
+}
+
+static int skip_raw(NeoAAReader reader, uint64_t size) {
+    if (reader->seekable && !reader->peekLength) {
+        if (lseek(reader->fd, (off_t)size, SEEK_CUR) < 0) {
+            return -1;
+        }
+        reader->fileOffset += size;
+        return 0;
+    }
+    uint8_t discard[65536];
+    while (size) {
+        size_t chunk = size < sizeof(discard) ? size : sizeof(discard);
+        if (read_raw(reader, discard, chunk) != (ssize_t)chunk) {
+            return -1;
+        }
+        size -= chunk;
+    }
+    return 0;
+}
+
+static int reserve(uint8_t **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return 0;
+    }
+    uint8_t *grown = (uint8_t *)realloc(*buffer, size);
+    if (!grown) {
+        return -1;
+    }
+    *buffer = grown;
+    *capacity = size;
+    return 0;
+}
+
+/*
+ * Chunk table file, host byte order since it only describes an
+ * archive on this machine: magic, version, the archive stat it
+ * was written for, then the chunks.
+ */
+#define NEOAA_CHUNKS_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t archiveSize;
+    int64_t archiveMtimeSec;
+    int64_t archiveMtimeNsec;
+    uint64_t count;
+} NeoAAChunkFileHeader;
+
+/* First chunk right after the stream header, every later one further on in both streams */
+static int chunks_valid(const NeoAAChunk *chunks, uint64_t count, uint64_t streamStart, uint64_t dataEnd) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (i == 0) {
+            if (chunks[i].rawOffset != 0 || chunks[i].fileOffset != NEOAA_STREAM_HEADER_SIZE) {
+                return 0;
+            }
+        } else if (chunks[i].rawOffset <= chunks[i - 1].rawOffset || chunks[i].fileOffset <= chunks[i - 1].fileOffset) {
+            return 0;
+        }
+        if (streamStart + chunks[i].fileOffset + NEOAA_BLOCK_HEADER_SIZE > dataEnd) {
+            return 0;
+        }
+    }
+    return count != 0;
+}
+
+char *neoaa_chunks_path(const char *archivePath) {
+    size_t length = strlen(archivePath);
+    char *path = (char *)malloc(length + sizeof(NEOAA_CHUNK_SUFFIX));
+    if (path) {
+        memcpy(path, archivePath, length);
+        memcpy(path + length, NEOAA_CHUNK_SUFFIX, sizeof(NEOAA_CHUNK_SUFFIX));
+    }
+    return path;
+}
+
+int neoaa_reader_load_chunks(NeoAAReader reader, const char *archivePath) {
+    if (reader->chunks) {
+        return 0;
+    }
+    struct stat fileStat;
+    if (!reader->compressed || !reader->seekable || fstat(reader->fd, &fileStat) != 0) {
+        return -1;
+    }
+    char *path = neoaa_chunks_path(archivePath);
+    if (!path) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return -1;
+    }
+    NeoAAChunkFileHeader fileHeader;
+    uint64_t fileSize = fileStat.st_size;
+    if (pread_all(fd, &fileHeader, sizeof(fileHeader), 0) != 0
+        || memcmp(fileHeader.magic, NEOAA_CHUNK_TABLE_MAGIC, 8) != 0
+        || fileHeader.version != NEOAA_CHUNKS_VERSION
+        || fileHeader.archiveSize != fileSize
+        || fileHeader.archiveMtimeSec != fileStat.st_mtim.tv_sec
+        || fileHeader.archiveMtimeNsec != fileStat.st_mtim.tv_nsec
+        || !fileHeader.count || fileHeader.count > fileSize / NEOAA_BLOCK_HEADER_SIZE) {
+        /* Stale or foreign, the archive still reads front to back */
+        close(fd);
+        return -1;
+    }
+    NeoAAChunk *chunks = (NeoAAChunk *)malloc(fileHeader.count * sizeof(NeoAAChunk));
+    int valid = chunks && pread_all(fd, chunks, fileHeader.count * sizeof(NeoAAChunk), sizeof(fileHeader)) == 0
+        && chunks_valid(chunks, fileHeader.count, reader->streamStart, fileSize);
+    close(fd);
+    if (!valid) {
+        free(chunks);
+        return -1;
+    }
+    reader->chunks = chunks;
+    reader->chunkCount = fileHeader.count;
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0) {
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int neoaa_chunks_save(const char *archivePath, const NeoAAChunk *chunks, size_t count) {
+    struct stat fileStat;
+    if (stat(archivePath, &fileStat) != 0) {
+        return -1;
+    }
+    char *path = neoaa_chunks_path(archivePath);
+    if (!path) {
+        return -1;
+    }
+    size_t pathLength = strlen(path);
+    char *tempPath = (char *)malloc(pathLength + 8);
+    if (!tempPath) {
+        free(path);
+        return -1;
+    }
+    snprintf(tempPath, pathLength + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(tempPath);
+    if (fd < 0) {
+        free(tempPath);
+        free(path);
+        return -1;
+    }
+    NeoAAChunkFileHeader fileHeader;
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    memcpy(fileHeader.magic, NEOAA_CHUNK_TABLE_MAGIC, 8);
+    fileHeader.version = NEOAA_CHUNKS_VERSION;
+    fileHeader.archiveSize = fileStat.st_size;
+    fileHeader.archiveMtimeSec = fileStat.st_mtim.tv_sec;
+    fileHeader.archiveMtimeNsec = fileStat.st_mtim.tv_nsec;
+    fileHeader.count = count;
+    int result = write_all(fd, &fileHeader, sizeof(fileHeader));
+    if (result == 0) {
+        result = write_all(fd, chunks, count * sizeof(NeoAAChunk));
+    }
+    fchmod(fd, 0644);
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    /* Rename so a reader never sees half a table */
+    if (result == 0 && rename(tempPath, path) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        unlink(tempPath);
+    }
+    free(tempPath);
+    free(path);
+    return result;
+}
+
+static NeoAAReader reader_create(int fd, int ownsFd) {
+    NeoAAReader reader = (NeoAAReader)calloc(1, sizeof(struct neoaa_reader_impl));
+    if (!reader) {
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->ownsFd = ownsFd;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+        reader->seekable = 1;
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        reader->fileOffset = position > 0 ? (uint64_t)position : 0;
+        reader->streamStart = reader->fileOffset;
+    }
+
+    uint8_t magic[4];
+    ssize_t got = read_raw(reader, magic, sizeof(magic));
+    if (got < 0) {
+        free(reader);
+        return NULL;
+    }
+    if (got == 4 && memcmp(magic, "pbz", 3) == 0) {
+        if (magic[3] == 'e') {
+            reader->compression = NEOAA_COMPRESS_LZFSE;
+        } else if (magic[3] == 'z') {
+            reader->compression = NEOAA_COMPRESS_ZLIB;
+        } else {
+            fprintf(stderr, "Unsupported archive compression pbz%c\n", magic[3]);
+            free(reader);
+            return NULL;
+        }
+        uint8_t blockSize[8];
+        if (read_raw(reader, blockSize, sizeof(blockSize)) != sizeof(blockSize)) {
+            free(reader);
+            return NULL;
+        }
+        reader->compressed = 1;
+        size_t scratchSize = neoaa_compress_scratch_size(reader->compression, 1);
+        if (scratchSize) {
+            reader->scratch = malloc(scratchSize);
+            if (!reader->scratch) {
+                free(reader);
+                return NULL;
+            }
+        }
+    } else {
+        /* Plain archive, the magic is the start of the first header */
+        memcpy(reader->peek, magic, got);
+        reader->peekLength = got;
+        reader->blockCapacity = NEOAA_READER_BUFFER_SIZE;
+        reader->block = (uint8_t *)malloc(reader->blockCapacity);
+        if (!reader->block) {
+            free(reader);
+            return NULL;
+        }
+    }
+    return reader;
+}
+
+NeoAAReader neoaa_reader_open_fd(int fd) {
+    return reader_create(fd, 0);
+}
+
+NeoAAReader neoaa_reader_open_path(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    NeoAAReader reader = reader_create(fd, 1);
+    if (!reader) {
+        close(fd);
+    } else {
+        neoaa_reader_load_chunks(reader, path);
+    }
+    return reader;
+}
+
+static int check_block_header(const uint8_t *blockHeader, uint64_t *rawSize, uint64_t *payloadSize) {
+    *rawSize = load_be64(blockHeader);
+    *payloadSize = load_be64(blockHeader + 8);
+    if (*rawSize > NEOAA_READER_MAX_BLOCK || *payloadSize > *rawSize) {
+        fprintf(stderr, "Corrupt compressed block header\n");
+        return -1;
+    }
+    return 1;
+}
+
+/* 1 with sizes filled, 0 at a clean end of stream, -1 on error */
+static int reader_block_header(NeoAAReader reader, uint64_t *rawSize, uint64_t *payloadSize) {
+    uint8_t blockHeader[NEOAA_BLOCK_HEADER_SIZE];
+    ssize_t got = read_raw(reader, blockHeader, sizeof(blockHeader));
+    if (got == 0) {
+        return 0;
+    }
+    if (got != sizeof(blockHeader)) {
+        return -1;
+    }
+    return check_block_header(blockHeader, rawSize, payloadSize);
+}
+
+static int decode_payload(NeoAAReader reader, const uint8_t *packed, uint64_t payloadSize,
+                          uint8_t *block, uint64_t rawSize, void *scratch) {
+    uint64_t start = neoaa_stats_start(reader->stats);
+    size_t decoded = neoaa_decompress_block(reader->compression, packed, payloadSize, block, rawSize, scratch);
+    neoaa_stats_phase(reader->stats, NEOAA_PHASE_DECOMPRESS, start, rawSize, 0);
+    if (decoded != rawSize) {
+        fprintf(stderr, "Failed to decompress archive block\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int reader_decode_block(NeoAAReader reader, uint64_t rawSize, uint64_t payloadSize) {
+    if (reserve(&reader->block, &reader->blockCapacity, rawSize) != 0) {
+        return -1;
+    }
+    if (payloadSize == rawSize) {
+        if (read_raw(reader, reader->block, rawSize) != (ssize_t)rawSize) {
+            return -1;
+        }
+    } else {
+        if (reserve(&reader->packed, &reader->packedCapacity, payloadSize) != 0) {
+            return -1;
+        }
+        if (read_raw(reader, reader->packed, payloadSize) != (ssize_t)payloadSize) {
+            return -1;
+        }
+        if (decode_payload(reader, reader->packed, payloadSize, reader->block, rawSize, reader->scratch) != 0) {
+            return -1;
+        }
+    }
+    reader->blockLength = rawSize;
+    reader->blockPosition = 0;
+    return 0;
+}
+
+/* Decode one chunk with pread only, so any number of workers can do this at once */
+static int decode_chunk(NeoAAReader reader, size_t chunk, NeoAAPrefetchSlot *slot,
+                        uint8_t **packed, size_t *packedCapacity, void *scratch) {
+    uint64_t fileOffset = reader->streamStart + reader->chunks[chunk].fileOffset;
+    uint8_t blockHeader[NEOAA_BLOCK_HEADER_SIZE];
+    uint64_t rawSize;
+    uint64_t payloadSize;
+    if (pread_all(reader->fd, blockHeader, sizeof(blockHeader), fileOffset) != 0
+        || check_block_header(blockHeader, &rawSize, &payloadSize) <= 0) {
+        return -1;
+    }
+    if (chunk + 1 < reader->chunkCount && reader->chunks[chunk].rawOffset + rawSize != reader->chunks[chunk + 1].rawOffset) {
+        return -1;
+    }
+    if (reserve(&slot->data, &slot->capacity, rawSize) != 0) {
+        return -1;
+    }
+    fileOffset += sizeof(blockHeader);
+    if (payloadSize == rawSize) {
+        if (pread_all(reader->fd, slot->data, rawSize, fileOffset) != 0) {
+            return -1;
+        }
+    } else {
+        if (reserve(packed, packedCapacity, payloadSize) != 0
+            || pread_all(reader->fd, *packed, payloadSize, fileOffset) != 0
+            || decode_payload(reader, *packed, payloadSize, slot->data, rawSize, scratch) != 0) {
+            return -1;
+        }
+    }
+    slot->length = rawSize;
+    return 0;
+}
+
+static void *prefetch_thread(void *context) {
+    NeoAAReaderPrefetch prefetch = (NeoAAReaderPrefetch)context;
+    NeoAAReader reader = prefetch->reader;
+    uint8_t *packed = NULL;
+    size_t packedCapacity = 0;
+    void *scratch = NULL;
+    size_t scratchSize = neoaa_compress_scratch_size(reader->compression, 1);
+    if (scratchSize) {
+        scratch = malloc(scratchSize);
+    }
+    pthread_mutex_lock(&prefetch->lock);
+    for (;;) {
+        while (!prefetch->shutdown
+               && (prefetch->nextClaim >= reader->chunkCount
+                   || prefetch->nextClaim >= prefetch->nextConsume + prefetch->slotCount)) {
+            pthread_cond_wait(&prefetch->workCond, &prefetch->lock);
+        }
+        if (prefetch->shutdown) {
+            break;
+        }
+        size_t chunk = prefetch->nextClaim++;
+        NeoAAPrefetchSlot *slot = &prefetch->slots[chunk % prefetch->slotCount];
+        slot->state = NEOAA_SLOT_BUSY;
+        prefetch->busy++;
+        pthread_mutex_unlock(&prefetch->lock);
+
+        int status = (scratchSize && !scratch) ? -1 : decode_chunk(reader, chunk, slot, &packed, &packedCapacity, scratch);
+
+        pthread_mutex_lock(&prefetch->lock);
+        slot->state = status == 0 ? NEOAA_SLOT_DONE : NEOAA_SLOT_FAILED;
+        prefetch->busy--;
+        pthread_cond_broadcast(&prefetch->doneCond);
+    }
+    pthread_mutex_unlock(&prefetch->lock);
+    free(packed);
+    free(scratch);
+    return NULL;
+}
+
+/* Drop everything decoded so far and restart the workers at chunk */
+static void prefetch_reset(NeoAAReaderPrefetch prefetch, size_t chunk) {
+    pthread_mutex_lock(&prefetch->lock);
+    while (prefetch->busy) {
+        pthread_cond_wait(&prefetch->doneCond, &prefetch->lock);
+    }
+    for (int i = 0; i < prefetch->slotCount; i++) {
+        prefetch->slots[i].state = NEOAA_SLOT_FREE;
+    }
+    prefetch->nextClaim = chunk;
+    prefetch->nextConsume = chunk;
+    pthread_cond_broadcast(&prefetch->workCond);
+    pthread_mutex_unlock(&prefetch->lock);
+}
+
+/* Same contract as reader_block_header, the decoded chunk becomes the current block */
+static int prefetch_next(NeoAAReader reader) {
+    NeoAAReaderPrefetch prefetch = reader->prefetch;
+    pthread_mutex_lock(&prefetch->lock);
+    if (prefetch->nextConsume >= reader->chunkCount) {
+        pthread_mutex_unlock(&prefetch->lock);
+        return 0;
+    }
+    NeoAAPrefetchSlot *slot = &prefetch->slots[prefetch->nextConsume % prefetch->slotCount];
+    while (slot->state != NEOAA_SLOT_DONE && slot->state != NEOAA_SLOT_FAILED) {
+        pthread_cond_wait(&prefetch->doneCond, &prefetch->lock);
+    }
+    int status = slot->state == NEOAA_SLOT_DONE ? 1 : -1;
+    if (status > 0) {
+        /* Hand the slot our old buffer, nothing gets copied */
+        uint8_t *data = slot->data;
+        size_t capacity = slot->capacity;
+        slot->data = reader->block;
+        slot->capacity = reader->blockCapacity;
+        reader->block = data;
+        reader->blockCapacity = capacity;
+        reader->blockLength = slot->length;
+        reader->blockPosition = 0;
+    }
+    slot->state = NEOAA_SLOT_FREE;
+    prefetch->nextConsume++;
+    pthread_cond_broadcast(&prefetch->workCond);
+    pthread_mutex_unlock(&prefetch->lock);
+    return status;
+}
+
+static int reader_refill(NeoAAReader reader) {
+    if (reader->eof || reader->error) {
+        return -1;
+    }
+    if (!reader->compressed) {
+        ssize_t got = read_raw(reader, reader->block, reader->blockCapacity);
+        if (got <= 0) {
+            if (got < 0) {
+                reader->error = -1;
+            }
+            reader->eof = 1;
+            return -1;
+        }
+        /* read_raw only comes back short at the end of the input */
+        reader->blockLength = got;
+        reader->blockPosition = 0;
+        return 0;
+    }
+    if (reader->prefetch) {
+        int status = prefetch_next(reader);
+        if (status <= 0) {
+            reader->error = status;
+            reader->eof = 1;
+            return -1;
+        }
+        return 0;
+    }
+    uint64_t rawSize;
+    uint64_t payloadSize;
+    int status = reader_block_header(reader, &rawSize, &payloadSize);
+    if (status <= 0) {
+        reader->error = status;
+        reader->eof = 1;
+        return -1;
+    }
+    if (reader_decode_block(reader, rawSize, payloadSize) != 0) {
+        reader->error = -1;
+        reader->eof = 1;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t neoaa_reader_read(NeoAAReader reader, void *data, size_t size) {
+    uint8_t *bytes = (uint8_t *)data;
+    size_t done = 0;
+    while (done < size) {
+        if (reader->blockPosition == reader->blockLength && reader_refill(reader) != 0) {
+            break;
+        }
+        size_t take = reader->blockLength - reader->blockPosition;
+        if (take > size - done) {
+            take = size - done;
+        }
+        memcpy(bytes + done, reader->block + reader->blockPosition, take);
+        reader->blockPosition += take;
+        done += take;
+    }
+    reader->offset += done;
+    if (!done && reader->error) {
+        return -1;
+    }
+    return (ssize_t)done;
+}
+
+int neoaa_reader_skip(NeoAAReader reader, uint64_t size) {
+    if (reader->chunks || (!reader->compressed && reader->seekable)) {
+        return neoaa_reader_seek(reader, reader->offset + size);
+    }
+    while (size) {
+        size_t buffered = reader->blockLength - reader->blockPosition;
+        if (buffered) {
+            size_t take = buffered < size ? buffered : (size_t)size;
+            reader->blockPosition += take;
+            reader->offset += take;
+            size -= take;
+            continue;
+        }
+        if (reader->eof) {
+            return -1;
+        }
+        if (!reader->compressed) {
+            if (skip_raw(reader, size) != 0) {
+                return -1;
+            }
+            reader->offset += size;
+            return 0;
+        }
+        uint64_t rawSize;
+        uint64_t payloadSize;
+        if (reader_block_header(reader, &rawSize, &payloadSize) <= 0) {
+            reader->eof = 1;
+            return -1;
+        }
+        if (rawSize <= size) {
+            /* Whole block is skipped, no need to decode it */
+            if (skip_raw(reader, payloadSize) != 0) {
+                return -1;
+            }
+            reader->offset += rawSize;
+            size -= rawSize;
+            continue;
+        }
+        if (reader_decode_block(reader, rawSize, payloadSize) != 0) {
+            reader->eof = 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* First chunk whose start is past offset */
+static size_t chunk_upper_bound(NeoAAReader reader, uint64_t offset) {
+    size_t low = 0;
+    size_t high = reader->chunkCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (reader->chunks[middle].rawOffset <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int reader_seek_chunk(NeoAAReader reader, uint64_t offset) {
+    size_t chunk = chunk_upper_bound(reader, offset) - 1;
+    if (reader->prefetch) {
+        prefetch_reset(reader->prefetch, chunk);
+    } else {
+        uint64_t fileOffset = reader->streamStart + reader->chunks[chunk].fileOffset;
+        if (lseek(reader->fd, (off_t)fileOffset, SEEK_SET) < 0) {
+            return -1;
+        }
+        reader->fileOffset = fileOffset;
+    }
+    reader->blockLength = 0;
+    reader->blockPosition = 0;
+    reader->eof = 0;
+    reader->error = 0;
+    reader->offset = reader->chunks[chunk].rawOffset;
+    if (offset == reader->offset) {
+        return 0;
+    }
+    /* Only the chunk holding offset is decoded */
+    if (reader_refill(reader) != 0 || offset - reader->offset > reader->blockLength) {
+        return -1;
+    }
+    reader->blockPosition = offset - reader->offset;
+    reader->offset = offset;
+    return 0;
+}
+
+int neoaa_reader_seek(NeoAAReader reader, uint64_t offset) {
+    uint64_t blockStart = reader->offset - reader->blockPosition;
+    if (offset >= blockStart && offset < blockStart + reader->blockLength) {
+        reader->blockPosition = offset - blockStart;
+        reader->offset = offset;
+        return 0;
+    }
+    if (reader->chunks) {
+        return reader_seek_chunk(reader, offset);
+    }
+    if (!reader->compressed && reader->seekable) {
+        uint64_t fileOffset = reader->streamStart + offset;
+        if (lseek(reader->fd, (off_t)fileOffset, SEEK_SET) < 0) {
+            return -1;
+        }
+        reader->fileOffset = fileOffset;
+        reader->peekLength = 0;
+        reader->blockLength = 0;
+        reader->blockPosition = 0;
+        reader->eof = 0;
+        reader->error = 0;
+        reader->offset = offset;
+        return 0;
+    }
+    if (offset < reader->offset) {
+        return -1;
+    }
+    return neoaa_reader_skip(reader, offset - reader->offset);
+}
+
+int neoaa_reader_scan_chunks(NeoAAReader reader) {
+    if (reader->chunks) {
+        return 0;
+    }
+    if (!reader->compressed || !reader->seekable) {
+        return -1;
+    }
+    /* Only block headers are read, with pread so the read position stays put */
+    size_t capacity = 256;
+    size_t count = 0;
+    NeoAAChunk *chunks = (NeoAAChunk *)malloc(capacity * sizeof(NeoAAChunk));
+    uint64_t rawOffset = 0;
+    uint64_t fileOffset = NEOAA_STREAM_HEADER_SIZE;
+    int valid = chunks != NULL;
+    while (valid) {
+        uint8_t blockHeader[NEOAA_BLOCK_HEADER_SIZE];
+        ssize_t got = pread(reader->fd, blockHeader, sizeof(blockHeader), reader->streamStart + fileOffset);
+        if (got == 0) {
+            break;
+        }
+        uint64_t rawSize;
+        uint64_t payloadSize;
+        int status = got == sizeof(blockHeader) ? check_block_header(blockHeader, &rawSize, &payloadSize) : -1;
+        if (status <= 0) {
+            valid = status == 0;
+            break;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            NeoAAChunk *grown = (NeoAAChunk *)realloc(chunks, capacity * sizeof(NeoAAChunk));
+            if (!grown) {
+                valid = 0;
+                break;
+            }
+            chunks = grown;
+        }
+        /* An empty block has nothing to seek to */
+        if (rawSize) {
+            chunks[count].rawOffset = rawOffset;
+            chunks[count].fileOffset = fileOffset;
+            count++;
+        }
+        rawOffset += rawSize;
+        fileOffset += NEOAA_BLOCK_HEADER_SIZE + payloadSize;
+    }
+    if (!valid || !count) {
+        free(chunks);
+        return -1;
+    }
+    reader->chunks = chunks;
+    reader->chunkCount = count;
+    return 0;
+}
+
+int neoaa_reader_set_threads(NeoAAReader reader, int threadCount) {
+    if (!reader->chunks || reader->prefetch || threadCount <= 1) {
+        return 0;
+    }
+    if (threadCount > NEOAA_MAX_THREADS) {
+        threadCount = NEOAA_MAX_THREADS;
+    }
+    /* Start with the chunk after whatever is buffered */
+    uint64_t nextOffset = reader->offset + (reader->blockLength - reader->blockPosition);
+    size_t chunk = chunk_upper_bound(reader, nextOffset);
+    if (chunk && reader->chunks[chunk - 1].rawOffset == nextOffset) {
+        chunk--;
+    } else {
+        /* Past the last chunk start, so there is nothing left to decode */
+        chunk = reader->chunkCount;
+    }
+    NeoAAReaderPrefetch prefetch = (NeoAAReaderPrefetch)calloc(1, sizeof(struct neoaa_reader_prefetch));
+    if (!prefetch) {
+        return -1;
+    }
+    prefetch->reader = reader;
+    prefetch->slotCount = threadCount * 2;
+    prefetch->slots = (NeoAAPrefetchSlot *)calloc(prefetch->slotCount, sizeof(NeoAAPrefetchSlot));
+    if (!prefetch->slots) {
+        free(prefetch);
+        return -1;
+    }
+    prefetch->nextClaim = chunk;
+    prefetch->nextConsume = chunk;
+    pthread_mutex_init(&prefetch->lock, NULL);
+    pthread_cond_init(&prefetch->workCond, NULL);
+    pthread_cond_init(&prefetch->doneCond, NULL);
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&prefetch->threads[i], NULL, prefetch_thread, prefetch) != 0) {
+            break;
+        }
+        prefetch->threadCount++;
+    }
+    reader->prefetch = prefetch;
+    if (!prefetch->threadCount) {
+        /* Back to decoding inline */
+        reader->prefetch = NULL;
+        pthread_mutex_destroy(&prefetch->lock);
+        pthread_cond_destroy(&prefetch->workCond);
+        pthread_cond_destroy(&prefetch->doneCond);
+        free(prefetch->slots);
+        free(prefetch);
+    }
+    return 0;
+}
+
+static void prefetch_destroy(NeoAAReaderPrefetch prefetch) {
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->shutdown = 1;
+    pthread_cond_broadcast(&prefetch->workCond);
+    pthread_mutex_unlock(&prefetch->lock);
+    for (int i = 0; i < prefetch->threadCount; i++) {
+        pthread_join(prefetch->threads[i], NULL);
+    }
+    for (int i = 0; i < prefetch->slotCount; i++) {
+        free(prefetch->slots[i].data);
+    }
+    free(prefetch->slots);
+    pthread_mutex_destroy(&prefetch->lock);
+    pthread_cond_destroy(&prefetch->workCond);
+    pthread_cond_destroy(&prefetch->doneCond);
+    free(prefetch);
+}
+
+void neoaa_reader_close(NeoAAReader reader) {
+    if (!reader) {
+        return;
+    }
+    if (reader->prefetch) {
+        prefetch_destroy(reader->prefetch);
+    }
+    if (reader->ownsFd) {
+        close(reader->fd);
+    }
+    free(reader->chunks);
+    free(reader->block);
+    free(reader->packed);
+    free(reader->scratch);
+    free(reader);
+}
@@ -0,0 +1,101 @@
+/*
+ *  reader.h
+ *  neoaa
+ *
+ *  Sequential reader over the uncompressed archive stream of a
+ *  plain or pbz* compressed archive. Works on pipes, decodes one
+ *  block at a time so memory does not depend on archive size.
+ *  Seekable compressed archives (see compress.h) get random
+ *  access through their chunk table, and can have the chunks
+ *  ahead of the read position decoded on worker threads. The
+ *  table is kept next to the archive as <archive>.nchk and is
+ *  only trusted while the archive size and mtime still match.
+ */
+
+#ifndef NEOAA_READER_H
+#define NEOAA_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "compress.h"
+#include "stats.h"
+
+typedef struct neoaa_reader_prefetch *NeoAAReaderPrefetch;
+
+#define NEOAA_CHUNK_SUFFIX ".nchk"
+
+/* Buffer used for plain archives */
+#define NEOAA_READER_BUFFER_SIZE (1024 * 1024)
+
+typedef struct neoaa_reader_impl *NeoAAReader;
+
+struct neoaa_reader_impl {
+    int fd;
+    int ownsFd;
+    int seekable;
+    int compressed;
+    NeoAACompression compression;
+    /* Position in the uncompressed stream of the next byte handed out */
+    uint64_t offset;
+    /* Position in the underlying file, and where the archive starts in it */
+    uint64_t fileOffset;
+    uint64_t streamStart;
+    /* Current decoded block (or read buffer for plain archives) */
+    uint8_t *block;
+    size_t blockCapacity;
+    size_t blockLength;
+    size_t blockPosition;
+    uint8_t *packed;
+    size_t packedCapacity;
+    void *scratch;
+    /* Bytes read while sniffing the format that belong to the stream */
+    uint8_t peek[4];
+    size_t peekLength;
+    int eof;
+    int error;
+    /* Chunk table of a seekable archive, NULL otherwise */
+    NeoAAChunk *chunks;
+    size_t chunkCount;
+    NeoAAReaderPrefetch prefetch;
+    /* Block decoding is timed here when set, before any threads start */
+    NeoAAStats *stats;
+};
+
+/* Does not take ownership of fd, see neoaa_reader_load_chunks for a seekable one */
+NeoAAReader neoaa_reader_open_fd(int fd);
+/* Picks up the chunk table saved next to the archive */
+NeoAAReader neoaa_reader_open_path(const char *path);
+/*
+ * Give a reader without a chunk table the one saved next to
+ * archivePath, the file it reads. Non zero if there is none or
+ * it does not belong to the archive as it is now.
+ */
+int neoaa_reader_load_chunks(NeoAAReader reader, const char *archivePath);
+/* <archive>.nchk, malloc'd */
+char *neoaa_chunks_path(const char *archivePath);
+/* Save the chunk table for the archive as it is on disk right now */
+int neoaa_chunks_save(const char *archivePath, const NeoAAChunk *chunks, size_t count);
+
+/* Reads up to size bytes, short only at the end of the stream. -1 on error. */
+ssize_t neoaa_reader_read(NeoAAReader reader, void *data, size_t size);
+/* Discard size bytes, whole compressed blocks are skipped without decoding */
+int neoaa_reader_skip(NeoAAReader reader, uint64_t size);
+/*
+ * Move to an offset in the uncompressed stream. Backwards only
+ * works on plain files and seekable archives, which also jump
+ * forwards without reading what is in between.
+ */
+int neoaa_reader_seek(NeoAAReader reader, uint64_t offset);
+/*
+ * Give a compressed archive without a chunk table one by walking
+ * its block headers, so it can be seeked like a seekable one.
+ * Non zero on pipes or a damaged stream.
+ */
+int neoaa_reader_scan_chunks(NeoAAReader reader);
+/* Decode upcoming chunks of a seekable archive on threadCount workers, a no-op otherwise */
+int neoaa_reader_set_threads(NeoAAReader reader, int threadCount);
+
+void neoaa_reader_close(NeoAAReader reader);
+
+#endif /* NEOAA_READER_H */
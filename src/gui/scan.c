@@ -0,0 +1,217 @@
+/*
+ *  scan.c
+ *  neoaa
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "scan.h"
+
+static uint64_t read_le(const uint8_t *data, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static int key_is(const uint8_t *key, const char *name) {
+    return key[0] == (uint8_t)name[0] && key[1] == (uint8_t)name[1] && key[2] == (uint8_t)name[2];
+}
+
+NeoAAArchiveKind neoaa_archive_kind(int fd) {
+    uint8_t magic[4];
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+        return NEOAA_ARCHIVE_UNKNOWN;
+    }
+    if (memcmp(magic, "AA01", 4) == 0 || memcmp(magic, "YAA1", 4) == 0) {
+        return NEOAA_ARCHIVE_PLAIN;
+    }
+    if (memcmp(magic, "pbz", 3) == 0) {
+        return NEOAA_ARCHIVE_COMPRESSED;
+    }
+    return NEOAA_ARCHIVE_UNKNOWN;
+}
+
+static char *copy_string(const uint8_t *data, size_t len) {
+    char *str = (char *)malloc(len + 1);
+    if (str) {
+        memcpy(str, data, len);
+        str[len] = '\0';
+    }
+    return str;
+}
+
+int neoaa_scan_decode(const uint8_t *header, size_t size, uint64_t headerOffset, NeoAAScanEntry *entry) {
+    memset(entry, 0, sizeof(NeoAAScanEntry));
+    if (size < 6) {
+        return -1;
+    }
+    entry->headerOffset = headerOffset;
+    entry->headerSize = (uint32_t)read_le(header + 4, 2);
+    if (entry->headerSize < 6 || entry->headerSize > size) {
+        return -1;
+    }
+    size_t offset = 6;
+    while (offset + 4 <= entry->headerSize) {
+        const uint8_t *key = header + offset;
+        char subtype = (char)header[offset + 3];
+        offset += 4;
+        size_t valueSize;
+        switch (subtype) {
+            case '*':
+                valueSize = 0;
+                break;
+            case '1': case '2': case '4': case '8':
+                valueSize = subtype - '0';
+                break;
+            case 'A':
+                valueSize = 2;
+                break;
+            case 'B':
+                valueSize = 4;
+                break;
+            case 'C':
+                valueSize = 8;
+                break;
+            case 'P':
+                if (offset + 2 > entry->headerSize) {
+                    neoaa_scan_entry_clear(entry);
+                    return -1;
+                }
+                valueSize = 2 + read_le(header + offset, 2);
+                break;
+            case 'F':
+                valueSize = 4;
+                break;
+            case 'G':
+                valueSize = 20;
+                break;
+            case 'H':
+                valueSize = 32;
+                break;
+            case 'I':
+                valueSize = 48;
+                break;
+            case 'J':
+                valueSize = 64;
+                break;
+            case 'S':
+                valueSize = 8;
+                break;
+            case 'T':
+                valueSize = 12;
+                break;
+            default:
+                neoaa_scan_entry_clear(entry);
+                return -1;
+        }
+        if (offset + valueSize > entry->headerSize) {
+            neoaa_scan_entry_clear(entry);
+            return -1;
+        }
+        const uint8_t *value = header + offset;
+        if (subtype >= '1' && subtype <= '8') {
+            uint64_t number = read_le(value, (int)valueSize);
+            if (key_is(key, "TYP")) {
+                entry->type = (char)number;
+            } else if (key_is(key, "UID")) {
+                entry->uid = number;
+                entry->hasUid = 1;
+                entry->uidSize = (uint8_t)valueSize;
+            } else if (key_is(key, "GID")) {
+                entry->gid = number;
+                entry->hasGid = 1;
+                entry->gidSize = (uint8_t)valueSize;
+            } else if (key_is(key, "MOD")) {
+                entry->mode = number;
+                entry->hasMode = 1;
+            } else if (key_is(key, "HLC")) {
+                entry->hardlinkCluster = number;
+                entry->hasHardlinkCluster = 1;
+            } else if (key_is(key, "CLC")) {
+                entry->cloneCluster = number;
+                entry->hasCloneCluster = 1;
+            }
+        } else if (subtype == 'A' || subtype == 'B' || subtype == 'C') {
+            /* Blobs follow the header in the order their fields appear */
+            uint64_t blobSize = read_le(value, (int)valueSize);
+            if (key_is(key, "DAT") && !entry->hasDat) {
+                entry->datSize = blobSize;
+                entry->datOffset = headerOffset + entry->headerSize + entry->blobsSize;
+                entry->hasDat = 1;
+            }
+            entry->blobsSize += blobSize;
+        } else if (subtype == 'F' && key_is(key, "CKS")) {
+            entry->digest.crc32 = (uint32_t)read_le(value, 4);
+            entry->digestFields |= NEOAA_DIGEST_CRC32;
+        } else if (subtype == 'H' && key_is(key, "SH2")) {
+            memcpy(entry->digest.sha256, value, NEOAA_SHA256_SIZE);
+            entry->digestFields |= NEOAA_DIGEST_SHA256;
+        } else if (subtype == 'P') {
+            if (key_is(key, "PAT") && !entry->path) {
+                entry->path = copy_string(value + 2, valueSize - 2);
+            } else if (key_is(key, "LNK") && !entry->link) {
+                entry->link = copy_string(value + 2, valueSize - 2);
+            }
+        }
+        offset += valueSize;
+    }
+    if (!entry->hasDat) {
+        entry->datOffset = headerOffset + entry->headerSize;
+    }
+    return 0;
+}
+
+int neoaa_scan_read(int fd, uint64_t offset, NeoAAScanEntry *entry) {
+    uint8_t header[NEOAA_MAX_HEADER_SIZE];
+    ssize_t got = pread(fd, header, 6, offset);
+    if (got == 0) {
+        return 0;
+    }
+    if (got != 6 || (memcmp(header, "AA01", 4) != 0 && memcmp(header, "YAA1", 4) != 0)) {
+        return -1;
+    }
+    size_t headerSize = (size_t)read_le(header + 4, 2);
+    if (headerSize < 6) {
+        return -1;
+    }
+    if (pread(fd, header + 6, headerSize - 6, offset + 6) != (ssize_t)(headerSize - 6)) {
+        return -1;
+    }
+    if (neoaa_scan_decode(header, headerSize, offset, entry) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+int neoaa_scan_next(NeoAAReader reader, uint8_t *header, NeoAAScanEntry *entry) {
+    uint64_t offset = reader->offset;
+    ssize_t got = neoaa_reader_read(reader, header, 6);
+    if (got == 0) {
+        return 0;
+    }
+    if (got != 6 || (memcmp(header, "AA01", 4) != 0 && memcmp(header, "YAA1", 4) != 0)) {
+        return -1;
+    }
+    size_t headerSize = (size_t)read_le(header + 4, 2);
+    if (headerSize < 6 || neoaa_reader_read(reader, header + 6, headerSize - 6) != (ssize_t)(headerSize - 6)) {
+        return -1;
+    }
+    if (neoaa_scan_decode(header, headerSize, offset, entry) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+void neoaa_scan_entry_clear(NeoAAScanEntry *entry) {
+    free(entry->path);
+    free(entry->link);
+    entry->path = NULL;
+    entry->link = NULL;
+}
+
+int neoaa_scan_entry_shares_data(const NeoAAScanEntry *entry) {
+    return entry->type == 'F' && !entry->hasDat && (entry->hasHardlinkCluster || entry->hasCloneCluster);
+}
@@ -0,0 +1,79 @@
+/*
+ *  scan.h
+ *  neoaa
+ *
+ *  Header-only reader for plain (uncompressed) Apple Archives.
+ *  Walks an archive with pread without ever loading blob data.
+ */
+
+#ifndef NEOAA_SCAN_H
+#define NEOAA_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "reader.h"
+#include "checksum.h"
+
+/* Largest possible header, the size field is 16 bits */
+#define NEOAA_MAX_HEADER_SIZE 0x10000
+
+typedef enum {
+    NEOAA_ARCHIVE_UNKNOWN,
+    NEOAA_ARCHIVE_PLAIN,
+    NEOAA_ARCHIVE_COMPRESSED,
+} NeoAAArchiveKind;
+
+typedef struct {
+    uint64_t headerOffset;
+    uint32_t headerSize;
+    char type;          /* TYP, 0 if missing */
+    char *path;         /* PAT, heap allocated, NULL if missing */
+    char *link;         /* LNK, heap allocated, NULL if missing */
+    uint64_t hardlinkCluster; /* HLC, entries with the same id are hard links of each other */
+    uint64_t cloneCluster;    /* CLC, same for identical copies */
+    int hasHardlinkCluster;
+    int hasCloneCluster;
+    uint64_t uid;
+    uint64_t gid;
+    uint64_t mode;
+    int hasUid;
+    int hasGid;
+    int hasMode;
+    uint8_t uidSize;    /* bytes UID and GID were stored in */
+    uint8_t gidSize;
+    int hasDat;
+    uint64_t datSize;   /* size of the DAT blob */
+    uint64_t datOffset; /* absolute offset of the DAT blob in the archive */
+    uint64_t blobsSize; /* all blobs after the header, to find the next one */
+    NeoAADigest digest; /* CKS and SH2, digestFields says which were there */
+    int digestFields;
+} NeoAAScanEntry;
+
+/* Look at the first bytes of a file to tell plain from compressed */
+NeoAAArchiveKind neoaa_archive_kind(int fd);
+
+/*
+ * Decode one encoded header already in memory. headerOffset is
+ * where it sits in the archive so blob offsets come out absolute.
+ */
+int neoaa_scan_decode(const uint8_t *header, size_t size, uint64_t headerOffset, NeoAAScanEntry *entry);
+
+/*
+ * Read the header at offset. Returns 1 on success, 0 at a clean
+ * end of archive and negative on a malformed or short header.
+ * The next header starts at offset + headerSize + blobsSize.
+ */
+int neoaa_scan_read(int fd, uint64_t offset, NeoAAScanEntry *entry);
+
+/*
+ * Same for the next header of a reader, plain or compressed.
+ * header must hold NEOAA_MAX_HEADER_SIZE bytes. The reader is
+ * left at the first blob, the caller reads or skips blobsSize.
+ */
+int neoaa_scan_next(NeoAAReader reader, uint8_t *header, NeoAAScanEntry *entry);
+
+void neoaa_scan_entry_clear(NeoAAScanEntry *entry);
+/* A file without DAT in an HLC or CLC cluster, its data is with the first entry of the cluster */
+int neoaa_scan_entry_shares_data(const NeoAAScanEntry *entry);
+
+#endif /* NEOAA_SCAN_H */
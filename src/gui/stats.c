@@ -0,0 +1,211 @@
+/*
+ *  stats.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "progress.h"
+
+static const char *phaseNames[NEOAA_PHASE_COUNT] = {
+    "walk", "dedup", "encode", "read", "compress", "write", "scan", "decompress", "metadata", "checksum",
+};
+
+NeoAAStats *neoaa_stats_create(void) {
+    NeoAAStats *stats = (NeoAAStats *)calloc(1, sizeof(NeoAAStats));
+    if (!stats) {
+        return NULL;
+    }
+    pthread_mutex_init(&stats->lock, NULL);
+    stats->startTime = neoaa_time_ns();
+    return stats;
+}
+
+void neoaa_stats_destroy(NeoAAStats *stats) {
+    if (!stats) {
+        return;
+    }
+    for (int i = 0; i < NEOAA_STATS_TOP_FILES; i++) {
+        free(stats->largest[i].path);
+        free(stats->slowest[i].path);
+    }
+    pthread_mutex_destroy(&stats->lock);
+    free(stats);
+}
+
+const char *neoaa_phase_name(NeoAAPhase phase) {
+    return phase < NEOAA_PHASE_COUNT ? phaseNames[phase] : "unknown";
+}
+
+uint64_t neoaa_stats_start(NeoAAStats *stats) {
+    return stats ? neoaa_time_ns() : 0;
+}
+
+void neoaa_stats_phase(NeoAAStats *stats, NeoAAPhase phase, uint64_t start, uint64_t bytes, uint64_t items) {
+    if (!stats) {
+        return;
+    }
+    NeoAAPhaseCounter *counter = &stats->phases[phase];
+    __atomic_fetch_add(&counter->ns, neoaa_time_ns() - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->items, items, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->calls, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Insert into a list sorted by key, biggest first. Returns the
+ * new floor, the smallest key once the list is full and 0 before.
+ */
+static uint64_t top_insert(NeoAAStatsFile *list, int byTime, const char *path, uint64_t size, uint64_t ns) {
+    uint64_t key = byTime ? ns : size;
+    int position = NEOAA_STATS_TOP_FILES;
+    while (position > 0) {
+        NeoAAStatsFile *above = &list[position - 1];
+        if (above->path && (byTime ? above->ns : above->size) >= key) {
+            break;
+        }
+        position--;
+    }
+    if (position < NEOAA_STATS_TOP_FILES) {
+        char *copy = strdup(path);
+        if (copy) {
+            free(list[NEOAA_STATS_TOP_FILES - 1].path);
+            memmove(&list[position + 1], &list[position], sizeof(NeoAAStatsFile) * (NEOAA_STATS_TOP_FILES - 1 - position));
+            list[position].path = copy;
+            list[position].size = size;
+            list[position].ns = ns;
+        }
+    }
+    NeoAAStatsFile *last = &list[NEOAA_STATS_TOP_FILES - 1];
+    return last->path ? (byTime ? last->ns : last->size) : 0;
+}
+
+void neoaa_stats_file(NeoAAStats *stats, const char *path, uint64_t size, uint64_t ns) {
+    if (!stats) {
+        return;
+    }
+    int largest = size > __atomic_load_n(&stats->largestFloor, __ATOMIC_RELAXED);
+    int slowest = ns > __atomic_load_n(&stats->slowestFloor, __ATOMIC_RELAXED);
+    if (!largest && !slowest) {
+        return;
+    }
+    pthread_mutex_lock(&stats->lock);
+    if (largest) {
+        __atomic_store_n(&stats->largestFloor, top_insert(stats->largest, 0, path, size, ns), __ATOMIC_RELAXED);
+    }
+    if (slowest) {
+        __atomic_store_n(&stats->slowestFloor, top_insert(stats->slowest, 1, path, size, ns), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats->lock);
+}
+
+void neoaa_stats_finish(NeoAAStats *stats) {
+    if (!stats) {
+        return;
+    }
+    __atomic_store_n(&stats->endTime, neoaa_time_ns(), __ATOMIC_RELAXED);
+}
+
+static double stats_elapsed(NeoAAStats *stats) {
+    uint64_t end = __atomic_load_n(&stats->endTime, __ATOMIC_RELAXED);
+    return (double)((end ? end : neoaa_time_ns()) - stats->startTime) / 1e9;
+}
+
+void neoaa_stats_format(NeoAAStats *stats, char *buf, size_t bufSize) {
+    if (!bufSize) {
+        return;
+    }
+    buf[0] = '\0';
+    if (!stats) {
+        return;
+    }
+    size_t used = 0;
+    for (int i = 0; i < NEOAA_PHASE_COUNT && used < bufSize; i++) {
+        uint64_t ns = __atomic_load_n(&stats->phases[i].ns, __ATOMIC_RELAXED);
+        if (ns) {
+            int n = snprintf(buf + used, bufSize - used, "%s%s %.2fs", used ? "  " : "", phaseNames[i], (double)ns / 1e9);
+            used += n > 0 ? (size_t)n : 0;
+        }
+    }
+    pthread_mutex_lock(&stats->lock);
+    if (stats->largest[0].path && used < bufSize) {
+        char size[32];
+        neoaa_format_bytes(size, sizeof(size), (double)stats->largest[0].size);
+        int n = snprintf(buf + used, bufSize - used, "\nLargest: %s (%s)", stats->largest[0].path, size);
+        used += n > 0 ? (size_t)n : 0;
+    }
+    if (stats->slowest[0].path && used < bufSize) {
+        snprintf(buf + used, bufSize - used, "\nSlowest: %s (%.2fs)", stats->slowest[0].path, (double)stats->slowest[0].ns / 1e9);
+    }
+    pthread_mutex_unlock(&stats->lock);
+}
+
+static void json_string(FILE *fp, const char *string) {
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)(string ? string : ""); *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(fp, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void json_files(FILE *fp, const NeoAAStatsFile *list) {
+    fputc('[', fp);
+    for (int i = 0; i < NEOAA_STATS_TOP_FILES && list[i].path; i++) {
+        fprintf(fp, "%s{\"path\": ", i ? ", " : "");
+        json_string(fp, list[i].path);
+        fprintf(fp, ", \"bytes\": %llu, \"seconds\": %.6f}", (unsigned long long)list[i].size, (double)list[i].ns / 1e9);
+    }
+    fputc(']', fp);
+}
+
+int neoaa_stats_write_json(NeoAAStats *stats, const char *reportPath, const char *command,
+                           const char *inputPath, const char *outputPath, int result) {
+    if (!stats) {
+        return -1;
+    }
+    FILE *fp = fopen(reportPath, "w");
+    if (!fp) {
+        perror("Failed to write report");
+        return -1;
+    }
+    fprintf(fp, "{\n  \"command\": ");
+    json_string(fp, command);
+    fprintf(fp, ",\n  \"input\": ");
+    json_string(fp, inputPath);
+    fprintf(fp, ",\n  \"output\": ");
+    json_string(fp, outputPath);
+    fprintf(fp, ",\n  \"result\": %d,\n  \"seconds\": %.6f,\n  \"phases\": {", result, stats_elapsed(stats));
+    int first = 1;
+    for (int i = 0; i < NEOAA_PHASE_COUNT; i++) {
+        NeoAAPhaseCounter *counter = &stats->phases[i];
+        uint64_t calls = __atomic_load_n(&counter->calls, __ATOMIC_RELAXED);
+        if (!calls) {
+            continue;
+        }
+        fprintf(fp, "%s\n    \"%s\": {\"seconds\": %.6f, \"bytes\": %llu, \"items\": %llu, \"calls\": %llu}",
+                first ? "" : ",", phaseNames[i], (double)__atomic_load_n(&counter->ns, __ATOMIC_RELAXED) / 1e9,
+                (unsigned long long)__atomic_load_n(&counter->bytes, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&counter->items, __ATOMIC_RELAXED), (unsigned long long)calls);
+        first = 0;
+    }
+    fprintf(fp, "%s},\n  \"largest\": ", first ? "" : "\n  ");
+    pthread_mutex_lock(&stats->lock);
+    json_files(fp, stats->largest);
+    fprintf(fp, ",\n  \"slowest\": ");
+    json_files(fp, stats->slowest);
+    pthread_mutex_unlock(&stats->lock);
+    fprintf(fp, "\n}\n");
+    if (fclose(fp) != 0) {
+        perror("Failed to write report");
+        return -1;
+    }
+    return 0;
+}
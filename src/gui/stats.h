@@ -0,0 +1,81 @@
+/*
+ *  stats.h
+ *  neoaa
+ *
+ *  Optional per-phase instrumentation for archive operations.
+ *  A job turns it on by hanging a NeoAAStats off its progress.
+ *  Every function accepts NULL and returns right away, and
+ *  neoaa_stats_start does not even read the clock then, so the
+ *  hooks can stay in the hot paths of release builds.
+ */
+
+#ifndef NEOAA_STATS_H
+#define NEOAA_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef enum {
+    NEOAA_PHASE_WALK,       /* readdir and lstat */
+    NEOAA_PHASE_DEDUP,      /* hashing and comparing candidates */
+    NEOAA_PHASE_ENCODE,     /* building headers */
+    NEOAA_PHASE_READ,       /* file data into memory */
+    NEOAA_PHASE_COMPRESS,   /* one pbz* block each */
+    NEOAA_PHASE_WRITE,      /* archive or extracted file output */
+    NEOAA_PHASE_SCAN,       /* parsing headers of an existing archive */
+    NEOAA_PHASE_DECOMPRESS, /* one pbz* block each */
+    NEOAA_PHASE_METADATA,   /* modes, owners and links after extracting */
+    NEOAA_PHASE_CHECKSUM,   /* CKS and SH2 of file contents */
+    NEOAA_PHASE_COUNT,
+} NeoAAPhase;
+
+/* Files kept in the largest and slowest lists */
+#define NEOAA_STATS_TOP_FILES 5
+
+typedef struct {
+    /* Summed over all threads, so it can exceed the wall time */
+    uint64_t ns;
+    uint64_t bytes;
+    uint64_t items;
+    uint64_t calls;
+} NeoAAPhaseCounter;
+
+typedef struct {
+    char *path;
+    uint64_t size;
+    uint64_t ns;
+} NeoAAStatsFile;
+
+typedef struct neoaa_stats_impl {
+    uint64_t startTime;
+    uint64_t endTime;
+    NeoAAPhaseCounter phases[NEOAA_PHASE_COUNT];
+    /* Guards the file lists, the floors let most files skip it */
+    pthread_mutex_t lock;
+    NeoAAStatsFile largest[NEOAA_STATS_TOP_FILES];
+    NeoAAStatsFile slowest[NEOAA_STATS_TOP_FILES];
+    uint64_t largestFloor;
+    uint64_t slowestFloor;
+} NeoAAStats;
+
+NeoAAStats *neoaa_stats_create(void);
+void neoaa_stats_destroy(NeoAAStats *stats);
+const char *neoaa_phase_name(NeoAAPhase phase);
+
+/* Timestamp to hand to neoaa_stats_phase, 0 without stats */
+uint64_t neoaa_stats_start(NeoAAStats *stats);
+/* Charge the time since start, plus bytes and items, to phase */
+void neoaa_stats_phase(NeoAAStats *stats, NeoAAPhase phase, uint64_t start, uint64_t bytes, uint64_t items);
+/* Consider one file for the largest and slowest lists, ns is what it took to process */
+void neoaa_stats_file(NeoAAStats *stats, const char *path, uint64_t size, uint64_t ns);
+/* Stop the wall clock, later phases still count */
+void neoaa_stats_finish(NeoAAStats *stats);
+
+/* A few lines for a status panel, safe while workers still report */
+void neoaa_stats_format(NeoAAStats *stats, char *buf, size_t bufSize);
+/* JSON report, command and paths are only copied into it. Non zero on failure. */
+int neoaa_stats_write_json(NeoAAStats *stats, const char *reportPath, const char *command,
+                           const char *inputPath, const char *outputPath, int result);
+
+#endif /* NEOAA_STATS_H */
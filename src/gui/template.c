@@ -0,0 +1,212 @@
+/*
+ *  template.c
+ *  neoaa
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "template.h"
+
+/* Longest template, a file with ids and both clusters, with room to spare */
+#define NEOAA_TEMPLATE_MAX_SIZE 96
+#define NEOAA_HEADER_PREFIX_SIZE 6
+
+/* Which optional fields a template of a kind has, one of each combination is built */
+#define NEOAA_TEMPLATE_IDS 1
+#define NEOAA_TEMPLATE_HLC 2
+#define NEOAA_TEMPLATE_CLC 4
+#define NEOAA_TEMPLATE_VARIANTS 8
+
+typedef struct {
+    uint8_t bytes[NEOAA_TEMPLATE_MAX_SIZE]; /* every field, strings empty and variable values 0 */
+    size_t size;
+    /* Where values get patched in, 0 when the kind has no such field */
+    size_t uidOffset;
+    size_t gidOffset;
+    size_t modOffset;
+    size_t flgOffset;
+    size_t hlcOffset;
+    size_t clcOffset;
+    size_t pathOffset; /* the 16 bit length, the string follows */
+    size_t linkOffset; /* same, always after PAT */
+    size_t datOffset;  /* the subtype, DAT is always the last field */
+} NeoAAHeaderTemplate;
+
+static NeoAAHeaderTemplate templates[NEOAA_TEMPLATE_KIND_COUNT][NEOAA_TEMPLATE_VARIANTS];
+static pthread_once_t templatesOnce = PTHREAD_ONCE_INIT;
+
+/* Append key and subtype, returns where the value goes */
+static size_t template_key(NeoAAHeaderTemplate *t, const char *key, char subtype) {
+    memcpy(t->bytes + t->size, key, 3);
+    t->bytes[t->size + 3] = (uint8_t)subtype;
+    t->size += 4;
+    return t->size;
+}
+
+static size_t template_uint(NeoAAHeaderTemplate *t, const char *key, int width, uint64_t value) {
+    size_t offset = template_key(t, key, (char)('0' + width));
+    for (int i = 0; i < width; i++) {
+        t->bytes[offset + i] = (uint8_t)(value >> (8 * i));
+    }
+    t->size += width;
+    return offset;
+}
+
+static size_t template_string(NeoAAHeaderTemplate *t, const char *key) {
+    size_t offset = template_key(t, key, 'P');
+    t->bytes[offset] = 0;
+    t->bytes[offset + 1] = 0;
+    t->size += 2;
+    return offset;
+}
+
+/* A 4 byte blob size, widened on encode when it does not fit */
+static size_t template_blob(NeoAAHeaderTemplate *t, const char *key) {
+    size_t offset = template_key(t, key, 'B');
+    memset(t->bytes + offset, 0, 4);
+    t->size += 4;
+    return offset - 1;
+}
+
+static void template_build(NeoAAHeaderTemplate *t, NeoAATemplateKind kind, int variant) {
+    memset(t, 0, sizeof(*t));
+    memcpy(t->bytes, "AA01", 4);
+    t->size = NEOAA_HEADER_PREFIX_SIZE;
+    if (kind == NEOAA_TEMPLATE_SINGLE_FILE) {
+        /* Always the same owner and mode, whatever the file had */
+        template_uint(t, "TYP", 1, 'F');
+        t->pathOffset = template_string(t, "PAT");
+        template_uint(t, "UID", 2, 0x1F5);
+        template_uint(t, "GID", 1, 0x14);
+        template_uint(t, "MOD", 2, 0x1ED);
+        template_uint(t, "FLG", 1, 0);
+        t->datOffset = template_blob(t, "DAT");
+        return;
+    }
+    /* Full width ids, the mode and the clusters ahead of PAT, so their offsets never shift */
+    if (variant & NEOAA_TEMPLATE_IDS) {
+        t->uidOffset = template_uint(t, "UID", 4, 0);
+        t->gidOffset = template_uint(t, "GID", 4, 0);
+    }
+    t->modOffset = template_uint(t, "MOD", 2, 0);
+    t->flgOffset = template_uint(t, "FLG", 4, 0);
+    if (kind == NEOAA_TEMPLATE_FILE || kind == NEOAA_TEMPLATE_DUPLICATE) {
+        if (variant & NEOAA_TEMPLATE_HLC) {
+            t->hlcOffset = template_uint(t, "HLC", 4, 0);
+        }
+        if (variant & NEOAA_TEMPLATE_CLC) {
+            t->clcOffset = template_uint(t, "CLC", 4, 0);
+        }
+    }
+    t->pathOffset = template_string(t, "PAT");
+    switch (kind) {
+        case NEOAA_TEMPLATE_DIRECTORY:
+            template_uint(t, "TYP", 1, 'D');
+            break;
+        case NEOAA_TEMPLATE_FILE:
+            template_uint(t, "TYP", 1, 'F');
+            t->datOffset = template_blob(t, "DAT");
+            break;
+        case NEOAA_TEMPLATE_SYMLINK:
+            t->linkOffset = template_string(t, "LNK");
+            template_uint(t, "TYP", 1, 'L');
+            break;
+        case NEOAA_TEMPLATE_DUPLICATE:
+            template_uint(t, "TYP", 1, 'F');
+            break;
+        default:
+            break;
+    }
+}
+
+static void templates_init(void) {
+    for (int kind = 0; kind < NEOAA_TEMPLATE_KIND_COUNT; kind++) {
+        for (int variant = 0; variant < NEOAA_TEMPLATE_VARIANTS; variant++) {
+            template_build(&templates[kind][variant], (NeoAATemplateKind)kind, variant);
+        }
+    }
+}
+
+static void template_patch(uint8_t *out, int width, uint64_t value) {
+    for (int i = 0; i < width; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/* Where a template offset ends up once the strings before it are in */
+static size_t template_shift(const NeoAAHeaderTemplate *t, size_t offset, size_t pathLength, size_t linkLength) {
+    if (t->pathOffset && offset > t->pathOffset) {
+        offset += pathLength;
+    }
+    if (t->linkOffset && offset > t->linkOffset) {
+        offset += linkLength;
+    }
+    return offset;
+}
+
+size_t neoaa_template_bound(const NeoAATemplateValues *values) {
+    return NEOAA_TEMPLATE_MAX_SIZE + values->pathLength + values->linkLength + 4;
+}
+
+size_t neoaa_template_encode(NeoAATemplateKind kind, const NeoAATemplateValues *values, uint8_t *out, size_t outSize) {
+    pthread_once(&templatesOnce, templates_init);
+    int variant = (values->ids ? NEOAA_TEMPLATE_IDS : 0) | (values->hardlinkCluster ? NEOAA_TEMPLATE_HLC : 0)
+        | (values->cloneCluster ? NEOAA_TEMPLATE_CLC : 0);
+    const NeoAAHeaderTemplate *t = &templates[kind][variant];
+    size_t pathLength = t->pathOffset ? values->pathLength : 0;
+    size_t linkLength = t->linkOffset ? values->linkLength : 0;
+    int wideSize = t->datOffset && values->size > 0xFFFFFFFFULL;
+    size_t size = t->size + pathLength + linkLength + (wideSize ? 4 : 0);
+    if (size > 0xFFFF || size > outSize || pathLength > 0xFFFF || linkLength > 0xFFFF) {
+        return 0;
+    }
+
+    /* The fixed bytes in between the strings go over as they are */
+    const size_t stringOffsets[2] = { t->pathOffset, t->linkOffset };
+    const char *strings[2] = { values->path, values->link };
+    const size_t lengths[2] = { pathLength, linkLength };
+    size_t from = 0;
+    size_t to = 0;
+    for (int i = 0; i < 2; i++) {
+        if (!stringOffsets[i]) {
+            continue;
+        }
+        size_t end = stringOffsets[i] + 2;
+        memcpy(out + to, t->bytes + from, end - from);
+        to += end - from;
+        from = end;
+        out[to - 2] = (uint8_t)lengths[i];
+        out[to - 1] = (uint8_t)(lengths[i] >> 8);
+        memcpy(out + to, strings[i], lengths[i]);
+        to += lengths[i];
+    }
+    memcpy(out + to, t->bytes + from, t->size - from);
+
+    out[4] = (uint8_t)size;
+    out[5] = (uint8_t)(size >> 8);
+    if (t->uidOffset) {
+        template_patch(out + t->uidOffset, 4, values->uid);
+    }
+    if (t->gidOffset) {
+        template_patch(out + t->gidOffset, 4, values->gid);
+    }
+    if (t->modOffset) {
+        template_patch(out + t->modOffset, 2, values->mode & 07777);
+    }
+    if (t->flgOffset) {
+        template_patch(out + t->flgOffset, 4, values->flags);
+    }
+    if (t->hlcOffset) {
+        template_patch(out + t->hlcOffset, 4, values->hardlinkCluster);
+    }
+    if (t->clcOffset) {
+        template_patch(out + t->clcOffset, 4, values->cloneCluster);
+    }
+    if (t->datOffset) {
+        size_t offset = template_shift(t, t->datOffset, pathLength, linkLength);
+        int width = wideSize ? 8 : 4;
+        out[offset] = wideSize ? 'C' : 'B';
+        template_patch(out + offset + 1, width, values->size);
+    }
+    return size;
+}
@@ -0,0 +1,61 @@
+/*
+ *  template.h
+ *  neoaa
+ *
+ *  Prebuilt headers for the kinds of entry archiving writes over
+ *  and over. Each kind is encoded once with its keys, subtypes and
+ *  constant values in place, an entry then only copies it and has
+ *  its path, link target, ids, mode, clusters and size patched in. The
+ *  templates are built on first use rather than at compile time,
+ *  encoding them takes a few hundred bytes of work once per process
+ *  and keeps the layout in one readable function.
+ */
+
+#ifndef NEOAA_TEMPLATE_H
+#define NEOAA_TEMPLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    /*
+     * Tree kinds start with UID and GID when ids is set, then MOD
+     * and FLG. Files follow with HLC and CLC when they are in a
+     * cluster, the first entry of a cluster carries the data and
+     * the later ones are restored from it.
+     */
+    NEOAA_TEMPLATE_DIRECTORY,   /* PAT, TYP D */
+    NEOAA_TEMPLATE_FILE,        /* PAT, TYP F, DAT */
+    NEOAA_TEMPLATE_SYMLINK,     /* PAT, LNK, TYP L */
+    NEOAA_TEMPLATE_DUPLICATE,   /* PAT, TYP F, no DAT, later member of its clusters */
+    NEOAA_TEMPLATE_SINGLE_FILE, /* wrap and add, fixed UID, GID, MOD and FLG around PAT and DAT */
+    NEOAA_TEMPLATE_KIND_COUNT,
+} NeoAATemplateKind;
+
+/* What differs between two headers of a kind, strings need no terminator */
+typedef struct {
+    const char *path;
+    size_t pathLength;
+    const char *link;  /* LNK kinds only */
+    size_t linkLength;
+    int ids;           /* tree kinds, lead with UID and GID */
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t mode;     /* tree kinds, only the permission bits are kept */
+    uint32_t flags;    /* tree kinds, st_flags where the system has them */
+    uint32_t hardlinkCluster; /* FILE and DUPLICATE, HLC and CLC when not 0 */
+    uint32_t cloneCluster;
+    uint64_t size;     /* DAT kinds, 8 byte blob size past 4 GiB */
+} NeoAATemplateValues;
+
+/* Room neoaa_template_encode needs for values, whatever the kind */
+size_t neoaa_template_bound(const NeoAATemplateValues *values);
+
+/*
+ * Encode a header of kind into out, which has outSize bytes.
+ * Returns its size, 0 when it does not fit out or the 16 bit
+ * header size.
+ */
+size_t neoaa_template_encode(NeoAATemplateKind kind, const NeoAATemplateValues *values, uint8_t *out, size_t outSize);
+
+#endif /* NEOAA_TEMPLATE_H */
@@ -0,0 +1,364 @@
+/*
+ *  uring.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NEOAA_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef NEOAA_HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+struct neoaa_uring_impl {
+    int fd;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned sqEntries;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    /* Queued since the last submit */
+    unsigned queued;
+    int broken;
+    /* Scratch for the batch helpers, one slot per queue entry */
+    struct statx *statxBuffer;
+    int *fds;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+/* Kernels before 5.6 have a ring but not the opcodes we need */
+static int uring_supported(int fd) {
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probeSize);
+    if (!probe) {
+        return 0;
+    }
+    int supported = 0;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        static const int needed[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_STATX};
+        supported = 1;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+            if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+                supported = 0;
+            }
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+NeoAAUring neoaa_uring_create(void) {
+    if (getenv("NEOAA_NO_URING")) {
+        return NULL;
+    }
+    NeoAAUring ring = (NeoAAUring)calloc(1, sizeof(struct neoaa_uring_impl));
+    if (!ring) {
+        return NULL;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    /* Completions are only ever reaped by the thread that submits */
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    ring->fd = uring_setup(NEOAA_URING_DEPTH, &params);
+    if (ring->fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ring->fd = uring_setup(NEOAA_URING_DEPTH, &params);
+    }
+    if (ring->fd < 0) {
+        /* ENOSYS, or EPERM under seccomp, both mean blocking I/O */
+        free(ring);
+        return NULL;
+    }
+    if (!uring_supported(ring->fd)) {
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap && ring->cqRingSize > ring->sqRingSize) {
+        ring->sqRingSize = ring->cqRingSize;
+    }
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        ring->sqRing = NULL;
+    }
+    if (singleMap) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            ring->cqRing = NULL;
+        }
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                             ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+    }
+    ring->statxBuffer = (struct statx *)malloc(params.sq_entries * sizeof(struct statx));
+    ring->fds = (int *)malloc(params.sq_entries * sizeof(int));
+    if (!ring->sqRing || !ring->cqRing || !ring->sqes || !ring->statxBuffer || !ring->fds) {
+        neoaa_uring_destroy(ring);
+        return NULL;
+    }
+    uint8_t *sq = (uint8_t *)ring->sqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+    uint8_t *cq = (uint8_t *)ring->cqRing;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void neoaa_uring_destroy(NeoAAUring ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    free(ring->statxBuffer);
+    free(ring->fds);
+    close(ring->fd);
+    free(ring);
+}
+
+/* Next free submission entry, zeroed. The batches never queue more than sqEntries. */
+static struct io_uring_sqe *uring_get_sqe(NeoAAUring ring, uint64_t userData) {
+    unsigned tail = *ring->sqTail + ring->queued;
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = userData;
+    ring->sqArray[index] = index;
+    ring->queued++;
+    return sqe;
+}
+
+/*
+ * Submit everything queued and hand each completion's result to
+ * results by index. Returns non zero if the ring broke, the ring
+ * then refuses further batches so callers stay on blocking calls.
+ */
+static int uring_run(NeoAAUring ring, int *results, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        results[i] = -ECANCELED;
+    }
+    unsigned pending = ring->queued;
+    ring->queued = 0;
+    __atomic_store_n(ring->sqTail, *ring->sqTail + pending, __ATOMIC_RELEASE);
+    unsigned toSubmit = pending;
+    unsigned completed = 0;
+    while (completed < pending) {
+        int submitted = uring_enter(ring->fd, toSubmit, pending - completed, IORING_ENTER_GETEVENTS);
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            ring->broken = 1;
+            return -1;
+        }
+        if (submitted > 0) {
+            toSubmit -= (unsigned)submitted < toSubmit ? (unsigned)submitted : toSubmit;
+        }
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+            if (cqe->user_data < count) {
+                results[cqe->user_data] = cqe->res;
+            }
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+int neoaa_uring_lstat_batch(NeoAAUring ring, int dirFd, const char *const *names, struct stat *stats,
+                            int *results, size_t count) {
+    if (ring->broken) {
+        return -1;
+    }
+    for (size_t start = 0; start < count; start += ring->sqEntries) {
+        size_t batch = count - start < ring->sqEntries ? count - start : ring->sqEntries;
+        for (size_t i = 0; i < batch; i++) {
+            struct io_uring_sqe *sqe = uring_get_sqe(ring, i);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirFd;
+            sqe->addr = (uint64_t)(uintptr_t)names[start + i];
+            sqe->len = STATX_BASIC_STATS;
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->off = (uint64_t)(uintptr_t)&ring->statxBuffer[i];
+        }
+        if (uring_run(ring, results + start, batch) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < batch; i++) {
+            if (results[start + i] != 0) {
+                continue;
+            }
+            /* Only the fields the walker keeps, same values lstat would give */
+            const struct statx *stx = &ring->statxBuffer[i];
+            struct stat *fileStat = &stats[start + i];
+            memset(fileStat, 0, sizeof(*fileStat));
+            fileStat->st_mode = stx->stx_mode;
+            fileStat->st_uid = stx->stx_uid;
+            fileStat->st_gid = stx->stx_gid;
+            fileStat->st_size = stx->stx_size;
+            fileStat->st_nlink = stx->stx_nlink;
+            fileStat->st_ino = stx->stx_ino;
+            fileStat->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+            fileStat->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+            fileStat->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+/* Finish a read that came back short with plain pread, the file may just be on a slow filesystem */
+static int read_rest(int fd, uint8_t *buffer, uint64_t size, uint64_t done) {
+    while (done < size) {
+        ssize_t got = pread(fd, buffer + done, size - done, done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -EIO;
+        }
+        done += got;
+    }
+    return 0;
+}
+
+int neoaa_uring_read_batch(NeoAAUring ring, const char *const *paths, void *const *buffers, const uint64_t *sizes,
+                           int *results, size_t count) {
+    if (ring->broken) {
+        return -1;
+    }
+    int *fds = ring->fds;
+    int *closed = (int *)ring->statxBuffer;
+    for (size_t start = 0; start < count; start += ring->sqEntries) {
+        size_t batch = count - start < ring->sqEntries ? count - start : ring->sqEntries;
+        int *batchResults = results + start;
+        for (size_t i = 0; i < batch; i++) {
+            struct io_uring_sqe *sqe = uring_get_sqe(ring, i);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)paths[start + i];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        }
+        if (uring_run(ring, fds, batch) != 0) {
+            for (size_t i = 0; i < batch; i++) {
+                if (fds[i] >= 0) {
+                    close(fds[i]);
+                }
+            }
+            return -1;
+        }
+        for (size_t i = 0; i < batch; i++) {
+            if (fds[i] >= 0) {
+                struct io_uring_sqe *sqe = uring_get_sqe(ring, i);
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = fds[i];
+                sqe->addr = (uint64_t)(uintptr_t)buffers[start + i];
+                sqe->len = (unsigned)sizes[start + i];
+                sqe->off = 0;
+            }
+        }
+        int failed = uring_run(ring, batchResults, batch);
+        for (size_t i = 0; i < batch; i++) {
+            uint8_t *buffer = (uint8_t *)buffers[start + i];
+            if (fds[i] < 0) {
+                batchResults[i] = fds[i];
+            } else if (failed || batchResults[i] < 0) {
+                /* Whatever the ring could not do is done blocking */
+                batchResults[i] = read_rest(fds[i], buffer, sizes[start + i], 0);
+            } else {
+                batchResults[i] = read_rest(fds[i], buffer, sizes[start + i], (uint64_t)batchResults[i]);
+            }
+        }
+        for (size_t i = 0; !failed && i < batch; i++) {
+            if (fds[i] >= 0) {
+                struct io_uring_sqe *sqe = uring_get_sqe(ring, i);
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = fds[i];
+            }
+        }
+        if (!failed && uring_run(ring, closed, batch) == 0) {
+            continue;
+        }
+        /* The files are read, only the ring is gone. Never close twice, the number may be reused. */
+        for (size_t i = 0; i < batch; i++) {
+            if (fds[i] >= 0 && (failed || closed[i] == -ECANCELED)) {
+                close(fds[i]);
+            }
+        }
+    }
+    return 0;
+}
+
+#else /* !NEOAA_HAVE_IO_URING */
+
+NeoAAUring neoaa_uring_create(void) {
+    return NULL;
+}
+
+void neoaa_uring_destroy(NeoAAUring ring) {
+    (void)ring;
+}
+
+int neoaa_uring_lstat_batch(NeoAAUring ring, int dirFd, const char *const *names, struct stat *stats,
+                            int *results, size_t count) {
+    return -1;
+}
+
+int neoaa_uring_read_batch(NeoAAUring ring, const char *const *paths, void *const *buffers, const uint64_t *sizes,
+                           int *results, size_t count) {
+    return -1;
+}
+
+#endif
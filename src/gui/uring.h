@@ -0,0 +1,49 @@
+/*
+ *  uring.h
+ *  neoaa
+ *
+ *  Batched file system calls through io_uring on Linux, spoken
+ *  with the raw syscalls so there is no liburing dependency. One
+ *  ring per thread. Trees of small files are dominated by the
+ *  latency of lstat, open, read and close, a batch of them costs
+ *  a handful of io_uring_enter calls instead. neoaa_uring_create
+ *  returns NULL where io_uring is missing, too old or forbidden,
+ *  or when NEOAA_NO_URING is set in the environment, and callers
+ *  then keep using the blocking calls.
+ */
+
+#ifndef NEOAA_URING_H
+#define NEOAA_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Submission queue size, also the most calls in flight at once */
+#define NEOAA_URING_DEPTH 256
+/* Files up to this size are read in one request, bigger ones are left to the blocking path */
+#define NEOAA_URING_MAX_READ (1024 * 1024)
+
+typedef struct neoaa_uring_impl *NeoAAUring;
+
+NeoAAUring neoaa_uring_create(void);
+void neoaa_uring_destroy(NeoAAUring ring);
+
+/*
+ * lstat every name relative to the open directory dirFd. results
+ * get 0 or a negative errno per name. Non zero only if the ring
+ * itself failed, the caller should then redo the batch blocking.
+ */
+int neoaa_uring_lstat_batch(NeoAAUring ring, int dirFd, const char *const *names, struct stat *stats,
+                            int *results, size_t count);
+
+/*
+ * Read exactly sizes[i] bytes of each file into buffers[i], each
+ * at most NEOAA_URING_MAX_READ. Opens, reads and closes go out as
+ * three batches. results get 0, a negative errno, or -EIO when a
+ * file came up short. Non zero only if the ring itself failed.
+ */
+int neoaa_uring_read_batch(NeoAAUring ring, const char *const *paths, void *const *buffers, const uint64_t *sizes,
+                           int *results, size_t count);
+
+#endif /* NEOAA_URING_H */
@@ -0,0 +1,632 @@
+/*
+ *  walk.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include "walk.h"
+#include "stats.h"
+#include "template.h"
+
+/* Names looked up together, one statx batch on the ring */
+#define NEOAA_WALK_BATCH 128
+
+int neoaa_default_thread_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    if (cpus > NEOAA_MAX_THREADS) {
+        return NEOAA_MAX_THREADS;
+    }
+    return (int)cpus;
+}
+
+char *neoaa_join_path(const char *base, const char *name) {
+    size_t baseLen = strlen(base);
+    size_t nameLen = strlen(name);
+    char *path = (char *)malloc(baseLen + nameLen + 2);
+    if (!path) {
+        return NULL;
+    }
+    if (baseLen) {
+        memcpy(path, base, baseLen);
+        path[baseLen] = '/';
+        baseLen++;
+    }
+    memcpy(path + baseLen, name, nameLen + 1);
+    return path;
+}
+
+/* Deque of directories (relative paths) waiting to be read */
+typedef struct {
+    pthread_mutex_t lock;
+    const char **tasks;
+    size_t head;
+    size_t tail;
+    size_t malloc;
+} NeoAAWalkQueue;
+
+typedef struct neoaa_walk_state NeoAAWalkState;
+
+typedef struct {
+    NeoAAWalkState *state;
+    int index;
+    NeoAAWalkQueue queue;
+    NeoAAWalkEntry *entries;
+    size_t entryCount;
+    size_t entryMalloc;
+    /* Paths found by this worker, handed to the caller's arena at the end */
+    NeoAAArena arena;
+    /* Full path of whatever is being looked at, grown as needed */
+    char *scratch;
+    size_t scratchSize;
+    /* Batched lstat, NULL when io_uring is not there */
+    NeoAAUring ring;
+    int ringTried;
+} NeoAAWalkWorker;
+
+struct neoaa_walk_state {
+    const char *root;
+    NeoAAWalkWorker *workers;
+    int workerCount;
+    NeoAAProgress *progress;
+    /* Directories pushed but not yet fully read */
+    size_t pending;
+    int error;
+    int sleepers;
+    pthread_mutex_t idleLock;
+    pthread_cond_t idleCond;
+};
+
+static int queue_push(NeoAAWalkQueue *queue, const char *task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail == queue->malloc) {
+        /* Compact before growing, thieves leave a gap at the head */
+        if (queue->head) {
+            memmove(queue->tasks, queue->tasks + queue->head, sizeof(const char *) * (queue->tail - queue->head));
+            queue->tail -= queue->head;
+            queue->head = 0;
+        }
+        if (queue->tail == queue->malloc) {
+            size_t newMalloc = queue->malloc ? queue->malloc * 2 : 64;
+            const char **newTasks = (const char **)realloc(queue->tasks, sizeof(const char *) * newMalloc);
+            if (!newTasks) {
+                pthread_mutex_unlock(&queue->lock);
+                return -1;
+            }
+            queue->tasks = newTasks;
+            queue->malloc = newMalloc;
+        }
+    }
+    queue->tasks[queue->tail++] = task;
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/* Owner side, LIFO keeps the walk depth first and cache friendly */
+static const char *queue_pop(NeoAAWalkQueue *queue) {
+    const char *task = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head) {
+        task = queue->tasks[--queue->tail];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+/* Thief side, FIFO takes the oldest and usually biggest subtree */
+static const char *queue_steal(NeoAAWalkQueue *queue) {
+    const char *task = NULL;
+    if (pthread_mutex_trylock(&queue->lock) != 0) {
+        return NULL;
+    }
+    if (queue->tail > queue->head) {
+        task = queue->tasks[queue->head++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+static int worker_add_entry(NeoAAWalkWorker *worker, char *path, struct stat *fileStat) {
+    if (worker->entryCount == worker->entryMalloc) {
+        size_t newMalloc = worker->entryMalloc ? worker->entryMalloc * 2 : 256;
+        NeoAAWalkEntry *newEntries = (NeoAAWalkEntry *)realloc(worker->entries, sizeof(NeoAAWalkEntry) * newMalloc);
+        if (!newEntries) {
+            return -1;
+        }
+        worker->entries = newEntries;
+        worker->entryMalloc = newMalloc;
+    }
+    NeoAAWalkEntry *entry = &worker->entries[worker->entryCount++];
+    entry->path = path;
+    entry->mode = fileStat->st_mode;
+    entry->uid = fileStat->st_uid;
+    entry->gid = fileStat->st_gid;
+    entry->size = S_ISREG(fileStat->st_mode) ? fileStat->st_size : 0;
+    entry->dev = fileStat->st_dev;
+    entry->ino = fileStat->st_ino;
+    entry->mtime = fileStat->st_mtim;
+    entry->nlink = fileStat->st_nlink;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    entry->flags = fileStat->st_flags;
+#else
+    entry->flags = 0;
+#endif
+    entry->duplicateOf = NULL;
+    entry->hardlinkCluster = 0;
+    entry->cloneCluster = 0;
+    return 0;
+}
+
+/* relativePath has to outlive the walk, it is an entry's path */
+static void walk_push_directory(NeoAAWalkWorker *worker, const char *relativePath) {
+    NeoAAWalkState *state = worker->state;
+    __atomic_fetch_add(&state->pending, 1, __ATOMIC_ACQ_REL);
+    if (queue_push(&worker->queue, relativePath) != 0) {
+        __atomic_fetch_sub(&state->pending, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&state->error, -2, __ATOMIC_RELAXED);
+        return;
+    }
+    if (__atomic_load_n(&state->sleepers, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&state->idleLock);
+        pthread_cond_signal(&state->idleCond);
+        pthread_mutex_unlock(&state->idleLock);
+    }
+}
+
+/* Make room for size bytes of path in the worker's scratch buffer */
+static char *worker_scratch(NeoAAWalkWorker *worker, size_t size) {
+    if (size > worker->scratchSize) {
+        size_t newSize = worker->scratchSize ? worker->scratchSize : 1024;
+        while (newSize < size) {
+            newSize *= 2;
+        }
+        char *newScratch = (char *)realloc(worker->scratch, newSize);
+        if (!newScratch) {
+            return NULL;
+        }
+        worker->scratch = newScratch;
+        worker->scratchSize = newSize;
+    }
+    return worker->scratch;
+}
+
+/*
+ * lstat a batch of names from the directory at the scratch's first
+ * dirLen bytes and record them. paths are the entries' relative
+ * paths, each name starts nameOffset bytes in.
+ */
+static int walk_stat_batch(NeoAAWalkWorker *worker, DIR *dir, size_t dirLen, size_t nameOffset, char **paths,
+                           size_t count) {
+    const char *names[NEOAA_WALK_BATCH];
+    struct stat stats[NEOAA_WALK_BATCH];
+    int results[NEOAA_WALK_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        names[i] = paths[i] + nameOffset;
+    }
+    if (!worker->ring || neoaa_uring_lstat_batch(worker->ring, dirfd(dir), names, stats, results, count) != 0) {
+        for (size_t i = 0; i < count; i++) {
+            size_t nameLen = strlen(names[i]);
+            char *fullPath = worker_scratch(worker, dirLen + nameLen + 2);
+            if (!fullPath) {
+                return -2;
+            }
+            fullPath[dirLen] = '/';
+            memcpy(fullPath + dirLen + 1, names[i], nameLen + 1);
+            results[i] = lstat(fullPath, &stats[i]) < 0 ? -errno : 0;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (results[i] < 0) {
+            fprintf(stderr, "Failed to get file info: %s\n", strerror(-results[i]));
+            continue;
+        }
+        if (worker_add_entry(worker, paths[i], &stats[i]) != 0) {
+            return -2;
+        }
+        if (S_ISDIR(stats[i].st_mode)) {
+            walk_push_directory(worker, paths[i]);
+        }
+    }
+    return 0;
+}
+
+static void walk_read_directory(NeoAAWalkWorker *worker, const char *relativeDir) {
+    NeoAAWalkState *state = worker->state;
+    NeoAAStats *stats = neoaa_progress_stats(state->progress);
+    uint64_t start = neoaa_stats_start(stats);
+    size_t firstEntry = worker->entryCount;
+    if (!worker->ringTried) {
+        worker->ring = neoaa_uring_create();
+        worker->ringTried = 1;
+    }
+    /* The scratch holds root/relativeDir, each name is appended in place for lstat */
+    size_t rootLen = strlen(state->root);
+    size_t relativeLen = strlen(relativeDir);
+    size_t dirLen = rootLen + (relativeLen ? relativeLen + 1 : 0);
+    char *dirPath = worker_scratch(worker, dirLen + 1);
+    if (!dirPath) {
+        __atomic_store_n(&state->error, -2, __ATOMIC_RELAXED);
+        return;
+    }
+    memcpy(dirPath, state->root, rootLen);
+    if (relativeLen) {
+        dirPath[rootLen] = '/';
+        memcpy(dirPath + rootLen + 1, relativeDir, relativeLen);
+    }
+    dirPath[dirLen] = '\0';
+    DIR *dir = opendir(dirPath);
+    if (!dir) {
+        fprintf(stderr, "Failed to open directory: %s\n", dirPath);
+        __atomic_store_n(&state->error, -1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* Names are gathered first so their lstat calls can go out together */
+    char *batch[NEOAA_WALK_BATCH];
+    size_t batchCount = 0;
+    size_t nameOffset = relativeLen ? relativeLen + 1 : 0;
+    struct dirent *entry;
+    for (;;) {
+        entry = readdir(dir);
+        if (entry && (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)) {
+            continue;  /* Skip "." and ".." */
+        }
+        if (neoaa_progress_cancelled(state->progress) || __atomic_load_n(&state->error, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (entry) {
+            batch[batchCount] = neoaa_arena_join_path(worker->arena, relativeDir, entry->d_name);
+            if (!batch[batchCount]) {
+                __atomic_store_n(&state->error, -2, __ATOMIC_RELAXED);
+                break;
+            }
+            batchCount++;
+        }
+        if (batchCount && (!entry || batchCount == NEOAA_WALK_BATCH)) {
+            if (walk_stat_batch(worker, dir, dirLen, nameOffset, batch, batchCount) != 0) {
+                __atomic_store_n(&state->error, -2, __ATOMIC_RELAXED);
+                break;
+            }
+            batchCount = 0;
+        }
+        if (!entry) {
+            break;
+        }
+    }
+    closedir(dir);
+    neoaa_stats_phase(stats, NEOAA_PHASE_WALK, start, 0, worker->entryCount - firstEntry);
+}
+
+static void *walk_worker_thread(void *context) {
+    NeoAAWalkWorker *worker = (NeoAAWalkWorker *)context;
+    NeoAAWalkState *state = worker->state;
+    for (;;) {
+        const char *task = queue_pop(&worker->queue);
+        for (int i = 1; !task && i < state->workerCount; i++) {
+            task = queue_steal(&state->workers[(worker->index + i) % state->workerCount].queue);
+        }
+        if (task) {
+            if (!neoaa_progress_cancelled(state->progress) && !__atomic_load_n(&state->error, __ATOMIC_RELAXED)) {
+                walk_read_directory(worker, task);
+            }
+            if (__atomic_sub_fetch(&state->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+                /* Last directory done, wake everyone so they can exit */
+                pthread_mutex_lock(&state->idleLock);
+                pthread_cond_broadcast(&state->idleCond);
+                pthread_mutex_unlock(&state->idleLock);
+            }
+            continue;
+        }
+        if (__atomic_load_n(&state->pending, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        }
+        /* Someone is still reading a directory that may produce more work */
+        pthread_mutex_lock(&state->idleLock);
+        __atomic_fetch_add(&state->sleepers, 1, __ATOMIC_ACQ_REL);
+        if (__atomic_load_n(&state->pending, __ATOMIC_ACQUIRE) != 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&state->idleCond, &state->idleLock, &deadline);
+        }
+        __atomic_fetch_sub(&state->sleepers, 1, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&state->idleLock);
+    }
+    return NULL;
+}
+
+/* Order paths component by component so a directory always precedes its contents */
+static int compare_walk_entries(const void *a, const void *b) {
+    const unsigned char *pathA = (const unsigned char *)((const NeoAAWalkEntry *)a)->path;
+    const unsigned char *pathB = (const unsigned char *)((const NeoAAWalkEntry *)b)->path;
+    while (*pathA && *pathA == *pathB) {
+        pathA++;
+        pathB++;
+    }
+    unsigned int charA = *pathA == '/' ? 1 : *pathA;
+    unsigned int charB = *pathB == '/' ? 1 : *pathB;
+    return (int)charA - (int)charB;
+}
+
+int neoaa_walk_directory(const char *dirPath, int threadCount, NeoAAArena arena, NeoAAWalkEntry **entries, size_t *entryCount,
+                         NeoAAProgress *progress) {
+    if (threadCount <= 0) {
+        threadCount = neoaa_default_thread_count();
+    }
+    if (threadCount > NEOAA_MAX_THREADS) {
+        threadCount = NEOAA_MAX_THREADS;
+    }
+    NeoAAWalkState state;
+    memset(&state, 0, sizeof(state));
+    state.root = dirPath;
+    state.workerCount = threadCount;
+    state.progress = progress;
+    pthread_mutex_init(&state.idleLock, NULL);
+    pthread_cond_init(&state.idleCond, NULL);
+    state.workers = (NeoAAWalkWorker *)calloc(threadCount, sizeof(NeoAAWalkWorker));
+    if (!state.workers) {
+        fprintf(stderr, "Failed to allocate walker state\n");
+        return -2;
+    }
+    for (int i = 0; i < threadCount; i++) {
+        state.workers[i].state = &state;
+        state.workers[i].index = i;
+        state.workers[i].arena = neoaa_arena_create();
+        if (!state.workers[i].arena) {
+            state.error = -2;
+        }
+        pthread_mutex_init(&state.workers[i].queue.lock, NULL);
+    }
+
+    /* Fail early on the root like the serial walk did */
+    DIR *rootDir = state.error ? NULL : opendir(dirPath);
+    if (rootDir) {
+        closedir(rootDir);
+        walk_push_directory(&state.workers[0], "");
+    } else if (!state.error) {
+        fprintf(stderr, "Failed to open directory: %s\n", dirPath);
+        state.error = -1;
+    }
+
+    pthread_t threads[NEOAA_MAX_THREADS];
+    int started = 0;
+    if (!state.error) {
+        for (int i = 1; i < threadCount; i++) {
+            if (pthread_create(&threads[i], NULL, walk_worker_thread, &state.workers[i]) != 0) {
+                break;
+            }
+            started = i;
+        }
+        /* The calling thread is worker 0 */
+        walk_worker_thread(&state.workers[0]);
+        for (int i = 1; i <= started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < threadCount; i++) {
+        total += state.workers[i].entryCount;
+    }
+    NeoAAWalkEntry *merged = (NeoAAWalkEntry *)neoaa_arena_alloc(arena, sizeof(NeoAAWalkEntry) * total);
+    size_t mergedCount = 0;
+    for (int i = 0; i < threadCount; i++) {
+        NeoAAWalkWorker *worker = &state.workers[i];
+        if (merged && worker->entryCount) {
+            memcpy(merged + mergedCount, worker->entries, sizeof(NeoAAWalkEntry) * worker->entryCount);
+            mergedCount += worker->entryCount;
+        }
+        /* The paths stay valid until the caller resets its arena */
+        if (worker->arena) {
+            neoaa_arena_merge(arena, worker->arena);
+            neoaa_arena_destroy(worker->arena);
+        }
+        free(worker->entries);
+        free(worker->scratch);
+        neoaa_uring_destroy(worker->ring);
+        free(worker->queue.tasks);
+        pthread_mutex_destroy(&worker->queue.lock);
+    }
+    free(state.workers);
+    pthread_mutex_destroy(&state.idleLock);
+    pthread_cond_destroy(&state.idleCond);
+
+    int result = state.error;
+    if (!merged) {
+        fprintf(stderr, "Failed to allocate walk results\n");
+        result = -2;
+    } else if (!result && neoaa_progress_cancelled(progress)) {
+        result = NEOAA_ERR_CANCELLED;
+    }
+    if (result) {
+        return result;
+    }
+    qsort(merged, mergedCount, sizeof(NeoAAWalkEntry), compare_walk_entries);
+    *entries = merged;
+    *entryCount = mergedCount;
+    return 0;
+}
+
+/* Most paths fit on the stack, deeper ones go to the heap */
+#define NEOAA_WALK_PATH_STACK 512
+
+static char *walk_full_path(char *buffer, const char *dirPath, const char *path) {
+    size_t dirLen = strlen(dirPath);
+    size_t pathLen = strlen(path);
+    if (dirLen + pathLen + 2 > NEOAA_WALK_PATH_STACK) {
+        return neoaa_join_path(dirPath, path);
+    }
+    memcpy(buffer, dirPath, dirLen);
+    buffer[dirLen] = '/';
+    memcpy(buffer + dirLen + 1, path, pathLen + 1);
+    return buffer;
+}
+
+#if !(defined(_WIN32) || defined(WIN32))
+/* Whole link target in a heap string, however long */
+static char *walk_read_link(const char *fullPath, ssize_t *length) {
+    size_t size = 256;
+    for (;;) {
+        char *target = (char *)malloc(size);
+        if (!target) {
+            return NULL;
+        }
+        ssize_t len = readlink(fullPath, target, size);
+        if (len < 0) {
+            perror("readlink failed");
+            free(target);
+            return NULL;
+        }
+        if ((size_t)len < size) {
+            target[len] = '\0';
+            *length = len;
+            return target;
+        }
+        /* Possibly truncated, try again with more room */
+        free(target);
+        size *= 2;
+    }
+}
+#endif
+
+uint8_t *neoaa_walk_build_header(const char *dirPath, NeoAAWalkEntry *entry, size_t *headerSize) {
+    NeoAATemplateValues values;
+    memset(&values, 0, sizeof(values));
+    values.path = entry->path;
+    values.pathLength = strlen(entry->path);
+#if !(defined(_WIN32) || defined(WIN32))
+    /* Set UID/GID on Unix-like systems */
+    values.ids = entry->uid != (uid_t)-1 && entry->gid != (gid_t)-1;
+    values.uid = (uint32_t)entry->uid;
+    values.gid = (uint32_t)entry->gid;
+#endif
+    values.mode = (uint32_t)(entry->mode & 07777);
+    values.flags = entry->flags;
+    values.hardlinkCluster = entry->hardlinkCluster;
+    values.cloneCluster = entry->cloneCluster;
+
+    NeoAATemplateKind kind;
+    char *symlinkTarget = NULL;
+    if (S_ISDIR(entry->mode)) {
+        kind = NEOAA_TEMPLATE_DIRECTORY;
+    } else if (S_ISLNK(entry->mode)) {
+#if !(defined(_WIN32) || defined(WIN32))
+        char pathBuffer[NEOAA_WALK_PATH_STACK];
+        char *fullPath = walk_full_path(pathBuffer, dirPath, entry->path);
+        if (!fullPath) {
+            return NULL;
+        }
+        ssize_t len = 0;
+        symlinkTarget = walk_read_link(fullPath, &len);
+        if (fullPath != pathBuffer) {
+            free(fullPath);
+        }
+        if (!symlinkTarget) {
+            return NULL;
+        }
+        kind = NEOAA_TEMPLATE_SYMLINK;
+        values.link = symlinkTarget;
+        values.linkLength = len;
+#else
+        return NULL;
+#endif
+    } else if (S_ISREG(entry->mode) && entry->duplicateOf) {
+        /* No data, HLC or CLC lead to the first entry of the cluster which has it */
+        kind = NEOAA_TEMPLATE_DUPLICATE;
+    } else if (S_ISREG(entry->mode)) {
+        /* The contents follow the header, see neoaa_walk_read_data */
+        kind = NEOAA_TEMPLATE_FILE;
+        values.size = entry->size;
+    } else {
+        return NULL;
+    }
+
+    size_t bound = neoaa_template_bound(&values);
+    uint8_t *header = (uint8_t *)malloc(bound);
+    *headerSize = header ? neoaa_template_encode(kind, &values, header, bound) : 0;
+    if (!*headerSize) {
+        fprintf(stderr, "Failed to create header for %s\n", entry->path);
+        free(header);
+        header = NULL;
+    }
+    free(symlinkTarget);
+    return header;
+}
+
+int neoaa_walk_read_data(const char *dirPath, const NeoAAWalkEntry *entry, void *data) {
+    char pathBuffer[NEOAA_WALK_PATH_STACK];
+    char *fullPath = walk_full_path(pathBuffer, dirPath, entry->path);
+    if (!fullPath) {
+        return -2;
+    }
+    int result = -1;
+    int fd = open(fullPath, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+    } else {
+        size_t fileSize = entry->size;
+        size_t bytesRead = 0;
+        while (bytesRead < fileSize) {
+            ssize_t r = read(fd, (unsigned char *)data + bytesRead, fileSize - bytesRead);
+            if (r <= 0) {
+                break;
+            }
+            bytesRead += r;
+        }
+        close(fd);
+        if (bytesRead < fileSize) {
+            fprintf(stderr, "Failed to read entire file: %s\n", fullPath);
+        } else {
+            result = 0;
+        }
+    }
+    if (fullPath != pathBuffer) {
+        free(fullPath);
+    }
+    return result;
+}
+
+void neoaa_walk_read_batch(NeoAAUring ring, const char *dirPath, NeoAAWalkEntry *const *entries, void *const *buffers,
+                           int *results, size_t count) {
+    char *paths[NEOAA_URING_DEPTH];
+    uint64_t sizes[NEOAA_URING_DEPTH];
+    int ringResult = -1;
+    if (ring && count && count <= NEOAA_URING_DEPTH) {
+        size_t joined = 0;
+        while (joined < count && (paths[joined] = neoaa_join_path(dirPath, entries[joined]->path)) != NULL) {
+            sizes[joined] = entries[joined]->size;
+            joined++;
+        }
+        if (joined == count) {
+            ringResult = neoaa_uring_read_batch(ring, (const char *const *)paths, buffers, sizes, results, count);
+        }
+        for (size_t i = 0; i < joined; i++) {
+            if (ringResult == 0 && results[i] == -EIO) {
+                fprintf(stderr, "Failed to read entire file: %s\n", paths[i]);
+            } else if (ringResult == 0 && results[i] < 0) {
+                fprintf(stderr, "Failed to open file: %s\n", strerror(-results[i]));
+            }
+            free(paths[i]);
+        }
+    }
+    if (ringResult != 0) {
+        for (size_t i = 0; i < count; i++) {
+            results[i] = neoaa_walk_read_data(dirPath, entries[i], buffers[i]);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ *  walk.h
+ *  neoaa
+ *
+ *  Parallel directory walker used when archiving directories.
+ */
+
+#ifndef NEOAA_WALK_H
+#define NEOAA_WALK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <libNeoAppleArchive.h>
+#include "progress.h"
+#include "arena.h"
+#include "uring.h"
+
+#define NEOAA_MAX_THREADS 64
+
+/* One filesystem entry found by the walker, only what the header needs */
+typedef struct {
+    char *path; /* relative to the walk root, used as PAT */
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    /* Identity and change time, for the incremental cache */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    nlink_t nlink;
+    uint32_t flags; /* st_flags on the BSDs, 0 elsewhere */
+    /*
+     * Set by the dedup pass for a regular file whose data another
+     * entry earlier in the archive already carries: that entry's
+     * path. Hard links of one file share an HLC id and identical
+     * copies a CLC id, the entry with the data has it too. 0 when
+     * the entry is in no such cluster.
+     */
+    const char *duplicateOf;
+    uint32_t hardlinkCluster;
+    uint32_t cloneCluster;
+} NeoAAWalkEntry;
+
+int neoaa_default_thread_count(void);
+
+/* base + "/" + name in a new heap string, just name if base is empty */
+char *neoaa_join_path(const char *base, const char *name);
+
+/*
+ * Enumerate everything below dirPath with threadCount workers
+ * (0 picks a default). Each worker owns a deque of directories,
+ * pops from its own tail and steals from the head of others when
+ * it runs dry. The result is sorted by PAT, directories before
+ * their contents, so archives are reproducible regardless of
+ * scheduling. The array and every path in it come from arena,
+ * also on failure, and go away with it.
+ */
+int neoaa_walk_directory(const char *dirPath, int threadCount, NeoAAArena arena, NeoAAWalkEntry **entries, size_t *entryCount,
+                         NeoAAProgress *progress);
+
+/*
+ * Encode the header of one entry from its template (see
+ * template.h) into a new heap buffer, NULL on failure. A regular
+ * file only gets its header, the caller is expected to put
+ * entry->size bytes of contents after it. Duplicates never carry
+ * data, their header names the entry that does.
+ */
+uint8_t *neoaa_walk_build_header(const char *dirPath, NeoAAWalkEntry *entry, size_t *headerSize);
+
+/* Read exactly entry->size bytes of a regular file into data, non zero if it came up short */
+int neoaa_walk_read_data(const char *dirPath, const NeoAAWalkEntry *entry, void *data);
+
+/*
+ * neoaa_walk_read_data for up to NEOAA_URING_DEPTH files at once,
+ * through the ring when there is one and one by one otherwise.
+ * results get 0 or non zero per file like neoaa_walk_read_data.
+ */
+void neoaa_walk_read_batch(NeoAAUring ring, const char *dirPath, NeoAAWalkEntry *const *entries, void *const *buffers,
+                           int *results, size_t count);
+
+#endif /* NEOAA_WALK_H */
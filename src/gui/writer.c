@@ -0,0 +1,1055 @@
+/*
+ *  writer.c
+ *  neoaa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "writer.h"
+#include "fileio.h"
+#include "reader.h"
+
+/* Rough in-memory cost of an item without its data */
+#define NEOAA_ITEM_OVERHEAD 512
+/* Most entries a producer claims at once, their small files are read as one io_uring batch */
+#define NEOAA_WRITER_BATCH 64
+
+static void writer_free(NeoAAWriter writer) {
+    free(writer->path);
+    free(writer->buffer);
+    free(writer);
+}
+
+static NeoAAWriter writer_alloc(const char *path, size_t bufferSize) {
+    NeoAAWriter writer = (NeoAAWriter)calloc(1, sizeof(struct neoaa_writer_impl));
+    if (!writer) {
+        return NULL;
+    }
+    writer->path = strdup(path);
+    writer->bufferSize = bufferSize;
+    writer->buffer = (uint8_t *)malloc(bufferSize);
+    if (!writer->path || !writer->buffer) {
+        free(writer->path);
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+static NeoAAWriter writer_create(const char *path, size_t bufferSize) {
+    NeoAAWriter writer = writer_alloc(path, bufferSize);
+    if (!writer) {
+        return NULL;
+    }
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        perror("Failed to open output");
+        free(writer->path);
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+NeoAAWriter neoaa_writer_open(const char *path) {
+    return writer_create(path, NEOAA_WRITER_BUFFER_SIZE);
+}
+
+NeoAAWriter neoaa_writer_open_compressed(const char *path, NeoAACompression compression, int threadCount, int seekable) {
+    if (compression == NEOAA_COMPRESS_RAW) {
+        return neoaa_writer_open(path);
+    }
+    size_t blockSize = seekable ? NEOAA_SEEKABLE_BLOCK_SIZE : NEOAA_DEFAULT_BLOCK_SIZE;
+    /* The buffer doubles as the block handed to the compressor */
+    NeoAAWriter writer = writer_create(path, blockSize);
+    if (!writer) {
+        return NULL;
+    }
+    writer->compressor = neoaa_compressor_create(writer->fd, compression, blockSize, threadCount);
+    if (!writer->compressor) {
+        fprintf(stderr, "Failed to start compressor\n");
+        neoaa_writer_abort(writer);
+        return NULL;
+    }
+    if (seekable) {
+        neoaa_compressor_enable_chunk_table(writer->compressor);
+    }
+    return writer;
+}
+
+static uint64_t load_be64(const uint8_t *src) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+static int pread_all(int fd, void *data, size_t size, uint64_t offset) {
+    uint8_t *bytes = (uint8_t *)data;
+    while (size) {
+        ssize_t got = pread(fd, bytes, size, offset);
+        if (got <= 0) {
+            return -1;
+        }
+        bytes += got;
+        size -= got;
+        offset += got;
+    }
+    return 0;
+}
+
+/*
+ * The new blocks of a compressed archive go at the end of the
+ * file. With a chunk table the uncompressed size is worked out
+ * from the last chunk.
+ */
+static int append_prepare_compressed(NeoAAWriter writer, int threadCount) {
+    NeoAAReader reader = neoaa_reader_open_fd(writer->fd);
+    if (!reader) {
+        return -1;
+    }
+    neoaa_reader_load_chunks(reader, writer->path);
+    uint8_t streamHeader[NEOAA_STREAM_HEADER_SIZE];
+    if (pread_all(writer->fd, streamHeader, sizeof(streamHeader), 0) != 0) {
+        neoaa_reader_close(reader);
+        return -1;
+    }
+    /* Shorter blocks than the stream declares are fine, only bigger ones are not */
+    size_t blockSize = load_be64(streamHeader + 4);
+    if (!blockSize) {
+        neoaa_reader_close(reader);
+        return -1;
+    }
+    if (blockSize > NEOAA_DEFAULT_BLOCK_SIZE) {
+        blockSize = NEOAA_DEFAULT_BLOCK_SIZE;
+    }
+    uint64_t dataEnd = writer->appendOffset;
+    uint64_t rawOffset = 0;
+    if (reader->chunkCount) {
+        const NeoAAChunk *last = &reader->chunks[reader->chunkCount - 1];
+        uint8_t blockHeader[NEOAA_BLOCK_HEADER_SIZE];
+        if (pread_all(writer->fd, blockHeader, sizeof(blockHeader), last->fileOffset) != 0) {
+            neoaa_reader_close(reader);
+            return -1;
+        }
+        rawOffset = last->rawOffset + load_be64(blockHeader);
+    }
+    if (lseek(writer->fd, dataEnd, SEEK_SET) < 0) {
+        neoaa_reader_close(reader);
+        return -1;
+    }
+    if (blockSize != writer->bufferSize) {
+        uint8_t *buffer = (uint8_t *)realloc(writer->buffer, blockSize);
+        if (!buffer) {
+            neoaa_reader_close(reader);
+            return -1;
+        }
+        writer->buffer = buffer;
+        writer->bufferSize = blockSize;
+    }
+    writer->compressor = neoaa_compressor_resume(writer->fd, reader->compression, blockSize, threadCount,
+                                                 reader->chunkCount ? reader->chunks : NULL, reader->chunkCount,
+                                                 rawOffset, dataEnd);
+    neoaa_reader_close(reader);
+    return writer->compressor ? 0 : -1;
+}
+
+NeoAAWriter neoaa_writer_open_append(const char *path, int threadCount) {
+    NeoAAWriter writer = writer_alloc(path, NEOAA_WRITER_BUFFER_SIZE);
+    if (!writer) {
+        return NULL;
+    }
+    writer->fd = open(path, O_RDWR);
+    if (writer->fd < 0) {
+        perror("Failed to open archive");
+        writer_free(writer);
+        return NULL;
+    }
+    /* abort truncates back to appendOffset, so it has to be right before anything is written */
+    struct stat fileStat;
+    if (fstat(writer->fd, &fileStat) != 0) {
+        close(writer->fd);
+        writer_free(writer);
+        return NULL;
+    }
+    writer->appending = 1;
+    writer->appendOffset = fileStat.st_size;
+    writer->savedTimes[0] = fileStat.st_atim;
+    writer->savedTimes[1] = fileStat.st_mtim;
+    uint8_t magic[4];
+    ssize_t got = pread(writer->fd, magic, sizeof(magic), 0);
+    int result;
+    if (got == sizeof(magic) && memcmp(magic, "pbz", 3) == 0) {
+        result = append_prepare_compressed(writer, threadCount);
+    } else {
+        /* Plain, the existing items are never even looked at */
+        result = lseek(writer->fd, writer->appendOffset, SEEK_SET) < 0 ? -1 : 0;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Cannot append to %s\n", path);
+        neoaa_writer_abort(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0) {
+            perror("Failed to write output");
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int writer_flush(NeoAAWriter writer) {
+    if (writer->bufferUsed && !writer->error) {
+        if (writer->compressor) {
+            uint8_t *next = neoaa_compressor_submit(writer->compressor, writer->buffer, writer->bufferUsed);
+            if (next) {
+                writer->buffer = next;
+            } else {
+                /* The compressor kept our buffer, give ourselves a scratch one so cleanup stays simple */
+                writer->buffer = (uint8_t *)malloc(writer->bufferSize);
+                writer->error = -1;
+            }
+        } else {
+            uint64_t start = neoaa_stats_start(writer->stats);
+            if (write_all(writer->fd, writer->buffer, writer->bufferUsed) != 0) {
+                writer->error = -1;
+            }
+            neoaa_stats_phase(writer->stats, NEOAA_PHASE_WRITE, start, writer->bufferUsed, 0);
+        }
+    }
+    writer->bufferUsed = 0;
+    return writer->error;
+}
+
+int neoaa_writer_write(NeoAAWriter writer, const void *data, size_t size) {
+    if (writer->error) {
+        return writer->error;
+    }
+    writer->bytesWritten += size;
+    if (writer->bufferUsed + size <= writer->bufferSize) {
+        memcpy(writer->buffer + writer->bufferUsed, data, size);
+        writer->bufferUsed += size;
+        return 0;
+    }
+    /* Big chunks skip the buffer on plain output, no point copying them twice */
+    if (!writer->compressor && size >= writer->bufferSize) {
+        if (writer_flush(writer) == 0) {
+            uint64_t start = neoaa_stats_start(writer->stats);
+            if (write_all(writer->fd, (const uint8_t *)data, size) != 0) {
+                writer->error = -1;
+            }
+            neoaa_stats_phase(writer->stats, NEOAA_PHASE_WRITE, start, size, 0);
+        }
+        return writer->error;
+    }
+    /* Compressed output is cut into exact blocks */
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size && !writer->error) {
+        size_t chunk = writer->bufferSize - writer->bufferUsed;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(writer->buffer + writer->bufferUsed, bytes, chunk);
+        writer->bufferUsed += chunk;
+        bytes += chunk;
+        size -= chunk;
+        if (writer->bufferUsed == writer->bufferSize) {
+            writer_flush(writer);
+        }
+    }
+    return writer->error;
+}
+
+int neoaa_writer_write_header(NeoAAWriter writer, const uint8_t *header, size_t headerSize, const NeoAADigest *digest) {
+    if (!digest || headerSize < 6 || headerSize + NEOAA_DIGEST_FIELDS_SIZE > 0xFFFF) {
+        return neoaa_writer_write(writer, header, headerSize);
+    }
+    /* The fields go at the end, the size in front grows to match */
+    uint8_t prefix[6];
+    memcpy(prefix, header, 4);
+    prefix[4] = (uint8_t)(headerSize + NEOAA_DIGEST_FIELDS_SIZE);
+    prefix[5] = (uint8_t)((headerSize + NEOAA_DIGEST_FIELDS_SIZE) >> 8);
+    uint8_t fields[NEOAA_DIGEST_FIELDS_SIZE];
+    neoaa_digest_encode(digest, fields);
+    neoaa_writer_write(writer, prefix, sizeof(prefix));
+    neoaa_writer_write(writer, header + 6, headerSize - 6);
+    return neoaa_writer_write(writer, fields, sizeof(fields));
+}
+
+/* Report bytes copied for neoaa_writer_write_file, a cancel fails the writer so every copy loop stops */
+static int writer_advance(NeoAAWriter writer, uint64_t size) {
+    if (writer->progress && !writer->error) {
+        neoaa_progress_add(writer->progress, size, 0);
+        if (neoaa_progress_cancelled(writer->progress)) {
+            writer->error = NEOAA_ERR_CANCELLED;
+        }
+    }
+    return writer->error;
+}
+
+/*
+ * Copy through our buffer with pread. A file that ends early is
+ * still emitted as exactly size bytes, the header already promised
+ * them and the archive has to stay parseable, so the rest is zeros
+ * and the file counts as incomplete. A read error fails the writer.
+ * fd -1 just writes size zeros.
+ */
+static int writer_read_fd(NeoAAWriter writer, int fd, uint64_t offset, uint64_t size) {
+    uint64_t copied = 0;
+    while (copied < size && !writer->error) {
+        if (writer->bufferUsed == writer->bufferSize) {
+            writer_flush(writer);
+            continue;
+        }
+        size_t chunk = writer->bufferSize - writer->bufferUsed;
+        if (chunk > size - copied) {
+            chunk = size - copied;
+        }
+        ssize_t bytesRead = fd < 0 ? 0 : pread(fd, writer->buffer + writer->bufferUsed, chunk, offset + copied);
+        if (bytesRead < 0) {
+            perror("Failed to read input");
+            writer->error = -1;
+            break;
+        }
+        if (bytesRead == 0) {
+            if (fd >= 0) {
+                fprintf(stderr, "Input shrank while archiving, zero padding\n");
+                writer->incomplete++;
+                fd = -1;
+            }
+            memset(writer->buffer + writer->bufferUsed, 0, chunk);
+            bytesRead = chunk;
+        }
+        if (writer->sum) {
+            uint64_t start = neoaa_stats_start(writer->stats);
+            neoaa_checksum_update(writer->sum, writer->buffer + writer->bufferUsed, bytesRead);
+            neoaa_stats_phase(writer->stats, NEOAA_PHASE_CHECKSUM, start, bytesRead, 0);
+        }
+        writer->bufferUsed += bytesRead;
+        writer->bytesWritten += bytesRead;
+        copied += bytesRead;
+        writer_advance(writer, bytesRead);
+    }
+    if (writer->bufferUsed == writer->bufferSize) {
+        writer_flush(writer);
+    }
+    return writer->error;
+}
+
+int neoaa_writer_splice(NeoAAWriter writer, int fd, uint64_t offset, uint64_t size) {
+    if (writer->compressor || writer->sum) {
+        /* Data has to pass through the compressor or the hash, no way around a copy */
+        return writer_read_fd(writer, fd, offset, size);
+    }
+    if (writer_flush(writer) != 0) {
+        return writer->error;
+    }
+    /* File offset, not stream offset, appends start the stream further in */
+    off_t copyStart = lseek(writer->fd, 0, SEEK_CUR);
+    if (copyStart < 0) {
+        writer->error = -1;
+        return writer->error;
+    }
+    uint64_t copied = 0;
+    while (copied < size && !writer->error) {
+        uint64_t window = size - copied < NEOAA_COPY_WINDOW ? size - copied : NEOAA_COPY_WINDOW;
+        uint64_t start = neoaa_stats_start(writer->stats);
+        int result = neoaa_copy_range(fd, offset + copied, writer->fd, window);
+        neoaa_stats_phase(writer->stats, NEOAA_PHASE_WRITE, start, window, 0);
+        if (result != 0) {
+            /* Find out how far the kernel got and read the rest ourselves, which tells a shrunk file from a bad one */
+            off_t position = lseek(writer->fd, 0, SEEK_CUR);
+            if (position < copyStart || (uint64_t)(position - copyStart) < copied
+                || (uint64_t)(position - copyStart) > size) {
+                writer->error = -1;
+                return writer->error;
+            }
+            uint64_t done = position - copyStart;
+            writer->bytesWritten += done - copied;
+            writer_advance(writer, done - copied);
+            return writer_read_fd(writer, fd, offset + done, size - done);
+        }
+        writer->bytesWritten += window;
+        copied += window;
+        writer_advance(writer, window);
+    }
+    return writer->error;
+}
+
+/* A real hole in plain output on disk, zeros for the compressor, which makes short work of them */
+static int writer_hole(NeoAAWriter writer, uint64_t size) {
+    if (!writer->compressor && writer_flush(writer) == 0 && neoaa_write_hole(writer->fd, size) == 0) {
+        if (writer->sum) {
+            neoaa_checksum_update_zeros(writer->sum, size);
+        }
+        writer->bytesWritten += size;
+        return writer_advance(writer, size);
+    }
+    return writer_read_fd(writer, -1, 0, size);
+}
+
+int neoaa_writer_copy_sparse(NeoAAWriter writer, int fd, uint64_t size) {
+    uint64_t offset = 0;
+    while (offset < size && !writer->error) {
+        uint64_t dataStart;
+        uint64_t dataEnd;
+        neoaa_next_data(fd, offset, size, &dataStart, &dataEnd);
+        if (dataStart - offset >= NEOAA_SPARSE_MIN_HOLE) {
+            writer_hole(writer, dataStart - offset);
+        } else {
+            /* Short holes go along with the data */
+            dataStart = offset;
+        }
+        if (dataEnd > dataStart) {
+            neoaa_writer_splice(writer, fd, dataStart, dataEnd - dataStart);
+        }
+        offset = dataEnd;
+    }
+    return writer->error;
+}
+
+/* The first size bytes of fd, padded with zeros past its end */
+static int writer_copy_fd(NeoAAWriter writer, int fd, uint64_t size) {
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size < size) {
+        return writer_read_fd(writer, fd, 0, size);
+    }
+    neoaa_writer_copy_sparse(writer, fd, size);
+    /* Shrinking during the copy turns the end into what looks like a hole */
+    if (!writer->error && fstat(fd, &fileStat) == 0 && (uint64_t)fileStat.st_size < size) {
+        fprintf(stderr, "Input shrank while archiving, zero padding\n");
+        writer->incomplete++;
+    }
+    return writer->error;
+}
+
+/* Overwrite bytes already written at offset in the stream, plain output or the block being filled */
+static int writer_patch(NeoAAWriter writer, uint64_t offset, const uint8_t *data, size_t size) {
+    uint64_t bufferStart = writer->bytesWritten - writer->bufferUsed;
+    if (offset < bufferStart) {
+        if (writer->compressor) {
+            return -1;
+        }
+        size_t flushed = bufferStart - offset < size ? (size_t)(bufferStart - offset) : size;
+        /* Appends start the stream at the old end of the file */
+        uint64_t fileOffset = (writer->appending ? writer->appendOffset : 0) + offset;
+        if (pwrite(writer->fd, data, flushed, (off_t)fileOffset) != (ssize_t)flushed) {
+            perror("Failed to write checksums");
+            writer->error = -1;
+            return -1;
+        }
+        offset += flushed;
+        data += flushed;
+        size -= flushed;
+    }
+    memcpy(writer->buffer + (offset - bufferStart), data, size);
+    return 0;
+}
+
+int neoaa_writer_write_file(NeoAAWriter writer, const uint8_t *header, size_t headerSize, int fd, uint64_t size, int checksums,
+                            NeoAAProgress *progress) {
+    size_t incomplete = writer->incomplete;
+    if (checksums && writer->compressor
+        && writer->bufferUsed + headerSize + NEOAA_DIGEST_FIELDS_SIZE + size >= writer->bufferSize) {
+        /* The header would be in a block the compressor already has by the time the digest is known */
+        checksums = 0;
+    }
+    if (!checksums || headerSize < 6 || headerSize + NEOAA_DIGEST_FIELDS_SIZE > 0xFFFF) {
+        neoaa_writer_write_header(writer, header, headerSize, NULL);
+        writer->progress = progress;
+        writer_copy_fd(writer, fd, size);
+        writer->progress = NULL;
+        if (writer->error) {
+            return writer->error;
+        }
+        return writer->incomplete != incomplete ? NEOAA_ERR_INCOMPLETE : 0;
+    }
+    /* Placeholder fields keep the layout, the real ones go over them once the data is through */
+    NeoAADigest digest;
+    memset(&digest, 0, sizeof(digest));
+    uint64_t fieldsOffset = writer->bytesWritten + headerSize;
+    neoaa_writer_write_header(writer, header, headerSize, &digest);
+    NeoAAChecksum sum;
+    neoaa_checksum_init(&sum);
+    writer->sum = &sum;
+    writer->progress = progress;
+    writer_copy_fd(writer, fd, size);
+    writer->sum = NULL;
+    writer->progress = NULL;
+    if (writer->error) {
+        return writer->error;
+    }
+    if (writer->incomplete != incomplete) {
+        /* The hash covers padding, not the file. The zero placeholder stays, which no data matches, so extract and verify flag it. */
+        return NEOAA_ERR_INCOMPLETE;
+    }
+    neoaa_checksum_final(&sum, &digest);
+    uint8_t fields[NEOAA_DIGEST_FIELDS_SIZE];
+    neoaa_digest_encode(&digest, fields);
+    writer_patch(writer, fieldsOffset, fields, sizeof(fields));
+    return writer->error;
+}
+
+/* Decoded bytes of another archive, which must not end before size */
+static int writer_read_stream(NeoAAWriter writer, NeoAAReader reader, uint64_t size) {
+    while (size && !writer->error) {
+        if (writer->bufferUsed == writer->bufferSize) {
+            writer_flush(writer);
+            continue;
+        }
+        size_t chunk = writer->bufferSize - writer->bufferUsed;
+        if (chunk > size) {
+            chunk = size;
+        }
+        ssize_t got = neoaa_reader_read(reader, writer->buffer + writer->bufferUsed, chunk);
+        if (got <= 0) {
+            fprintf(stderr, "Previous archive ended early\n");
+            writer->error = -1;
+            break;
+        }
+        writer->bufferUsed += got;
+        writer->bytesWritten += got;
+        size -= got;
+    }
+    if (writer->bufferUsed == writer->bufferSize) {
+        writer_flush(writer);
+    }
+    return writer->error;
+}
+
+/* First chunk starting at or after offset */
+static size_t chunk_lower_bound(NeoAAReader reader, uint64_t offset) {
+    size_t low = 0;
+    size_t high = reader->chunkCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (reader->chunks[middle].rawOffset < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*
+ * Copy length bytes at offset of the previous archive's stream.
+ * Plain archives go through neoaa_writer_splice. Between
+ * compressed archives of the same algorithm whole old blocks are
+ * sent as they are; the block in progress is cut short at the
+ * first old block boundary so the two streams line up again.
+ */
+static int writer_reuse(NeoAAWriter writer, NeoAAReader source, uint64_t offset, uint64_t length) {
+    if (!source->compressed) {
+        return neoaa_writer_splice(writer, source->fd, source->streamStart + offset, length);
+    }
+    int copyBlocks = writer->compressor && neoaa_compressor_compression(writer->compressor) == source->compression;
+    while (length && !writer->error) {
+        size_t chunk = chunk_lower_bound(source, offset);
+        uint64_t take = length;
+        if (copyBlocks && chunk < source->chunkCount) {
+            if (source->chunks[chunk].rawOffset == offset) {
+                uint64_t fileOffset = source->streamStart + source->chunks[chunk].fileOffset;
+                uint8_t blockHeader[NEOAA_BLOCK_HEADER_SIZE];
+                if (pread_all(source->fd, blockHeader, sizeof(blockHeader), fileOffset) != 0) {
+                    writer->error = -1;
+                    break;
+                }
+                uint64_t rawSize = load_be64(blockHeader);
+                uint64_t payloadSize = load_be64(blockHeader + 8);
+                if (rawSize && rawSize <= length && rawSize <= writer->bufferSize && payloadSize <= rawSize) {
+                    if (writer_flush(writer) != 0
+                        || neoaa_compressor_submit_copy(writer->compressor, source->fd, fileOffset + NEOAA_BLOCK_HEADER_SIZE,
+                                                        rawSize, payloadSize) != 0) {
+                        writer->error = -1;
+                        break;
+                    }
+                    writer->bytesWritten += rawSize;
+                    offset += rawSize;
+                    length -= rawSize;
+                    continue;
+                }
+            } else if (source->chunks[chunk].rawOffset - offset < take) {
+                take = source->chunks[chunk].rawOffset - offset;
+            }
+        }
+        /* Not on a block we can send whole, decode up to the next boundary */
+        if (neoaa_reader_seek(source, offset) != 0) {
+            fprintf(stderr, "Failed to read previous archive\n");
+            writer->error = -1;
+            break;
+        }
+        if (writer_read_stream(writer, source, take) != 0) {
+            break;
+        }
+        offset += take;
+        length -= take;
+    }
+    return writer->error;
+}
+
+void neoaa_writer_set_cache(NeoAAWriter writer, NeoAACache previous, uint64_t *offsets, uint64_t *lengths) {
+    writer->cache = previous;
+    writer->entryOffsets = offsets;
+    writer->entryLengths = lengths;
+}
+
+/* A table left from whatever archive was at path before */
+static void remove_chunks(const char *path) {
+    char *chunksPath = neoaa_chunks_path(path);
+    if (chunksPath) {
+        unlink(chunksPath);
+        free(chunksPath);
+    }
+}
+
+int neoaa_writer_close(NeoAAWriter writer) {
+    writer_flush(writer);
+    NeoAAChunk *chunks = NULL;
+    size_t chunkCount = 0;
+    if (writer->compressor && neoaa_compressor_finish(writer->compressor, &chunks, &chunkCount) != 0) {
+        writer->error = -1;
+    }
+    if (close(writer->fd) != 0) {
+        writer->error = -1;
+    }
+    /* The table is saved once the archive is final, it only holds while the size and mtime match */
+    if (chunks && !writer->error && neoaa_chunks_save(writer->path, chunks, chunkCount) != 0) {
+        fprintf(stderr, "Failed to save chunk table for %s, it will only read sequentially\n", writer->path);
+    } else if (!chunks && !writer->appending) {
+        remove_chunks(writer->path);
+    }
+    free(chunks);
+    int error = writer->error;
+    writer_free(writer);
+    return error;
+}
+
+void neoaa_writer_set_stats(NeoAAWriter writer, NeoAAStats *stats) {
+    writer->stats = stats;
+    if (writer->compressor) {
+        neoaa_compressor_set_stats(writer->compressor, stats);
+    }
+}
+
+void neoaa_writer_set_checksums(NeoAAWriter writer, int enabled) {
+    writer->checksums = enabled;
+}
+
+void neoaa_writer_set_adaptive(NeoAAWriter writer, int enabled) {
+    if (writer->compressor) {
+        neoaa_compressor_set_adaptive(writer->compressor, enabled);
+    }
+}
+
+void neoaa_writer_abort(NeoAAWriter writer) {
+    if (writer->compressor) {
+        neoaa_compressor_finish(writer->compressor, NULL, NULL);
+    }
+    if (writer->appending) {
+        /* Drop what we added, with the old mtime so its .nchk still holds */
+        if (ftruncate(writer->fd, writer->appendOffset) != 0 || futimens(writer->fd, writer->savedTimes) != 0) {
+            fprintf(stderr, "Failed to restore %s\n", writer->path);
+        }
+    } else {
+        unlink(writer->path);
+        remove_chunks(writer->path);
+    }
+    close(writer->fd);
+    writer_free(writer);
+}
+
+typedef struct {
+    uint8_t *header;               /* encoded, NULL for entries left out */
+    size_t headerSize;
+    void *data;                    /* file contents from the buffer pool, NULL to copy from disk */
+    const NeoAACacheRecord *reuse; /* unchanged since the previous archive */
+    NeoAADigest digest;
+    int hasDigest;
+    int unreadable;                /* left out because its data could not be read */
+    size_t cost;
+    int ready;
+} NeoAAWriterSlot;
+
+typedef struct {
+    const char *root;
+    NeoAACache cache;
+    NeoAAWalkEntry *entries;
+    size_t entryCount;
+    NeoAAWriterSlot *slots;
+    NeoAABufferPool buffers;
+    NeoAAStats *stats;
+    size_t inlineLimit;
+    int checksums;
+    size_t budgetLimit;
+    size_t budgetUsed;
+    size_t nextClaim;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t budgetCond;
+    pthread_cond_t readyCond;
+} NeoAAWriterPipeline;
+
+/* What a producer decided about one claimed entry */
+typedef struct {
+    size_t index;
+    const NeoAACacheRecord *reuse;
+    size_t cost;
+    int loadData;
+    uint8_t *header;
+    size_t headerSize;
+    void *data;
+    NeoAADigest digest;
+    int hasDigest;
+    int unreadable;
+} NeoAAProducerTask;
+
+/* Called with the lock held, the cache lookup is not thread safe */
+static void producer_plan(NeoAAWriterPipeline *pipeline, size_t index, NeoAAProducerTask *task) {
+    NeoAAWalkEntry *entry = &pipeline->entries[index];
+    task->index = index;
+    /* Cluster ids are handed out afresh on every run, an entry with one is always encoded again */
+    int clustered = entry->hardlinkCluster || entry->cloneCluster;
+    task->reuse = pipeline->cache && !clustered ? neoaa_cache_find(pipeline->cache, entry) : NULL;
+    task->loadData = S_ISREG(entry->mode) && !task->reuse && !entry->duplicateOf && entry->size
+        && (size_t)entry->size <= pipeline->inlineLimit;
+    task->cost = NEOAA_ITEM_OVERHEAD + (task->loadData ? neoaa_buffer_pool_round(entry->size) : 0);
+    task->header = NULL;
+    task->headerSize = 0;
+    task->data = NULL;
+    task->hasDigest = 0;
+    task->unreadable = 0;
+}
+
+/* Small enough to go through the ring with its neighbours */
+static int producer_batchable(const NeoAAWriterPipeline *pipeline, const NeoAAProducerTask *task) {
+    return task->loadData && pipeline->entries[task->index].size <= NEOAA_URING_MAX_READ;
+}
+
+/* Build the headers of a claimed run and read the contents that go inline */
+static void producer_run(NeoAAWriterPipeline *pipeline, NeoAAUring ring, NeoAAProducerTask *tasks, size_t count) {
+    NeoAAWalkEntry *reads[NEOAA_WRITER_BATCH];
+    void *buffers[NEOAA_WRITER_BATCH];
+    int results[NEOAA_WRITER_BATCH];
+    NeoAAProducerTask *readTasks[NEOAA_WRITER_BATCH];
+    size_t readCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        NeoAAProducerTask *task = &tasks[i];
+        NeoAAWalkEntry *entry = &pipeline->entries[task->index];
+        if (task->reuse) {
+            continue;
+        }
+        uint64_t encodeStart = neoaa_stats_start(pipeline->stats);
+        task->header = neoaa_walk_build_header(pipeline->root, entry, &task->headerSize);
+        neoaa_stats_phase(pipeline->stats, NEOAA_PHASE_ENCODE, encodeStart, 0, 1);
+        if (task->header && pipeline->checksums && S_ISREG(entry->mode) && !entry->duplicateOf && !entry->size) {
+            /* Nothing to read, streamed files are hashed by the writer as they go out */
+            neoaa_checksum_buffer(NULL, 0, &task->digest);
+            task->hasDigest = 1;
+        }
+        if (!task->header || !task->loadData) {
+            continue;
+        }
+        task->data = neoaa_buffer_pool_get(pipeline->buffers, entry->size);
+        if (!task->data) {
+            /* Same as an entry that could not be read at all, it is left out */
+            fprintf(stderr, "Memory allocation failed for file: %s\n", entry->path);
+            free(task->header);
+            task->header = NULL;
+            task->unreadable = 1;
+            continue;
+        }
+        reads[readCount] = entry;
+        buffers[readCount] = task->data;
+        readTasks[readCount] = task;
+        readCount++;
+    }
+    if (!readCount) {
+        return;
+    }
+    uint64_t readStart = neoaa_stats_start(pipeline->stats);
+    neoaa_walk_read_batch(ring, pipeline->root, reads, buffers, results, readCount);
+    uint64_t readEnd = neoaa_stats_start(pipeline->stats);
+    uint64_t readBytes = 0;
+    for (size_t i = 0; i < readCount; i++) {
+        NeoAAProducerTask *task = readTasks[i];
+        readBytes += reads[i]->size;
+        /* A batch finishes together, each file is charged its share */
+        neoaa_stats_file(pipeline->stats, reads[i]->path, reads[i]->size, (readEnd - readStart) / readCount);
+        if (results[i] != 0) {
+            neoaa_buffer_pool_put(pipeline->buffers, task->data, reads[i]->size);
+            free(task->header);
+            task->header = NULL;
+            task->data = NULL;
+            task->unreadable = 1;
+        }
+    }
+    neoaa_stats_phase(pipeline->stats, NEOAA_PHASE_READ, readStart, readBytes, readCount);
+    if (!pipeline->checksums) {
+        return;
+    }
+    /* Still warm from the read */
+    uint64_t checksumStart = neoaa_stats_start(pipeline->stats);
+    for (size_t i = 0; i < readCount; i++) {
+        NeoAAProducerTask *task = readTasks[i];
+        if (task->data) {
+            neoaa_checksum_buffer(task->data, reads[i]->size, &task->digest);
+            task->hasDigest = 1;
+        }
+    }
+    neoaa_stats_phase(pipeline->stats, NEOAA_PHASE_CHECKSUM, checksumStart, readBytes, readCount);
+}
+
+static void *writer_producer_thread(void *context) {
+    NeoAAWriterPipeline *pipeline = (NeoAAWriterPipeline *)context;
+    /* Without io_uring every batch is a single entry, read the old way */
+    NeoAAUring ring = neoaa_uring_create();
+    NeoAAProducerTask tasks[NEOAA_WRITER_BATCH];
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->stop && pipeline->nextClaim < pipeline->entryCount) {
+        size_t index = pipeline->nextClaim;
+        producer_plan(pipeline, index, &tasks[0]);
+        /*
+         * Budget is reserved strictly in entry order, so whatever is
+         * in flight is always the run of entries right after the
+         * writer's position and the writer can never starve. An
+         * empty budget admits anything so one big item still goes.
+         */
+        while (!pipeline->stop && pipeline->nextClaim == index && pipeline->budgetUsed
+               && pipeline->budgetUsed + tasks[0].cost > pipeline->budgetLimit) {
+            pthread_cond_wait(&pipeline->budgetCond, &pipeline->lock);
+        }
+        if (pipeline->stop) {
+            break;
+        }
+        if (pipeline->nextClaim != index) {
+            /* Another producer took this one while we waited */
+            continue;
+        }
+        pipeline->nextClaim++;
+        pipeline->budgetUsed += tasks[0].cost;
+        size_t count = 1;
+        /* Small files right behind it join the batch as long as the budget has room without waiting */
+        while (ring && count < NEOAA_WRITER_BATCH && producer_batchable(pipeline, &tasks[0])
+               && pipeline->nextClaim < pipeline->entryCount) {
+            producer_plan(pipeline, pipeline->nextClaim, &tasks[count]);
+            if (!producer_batchable(pipeline, &tasks[count])
+                || pipeline->budgetUsed + tasks[count].cost > pipeline->budgetLimit) {
+                break;
+            }
+            pipeline->nextClaim++;
+            pipeline->budgetUsed += tasks[count].cost;
+            count++;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+
+        producer_run(pipeline, ring, tasks, count);
+
+        pthread_mutex_lock(&pipeline->lock);
+        for (size_t i = 0; i < count; i++) {
+            NeoAAWriterSlot *slot = &pipeline->slots[tasks[i].index];
+            slot->header = tasks[i].header;
+            slot->headerSize = tasks[i].headerSize;
+            slot->data = tasks[i].data;
+            slot->reuse = tasks[i].reuse;
+            slot->digest = tasks[i].digest;
+            slot->hasDigest = tasks[i].hasDigest;
+            slot->unreadable = tasks[i].unreadable;
+            slot->cost = tasks[i].cost;
+            slot->ready = 1;
+        }
+        pthread_cond_signal(&pipeline->readyCond);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    neoaa_uring_destroy(ring);
+    return NULL;
+}
+
+int neoaa_writer_write_entries(NeoAAWriter writer, const char *dirPath, NeoAAWalkEntry *entries, size_t entryCount,
+                               int threadCount, size_t memoryLimit, NeoAAProgress *progress) {
+    if (threadCount <= 0) {
+        threadCount = neoaa_default_thread_count();
+    }
+    if (threadCount > NEOAA_MAX_THREADS) {
+        threadCount = NEOAA_MAX_THREADS;
+    }
+    if (!memoryLimit) {
+        memoryLimit = NEOAA_DEFAULT_MEMORY_LIMIT;
+    }
+    NeoAAWriterPipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.root = dirPath;
+    pipeline.cache = writer->cache;
+    pipeline.entries = entries;
+    pipeline.entryCount = entryCount;
+    pipeline.budgetLimit = memoryLimit;
+    if (neoaa_progress_stats(progress)) {
+        neoaa_writer_set_stats(writer, neoaa_progress_stats(progress));
+    }
+    pipeline.stats = writer->stats;
+    pipeline.checksums = writer->checksums;
+    /* Leave room for the other producers to keep reading small files */
+    pipeline.inlineLimit = memoryLimit / 8;
+    pipeline.slots = (NeoAAWriterSlot *)calloc(entryCount ? entryCount : 1, sizeof(NeoAAWriterSlot));
+    /* Never holds more than the budget lets producers have in flight anyway */
+    pipeline.buffers = neoaa_buffer_pool_create(memoryLimit);
+    if (!pipeline.slots || !pipeline.buffers) {
+        fprintf(stderr, "Failed to allocate writer slots\n");
+        free(pipeline.slots);
+        neoaa_buffer_pool_destroy(pipeline.buffers);
+        return -2;
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.budgetCond, NULL);
+    pthread_cond_init(&pipeline.readyCond, NULL);
+
+    pthread_t threads[NEOAA_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&threads[i], NULL, writer_producer_thread, &pipeline) != 0) {
+            break;
+        }
+        started++;
+    }
+    int result = 0;
+    if (!started) {
+        fprintf(stderr, "Failed to start producer threads\n");
+        result = -2;
+    }
+
+    size_t written = 0;
+    size_t consumed = 0;
+    /* Unchanged entries that follow each other in the previous archive are copied as one run */
+    uint64_t runOffset = 0;
+    uint64_t runLength = 0;
+    for (size_t i = 0; i < entryCount && !result; i++) {
+        pthread_mutex_lock(&pipeline.lock);
+        while (!pipeline.slots[i].ready) {
+            pthread_cond_wait(&pipeline.readyCond, &pipeline.lock);
+        }
+        NeoAAWriterSlot slot = pipeline.slots[i];
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (runLength && (!slot.reuse || runOffset + runLength != slot.reuse->offset)) {
+            writer_reuse(writer, writer->cache->source, runOffset, runLength);
+            runLength = 0;
+        }
+        uint64_t entryStart = writer->bytesWritten + runLength;
+        if (slot.reuse) {
+            if (!runLength) {
+                runOffset = slot.reuse->offset;
+            }
+            runLength += slot.reuse->length;
+            neoaa_progress_add(progress, entries[i].size, 1);
+            written++;
+        } else if (slot.header) {
+            NeoAAWalkEntry *entry = &entries[i];
+            /* Streamed files report their bytes while they are copied */
+            uint64_t bytesLeft = entry->size;
+            if (!slot.data && S_ISREG(entry->mode) && entry->size && !entry->duplicateOf) {
+                char *fullPath = neoaa_join_path(dirPath, entry->path);
+                if (fullPath) {
+                    /* Streamed files are timed whole, read, hash and write together */
+                    uint64_t start = neoaa_stats_start(pipeline.stats);
+                    int fd = open(fullPath, O_RDONLY | O_CLOEXEC);
+                    if (fd >= 0) {
+                        neoaa_writer_write_file(writer, slot.header, slot.headerSize, fd, entry->size, pipeline.checksums, progress);
+                        close(fd);
+                        bytesLeft = 0;
+                        written++;
+                    } else {
+                        /* Left out like an inline file that could not be read */
+                        fprintf(stderr, "Failed to open file %s: %s\n", entry->path, strerror(errno));
+                        writer->incomplete++;
+                    }
+                    neoaa_stats_file(pipeline.stats, entry->path, entry->size, neoaa_stats_start(pipeline.stats) - start);
+                    free(fullPath);
+                } else {
+                    writer->error = -2;
+                }
+            } else {
+                neoaa_writer_write_header(writer, slot.header, slot.headerSize, slot.hasDigest ? &slot.digest : NULL);
+                if (slot.data) {
+                    neoaa_writer_write(writer, slot.data, entry->size);
+                    neoaa_buffer_pool_put(pipeline.buffers, slot.data, entry->size);
+                }
+                written++;
+            }
+            free(slot.header);
+            neoaa_progress_add(progress, bytesLeft, 1);
+        } else if (slot.unreadable) {
+            writer->incomplete++;
+        }
+        if (writer->entryOffsets) {
+            writer->entryOffsets[i] = entryStart;
+            writer->entryLengths[i] = slot.reuse ? slot.reuse->length : writer->bytesWritten - entryStart;
+            /* A cluster member is only right next to the rest of its cluster, so it is never cached */
+            if (entries[i].hardlinkCluster || entries[i].cloneCluster) {
+                writer->entryLengths[i] = 0;
+            }
+        }
+
+        consumed = i + 1;
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.budgetUsed -= slot.cost;
+        pthread_cond_broadcast(&pipeline.budgetCond);
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (writer->error) {
+            result = writer->error;
+        } else if (neoaa_progress_cancelled(progress)) {
+            result = NEOAA_ERR_CANCELLED;
+        }
+    }
+    if (runLength && !result && writer_reuse(writer, writer->cache->source, runOffset, runLength) != 0) {
+        result = writer->error;
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.stop = 1;
+    pthread_cond_broadcast(&pipeline.budgetCond);
+    pthread_mutex_unlock(&pipeline.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    /* Anything produced past the point the writer stopped at */
+    for (size_t i = consumed; i < entryCount; i++) {
+        if (pipeline.slots[i].ready && pipeline.slots[i].header) {
+            free(pipeline.slots[i].header);
+            neoaa_buffer_pool_put(pipeline.buffers, pipeline.slots[i].data, entries[i].size);
+        }
+    }
+    free(pipeline.slots);
+    neoaa_buffer_pool_destroy(pipeline.buffers);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.budgetCond);
+    pthread_cond_destroy(&pipeline.readyCond);
+
+    if (!result && !written) {
+        fprintf(stderr, "No items found to archive\n");
+        return -3;
+    }
+    if (!result && writer->incomplete) {
+        fprintf(stderr, "%zu file%s could not be read whole, the archive is incomplete\n", writer->incomplete,
+                writer->incomplete == 1 ? "" : "s");
+        return NEOAA_ERR_INCOMPLETE;
+    }
+    return result;
+}
@@ -0,0 +1,139 @@
+/*
+ *  writer.h
+ *  neoaa
+ *
+ *  Streaming archive writer. Items are serialized to the output
+ *  as soon as they are ready instead of collecting a whole
+ *  NeoAAArchivePlain in memory first.
+ */
+
+#ifndef NEOAA_WRITER_H
+#define NEOAA_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <libNeoAppleArchive.h>
+#include "progress.h"
+#include "walk.h"
+#include "compress.h"
+#include "cache.h"
+#include "checksum.h"
+
+/* Size of the buffer small items are batched in before hitting write() */
+#define NEOAA_WRITER_BUFFER_SIZE (1024 * 1024)
+
+/* Default ceiling for file data held in memory by the producers */
+#define NEOAA_DEFAULT_MEMORY_LIMIT (256ULL * 1024 * 1024)
+
+typedef struct neoaa_writer_impl *NeoAAWriter;
+
+struct neoaa_writer_impl {
+    int fd;
+    char *path;
+    uint8_t *buffer;
+    size_t bufferSize;
+    size_t bufferUsed;
+    uint64_t bytesWritten;
+    int error;
+    NeoAACompressor compressor; /* NULL for a plain archive */
+    /* Appending to an existing archive, abort puts it back the way it was */
+    int appending;
+    uint64_t appendOffset;
+    /* Access and modification time before appending, abort puts them back */
+    struct timespec savedTimes[2];
+    /* Incremental archiving, see neoaa_writer_set_cache */
+    NeoAACache cache;
+    uint64_t *entryOffsets;
+    uint64_t *entryLengths;
+    NeoAAStats *stats;
+    /* write_entries gives files CKS and SH2 fields */
+    int checksums;
+    /* Hashes whatever neoaa_writer_write_file copies, NULL otherwise */
+    NeoAAChecksum *sum;
+    /* Gets what neoaa_writer_write_file copies as it goes, and stops it when cancelled */
+    NeoAAProgress *progress;
+    /* Files left out or zero padded because they could not be read whole */
+    size_t incomplete;
+};
+
+NeoAAWriter neoaa_writer_open(const char *path);
+/*
+ * Same but the stream goes through a parallel block compressor,
+ * RAW gives a plain writer. Seekable output uses smaller blocks
+ * and close saves their chunk table next to the archive for
+ * random access (see reader.h).
+ */
+NeoAAWriter neoaa_writer_open_compressed(const char *path, NeoAACompression compression, int threadCount, int seekable);
+/*
+ * Add items to the end of an existing archive without reading
+ * any of its items. Plain archives just grow. Compressed ones
+ * keep their compression and get new blocks after the old ones,
+ * a chunk table is extended to cover them.
+ */
+NeoAAWriter neoaa_writer_open_append(const char *path, int threadCount);
+int neoaa_writer_write(NeoAAWriter writer, const void *data, size_t size);
+/* Encoded header, with CKS and SH2 fields for digest unless it is NULL */
+int neoaa_writer_write_header(NeoAAWriter writer, const uint8_t *header, size_t headerSize, const NeoAADigest *digest);
+/* Copy size bytes of fd starting at offset in kernel where possible */
+int neoaa_writer_splice(NeoAAWriter writer, int fd, uint64_t offset, uint64_t size);
+/*
+ * Copy the first size bytes of an fd nobody else reads
+ * sequentially. Only its data extents are read, holes become
+ * holes in plain output on disk and zeros for the compressor.
+ */
+int neoaa_writer_copy_sparse(NeoAAWriter writer, int fd, uint64_t size);
+/*
+ * A header followed by exactly size bytes of fd, copied like
+ * neoaa_writer_copy_sparse. A file that shrank under us is zero
+ * padded and counted in incomplete, NEOAA_ERR_INCOMPLETE then
+ * tells the caller while the writer itself is still fine. A read
+ * error fails the writer. With checksums the data is hashed as it
+ * goes through and CKS and SH2 are patched into the header after
+ * it, so they always match the bytes in the archive. A padded
+ * file keeps the zero placeholder instead, which never matches,
+ * so nothing vouches for data that is not the file's. Compressed
+ * output can only be patched while the header is still in the
+ * block being filled, an entry too big for that goes without.
+ * The bytes are added to progress while they are copied, and a
+ * cancel stops the copy with NEOAA_ERR_CANCELLED.
+ */
+int neoaa_writer_write_file(NeoAAWriter writer, const uint8_t *header, size_t headerSize, int fd, uint64_t size, int checksums,
+                            NeoAAProgress *progress);
+/* Time output and compression, write_entries picks this up from its progress */
+void neoaa_writer_set_stats(NeoAAWriter writer, NeoAAStats *stats);
+/* Checksum every file write_entries stores, hashed while its data is in memory */
+void neoaa_writer_set_checksums(NeoAAWriter writer, int enabled);
+/* Let the block compressor skip blocks that sample as incompressible, no effect on plain writers */
+void neoaa_writer_set_adaptive(NeoAAWriter writer, int enabled);
+/* Flushes and closes, returns non zero if any write failed */
+int neoaa_writer_close(NeoAAWriter writer);
+/* Closes and removes the partial output, or undoes an append */
+void neoaa_writer_abort(NeoAAWriter writer);
+
+/*
+ * Make write_entries incremental. Entries the cache of the
+ * previous archive still knows are copied from it as they were
+ * encoded, runs of them at once, and compressed blocks go out
+ * untouched when the algorithm matches. When offsets and
+ * lengths are given they receive where every entry landed in
+ * the new stream, for the next cache. previous may be NULL,
+ * offsets and lengths are given together or not at all.
+ */
+void neoaa_writer_set_cache(NeoAAWriter writer, NeoAACache previous, uint64_t *offsets, uint64_t *lengths);
+
+/*
+ * Build items for the sorted walk entries on threadCount
+ * producers and write them in order. Producers reserve memory
+ * for the data they load in entry order and block once
+ * memoryLimit is in flight, so memory stays bounded however
+ * big the tree is. Files too big to fit comfortably in the
+ * budget are streamed by the writer straight from disk with
+ * neoaa_writer_write_file. Files that cannot be read are left
+ * out, and the archive is still finished; NEOAA_ERR_INCOMPLETE
+ * says so if there were any, or any shrank while being copied.
+ */
+int neoaa_writer_write_entries(NeoAAWriter writer, const char *dirPath, NeoAAWalkEntry *entries, size_t entryCount,
+                               int threadCount, size_t memoryLimit, NeoAAProgress *progress);
+
+#endif /* NEOAA_WRITER_H */